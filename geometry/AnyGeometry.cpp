@@ -2,8 +2,10 @@
 #include <math3d/geometry3d.h>
 #include <meshing/VolumeGrid.h>
 #include <meshing/Voxelize.h>
+#include <meshing/MeshPrimitives.h>
 #include <GLdraw/GeometryAppearance.h>
 #include "CollisionPointCloud.h"
+#include "PointKernels.h"
 #include <utils/stringutils.h>
 #include <meshing/IO.h>
 #include <Timer.h>
@@ -452,7 +454,9 @@ AnyCollisionGeometry3D::AnyCollisionGeometry3D(const AnyCollisionGeometry3D& geo
   if(!geom.collisionData.empty()) {
     switch(type) {
     case Primitive:
+      break;
     case ImplicitSurface:
+      collisionData = CollisionImplicitSurface(geom.ImplicitSurfaceCollisionData());
       break;
     case TriangleMesh:
       {
@@ -483,12 +487,12 @@ AnyCollisionGeometry3D::AnyCollisionGeometry3D(const AnyCollisionGeometry3D& geo
   const RigidTransform& AnyCollisionGeometry3D::PrimitiveCollisionData() const { return currentTransform; }
   const CollisionMesh& AnyCollisionGeometry3D::TriangleMeshCollisionData() const { return *AnyCast_Raw<CollisionMesh>(&collisionData); }
   const CollisionPointCloud& AnyCollisionGeometry3D::PointCloudCollisionData() const { return *AnyCast_Raw<CollisionPointCloud>(&collisionData); }
-  const RigidTransform& AnyCollisionGeometry3D::ImplicitSurfaceCollisionData() const { return currentTransform; }
+  const CollisionImplicitSurface& AnyCollisionGeometry3D::ImplicitSurfaceCollisionData() const { return *AnyCast_Raw<CollisionImplicitSurface>(&collisionData); }
   const vector<AnyCollisionGeometry3D>& AnyCollisionGeometry3D::GroupCollisionData() const { return *AnyCast_Raw<vector<AnyCollisionGeometry3D> >(&collisionData); }
   RigidTransform& AnyCollisionGeometry3D::PrimitiveCollisionData() { return currentTransform; }
   CollisionMesh& AnyCollisionGeometry3D::TriangleMeshCollisionData() { return *AnyCast_Raw<CollisionMesh>(&collisionData); }
   CollisionPointCloud& AnyCollisionGeometry3D::PointCloudCollisionData() { return *AnyCast_Raw<CollisionPointCloud>(&collisionData); }
-  RigidTransform& AnyCollisionGeometry3D::ImplicitSurfaceCollisionData() { return currentTransform; }
+  CollisionImplicitSurface& AnyCollisionGeometry3D::ImplicitSurfaceCollisionData() { return *AnyCast_Raw<CollisionImplicitSurface>(&collisionData); }
   vector<AnyCollisionGeometry3D>& AnyCollisionGeometry3D::GroupCollisionData() { return *AnyCast_Raw<vector<AnyCollisionGeometry3D> >(&collisionData); }
 
 void AnyCollisionGeometry3D::InitCollisionData()
@@ -502,11 +506,20 @@ void AnyCollisionGeometry3D::ReinitCollisionData()
   RigidTransform T = GetTransform();
   switch(type) {
   case Primitive:
-  case ImplicitSurface:
     collisionData = int(0);
     break;
+  case ImplicitSurface:
+    collisionData = CollisionImplicitSurface(AsImplicitSurface());
+    break;
   case TriangleMesh:
-    collisionData = CollisionMesh(AsTriangleMesh());
+    {
+      collisionData = CollisionMesh();
+      CollisionMesh& cmesh = TriangleMeshCollisionData();
+      const Meshing::TriMesh& mesh = AsTriangleMesh();
+      cmesh.verts = mesh.verts;
+      cmesh.tris = mesh.tris;
+      cmesh.InitCollisionsCached();
+    }
     break;
   case PointCloud:
     collisionData = CollisionPointCloud(AsPointCloud());
@@ -597,7 +610,7 @@ Box3D AnyCollisionGeometry3D::GetBB() const
       ::GetBB(PointCloudCollisionData(),b);
       break;
     case ImplicitSurface:
-      b.setTransformed(AsImplicitSurface().bb,ImplicitSurfaceCollisionData());
+      b.setTransformed(AsImplicitSurface().bb,ImplicitSurfaceCollisionData().currentTransform);
       break;
     case Group:
       {
@@ -626,7 +639,9 @@ void AnyCollisionGeometry3D::SetTransform(const RigidTransform& T)
   if(!collisionData.empty()) {
     switch(type) {
     case Primitive:
+      break;
     case ImplicitSurface:
+      ImplicitSurfaceCollisionData().currentTransform = T;
       break;
     case TriangleMesh:
       TriangleMeshCollisionData().UpdateTransform(T);
@@ -654,26 +669,20 @@ Real AnyCollisionGeometry3D::Distance(const Vector3& pt)
   case Primitive:
     return Max(AsPrimitive().Distance(ptlocal)-margin,0.0);
   case ImplicitSurface:
-    return AsImplicitSurface().TrilinearInterpolate(ptlocal);
+    return ImplicitSurfaceCollisionData().Value(ptlocal)-margin;
   case TriangleMesh:
     {
       Vector3 cp;
       ClosestPoint(TriangleMeshCollisionData(),pt,cp);
-      return Min(pt.distance(cp)-margin,0.0);
+      return Max(ptlocal.distance(cp)-margin,0.0);
     }
   case PointCloud:
     {
       const CollisionPointCloud& pc = PointCloudCollisionData();
       Vector3 cp;
       int id;
-      if(!pc.octree->NearestNeighbor(ptlocal,cp,id)) return Inf;
-      return Min(cp.distance(ptlocal)-margin,0.0);
-      /*
-      Real dmin = Inf;
-      for(size_t i=0;i<pc.points.size();i++)
-	dmin = Min(dmin,ptlocal.distanceSquared(pc.points[i]));
-      return Min(Sqrt(dmin)-margin,0.0);
-      */
+      if(!pc.octree || !pc.octree->NearestNeighbor(ptlocal,cp,id)) return Inf;
+      return Max(cp.distance(ptlocal)-margin,0.0);
     }
   case Group:
     {
@@ -681,7 +690,7 @@ Real AnyCollisionGeometry3D::Distance(const Vector3& pt)
       Real dmin = Inf;
       for(size_t i=0;i<items.size();i++)
 	dmin = Min(dmin,items[i].Distance(pt));
-      return Min(Sqrt(dmin)-margin,0.0);
+      return Max(dmin-margin,0.0);
     }
   }
   return Inf;
@@ -696,28 +705,30 @@ Real AnyCollisionGeometry3D::Distance(const Vector3& pt,Vector3& cp)
   switch(type) {
   case Primitive:
     {
-      vector<double> params = AsPrimitive().ClosestPointParameters(pt);
+      vector<double> params = AsPrimitive().ClosestPointParameters(ptlocal);
       cplocal = AsPrimitive().ParametersToPoint(params);
       Real d = cplocal.distance(ptlocal);
-      if(d <= margin) { cp == pt; return 0; }
+      if(d <= margin) { cp = pt; return 0; }
       //TODO shift toward cplocal by margin
       cp = GetTransform()*cplocal;
-      return d;
+      return d-margin;
     }
   case ImplicitSurface:
     fprintf(stderr,"TODO: closest point from implicit surface to point\n");
     return Inf;
   case TriangleMesh:
     {
-      ClosestPoint(TriangleMeshCollisionData(),pt,cp);
-      return Min(pt.distance(cp)-margin,0.0);
+      ClosestPoint(TriangleMeshCollisionData(),pt,cplocal);
+      cp = GetTransform()*cplocal;
+      return Max(pt.distance(cp)-margin,0.0);
     }
   case PointCloud:
     {
       const CollisionPointCloud& pc = PointCloudCollisionData();
       int id;
-      if(!pc.octree->NearestNeighbor(ptlocal,cp,id)) return Inf;
-      return Min(cp.distance(ptlocal)-margin,0.0);
+      if(!pc.octree || !pc.octree->NearestNeighbor(ptlocal,cplocal,id)) return Inf;
+      cp = GetTransform()*cplocal;
+      return Max(cp.distance(pt)-margin,0.0);
     }
   case Group:
     {
@@ -731,7 +742,7 @@ Real AnyCollisionGeometry3D::Distance(const Vector3& pt,Vector3& cp)
 	  cp = temp;
 	}
       }
-      return Min(Sqrt(dmin)-margin,0.0);
+      return Max(dmin-margin,0.0);
     }
   }
   return Inf;
@@ -739,32 +750,74 @@ Real AnyCollisionGeometry3D::Distance(const Vector3& pt,Vector3& cp)
 
 
 
-bool Collides(const Meshing::VolumeGrid& grid,const GeometricPrimitive3D& a,Real margin,
-	      vector<int>& gridelements,size_t maxContacts)
+inline void Copy(const PQP_REAL p[3],Vector3& x)
 {
-  if(a.type != GeometricPrimitive3D::Point && a.type != GeometricPrimitive3D::Sphere) {
-    FatalError("Can't collide an implicit surface and a non-sphere primitive yet\n");
-  }
-  if(a.type == GeometricPrimitive3D::Point) {
-    const Vector3& pt = *AnyCast_Raw<Vector3>(&a.data);
-    bool res = (grid.TrilinearInterpolate(pt) + a.Distance(grid.bb) <= margin);
-    if(res) {
-      gridelements.resize(1);
-      IntTriple cell;
-      grid.GetIndex(pt,cell);
-      gridelements[0] = cell.a*grid.value.n*grid.value.p + cell.b*grid.value.p + cell.c;
-    }
-    return res;
-  }
-  const Sphere3D* s=AnyCast_Raw<Sphere3D>(&a.data);
-  bool res = (grid.TrilinearInterpolate(s->center) + a.Distance(grid.bb) <= margin+s->radius);  
-  if(res) {
-    gridelements.resize(1);
-    IntTriple cell;
-    grid.GetIndex(s->center,cell);
-    gridelements[0] = cell.a*grid.value.n*grid.value.p + cell.b*grid.value.p + cell.c;
+  x.set(p[0],p[1],p[2]);
+}
+
+inline void Copy(const Vector3& x,PQP_REAL p[3])
+{
+  p[0] = x.x;
+  p[1] = x.y;
+  p[2] = x.z;
+}
+
+
+inline void BVToBox(const BV& b,Box3D& box)
+{
+  Copy(b.d,box.dims);
+  Copy(b.To,box.origin);
+  //box.xbasis.set(b.R[0][0],b.R[0][1],b.R[0][2]);
+  //box.ybasis.set(b.R[1][0],b.R[1][1],b.R[1][2]);
+  //box.zbasis.set(b.R[2][0],b.R[2][1],b.R[2][2]);
+  box.xbasis.set(b.R[0][0],b.R[1][0],b.R[2][0]);
+  box.ybasis.set(b.R[0][1],b.R[1][1],b.R[2][1]);
+  box.zbasis.set(b.R[0][2],b.R[1][2],b.R[2][2]);
+
+  //move the box to have origin at the corner
+  box.origin -= box.dims.x*box.xbasis;
+  box.origin -= box.dims.y*box.ybasis;
+  box.origin -= box.dims.z*box.zbasis;
+  box.dims *= 2;
+}
+
+
+inline bool Collide(const Triangle3D& tri,const Sphere3D& s)
+{
+  Vector3 pt = tri.closestPoint(s.center);
+  return s.contains(pt);
+}
+
+inline Real Volume(const AABB3D& bb)
+{
+  Vector3 d = bb.bmax-bb.bmin;
+  return d.x*d.y*d.z;
+}
+
+inline Real Volume(const OctreeNode& n)
+{
+  return Volume(n.bb);
+}
+
+
+inline Real Volume(const BV& b)
+{
+  return 8.0*b.d[0]*b.d[1]*b.d[2];
+}
+
+//meshes a primitive, for the pairs that GeometricPrimitive3D::Distance
+//doesn't support
+void MakeCollisionMesh(const GeometricPrimitive3D& g,CollisionMesh& mesh)
+{
+  if(g.type == GeometricPrimitive3D::AABB) {
+    Box3D box;
+    box.set(*AnyCast_Raw<AABB3D>(&g.data));
+    Meshing::MakeTriMesh(box,mesh);
   }
-  return res;
+  else
+    Meshing::MakeTriMesh(g,mesh);
+  mesh.InitCollisions();
+  mesh.currentTransform.setIdentity();
 }
 
 bool Collides(const GeometricPrimitive3D& a,const GeometricPrimitive3D& b,Real margin)
@@ -773,15 +826,6 @@ bool Collides(const GeometricPrimitive3D& a,const GeometricPrimitive3D& b,Real m
   return a.Distance(b) <= margin;
 }
 
-bool Collides(const GeometricPrimitive3D& a,const Meshing::VolumeGrid& b,const RigidTransform& Tb,Real margin,
-	      vector<int>& gridelements,size_t maxContacts)
-{
-  GeometricPrimitive3D alocal=a;
-  RigidTransform Tbinv; Tbinv.setInverse(Tb);
-  alocal.Transform(Tbinv);
-  return Collides(b,alocal,margin,gridelements,maxContacts);
-}
-
 bool Collides(const GeometricPrimitive3D& a,const CollisionMesh& c,Real margin,
 	      vector<int>& meshelements,size_t maxContacts)
 {
@@ -799,18 +843,355 @@ bool Collides(const GeometricPrimitive3D& a,const CollisionPointCloud& b,Real ma
 
 
 
-bool Collides(const Meshing::VolumeGrid& a,const RigidTransform& Ta,const Meshing::VolumeGrid& b,const RigidTransform& Tb,Real margin,
+//lower bound on the values of an implicit surface over a box given in the
+//grid's frame, from the value pyramid and the value at the box's center
+inline Real ValueLowerBound(const CollisionImplicitSurface& grid,const Box3D& box)
+{
+  AABB3D bb;
+  box.getAABB(bb);
+  Real lb = grid.ValueLowerBound(bb);
+  return Max(lb,grid.Value(box.center()) - 0.5*box.dims.norm());
+}
+
+//Given the values va and vb of two distance fields at a point, returns
+//max(va,0)+max(vb,0), the length of a path between the surfaces through the
+//point, or max(va,vb) if the point is inside both.  Nondecreasing in va and
+//vb, so it can be applied to lower bounds too.
+inline Real CombinedValue(Real va,Real vb)
+{
+  if(va < 0 && vb < 0) return Max(va,vb);
+  return Max(va,0.0)+Max(vb,0.0);
+}
+
+/** Collides an implicit surface and a mesh by descending the mesh's PQP
+ * BVH, pruning nodes whose value lower bound exceeds the margin.  Triangles
+ * are tested at their vertices, then subdivided until the pieces are
+ * smaller than half a grid cell and tested at their centroids.  See
+ * CollisionImplicitSurface::conservative.
+ */
+class ImplicitMeshCollider
+{
+public:
+  const CollisionImplicitSurface& grid;
+  const CollisionMesh& mesh;
+  RigidTransform Tgm;   //mesh frame -> grid frame
+  Real margin;
+  Real resolution;
+  size_t maxContacts;
+  vector<int> gridElements,triElements;
+  ImplicitMeshCollider(const CollisionImplicitSurface& _grid,const CollisionMesh& _mesh,Real _margin)
+    :grid(_grid),mesh(_mesh),margin(_margin),maxContacts(1)
+  {
+    RigidTransform Tw_grid;
+    Tw_grid.setInverse(grid.currentTransform);
+    Tgm.mul(Tw_grid,mesh.currentTransform);
+    Vector3 h = grid.GetCellSize();
+    resolution = 0.5*Min(h.x,h.y,h.z);
+  }
+  bool Collide(size_t _maxContacts=1) {
+    maxContacts = _maxContacts;
+    gridElements.resize(0);
+    triElements.resize(0);
+    if(mesh.tris.empty() || grid.value.empty()) return false;
+    if(LowerBound(0) <= margin) _Recurse(0);
+    return !triElements.empty();
+  }
+  Real LowerBound(int bvnode) const {
+    Box3D box,boxg;
+    BVToBox(mesh.pqpModel->b[bvnode],box);
+    boxg.setTransformed(box,Tgm);
+    return ValueLowerBound(grid,boxg);
+  }
+  //returns true if enough contacts were found
+  bool _Recurse(int bvnode) {
+    const BV& b = mesh.pqpModel->b[bvnode];
+    if(b.Leaf()) {
+      int t = -b.first_child-1;
+      Triangle3D tri;
+      Copy(mesh.pqpModel->tris[t].p1,tri.a);
+      Copy(mesh.pqpModel->tris[t].p2,tri.b);
+      Copy(mesh.pqpModel->tris[t].p3,tri.c);
+      tri.a = Tgm * tri.a;
+      tri.b = Tgm * tri.b;
+      tri.c = Tgm * tri.c;
+      Vector3 pt;
+      if(_CollideTriangle(tri,pt)) {
+	gridElements.push_back(grid.CellElement(pt));
+	triElements.push_back(mesh.pqpModel->tris[t].id);
+	return triElements.size() >= maxContacts;
+      }
+      return false;
+    }
+    int c1=b.first_child;
+    int c2=c1+1;
+    Real d1=LowerBound(c1),d2=LowerBound(c2);
+    if(d2 < d1) { std::swap(c1,c2); std::swap(d1,d2); }
+    if(d1 <= margin && _Recurse(c1)) return true;
+    if(d2 <= margin && _Recurse(c2)) return true;
+    return false;
+  }
+  bool _CollideTriangle(const Triangle3D& tri,Vector3& pt) {
+    if(grid.Value(tri.a) <= margin) { pt = tri.a; return true; }
+    if(grid.Value(tri.b) <= margin) { pt = tri.b; return true; }
+    if(grid.Value(tri.c) <= margin) { pt = tri.c; return true; }
+    return _CollideSubTriangle(tri,pt);
+  }
+  bool _CollideSubTriangle(const Triangle3D& tri,Vector3& pt) {
+    Vector3 c = (tri.a+tri.b+tri.c)/3.0;
+    Real r = Max(c.distance(tri.a),c.distance(tri.b),c.distance(tri.c));
+    Real vc = grid.Value(c);
+    if(vc <= margin) { pt = c; return true; }
+    if(vc - r > margin) return false;
+    if(r <= resolution) {
+      if(grid.conservative) { pt = c; return true; }
+      return false;
+    }
+    Vector3 ab=(tri.a+tri.b)*0.5,bc=(tri.b+tri.c)*0.5,ca=(tri.c+tri.a)*0.5;
+    return _CollideSubTriangle(Triangle3D(tri.a,ab,ca),pt) ||
+      _CollideSubTriangle(Triangle3D(ab,tri.b,bc),pt) ||
+      _CollideSubTriangle(Triangle3D(ca,bc,tri.c),pt) ||
+      _CollideSubTriangle(Triangle3D(ab,bc,ca),pt);
+  }
+};
+
+/** Collides an implicit surface and a point cloud by descending the octree,
+ * pruning nodes whose value lower bound exceeds the margin, and testing
+ * the points of the remaining leaves.
+ */
+class ImplicitPointCollider
+{
+public:
+  const CollisionImplicitSurface& grid;
+  const CollisionPointCloud& pc;
+  RigidTransform Tgp;   //point cloud frame -> grid frame
+  Real margin;
+  size_t maxContacts;
+  vector<int> gridElements,pointElements;
+  ImplicitPointCollider(const CollisionImplicitSurface& _grid,const CollisionPointCloud& _pc,Real _margin)
+    :grid(_grid),pc(_pc),margin(_margin),maxContacts(1)
+  {
+    RigidTransform Tw_grid;
+    Tw_grid.setInverse(grid.currentTransform);
+    Tgp.mul(Tw_grid,pc.currentTransform);
+  }
+  bool Collide(size_t _maxContacts=1) {
+    maxContacts = _maxContacts;
+    gridElements.resize(0);
+    pointElements.resize(0);
+    if(!pc.octree || grid.value.empty()) return false;
+    if(LowerBound(0) <= margin) _Recurse(0);
+    return !pointElements.empty();
+  }
+  Real LowerBound(int index) const {
+    const AABB3D& bb = pc.octree->Node(index).bb;
+    if(bb.bmin.x > bb.bmax.x) return Inf;
+    Box3D boxg;
+    boxg.setTransformed(bb,Tgp);
+    return ValueLowerBound(grid,boxg);
+  }
+  //returns true if enough contacts were found
+  bool _Recurse(int index) {
+    const OctreeNode& n = pc.octree->Node(index);
+    if(pc.octree->IsLeaf(n)) {
+      int first,last;
+      pc.octree->GetPointRange(index,first,last);
+      const vector<Vector3>& pts = pc.octree->Points();
+      for(int i=first;i<last;i++) {
+	Vector3 pgrid = Tgp*pts[i];
+	if(grid.Value(pgrid) <= margin) {
+	  gridElements.push_back(grid.CellElement(pgrid));
+	  pointElements.push_back(pc.octree->PointIDs()[i]);
+	  if(pointElements.size() >= maxContacts) return true;
+	}
+      }
+      return false;
+    }
+    for(int i=0;i<8;i++)
+      if(LowerBound(n.childIndices[i]) <= margin && _Recurse(n.childIndices[i])) return true;
+    return false;
+  }
+};
+
+//Collides an implicit surface with a box given in the grid's frame, by
+//bisecting the box along its longest side down to half a grid cell
+bool CollidesBox(const CollisionImplicitSurface& grid,const Box3D& box,Real margin,Real resolution,Vector3& pt)
+{
+  Vector3 c = box.center();
+  Real r = 0.5*box.dims.norm();
+  Real vc = grid.Value(c);
+  if(vc <= margin) { pt = c; return true; }
+  if(vc - r > margin) return false;
+  AABB3D bb;
+  box.getAABB(bb);
+  if(grid.ValueLowerBound(bb) > margin) return false;
+  if(r <= resolution) {
+    if(grid.conservative) { pt = c; return true; }
+    return false;
+  }
+  Box3D half = box;
+  Vector3 shift;
+  if(box.dims.x >= box.dims.y && box.dims.x >= box.dims.z) {
+    half.dims.x *= 0.5;
+    shift = half.dims.x*box.xbasis;
+  }
+  else if(box.dims.y >= box.dims.z) {
+    half.dims.y *= 0.5;
+    shift = half.dims.y*box.ybasis;
+  }
+  else {
+    half.dims.z *= 0.5;
+    shift = half.dims.z*box.zbasis;
+  }
+  if(CollidesBox(grid,half,margin,resolution,pt)) return true;
+  half.origin += shift;
+  return CollidesBox(grid,half,margin,resolution,pt);
+}
+
+bool Collides(const GeometricPrimitive3D& a,const CollisionImplicitSurface& b,Real margin,
+	      vector<int>& gridelements,size_t maxContacts)
+{
+  if(b.value.empty()) return false;
+  GeometricPrimitive3D alocal=a;
+  RigidTransform Tbinv; Tbinv.setInverse(b.currentTransform);
+  alocal.Transform(Tbinv);
+  Vector3 pt;
+  switch(alocal.type) {
+  case GeometricPrimitive3D::Point:
+  case GeometricPrimitive3D::Sphere:
+    {
+      Real r = 0;
+      if(alocal.type == GeometricPrimitive3D::Point) pt = *AnyCast_Raw<Vector3>(&alocal.data);
+      else {
+	pt = AnyCast_Raw<Sphere3D>(&alocal.data)->center;
+	r = AnyCast_Raw<Sphere3D>(&alocal.data)->radius;
+      }
+      if(b.Value(pt) - r > margin) return false;
+    }
+    break;
+  case GeometricPrimitive3D::AABB:
+  case GeometricPrimitive3D::Box:
+    {
+      Box3D box = alocal.GetBB();
+      Vector3 h = b.GetCellSize();
+      if(!CollidesBox(b,box,margin,0.5*Min(h.x,h.y,h.z),pt)) return false;
+    }
+    break;
+  default:
+    {
+      //other primitives are meshed, and only their surfaces are tested
+      CollisionMesh amesh;
+      MakeCollisionMesh(a,amesh);
+      ImplicitMeshCollider collider(b,amesh,margin);
+      if(!collider.Collide(1)) return false;
+      gridelements = collider.gridElements;
+      return true;
+    }
+  }
+  gridelements.resize(1);
+  gridelements[0] = b.CellElement(pt);
+  return true;
+}
+
+bool Collides(const CollisionImplicitSurface& a,const CollisionMesh& b,Real margin,
+	      vector<int>& elements1,vector<int>& elements2,size_t maxContacts)
+{
+  ImplicitMeshCollider collider(a,b,margin);
+  if(!collider.Collide(maxContacts)) return false;
+  elements1 = collider.gridElements;
+  elements2 = collider.triElements;
+  return true;
+}
+
+bool Collides(const CollisionImplicitSurface& a,const CollisionPointCloud& b,Real margin,
 	      vector<int>& elements1,vector<int>& elements2,size_t maxContacts)
 {
-  FatalError("Volume grid to volume grid collisions not done\n");
-  return false;
+  ImplicitPointCollider collider(a,b,margin);
+  if(!collider.Collide(maxContacts)) return false;
+  elements1 = collider.gridElements;
+  elements2 = collider.pointElements;
+  return true;
 }
 
-bool Collides(const Meshing::VolumeGrid& a,const RigidTransform& Ta,const CollisionMesh& b,Real margin,
+//Descends the value pyramid of b, pruning the blocks that can't be within
+//the margin using the value bounds of both grids, and tests the cells of the
+//remaining blocks at their centers.
+class ImplicitImplicitCollider
+{
+public:
+  ImplicitImplicitCollider(const CollisionImplicitSurface& _a,const CollisionImplicitSurface& _b,Real _margin)
+    :a(_a),b(_b),margin(_margin),maxContacts(1)
+  {
+    RigidTransform Tw_a;
+    Tw_a.setInverse(a.currentTransform);
+    Tab.mul(Tw_a,b.currentTransform);
+    h = b.GetCellSize();
+    rcell = ((a.conservative || b.conservative) ? 0.5*h.norm() : 0.0);
+    vbmax = Max(margin,0.0) + rcell;
+  }
+  bool Collide(size_t _maxContacts) {
+    maxContacts = _maxContacts;
+    if(a.pyramid.IsEmpty() || b.pyramid.IsEmpty()) return false;
+    Recurse(b.pyramid.NumLevels()-1,IntTriple(0,0,0));
+    return !elements1.empty();
+  }
+  //returns false if the maximum number of contacts is reached
+  bool Recurse(int level,const IntTriple& index) {
+    const Meshing::VolumeGridPyramid& pyramid = b.pyramid;
+    Real bmin = pyramid.minValues[level](index);
+    if(bmin > vbmax) return true;
+    IntTriple cmin,cmax;
+    pyramid.GetCubeRange(level,index,cmin,cmax);
+    AABB3D blockbb;
+    blockbb.bmin.set(b.bb.bmin.x+cmin.a*h.x,b.bb.bmin.y+cmin.b*h.y,b.bb.bmin.z+cmin.c*h.z);
+    blockbb.bmax.set(b.bb.bmin.x+(cmax.a+1)*h.x,b.bb.bmin.y+(cmax.b+1)*h.y,b.bb.bmin.z+(cmax.c+1)*h.z);
+    Box3D boxa;
+    boxa.setTransformed(blockbb,Tab);
+    if(CombinedValue(ValueLowerBound(a,boxa)-rcell,bmin-rcell) > margin) return true;
+    if(level > 0) {
+      const Array3D<Real>& child = pyramid.minValues[level-1];
+      IntTriple c;
+      for(c.a=2*index.a;c.a<=Min(2*index.a+1,child.m-1);c.a++)
+	for(c.b=2*index.b;c.b<=Min(2*index.b+1,child.n-1);c.b++)
+	  for(c.c=2*index.c;c.c<=Min(2*index.c+1,child.p-1);c.c++)
+	    if(!Recurse(level-1,c)) return false;
+      return true;
+    }
+    Vector3 c;
+    for(int i=cmin.a;i<=cmax.a;i++)
+      for(int j=cmin.b;j<=cmax.b;j++)
+	for(int k=cmin.c;k<=cmax.c;k++) {
+	  Real vb = b.value(i,j,k);
+	  if(vb > vbmax) continue;
+	  b.GetCellCenter(i,j,k,c);
+	  Vector3 ca = Tab*c;
+	  Real va = a.Value(ca);
+	  if(CombinedValue(va-rcell,vb-rcell) <= margin) {
+	    elements1.push_back(a.CellElement(ca));
+	    elements2.push_back(i*b.value.n*b.value.p + j*b.value.p + k);
+	    if(elements1.size() >= maxContacts) return false;
+	  }
+	}
+    return true;
+  }
+
+  const CollisionImplicitSurface& a;
+  const CollisionImplicitSurface& b;
+  Real margin;
+  size_t maxContacts;
+  RigidTransform Tab;
+  Vector3 h;
+  Real rcell,vbmax;
+  vector<int> elements1,elements2;
+};
+
+bool Collides(const CollisionImplicitSurface& a,const CollisionImplicitSurface& b,Real margin,
 	      vector<int>& elements1,vector<int>& elements2,size_t maxContacts)
 {
-  FatalError("Volume grid to triangle mesh collisions not done\n");
-  return false;
+  ImplicitImplicitCollider collider(a,b,margin);
+  if(!collider.Collide(maxContacts)) return false;
+  elements1 = collider.elements1;
+  elements2 = collider.elements2;
+  return true;
 }
 
 bool Collides(const CollisionMesh& a,const CollisionMesh& b,Real margin,
@@ -840,7 +1221,7 @@ bool Collides(const GeometricPrimitive3D& a,const RigidTransform& Ta,Real margin
       return false;
     }
   case AnyCollisionGeometry3D::ImplicitSurface:
-    if(::Collides(aw,b.AsImplicitSurface(),b.GetTransform(),margin+b.margin,elements2,maxContacts)) {
+    if(::Collides(aw,b.ImplicitSurfaceCollisionData(),margin+b.margin,elements2,maxContacts)) {
       elements1.push_back(0);
       return true;
     }
@@ -881,7 +1262,7 @@ bool Collides(const GeometricPrimitive3D& a,const RigidTransform& Ta,Real margin
 }
 
 
-bool Collides(const Meshing::VolumeGrid& a,const RigidTransform& Ta,Real margin,AnyCollisionGeometry3D& b,
+bool Collides(const CollisionImplicitSurface& a,Real margin,AnyCollisionGeometry3D& b,
 	      vector<int>& elements1,vector<int>& elements2,size_t maxContacts)
 {
   switch(b.type) {
@@ -889,19 +1270,18 @@ bool Collides(const Meshing::VolumeGrid& a,const RigidTransform& Ta,Real margin,
     {
       GeometricPrimitive3D bw=b.AsPrimitive();
       bw.Transform(b.GetTransform());
-      if(::Collides(bw,a,Ta,margin+b.margin,elements1,maxContacts)) {
+      if(::Collides(bw,a,margin+b.margin,elements1,maxContacts)) {
 	elements2.push_back(0);
 	return true;
       }
       return false;
     }
   case AnyCollisionGeometry3D::ImplicitSurface:
-    return ::Collides(a,Ta,b.AsImplicitSurface(),b.GetTransform(),margin+b.margin,elements1,elements2,maxContacts);
+    return ::Collides(a,b.ImplicitSurfaceCollisionData(),margin+b.margin,elements1,elements2,maxContacts);
   case AnyCollisionGeometry3D::TriangleMesh:
-    return ::Collides(a,Ta,b.TriangleMeshCollisionData(),margin+b.margin,elements1,elements2,maxContacts);
+    return ::Collides(a,b.TriangleMeshCollisionData(),margin+b.margin,elements1,elements2,maxContacts);
   case AnyCollisionGeometry3D::PointCloud:
-    FatalError("Point cloud testing should be prioritized");
-    break;
+    return ::Collides(a,b.PointCloudCollisionData(),margin+b.margin,elements1,elements2,maxContacts);
   case AnyCollisionGeometry3D::Group:
     {
       vector<AnyCollisionGeometry3D>& bitems = b.GroupCollisionData();
@@ -909,7 +1289,7 @@ bool Collides(const Meshing::VolumeGrid& a,const RigidTransform& Ta,Real margin,
       elements2.resize(0);
       for(size_t i=0;i<bitems.size();i++) {
 	vector<int> e1,e2;
-	if(Collides(a,Ta,margin+b.margin,bitems[i],e1,e2,maxContacts)) {
+	if(Collides(a,margin+b.margin,bitems[i],e1,e2,maxContacts)) {
 	  for(size_t j=0;j<e1.size();j++) {
 	    elements1.push_back(e1[j]);
 	    elements2.push_back((int)i);
@@ -940,7 +1320,7 @@ bool Collides(const CollisionMesh& a,Real margin,AnyCollisionGeometry3D& b,
       return false;
     }
   case AnyCollisionGeometry3D::ImplicitSurface:
-    return ::Collides(b.AsImplicitSurface(),b.GetTransform(),a,margin+b.margin,elements2,elements1,maxContacts);
+    return ::Collides(b.ImplicitSurfaceCollisionData(),a,margin+b.margin,elements2,elements1,maxContacts);
   case AnyCollisionGeometry3D::TriangleMesh:
     return ::Collides(a,b.TriangleMeshCollisionData(),margin+b.margin,elements1,elements2,maxContacts);
   case AnyCollisionGeometry3D::PointCloud:
@@ -970,84 +1350,12 @@ bool Collides(const CollisionMesh& a,Real margin,AnyCollisionGeometry3D& b,
 }
 
 
-static Real gWithinDistanceMargin = 0;
-static const CollisionPointCloud* gWithinDistancePC = NULL;
-static AnyCollisionGeometry3D* gWithinDistanceGeom = NULL;
-static vector<int>* gWithinDistanceElements1 = NULL;
-static vector<int>* gWithinDistanceElements2 = NULL;
-static size_t gWithinDistanceMaxContacts = 0;
-static GeometricPrimitive3D point_primitive(Vector3(0.0));
-bool withinDistance_PC_AnyGeom(void* obj)
-{
-  Point3D* p = reinterpret_cast<Point3D*>(obj);
-  Vector3 pw = gWithinDistancePC->currentTransform*(*p);
-  RigidTransform Tident; Tident.R.setIdentity(); Tident.t = pw;
-  vector<int> temp;
-  if(Collides(point_primitive,Tident,gWithinDistanceMargin,*gWithinDistanceGeom,temp,*gWithinDistanceElements1,gWithinDistanceMaxContacts)) {
-    printf("Colliding point %g %g %g distance %g\n",pw.x,pw.y,pw.z,gWithinDistanceGeom->Distance(pw));
-    gWithinDistanceElements2->push_back(p-&gWithinDistancePC->points[0]);
-    if(gWithinDistanceElements1->size() >= gWithinDistanceMaxContacts) 
-      return false;
-  }
-  return true;
-}
-
-
-inline void Copy(const PQP_REAL p[3],Vector3& x)
-{
-  x.set(p[0],p[1],p[2]);
-}
-
-inline void Copy(const Vector3& x,PQP_REAL p[3])
-{
-  p[0] = x.x;
-  p[1] = x.y;
-  p[2] = x.z;
-}
-
-
-inline void BVToBox(const BV& b,Box3D& box)
-{
-  Copy(b.d,box.dims);
-  Copy(b.To,box.origin);
-  //box.xbasis.set(b.R[0][0],b.R[0][1],b.R[0][2]);
-  //box.ybasis.set(b.R[1][0],b.R[1][1],b.R[1][2]);
-  //box.zbasis.set(b.R[2][0],b.R[2][1],b.R[2][2]);
-  box.xbasis.set(b.R[0][0],b.R[1][0],b.R[2][0]);
-  box.ybasis.set(b.R[0][1],b.R[1][1],b.R[2][1]);
-  box.zbasis.set(b.R[0][2],b.R[1][2],b.R[2][2]);
-
-  //move the box to have origin at the corner
-  box.origin -= box.dims.x*box.xbasis;
-  box.origin -= box.dims.y*box.ybasis;
-  box.origin -= box.dims.z*box.zbasis;
-  box.dims *= 2;
-}
-
-
-inline bool Collide(const Triangle3D& tri,const Sphere3D& s)
-{
-  Vector3 pt = tri.closestPoint(s.center);
-  return s.contains(pt);
-}
-
-inline Real Volume(const AABB3D& bb)
-{
-  Vector3 d = bb.bmax-bb.bmin;
-  return d.x*d.y*d.z;
-}
-
-inline Real Volume(const OctreeNode& n)
-{
-  return Volume(n.bb);
-}
-
-
-inline Real Volume(const BV& b)
-{
-  return 8.0*b.d[0]*b.d[1]*b.d[2];
-}
-
+/** Collides a point cloud and a mesh by descending the octree and the PQP
+ * BVH together.  The traversal uses an explicit stack of node pairs, and
+ * at pairs of leaves the points of the octree leaf, which are contiguous
+ * after OctreePointSet::FitToPoints, are tested against the triangle in one
+ * batch.
+ */
 class PointMeshCollider
 {
 public:
@@ -1057,6 +1365,8 @@ public:
   Real margin;
   size_t maxContacts;
   vector<int> pcpoints,meshtris;
+  vector<pair<int,int> > stack;
+  vector<Real> d2;
   PointMeshCollider(const CollisionPointCloud& a,const CollisionMesh& b,Real _margin)
     :pc(a),mesh(b),margin(_margin),maxContacts(1)
   {
@@ -1067,10 +1377,37 @@ public:
   bool Recurse(size_t _maxContacts=1)
   {
     maxContacts=_maxContacts;
-    _Recurse(0,0);
+    if(!pc.octree || mesh.tris.empty()) return false;
+    const OctreePointSet& octree = *pc.octree;
+    stack.resize(0);
+    stack.push_back(pair<int,int>(0,0));
+    while(!stack.empty()) {
+      int pcOctreeNode = stack.back().first;
+      int meshBVHNode = stack.back().second;
+      stack.pop_back();
+      const OctreeNode& pcnode = octree.Node(pcOctreeNode);
+      const BV& meshnode = mesh.pqpModel->b[meshBVHNode];
+      if(Prune(pcnode,meshnode)) continue;
+      bool pcleaf = octree.IsLeaf(pcnode);
+      if(pcleaf && meshnode.Leaf()) {
+	if(!LeafTest(pcOctreeNode,meshBVHNode)) break;
+      }
+      else if(pcleaf || (!meshnode.Leaf() && Volume(pcnode) < Volume(meshnode))) {
+	//split mesh BVH
+	int c1=meshnode.first_child;
+	stack.push_back(pair<int,int>(pcOctreeNode,c1+1));
+	stack.push_back(pair<int,int>(pcOctreeNode,c1));
+      }
+      else {
+	//split octree node
+	for(int i=7;i>=0;i--)
+	  stack.push_back(pair<int,int>(pcnode.childIndices[i],meshBVHNode));
+      }
+    }
     return !pcpoints.empty();
   }
   bool Prune(const OctreeNode& pcnode,const BV& meshnode) {
+    if(pcnode.bb.bmin.x > pcnode.bb.bmax.x) return true;
     Box3D meshbox,meshbox_pc;
     BVToBox(meshnode,meshbox);
     meshbox_pc.setTransformed(meshbox,Tba);
@@ -1083,76 +1420,38 @@ public:
       return !meshbox_pc.intersects(expanded_bb);
     }
   }
-  bool _Recurse(int pcOctreeNode,int meshBVHNode) {
-    const OctreeNode& pcnode = pc.octree->Node(pcOctreeNode);
-    const BV& meshnode = mesh.pqpModel->b[meshBVHNode];
-    //returns true to keep recursing
-    if(Prune(pcnode,meshnode))
-      return true;
-    if(pc.octree->IsLeaf(pcnode)) {
-      if(meshnode.Leaf()) {
-	int t = -meshnode.first_child-1;
-	Triangle3D tri;
-	Copy(mesh.pqpModel->tris[t].p1,tri.a);
-	Copy(mesh.pqpModel->tris[t].p2,tri.b);
-	Copy(mesh.pqpModel->tris[t].p3,tri.c);
-	tri.a = Tba * tri.a;
-	tri.b = Tba * tri.b;
-	tri.c = Tba * tri.c;
-	//collide the triangle and points
-	vector<Vector3> pts;
-	vector<int> pcids;
-	pc.octree->GetPoints(pcOctreeNode,pts);
-	pc.octree->GetPointIDs(pcOctreeNode,pcids);
-	Sphere3D temp;
-	temp.radius = margin;
-	for(size_t i=0;i<pts.size();i++) {
-	  temp.center = pts[i];
-	  if(Collide(tri,temp)) {
-	    pcpoints.push_back(pcids[i]);
-	    meshtris.push_back(mesh.pqpModel->tris[t].id);
-	    if(pcpoints.size() >= maxContacts) return false;
-	  }
-	}
-	//continue
-	return true;
-      }
-      else {
-	//split mesh BVH
-	return _RecurseSplitMesh(pcOctreeNode,meshBVHNode);
+  //returns false if the maximum number of contacts is reached
+  bool LeafTest(int pcOctreeNode,int meshBVHNode) {
+    int first,last;
+    pc.octree->GetPointRange(pcOctreeNode,first,last);
+    if(first == last) return true;
+    int t = -mesh.pqpModel->b[meshBVHNode].first_child-1;
+    Triangle3D tri;
+    Copy(mesh.pqpModel->tris[t].p1,tri.a);
+    Copy(mesh.pqpModel->tris[t].p2,tri.b);
+    Copy(mesh.pqpModel->tris[t].p3,tri.c);
+    tri.a = Tba * tri.a;
+    tri.b = Tba * tri.b;
+    tri.c = Tba * tri.c;
+    d2.resize(last-first);
+    PointTriangleDistance2(pc.octree->PointsX()+first,pc.octree->PointsY()+first,pc.octree->PointsZ()+first,last-first,tri,&d2[0]);
+    Real margin2 = Sqr(margin);
+    const vector<int>& ids = pc.octree->PointIDs();
+    for(int i=0;i<last-first;i++) {
+      if(d2[i] <= margin2) {
+	pcpoints.push_back(ids[first+i]);
+	meshtris.push_back(mesh.pqpModel->tris[t].id);
+	if(pcpoints.size() >= maxContacts) return false;
       }
     }
-    else {
-      if(meshnode.Leaf()) {
-	//split octree node
-	return _RecurseSplitOctree(pcOctreeNode,meshBVHNode);
-      }
-      else {
-	//determine which BVH to split
-	Real vpc = Volume(pcnode);
-	Real vmesh = Volume(meshnode);
-	if(vpc < vmesh)
-	  return _RecurseSplitMesh(pcOctreeNode,meshBVHNode);
-	else
-	  return _RecurseSplitOctree(pcOctreeNode,meshBVHNode);
-      }
-    }
-  }
-  bool _RecurseSplitMesh(int pcOctreeNode,int meshBVHNode) {
-    int c1=mesh.pqpModel->b[meshBVHNode].first_child;
-    int c2=c1+1;
-    if(!_Recurse(pcOctreeNode,c1)) return false;
-    if(!_Recurse(pcOctreeNode,c2)) return false;
-    return true;
-  }
-  bool _RecurseSplitOctree(int pcOctreeNode,int meshBVHNode) {
-    const OctreeNode& pcnode = pc.octree->Node(pcOctreeNode);
-    for(int i=0;i<8;i++)
-      if(!_Recurse(pcnode.childIndices[i],meshBVHNode)) return false;
     return true;
   }
 };
 
+/** Collides two point clouds by descending both octrees, like
+ * PointMeshCollider.  At pairs of leaves, each point of b's leaf is tested
+ * against all the points of a's leaf in one batch.
+ */
 class PointPointCollider
 {
 public:
@@ -1162,6 +1461,8 @@ public:
   Real margin;
   size_t maxContacts;
   vector<int> acollisions,bcollisions;
+  vector<pair<int,int> > stack;
+  vector<Real> d2;
   PointPointCollider(const CollisionPointCloud& _a,const CollisionPointCloud& _b,Real _margin)
     :a(_a),b(_b),margin(_margin),maxContacts(1)
   {
@@ -1172,10 +1473,35 @@ public:
   bool Recurse(size_t _maxContacts=1)
   {
     maxContacts=_maxContacts;
-    _Recurse(0,0);
+    if(!a.octree || !b.octree) return false;
+    stack.resize(0);
+    stack.push_back(pair<int,int>(0,0));
+    while(!stack.empty()) {
+      int aindex = stack.back().first;
+      int bindex = stack.back().second;
+      stack.pop_back();
+      const OctreeNode& anode = a.octree->Node(aindex);
+      const OctreeNode& bnode = b.octree->Node(bindex);
+      if(Prune(anode,bnode)) continue;
+      bool aleaf = a.octree->IsLeaf(anode), bleaf = b.octree->IsLeaf(bnode);
+      if(aleaf && bleaf) {
+	if(!LeafTest(aindex,bindex)) break;
+      }
+      else if(aleaf || (!bleaf && Volume(anode) < Volume(bnode))) {
+	//split b
+	for(int i=7;i>=0;i--)
+	  stack.push_back(pair<int,int>(aindex,bnode.childIndices[i]));
+      }
+      else {
+	//split a
+	for(int i=7;i>=0;i--)
+	  stack.push_back(pair<int,int>(anode.childIndices[i],bindex));
+      }
+    }
     return !acollisions.empty();
   }
   bool Prune(const OctreeNode& anode,const OctreeNode& bnode) {
+    if(anode.bb.bmin.x > anode.bb.bmax.x || bnode.bb.bmin.x > bnode.bb.bmax.x) return true;
     Box3D meshbox_pc;
     meshbox_pc.setTransformed(bnode.bb,Tba);
     if(margin==0)
@@ -1187,64 +1513,28 @@ public:
       return !meshbox_pc.intersects(expanded_bb);
     }
   }
-  bool _Recurse(int aindex,int bindex) {
-    const OctreeNode& anode = a.octree->Node(aindex);
-    const OctreeNode& bnode = b.octree->Node(bindex);
-    //returns true to keep recursing
-    if(Prune(anode,bnode))
-      return true;
-    if(a.octree->IsLeaf(anode)) {
-      if(b.octree->IsLeaf(bnode)) {
-	//collide the triangle and points
-	vector<Vector3> apts,bpts;
-	vector<int> aids,bids;
-	a.octree->GetPoints(aindex,apts);
-	b.octree->GetPoints(bindex,bpts);
-	a.octree->GetPointIDs(aindex,aids);
-	b.octree->GetPointIDs(bindex,bids);
-	for(size_t i=0;i<apts.size();i++) {
-	  for(size_t j=0;j<bpts.size();j++) {
-	    if(apts[i].distanceSquared(bpts[j]) <= Sqr(margin)) {
-	      acollisions.push_back(aids[i]);
-	      acollisions.push_back(bids[i]);
-	      if(acollisions.size() >= maxContacts) return false;
-	    }
-	  }
+  //returns false if the maximum number of contacts is reached
+  bool LeafTest(int aindex,int bindex) {
+    int afirst,alast,bfirst,blast;
+    a.octree->GetPointRange(aindex,afirst,alast);
+    b.octree->GetPointRange(bindex,bfirst,blast);
+    int na = alast-afirst;
+    if(na == 0) return true;
+    d2.resize(na);
+    Real margin2 = Sqr(margin);
+    const vector<Vector3>& bpts = b.octree->Points();
+    const vector<int>& aids = a.octree->PointIDs();
+    const vector<int>& bids = b.octree->PointIDs();
+    for(int j=bfirst;j<blast;j++) {
+      PointPointDistance2(a.octree->PointsX()+afirst,a.octree->PointsY()+afirst,a.octree->PointsZ()+afirst,na,Tba*bpts[j],&d2[0]);
+      for(int i=0;i<na;i++) {
+	if(d2[i] <= margin2) {
+	  acollisions.push_back(aids[afirst+i]);
+	  bcollisions.push_back(bids[j]);
+	  if(acollisions.size() >= maxContacts) return false;
 	}
-	//continue
-	return true;
-      }
-      else {
-	//split b
-	return _RecurseSplitB(aindex,bindex);
-      }
-    }
-    else {
-      if(b.octree->IsLeaf(bnode)) {
-	//split a
-	return _RecurseSplitA(aindex,bindex);
-      }
-      else {
-	//determine which BVH to split
-	Real va = Volume(anode);
-	Real vb = Volume(bnode);
-	if(va < vb)
-	  return _RecurseSplitB(aindex,bindex);
-	else
-	  return _RecurseSplitA(aindex,bindex);
       }
     }
-  }
-  bool _RecurseSplitA(int aindex,int bindex) {
-    const OctreeNode& anode = a.octree->Node(aindex);
-    for(int i=0;i<8;i++)
-      if(!_Recurse(anode.childIndices[i],bindex)) return false;
-    return true;
-  }
-  bool _RecurseSplitB(int aindex,int bindex) {
-    const OctreeNode& bnode = b.octree->Node(bindex);
-    for(int i=0;i<8;i++)
-      if(!_Recurse(aindex,bnode.childIndices[i])) return false;
     return true;
   }
 };
@@ -1295,102 +1585,16 @@ bool Collides(const CollisionPointCloud& a,Real margin,AnyCollisionGeometry3D& b
     }
   case AnyCollisionGeometry3D::TriangleMesh:
     {
-      bool res=::Collides(a,margin,b.TriangleMeshCollisionData(),elements1,elements2,maxContacts);
+      bool res=::Collides(a,margin+b.margin,b.TriangleMeshCollisionData(),elements1,elements2,maxContacts);
       return res;
     }
   case AnyCollisionGeometry3D::PointCloud:
     {
-      bool res=::Collides(a,margin,b.PointCloudCollisionData(),elements1,elements2,maxContacts);
+      bool res=::Collides(a,margin+b.margin,b.PointCloudCollisionData(),elements1,elements2,maxContacts);
       return res;
     }
   case AnyCollisionGeometry3D::ImplicitSurface:
-    {
-      Timer timer;
-      Box3D abb;
-      GetBB(a,abb);
-      Box3D bbb = b.GetBB();
-      Box3D bbbexpanded = bbb;
-      bbbexpanded.dims += Vector3(margin*2.0);
-      bbbexpanded.origin -= margin*(bbb.xbasis+bbb.ybasis+bbb.zbasis);
-      //quick reject test
-      if(!abb.intersectsApprox(bbbexpanded)) {
-	printf("0 contacts (quick reject) time %g\n",timer.ElapsedTime());
-	return false;
-      }
-      RigidTransform Tw_a;
-      Tw_a.setInverse(a.currentTransform);
-      Box3D bbb_a;
-      bbb_a.setTransformed(bbbexpanded,Tw_a);
-      AABB3D baabb_a;
-      bbb_a.getAABB(baabb_a);
-      baabb_a.setIntersection(a.bblocal);
-
-      //octree-vs b's bounding box method (not terribly smart, could be
-      //improved by descending bounding box hierarchies)
-      vector<Vector3> apoints;
-      vector<int> aids;
-      a.octree->BoxQuery(bbb_a,apoints,aids);
-      RigidTransform Tident; Tident.setIdentity();
-      //test all points, linearly
-      for(size_t i=0;i<apoints.size();i++) {
-	Vector3 p_w = a.currentTransform*apoints[i];
-	Tident.t = p_w;
-	vector<int> temp;
-	if(Collides(point_primitive,Tident,margin,b,temp,elements1,maxContacts)) {
-	  elements2.push_back(i);
-	  if(elements2.size() >= maxContacts) {
-	    printf("%d contacts time %g\n",maxContacts,timer.ElapsedTime());
-
-	    //printf("Collision in time %g\n",timer.ElapsedTime());
-	    return true;
-	  }
-	}
-      }
-      printf("%d contacts time %g\n",maxContacts,timer.ElapsedTime());	    
-      // printf("No collision in time %g\n",timer.ElapsedTime());
-      return !elements2.empty();
-
-      /*
-      //grid method
-      GridSubdivision::Index imin,imax;
-      a.grid.PointToIndex(Vector(3,baabb_a.bmin),imin);
-      a.grid.PointToIndex(Vector(3,baabb_a.bmax),imax);
-      int numCells = (imax[0]-imin[0]+1)*(imax[1]-imin[1]+1)*(imax[2]-imin[2]+1);
-      Timer timer;
-      if(numCells >(int) a.points.size()) {
-	RigidTransform Tident; Tident.setIdentity();
-	//test all points, linearly
-	for(size_t i=0;i<a.points.size();i++) {
-	  Vector3 p_w = a.currentTransform*a.points[i];
-	  Tident.t = p_w;
-	  vector<int> temp;
-	  if(Collides(point_primitive,Tident,margin,b,temp,elements1,maxContacts)) {
-	    elements2.push_back(i);
-	    if(elements2.size() >= maxContacts) {
-	      printf("Collision in time %g\n",timer.ElapsedTime());
-	      return true;
-	    }
-	  }
-	}
-	printf("No collision in time %g\n",timer.ElapsedTime());
-	return false;
-      }
-      else {
-	printf("Box testing\n");
-	gWithinDistanceMargin = margin;
-	gWithinDistancePC = &a;
-	gWithinDistanceGeom = &b;
-	gWithinDistanceElements1 = &elements1;
-	gWithinDistanceElements2 = &elements2;
-	gWithinDistanceMaxContacts = maxContacts;
-	bool collisionFree = a.grid.IndexQuery(imin,imax,withinDistance_PC_AnyGeom);
-	if(collisionFree) printf("No collision in time %g\n",timer.ElapsedTime());
-	else printf("Collision in time %g\n",timer.ElapsedTime());
-	return !collisionFree;
-      }
-      */
-    }
-    return false;
+    return ::Collides(b.ImplicitSurfaceCollisionData(),a,margin+b.margin,elements2,elements1,maxContacts);
   case AnyCollisionGeometry3D::Group:
     {
       vector<AnyCollisionGeometry3D>& bitems = b.GroupCollisionData();
@@ -1431,6 +1635,667 @@ bool Collides(vector<AnyCollisionGeometry3D>& group,Real margin,AnyCollisionGeom
 }
 
 
+//lower bound on the distance between an AABB and a box.  Returns Inf if the
+//AABB is empty.
+inline Real DistanceLowerBound(const AABB3D& a,const Box3D& b)
+{
+  if(a.bmin.x > a.bmax.x) return Inf;
+  AABB3D bb;
+  b.getAABB(bb);
+  Real d = a.distance(bb);
+  Real dsphere = (a.bmin+a.bmax).distance(2.0*b.center())*0.5 - 0.5*a.bmin.distance(a.bmax) - 0.5*b.dims.norm();
+  return Max(d,dsphere);
+}
+
+//lower bound on the distance between two AABBs.  Returns Inf if a is empty.
+inline Real DistanceLowerBound(const AABB3D& a,const AABB3D& b)
+{
+  if(a.bmin.x > a.bmax.x) return Inf;
+  return a.distance(b);
+}
+
+//true if GeometricPrimitive3D::Distance(Vector3) is implemented for g
+inline bool SupportsPointDistance(const GeometricPrimitive3D& g)
+{
+  switch(g.type) {
+  case GeometricPrimitive3D::Point:
+  case GeometricPrimitive3D::Segment:
+  case GeometricPrimitive3D::Sphere:
+  case GeometricPrimitive3D::Cylinder:
+  case GeometricPrimitive3D::AABB:
+  case GeometricPrimitive3D::Box:
+  case GeometricPrimitive3D::Triangle:
+    return true;
+  default:
+    return false;
+  }
+}
+
+//visits the 8 children of an octree node in order of increasing lower bound
+//on the distance, skipping those whose bound exceeds dmin.  LowerBound(c)
+//and Visit(c) are members of Searcher.
+template <class Searcher>
+void VisitOctreeChildren(Searcher& s,const OctreeNode& n)
+{
+  Real lb[8];
+  int order[8];
+  for(int i=0;i<8;i++) {
+    lb[i] = s.LowerBound(n.childIndices[i]);
+    order[i] = i;
+    for(int j=i;j>0 && lb[order[j]] < lb[order[j-1]];j--)
+      std::swap(order[j],order[j-1]);
+  }
+  for(int i=0;i<8;i++) {
+    if(!(lb[order[i]] < s.dmin)) break;
+    s.Visit(n.childIndices[order[i]]);
+  }
+}
+
+/** Branch and bound for the distance between a point cloud and a mesh.
+ * Descends the octree and the PQP BVH together like PointMeshCollider,
+ * visiting the closer child first and pruning pairs of nodes that can't
+ * beat the closest distance found so far.  dmin starts at the bound, so
+ * nothing is returned if the distance exceeds the bound.
+ */
+class PointMeshDistance
+{
+public:
+  const CollisionPointCloud& pc;
+  const CollisionMesh& mesh;
+  RigidTransform Tba;
+  Real dmin;
+  int closestPoint,closestTri;
+  int meshNode;  //the BVH node being split, for VisitOctreeChildren
+  vector<Real> d2;
+  PointMeshDistance(const CollisionPointCloud& a,const CollisionMesh& b)
+    :pc(a),mesh(b),dmin(Inf),closestPoint(-1),closestTri(-1),meshNode(0)
+  {
+    RigidTransform Twa;
+    Twa.setInverse(a.currentTransform);
+    Tba.mul(Twa,b.currentTransform);
+  }
+  Real Compute(Real bound=Inf) {
+    dmin = bound;
+    closestPoint = closestTri = -1;
+    if(!pc.octree || mesh.tris.empty()) return Inf;
+    if(LowerBound(0,0) < dmin) _Recurse(0,0);
+    if(closestPoint < 0) return Inf;
+    return dmin;
+  }
+  Real LowerBound(int pcOctreeNode,int meshBVHNode) const {
+    Box3D meshbox,meshbox_pc;
+    BVToBox(mesh.pqpModel->b[meshBVHNode],meshbox);
+    meshbox_pc.setTransformed(meshbox,Tba);
+    return DistanceLowerBound(pc.octree->Node(pcOctreeNode).bb,meshbox_pc);
+  }
+  Real LowerBound(int pcOctreeNode) const { return LowerBound(pcOctreeNode,meshNode); }
+  void Visit(int pcOctreeNode) { _Recurse(pcOctreeNode,meshNode); }
+  void _Recurse(int pcOctreeNode,int meshBVHNode) {
+    const OctreeNode& pcnode = pc.octree->Node(pcOctreeNode);
+    const BV& meshnode = mesh.pqpModel->b[meshBVHNode];
+    if(pc.octree->IsLeaf(pcnode)) {
+      if(meshnode.Leaf()) {
+	int t = -meshnode.first_child-1;
+	Triangle3D tri;
+	Copy(mesh.pqpModel->tris[t].p1,tri.a);
+	Copy(mesh.pqpModel->tris[t].p2,tri.b);
+	Copy(mesh.pqpModel->tris[t].p3,tri.c);
+	tri.a = Tba * tri.a;
+	tri.b = Tba * tri.b;
+	tri.c = Tba * tri.c;
+	int first,last;
+	pc.octree->GetPointRange(pcOctreeNode,first,last);
+	if(first == last) return;
+	d2.resize(last-first);
+	PointTriangleDistance2(pc.octree->PointsX()+first,pc.octree->PointsY()+first,pc.octree->PointsZ()+first,last-first,tri,&d2[0]);
+	Real d2min = Sqr(dmin);
+	bool found = false;
+	for(int i=0;i<last-first;i++) {
+	  if(d2[i] < d2min) {
+	    d2min = d2[i];
+	    closestPoint = pc.octree->PointIDs()[first+i];
+	    closestTri = mesh.pqpModel->tris[t].id;
+	    found = true;
+	  }
+	}
+	if(found) dmin = Min(dmin,Sqrt(d2min));
+      }
+      else
+	_RecurseSplitMesh(pcOctreeNode,meshBVHNode);
+    }
+    else {
+      if(meshnode.Leaf() || Volume(pcnode) >= Volume(meshnode))
+	_RecurseSplitOctree(pcOctreeNode,meshBVHNode);
+      else
+	_RecurseSplitMesh(pcOctreeNode,meshBVHNode);
+    }
+  }
+  void _RecurseSplitMesh(int pcOctreeNode,int meshBVHNode) {
+    int c1=mesh.pqpModel->b[meshBVHNode].first_child;
+    int c2=c1+1;
+    Real d1=LowerBound(pcOctreeNode,c1),d2=LowerBound(pcOctreeNode,c2);
+    if(d2 < d1) { std::swap(c1,c2); std::swap(d1,d2); }
+    if(d1 < dmin) _Recurse(pcOctreeNode,c1);
+    if(d2 < dmin) _Recurse(pcOctreeNode,c2);
+  }
+  void _RecurseSplitOctree(int pcOctreeNode,int meshBVHNode) {
+    int oldMeshNode = meshNode;
+    meshNode = meshBVHNode;
+    VisitOctreeChildren(*this,pc.octree->Node(pcOctreeNode));
+    meshNode = oldMeshNode;
+  }
+};
+
+/** Branch and bound for the distance between two point clouds, descending
+ * both octrees.  See PointMeshDistance.
+ */
+class PointPointDistance
+{
+public:
+  const CollisionPointCloud& a;
+  const CollisionPointCloud& b;
+  RigidTransform Tba;
+  Real dmin;
+  int closestA,closestB;
+  int fixedNode;   //the node of the other octree, for VisitOctreeChildren
+  bool splitA;     //which octree VisitOctreeChildren is splitting
+  vector<Real> d2;
+  PointPointDistance(const CollisionPointCloud& _a,const CollisionPointCloud& _b)
+    :a(_a),b(_b),dmin(Inf),closestA(-1),closestB(-1),fixedNode(0),splitA(true)
+  {
+    RigidTransform Twa;
+    Twa.setInverse(a.currentTransform);
+    Tba.mul(Twa,b.currentTransform);
+  }
+  Real Compute(Real bound=Inf) {
+    dmin = bound;
+    closestA = closestB = -1;
+    if(!a.octree || !b.octree) return Inf;
+    if(LowerBound(0,0) < dmin) _Recurse(0,0);
+    if(closestA < 0) return Inf;
+    return dmin;
+  }
+  Real LowerBound(int aindex,int bindex) const {
+    const AABB3D& bbb = b.octree->Node(bindex).bb;
+    if(bbb.bmin.x > bbb.bmax.x) return Inf;
+    Box3D bbox_a;
+    bbox_a.setTransformed(bbb,Tba);
+    return DistanceLowerBound(a.octree->Node(aindex).bb,bbox_a);
+  }
+  Real LowerBound(int index) const {
+    if(splitA) return LowerBound(index,fixedNode);
+    return LowerBound(fixedNode,index);
+  }
+  void Visit(int index) {
+    if(splitA) _Recurse(index,fixedNode);
+    else _Recurse(fixedNode,index);
+  }
+  void _Recurse(int aindex,int bindex) {
+    const OctreeNode& anode = a.octree->Node(aindex);
+    const OctreeNode& bnode = b.octree->Node(bindex);
+    bool aleaf = a.octree->IsLeaf(anode), bleaf = b.octree->IsLeaf(bnode);
+    if(aleaf && bleaf) {
+      int afirst,alast,bfirst,blast;
+      a.octree->GetPointRange(aindex,afirst,alast);
+      b.octree->GetPointRange(bindex,bfirst,blast);
+      int na = alast-afirst;
+      if(na == 0) return;
+      d2.resize(na);
+      Real d2min = Sqr(dmin);
+      bool found = false;
+      for(int j=bfirst;j<blast;j++) {
+	PointPointDistance2(a.octree->PointsX()+afirst,a.octree->PointsY()+afirst,a.octree->PointsZ()+afirst,na,Tba*b.octree->Points()[j],&d2[0]);
+	for(int i=0;i<na;i++) {
+	  if(d2[i] < d2min) {
+	    d2min = d2[i];
+	    closestA = a.octree->PointIDs()[afirst+i];
+	    closestB = b.octree->PointIDs()[j];
+	    found = true;
+	  }
+	}
+      }
+      if(found) dmin = Min(dmin,Sqrt(d2min));
+      return;
+    }
+    bool split = (!aleaf && (bleaf || Volume(anode) >= Volume(bnode)));
+    bool oldSplitA = splitA;
+    int oldFixedNode = fixedNode;
+    splitA = split;
+    fixedNode = (split ? bindex : aindex);
+    VisitOctreeChildren(*this,(split ? anode : bnode));
+    splitA = oldSplitA;
+    fixedNode = oldFixedNode;
+  }
+};
+
+/** Branch and bound for the distance between a point cloud and a primitive
+ * given in the point cloud's local frame.  Octree nodes are bounded by the
+ * distance to the primitive's AABB.
+ */
+class PointPrimitiveDistance
+{
+public:
+  const CollisionPointCloud& pc;
+  const GeometricPrimitive3D& g;
+  AABB3D gbb;
+  Real dmin;
+  int closestPoint;
+  PointPrimitiveDistance(const CollisionPointCloud& _pc,const GeometricPrimitive3D& glocal)
+    :pc(_pc),g(glocal),dmin(Inf),closestPoint(-1)
+  {
+    gbb = g.GetAABB();
+  }
+  Real Compute(Real bound=Inf) {
+    dmin = bound;
+    closestPoint = -1;
+    if(!pc.octree) return Inf;
+    if(LowerBound(0) < dmin) Visit(0);
+    if(closestPoint < 0) return Inf;
+    return dmin;
+  }
+  Real LowerBound(int index) const { return DistanceLowerBound(pc.octree->Node(index).bb,gbb); }
+  void Visit(int index) {
+    const OctreeNode& n = pc.octree->Node(index);
+    if(pc.octree->IsLeaf(n)) {
+      int first,last;
+      pc.octree->GetPointRange(index,first,last);
+      for(int i=first;i<last;i++) {
+	Real d = g.Distance(pc.octree->Points()[i]);
+	if(d < dmin) {
+	  dmin = d;
+	  closestPoint = pc.octree->PointIDs()[i];
+	}
+      }
+    }
+    else
+      VisitOctreeChildren(*this,n);
+  }
+};
+
+/** Branch and bound for the distance between an implicit surface and a point
+ * cloud.  Assumes the grid holds a distance field, so that the value at the
+ * center of a node, minus its radius, bounds the values inside the node.
+ */
+class ImplicitPointDistance
+{
+public:
+  const CollisionImplicitSurface& grid;
+  const CollisionPointCloud& pc;
+  RigidTransform Tgp;   //point cloud frame -> grid frame
+  Real dmin;
+  int closestPoint;
+  Vector3 closestPointGrid;
+  ImplicitPointDistance(const CollisionImplicitSurface& _grid,const CollisionPointCloud& _pc)
+    :grid(_grid),pc(_pc),dmin(Inf),closestPoint(-1)
+  {
+    RigidTransform Tw_grid;
+    Tw_grid.setInverse(grid.currentTransform);
+    Tgp.mul(Tw_grid,pc.currentTransform);
+  }
+  Real Compute(Real bound=Inf) {
+    dmin = bound;
+    closestPoint = -1;
+    if(!pc.octree) return Inf;
+    if(LowerBound(0) < dmin) Visit(0);
+    if(closestPoint < 0) return Inf;
+    return dmin;
+  }
+  Real LowerBound(int index) const {
+    const AABB3D& bb = pc.octree->Node(index).bb;
+    if(bb.bmin.x > bb.bmax.x) return Inf;
+    Box3D boxg;
+    boxg.setTransformed(bb,Tgp);
+    return ValueLowerBound(grid,boxg);
+  }
+  void Visit(int index) {
+    const OctreeNode& n = pc.octree->Node(index);
+    if(pc.octree->IsLeaf(n)) {
+      int first,last;
+      pc.octree->GetPointRange(index,first,last);
+      for(int i=first;i<last;i++) {
+	Vector3 pgrid = Tgp*pc.octree->Points()[i];
+	Real d = grid.Value(pgrid);
+	if(d < dmin) {
+	  dmin = d;
+	  closestPoint = pc.octree->PointIDs()[i];
+	  closestPointGrid = pgrid;
+	}
+      }
+    }
+    else
+      VisitOctreeChildren(*this,n);
+  }
+};
+
+/** Branch and bound for the distance between an implicit surface and a
+ * mesh.  BVH nodes are bounded like in ImplicitPointDistance, and triangles
+ * are subdivided until they are smaller than a grid cell.
+ */
+class ImplicitMeshDistance
+{
+public:
+  const CollisionImplicitSurface& grid;
+  const CollisionMesh& mesh;
+  RigidTransform Tgm;   //mesh frame -> grid frame
+  Real resolution;
+  Real dmin;
+  int closestTri;
+  Vector3 closestPointGrid;
+  ImplicitMeshDistance(const CollisionImplicitSurface& _grid,const CollisionMesh& _mesh)
+    :grid(_grid),mesh(_mesh),dmin(Inf),closestTri(-1)
+  {
+    RigidTransform Tw_grid;
+    Tw_grid.setInverse(grid.currentTransform);
+    Tgm.mul(Tw_grid,mesh.currentTransform);
+    Vector3 h = grid.GetCellSize();
+    resolution = 0.5*Min(h.x,h.y,h.z);
+  }
+  Real Compute(Real bound=Inf) {
+    dmin = bound;
+    closestTri = -1;
+    if(mesh.tris.empty()) return Inf;
+    if(LowerBound(0) < dmin) _Recurse(0);
+    if(closestTri < 0) return Inf;
+    return dmin;
+  }
+  Real LowerBound(int bvnode) const {
+    Box3D box,boxg;
+    BVToBox(mesh.pqpModel->b[bvnode],box);
+    boxg.setTransformed(box,Tgm);
+    return ValueLowerBound(grid,boxg);
+  }
+  void _Recurse(int bvnode) {
+    const BV& b = mesh.pqpModel->b[bvnode];
+    if(b.Leaf()) {
+      int t = -b.first_child-1;
+      Triangle3D tri;
+      Copy(mesh.pqpModel->tris[t].p1,tri.a);
+      Copy(mesh.pqpModel->tris[t].p2,tri.b);
+      Copy(mesh.pqpModel->tris[t].p3,tri.c);
+      tri.a = Tgm * tri.a;
+      tri.b = Tgm * tri.b;
+      tri.c = Tgm * tri.c;
+      _RecurseTriangle(tri,mesh.pqpModel->tris[t].id);
+      return;
+    }
+    int c1=b.first_child;
+    int c2=c1+1;
+    Real d1=LowerBound(c1),d2=LowerBound(c2);
+    if(d2 < d1) { std::swap(c1,c2); std::swap(d1,d2); }
+    if(d1 < dmin) _Recurse(c1);
+    if(d2 < dmin) _Recurse(c2);
+  }
+  void _RecurseTriangle(const Triangle3D& tri,int id) {
+    Vector3 c = (tri.a+tri.b+tri.c)/3.0;
+    Real r = Max(c.distance(tri.a),c.distance(tri.b),c.distance(tri.c));
+    Real vc = grid.Value(c);
+    if(vc < dmin) {
+      dmin = vc;
+      closestTri = id;
+      closestPointGrid = c;
+    }
+    if(r <= resolution || !(vc - r < dmin)) return;
+    Vector3 ab=(tri.a+tri.b)*0.5,bc=(tri.b+tri.c)*0.5,ca=(tri.c+tri.a)*0.5;
+    _RecurseTriangle(Triangle3D(tri.a,ab,ca),id);
+    _RecurseTriangle(Triangle3D(ab,tri.b,bc),id);
+    _RecurseTriangle(Triangle3D(ca,bc,tri.c),id);
+    _RecurseTriangle(Triangle3D(ab,bc,ca),id);
+  }
+};
+
+//Distance functions.  Each returns the distance between the underlying
+//geometries without margins, and the closest elements.  If the distance
+//exceeds bound, they may stop early and return any value > bound.
+
+Real Distance(const CollisionMesh& a,const CollisionMesh& b,Real bound,int& elem1,int& elem2)
+{
+  CollisionMeshQuery q(a,b);
+  Real d = q.Distance(0,0,bound);
+  q.ClosestPair(elem1,elem2);
+  return d;
+}
+
+Real Distance(const GeometricPrimitive3D& aw,const CollisionMesh& b,Real bound,int& elem2)
+{
+  if(aw.type == GeometricPrimitive3D::Point || aw.type == GeometricPrimitive3D::Sphere) {
+    Vector3 c;
+    Real r = 0;
+    if(aw.type == GeometricPrimitive3D::Point) c = *AnyCast_Raw<Vector3>(&aw.data);
+    else {
+      c = AnyCast_Raw<Sphere3D>(&aw.data)->center;
+      r = AnyCast_Raw<Sphere3D>(&aw.data)->radius;
+    }
+    Vector3 cp;
+    elem2 = ClosestPoint(b,c,cp);
+    return Max(0.0,(b.currentTransform*cp).distance(c) - r);
+  }
+  CollisionMesh amesh;
+  MakeCollisionMesh(aw,amesh);
+  int elem1;
+  return Distance(amesh,b,bound,elem1,elem2);
+}
+
+Real Distance(const GeometricPrimitive3D& aw,const CollisionPointCloud& b,Real bound,int& elem2)
+{
+  if(!SupportsPointDistance(aw)) {
+    CollisionMesh amesh;
+    MakeCollisionMesh(aw,amesh);
+    PointMeshDistance distance(b,amesh);
+    Real d = distance.Compute(bound);
+    elem2 = distance.closestPoint;
+    return d;
+  }
+  GeometricPrimitive3D alocal = aw;
+  RigidTransform Tinv;
+  Tinv.setInverse(b.currentTransform);
+  alocal.Transform(Tinv);
+  PointPrimitiveDistance distance(b,alocal);
+  Real d = distance.Compute(bound);
+  elem2 = distance.closestPoint;
+  return d;
+}
+
+Real Distance(const CollisionImplicitSurface& a,const CollisionMesh& b,Real bound,int& elem1,int& elem2)
+{
+  ImplicitMeshDistance distance(a,b);
+  Real d = distance.Compute(bound);
+  elem2 = distance.closestTri;
+  elem1 = (elem2 >= 0 ? a.CellElement(distance.closestPointGrid) : -1);
+  return d;
+}
+
+Real Distance(const CollisionImplicitSurface& a,const GeometricPrimitive3D& bw,Real bound,int& elem1)
+{
+  if(bw.type == GeometricPrimitive3D::Point || bw.type == GeometricPrimitive3D::Sphere) {
+    Vector3 c;
+    Real r = 0;
+    if(bw.type == GeometricPrimitive3D::Point) c = *AnyCast_Raw<Vector3>(&bw.data);
+    else {
+      c = AnyCast_Raw<Sphere3D>(&bw.data)->center;
+      r = AnyCast_Raw<Sphere3D>(&bw.data)->radius;
+    }
+    Vector3 clocal;
+    a.currentTransform.mulInverse(c,clocal);
+    elem1 = a.CellElement(clocal);
+    return a.Value(clocal) - r;
+  }
+  CollisionMesh bmesh;
+  MakeCollisionMesh(bw,bmesh);
+  int elem2;
+  return Distance(a,bmesh,bound,elem1,elem2);
+}
+
+Real Distance(const CollisionImplicitSurface& a,const CollisionPointCloud& b,Real bound,int& elem1,int& elem2)
+{
+  ImplicitPointDistance distance(a,b);
+  Real d = distance.Compute(bound);
+  elem2 = distance.closestPoint;
+  elem1 = (elem2 >= 0 ? a.CellElement(distance.closestPointGrid) : -1);
+  return d;
+}
+
+//Samples b at its cell centers, descending the value pyramid of b and
+//skipping the blocks whose bounds show they can't get closer than the best
+//distance so far.  Away from both surfaces, the sum of the distance fields is
+//minimized on the segment between the closest points.
+class ImplicitImplicitDistance
+{
+public:
+  ImplicitImplicitDistance(const CollisionImplicitSurface& _a,const CollisionImplicitSurface& _b)
+    :a(_a),b(_b),dmin(Inf),elem1(-1),elem2(-1)
+  {
+    RigidTransform Tw_a;
+    Tw_a.setInverse(a.currentTransform);
+    Tab.mul(Tw_a,b.currentTransform);
+    h = b.GetCellSize();
+  }
+  Real Compute(Real bound) {
+    dmin = bound;
+    elem1 = elem2 = -1;
+    if(a.pyramid.IsEmpty() || b.pyramid.IsEmpty()) return Inf;
+    Recurse(b.pyramid.NumLevels()-1,IntTriple(0,0,0));
+    if(elem1 < 0) return Inf;
+    return dmin;
+  }
+  void Recurse(int level,const IntTriple& index) {
+    const Meshing::VolumeGridPyramid& pyramid = b.pyramid;
+    Real bmin = pyramid.minValues[level](index);
+    if(bmin >= 0 && bmin >= dmin) return;
+    IntTriple cmin,cmax;
+    pyramid.GetCubeRange(level,index,cmin,cmax);
+    AABB3D blockbb;
+    blockbb.bmin.set(b.bb.bmin.x+cmin.a*h.x,b.bb.bmin.y+cmin.b*h.y,b.bb.bmin.z+cmin.c*h.z);
+    blockbb.bmax.set(b.bb.bmin.x+(cmax.a+1)*h.x,b.bb.bmin.y+(cmax.b+1)*h.y,b.bb.bmin.z+(cmax.c+1)*h.z);
+    Box3D boxa;
+    boxa.setTransformed(blockbb,Tab);
+    if(!(CombinedValue(ValueLowerBound(a,boxa),bmin) < dmin)) return;
+    if(level > 0) {
+      const Array3D<Real>& child = pyramid.minValues[level-1];
+      IntTriple c;
+      for(c.a=2*index.a;c.a<=Min(2*index.a+1,child.m-1);c.a++)
+	for(c.b=2*index.b;c.b<=Min(2*index.b+1,child.n-1);c.b++)
+	  for(c.c=2*index.c;c.c<=Min(2*index.c+1,child.p-1);c.c++)
+	    Recurse(level-1,c);
+      return;
+    }
+    Vector3 c,ca;
+    for(int i=cmin.a;i<=cmax.a;i++)
+      for(int j=cmin.b;j<=cmax.b;j++)
+	for(int k=cmin.c;k<=cmax.c;k++) {
+	  Real vb = b.value(i,j,k);
+	  if(vb >= 0 && vb >= dmin) continue;
+	  b.GetCellCenter(i,j,k,c);
+	  ca = Tab*c;
+	  Real d = CombinedValue(a.Value(ca),vb);
+	  if(d < dmin) {
+	    dmin = d;
+	    elem1 = a.CellElement(ca);
+	    elem2 = i*b.value.n*b.value.p + j*b.value.p + k;
+	  }
+	}
+  }
+
+  const CollisionImplicitSurface& a;
+  const CollisionImplicitSurface& b;
+  RigidTransform Tab;
+  Vector3 h;
+  Real dmin;
+  int elem1,elem2;
+};
+
+Real Distance(const CollisionImplicitSurface& a,const CollisionImplicitSurface& b,Real bound,int& elem1,int& elem2)
+{
+  ImplicitImplicitDistance distance(a,b);
+  Real d = distance.Compute(bound);
+  elem1 = distance.elem1;
+  elem2 = distance.elem2;
+  return d;
+}
+
+Real Distance(const GeometricPrimitive3D& a,const RigidTransform& Ta,AnyCollisionGeometry3D& b,Real bound,int& elem1,int& elem2)
+{
+  elem1 = 0;
+  if(a.type == GeometricPrimitive3D::Empty) return Inf;
+  GeometricPrimitive3D aw=a;
+  aw.Transform(Ta);
+  switch(b.type) {
+  case AnyCollisionGeometry3D::Primitive:
+    {
+      GeometricPrimitive3D bw=b.AsPrimitive();
+      bw.Transform(b.GetTransform());
+      elem2 = 0;
+      if(GeometricPrimitive3D::SupportsDistance(aw.type,bw.type))
+	return aw.Distance(bw);
+      CollisionMesh bmesh;
+      MakeCollisionMesh(bw,bmesh);
+      int temp;
+      return Distance(aw,bmesh,bound,temp);
+    }
+  case AnyCollisionGeometry3D::ImplicitSurface:
+    return Distance(b.ImplicitSurfaceCollisionData(),aw,bound,elem2);
+  case AnyCollisionGeometry3D::TriangleMesh:
+    return Distance(aw,b.TriangleMeshCollisionData(),bound,elem2);
+  case AnyCollisionGeometry3D::PointCloud:
+    return Distance(aw,b.PointCloudCollisionData(),bound,elem2);
+  default:
+    FatalError("Invalid type");
+  }
+  return Inf;
+}
+
+Real Distance(const CollisionImplicitSurface& a,AnyCollisionGeometry3D& b,Real bound,int& elem1,int& elem2)
+{
+  switch(b.type) {
+  case AnyCollisionGeometry3D::ImplicitSurface:
+    return Distance(a,b.ImplicitSurfaceCollisionData(),bound,elem1,elem2);
+  case AnyCollisionGeometry3D::TriangleMesh:
+    return Distance(a,b.TriangleMeshCollisionData(),bound,elem1,elem2);
+  case AnyCollisionGeometry3D::PointCloud:
+    return Distance(a,b.PointCloudCollisionData(),bound,elem1,elem2);
+  default:
+    FatalError("Invalid type");
+  }
+  return Inf;
+}
+
+Real Distance(const CollisionPointCloud& a,AnyCollisionGeometry3D& b,Real bound,int& elem1,int& elem2)
+{
+  switch(b.type) {
+  case AnyCollisionGeometry3D::PointCloud:
+    {
+      PointPointDistance distance(a,b.PointCloudCollisionData());
+      Real d = distance.Compute(bound);
+      elem1 = distance.closestA;
+      elem2 = distance.closestB;
+      return d;
+    }
+  case AnyCollisionGeometry3D::TriangleMesh:
+    {
+      PointMeshDistance distance(a,b.TriangleMeshCollisionData());
+      Real d = distance.Compute(bound);
+      elem1 = distance.closestPoint;
+      elem2 = distance.closestTri;
+      return d;
+    }
+  default:
+    FatalError("Invalid type");
+  }
+  return Inf;
+}
+
+//pairs are handled by the first type in this order
+inline int DistancePriority(AnyGeometry3D::Type type)
+{
+  switch(type) {
+  case AnyGeometry3D::Group: return 0;
+  case AnyGeometry3D::Primitive: return 1;
+  case AnyGeometry3D::ImplicitSurface: return 2;
+  case AnyGeometry3D::PointCloud: return 3;
+  case AnyGeometry3D::TriangleMesh: return 4;
+  }
+  return 5;
+}
+
 bool AnyCollisionGeometry3D::Collides(AnyCollisionGeometry3D& geom)
 {
   InitCollisionData();
@@ -1452,7 +2317,7 @@ bool AnyCollisionGeometry3D::Collides(AnyCollisionGeometry3D& geom,
   case Primitive:
     return ::Collides(AsPrimitive(),GetTransform(),margin,geom,elements1,elements2,maxContacts);
   case ImplicitSurface:
-    return ::Collides(AsImplicitSurface(),GetTransform(),margin,geom,elements1,elements2,maxContacts);
+    return ::Collides(ImplicitSurfaceCollisionData(),margin,geom,elements1,elements2,maxContacts);
   case TriangleMesh:
     return ::Collides(TriangleMeshCollisionData(),margin,geom,elements1,elements2,maxContacts);
   case PointCloud:
@@ -1473,12 +2338,46 @@ Real AnyCollisionGeometry3D::Distance(AnyCollisionGeometry3D& geom)
   return Distance(geom,elem1,elem2);
 }
 
-Real AnyCollisionGeometry3D::Distance(AnyCollisionGeometry3D& geom,int& elem1,int& elem2)
+Real AnyCollisionGeometry3D::Distance(AnyCollisionGeometry3D& geom,int& elem1,int& elem2,Real bound)
 {
   InitCollisionData();
   geom.InitCollisionData();
-  FatalError("Distance not implemented yet\n");
-  return Inf;
+  if(DistancePriority(geom.type) < DistancePriority(type))
+    return geom.Distance(*this,elem2,elem1,bound);
+  elem1 = elem2 = -1;
+  if(type == Group) {
+    vector<AnyCollisionGeometry3D>& items = GroupCollisionData();
+    Real dmin = Inf;
+    for(size_t i=0;i<items.size();i++) {
+      int e1,e2;
+      Real d = items[i].Distance(geom,e1,e2,Min(dmin,bound+margin));
+      if(d < dmin) {
+	dmin = d;
+	elem1 = (int)i;
+	elem2 = e2;
+      }
+    }
+    return dmin - margin;
+  }
+  Real rawbound = bound + margin + geom.margin;
+  Real d = Inf;
+  switch(type) {
+  case Primitive:
+    d = ::Distance(AsPrimitive(),GetTransform(),geom,rawbound,elem1,elem2);
+    break;
+  case ImplicitSurface:
+    d = ::Distance(ImplicitSurfaceCollisionData(),geom,rawbound,elem1,elem2);
+    break;
+  case PointCloud:
+    d = ::Distance(PointCloudCollisionData(),geom,rawbound,elem1,elem2);
+    break;
+  case TriangleMesh:
+    d = ::Distance(TriangleMeshCollisionData(),geom.TriangleMeshCollisionData(),rawbound,elem1,elem2);
+    break;
+  default:
+    FatalError("Invalid type");
+  }
+  return d - margin - geom.margin;
 }
 
 bool AnyCollisionGeometry3D::WithinDistance(AnyCollisionGeometry3D& geom,Real tol)
@@ -1494,11 +2393,14 @@ bool AnyCollisionGeometry3D::WithinDistance(AnyCollisionGeometry3D& geom,Real to
 {
   InitCollisionData();
   geom.InitCollisionData();
+  //prioritize point cloud testing
+  if(geom.type == PointCloud && type != PointCloud)
+    return geom.WithinDistance(*this,tol,elements2,elements1,maxContacts);
   switch(type) {
   case Primitive:
     return ::Collides(AsPrimitive(),GetTransform(),margin+tol,geom,elements1,elements2,maxContacts);
   case ImplicitSurface:
-    return ::Collides(AsImplicitSurface(),GetTransform(),margin+tol,geom,elements1,elements2,maxContacts);
+    return ::Collides(ImplicitSurfaceCollisionData(),margin+tol,geom,elements1,elements2,maxContacts);
   case TriangleMesh:
     return ::Collides(TriangleMeshCollisionData(),margin+tol,geom,elements1,elements2,maxContacts);
   case PointCloud:
@@ -1534,8 +2436,20 @@ bool AnyCollisionGeometry3D::RayCast(const Ray3D& r,Real* distance,int* element)
     }
     break;
   case ImplicitSurface:
-    FatalError("Can't ray-cast implicit surfaces yet\n");
-    break;
+    {
+      const CollisionImplicitSurface& grid = ImplicitSurfaceCollisionData();
+      Vector3 worldpt;
+      if(::RayCast(grid,margin,r,worldpt)) {
+	if(distance) *distance = worldpt.distance(r.source);
+	if(element) {
+	  Vector3 localpt;
+	  grid.currentTransform.mulInverse(worldpt,localpt);
+	  *element = grid.CellElement(localpt);
+	}
+	return true;
+      }
+      return false;
+    }
   case TriangleMesh:
     {
       Vector3 worldpt;
@@ -3,6 +3,7 @@
 
 #include <KrisLibrary/utils/AnyValue.h>
 #include "CollisionMesh.h"
+#include "CollisionImplicitSurface.h"
 
 class TiXmlElement;
 
@@ -113,12 +114,12 @@ class AnyCollisionGeometry3D : public AnyGeometry3D
   const RigidTransform& PrimitiveCollisionData() const;
   const CollisionMesh& TriangleMeshCollisionData() const;
   const CollisionPointCloud& PointCloudCollisionData() const;
-  const RigidTransform& ImplicitSurfaceCollisionData() const;
+  const CollisionImplicitSurface& ImplicitSurfaceCollisionData() const;
   const vector<AnyCollisionGeometry3D>& GroupCollisionData() const;
   RigidTransform& PrimitiveCollisionData();
   CollisionMesh& TriangleMeshCollisionData();
   CollisionPointCloud& PointCloudCollisionData();
-  RigidTransform& ImplicitSurfaceCollisionData();
+  CollisionImplicitSurface& ImplicitSurfaceCollisionData();
   vector<AnyCollisionGeometry3D>& GroupCollisionData();
   ///Returns an axis-aligned bounding box in the world coordinate frame
   ///containing the transformed geometry.  Note: if collision data is
@@ -144,7 +145,12 @@ class AnyCollisionGeometry3D : public AnyGeometry3D
   bool Collides(AnyCollisionGeometry3D& geom);
   bool Collides(AnyCollisionGeometry3D& geom,vector<int>& elements1,vector<int>& elements2,size_t maxcollisions=INT_MAX);
   Real Distance(AnyCollisionGeometry3D& geom);
-  Real Distance(AnyCollisionGeometry3D& geom,int& elem1,int& elem2);
+  ///Returns the distance to geom, minus both margins, and the indices of
+  ///the closest elements (triangles, points, grid cells, or group items).
+  ///Implicit surfaces return a signed distance.  If bound is given, the
+  ///search may stop early and return any value > bound when the distance
+  ///exceeds bound.
+  Real Distance(AnyCollisionGeometry3D& geom,int& elem1,int& elem2,Real bound=Inf);
   bool WithinDistance(AnyCollisionGeometry3D& geom,Real d);
   bool WithinDistance(AnyCollisionGeometry3D& geom,Real d,vector<int>& elements1,vector<int>& elements2,size_t maxcollisions=INT_MAX);
   bool RayCast(const Ray3D& r,Real* distance=NULL,int* element=NULL);
@@ -153,14 +159,14 @@ class AnyCollisionGeometry3D : public AnyGeometry3D
    * - Primitive: null
    * - TriangleMesh: CollisionMesh
    * - PointCloud: CollisionPointCloud
-   * - VolumeGrid: null
+   * - VolumeGrid: CollisionImplicitSurface
    * - Group: vector<AnyCollisionGeometry3D>
    */
   AnyValue collisionData;
   ///Amount by which the underlying geometry is "fattened"
   Real margin;
   ///The current transform, used if the collision data is not initialized yet
-  ///or the data type is Primitive / VolumeGrid.
+  ///or the data type is Primitive.
   RigidTransform currentTransform;
 };
 
@@ -0,0 +1,284 @@
+#include "Broadphase.h"
+#include "AnyGeometry.h"
+#include <algorithm>
+using namespace std;
+
+namespace Geometry {
+
+inline unsigned long long PairKey(int a,int b)
+{
+  if(a > b) std::swap(a,b);
+  return ((unsigned long long)(unsigned int)a << 32) | (unsigned long long)(unsigned int)b;
+}
+
+inline bool EndpointLess(const SweepAndPrune::Endpoint& a,const SweepAndPrune::Endpoint& b)
+{
+  //mins come before maxes at equal values, so touching boxes overlap
+  return a.value < b.value || (a.value == b.value && !a.isMax && b.isMax);
+}
+
+SweepAndPrune::SweepAndPrune(Real _padding)
+  :padding(_padding),rebuild(false),numAdded(0)
+{}
+
+void SweepAndPrune::Clear()
+{
+  boxes.clear();
+  valid.clear();
+  freeIds.clear();
+  for(int k=0;k<3;k++) endpoints[k].clear();
+  pairs.clear();
+  rebuild = false;
+  numAdded = 0;
+}
+
+int SweepAndPrune::Add(const AABB3D& bb)
+{
+  int id;
+  if(!freeIds.empty()) {
+    id = freeIds.back();
+    freeIds.pop_back();
+    boxes[id] = bb;
+    valid[id] = true;
+  }
+  else {
+    id = (int)boxes.size();
+    boxes.push_back(bb);
+    valid.push_back(true);
+  }
+  //endpoint values are filled in on Update()
+  Endpoint e;
+  e.value = Inf;
+  e.id = id;
+  for(int k=0;k<3;k++) {
+    e.isMax = false;
+    endpoints[k].push_back(e);
+    e.isMax = true;
+    endpoints[k].push_back(e);
+  }
+  numAdded++;
+  if(numAdded > 8 && numAdded*4 > (int)boxes.size()) rebuild = true;
+  return id;
+}
+
+void SweepAndPrune::Remove(int id)
+{
+  Assert(IsValid(id));
+  valid[id] = false;
+  freeIds.push_back(id);
+  for(int k=0;k<3;k++) {
+    size_t n=0;
+    for(size_t i=0;i<endpoints[k].size();i++)
+      if(endpoints[k][i].id != id) endpoints[k][n++] = endpoints[k][i];
+    endpoints[k].resize(n);
+  }
+  vector<unsigned long long> toErase;
+  for(UNORDERED_SET_TEMPLATE<unsigned long long>::const_iterator i=pairs.begin();i!=pairs.end();i++) {
+    int a = (int)(*i >> 32), b = (int)(*i & 0xffffffff);
+    if(a == id || b == id) toErase.push_back(*i);
+  }
+  for(size_t i=0;i<toErase.size();i++)
+    pairs.erase(toErase[i]);
+}
+
+void SweepAndPrune::Set(int id,const AABB3D& bb)
+{
+  Assert(IsValid(id));
+  boxes[id] = bb;
+}
+
+bool SweepAndPrune::PaddedOverlap(int a,int b) const
+{
+  const AABB3D& ba=boxes[a], &bb=boxes[b];
+  Real p2 = 2*padding;
+  if(ba.bmin.x > bb.bmax.x + p2 || bb.bmin.x > ba.bmax.x + p2) return false;
+  if(ba.bmin.y > bb.bmax.y + p2 || bb.bmin.y > ba.bmax.y + p2) return false;
+  if(ba.bmin.z > bb.bmax.z + p2 || bb.bmin.z > ba.bmax.z + p2) return false;
+  return true;
+}
+
+void SweepAndPrune::AddPair(int a,int b)
+{
+  pairs.insert(PairKey(a,b));
+}
+
+void SweepAndPrune::RemovePair(int a,int b)
+{
+  pairs.erase(PairKey(a,b));
+}
+
+void SweepAndPrune::Rebuild()
+{
+  for(int k=0;k<3;k++)
+    sort(endpoints[k].begin(),endpoints[k].end(),EndpointLess);
+  pairs.clear();
+  vector<int> active;
+  const vector<Endpoint>& e=endpoints[0];
+  for(size_t i=0;i<e.size();i++) {
+    if(!e[i].isMax) {
+      for(size_t j=0;j<active.size();j++)
+        if(PaddedOverlap(e[i].id,active[j])) AddPair(e[i].id,active[j]);
+      active.push_back(e[i].id);
+    }
+    else {
+      for(size_t j=0;j<active.size();j++)
+        if(active[j] == e[i].id) {
+          active[j] = active.back();
+          active.pop_back();
+          break;
+        }
+    }
+  }
+}
+
+void SweepAndPrune::Update()
+{
+  for(int k=0;k<3;k++) {
+    vector<Endpoint>& e=endpoints[k];
+    for(size_t i=0;i<e.size();i++) {
+      if(e[i].isMax) e[i].value = boxes[e[i].id].bmax[k] + padding;
+      else e[i].value = boxes[e[i].id].bmin[k] - padding;
+    }
+  }
+  if(rebuild) {
+    Rebuild();
+    rebuild = false;
+    numAdded = 0;
+    return;
+  }
+  numAdded = 0;
+  //insertion sort, with the swaps telling which pairs start or stop
+  //overlapping
+  for(int k=0;k<3;k++) {
+    vector<Endpoint>& e=endpoints[k];
+    for(size_t i=1;i<e.size();i++) {
+      if(!EndpointLess(e[i],e[i-1])) continue;
+      Endpoint temp = e[i];
+      size_t j=i;
+      while(j > 0 && EndpointLess(temp,e[j-1])) {
+        const Endpoint& other = e[j-1];
+        if(other.id != temp.id) {
+          if(!temp.isMax && other.isMax) {
+            if(PaddedOverlap(temp.id,other.id)) AddPair(temp.id,other.id);
+          }
+          else if(temp.isMax && !other.isMax)
+            RemovePair(temp.id,other.id);
+        }
+        e[j] = e[j-1];
+        j--;
+      }
+      e[j] = temp;
+    }
+  }
+}
+
+void SweepAndPrune::OverlappingPairs(vector<pair<int,int> >& res)
+{
+  Update();
+  res.resize(0);
+  res.reserve(pairs.size());
+  for(UNORDERED_SET_TEMPLATE<unsigned long long>::const_iterator i=pairs.begin();i!=pairs.end();i++)
+    res.push_back(pair<int,int>((int)(*i >> 32),(int)(*i & 0xffffffff)));
+  sort(res.begin(),res.end());
+}
+
+void SweepAndPrune::Overlapping(int id,vector<int>& ids)
+{
+  Update();
+  ids.resize(0);
+  for(UNORDERED_SET_TEMPLATE<unsigned long long>::const_iterator i=pairs.begin();i!=pairs.end();i++) {
+    int a = (int)(*i >> 32), b = (int)(*i & 0xffffffff);
+    if(a == id) ids.push_back(b);
+    else if(b == id) ids.push_back(a);
+  }
+  sort(ids.begin(),ids.end());
+}
+
+
+
+AnyCollisionBroadphase::AnyCollisionBroadphase(Real _maxDistance)
+  :maxDistance(_maxDistance),sap(_maxDistance*0.5)
+{}
+
+void AnyCollisionBroadphase::Clear()
+{
+  geometries.clear();
+  sap.Clear();
+}
+
+int AnyCollisionBroadphase::Add(AnyCollisionGeometry3D* geom)
+{
+  int id = sap.Add(geom->GetAABB());
+  if(id >= (int)geometries.size()) geometries.resize(id+1,NULL);
+  geometries[id] = geom;
+  return id;
+}
+
+void AnyCollisionBroadphase::Remove(int id)
+{
+  sap.Remove(id);
+  geometries[id] = NULL;
+}
+
+void AnyCollisionBroadphase::SetTransform(int id,const RigidTransform& T)
+{
+  geometries[id]->SetTransform(T);
+  sap.Set(id,geometries[id]->GetAABB());
+}
+
+void AnyCollisionBroadphase::Refresh(int id)
+{
+  sap.Set(id,geometries[id]->GetAABB());
+}
+
+void AnyCollisionBroadphase::RefreshAll()
+{
+  for(size_t i=0;i<geometries.size();i++)
+    if(geometries[i]) sap.Set((int)i,geometries[i]->GetAABB());
+}
+
+void AnyCollisionBroadphase::OverlappingPairs(vector<pair<int,int> >& pairs)
+{
+  NearbyPairs(0,pairs);
+}
+
+void AnyCollisionBroadphase::NearbyPairs(Real d,vector<pair<int,int> >& pairs)
+{
+  Assert(d <= maxDistance);
+  sap.OverlappingPairs(pairs);
+  if(d == maxDistance) return;
+  //the boxes are padded for maxDistance, filter out the farther ones
+  size_t n=0;
+  for(size_t i=0;i<pairs.size();i++) {
+    const AABB3D& a=sap.Get(pairs[i].first), &b=sap.Get(pairs[i].second);
+    if(a.bmin.x > b.bmax.x + d || b.bmin.x > a.bmax.x + d) continue;
+    if(a.bmin.y > b.bmax.y + d || b.bmin.y > a.bmax.y + d) continue;
+    if(a.bmin.z > b.bmax.z + d || b.bmin.z > a.bmax.z + d) continue;
+    pairs[n++] = pairs[i];
+  }
+  pairs.resize(n);
+}
+
+void AnyCollisionBroadphase::CollidingPairs(vector<pair<int,int> >& pairs)
+{
+  NearbyPairs(0,pairs);
+  size_t n=0;
+  for(size_t i=0;i<pairs.size();i++) {
+    if(geometries[pairs[i].first]->Collides(*geometries[pairs[i].second]))
+      pairs[n++] = pairs[i];
+  }
+  pairs.resize(n);
+}
+
+void AnyCollisionBroadphase::WithinDistancePairs(Real d,vector<pair<int,int> >& pairs)
+{
+  NearbyPairs(d,pairs);
+  size_t n=0;
+  for(size_t i=0;i<pairs.size();i++) {
+    if(geometries[pairs[i].first]->WithinDistance(*geometries[pairs[i].second],d))
+      pairs[n++] = pairs[i];
+  }
+  pairs.resize(n);
+}
+
+} //namespace Geometry
@@ -0,0 +1,123 @@
+#ifndef GEOMETRY_BROADPHASE_H
+#define GEOMETRY_BROADPHASE_H
+
+#include <KrisLibrary/math3d/AABB3D.h>
+#include <KrisLibrary/utils/stl_tr1.h>
+#include <vector>
+
+namespace Geometry {
+
+  using namespace Math3D;
+  class AnyCollisionGeometry3D;
+
+/** @ingroup Geometry
+ * @brief An incremental sweep-and-prune broadphase over axis-aligned boxes.
+ *
+ * Boxes are added with Add() and moved with Set().  Update() then brings the
+ * three sorted endpoint lists up to date with an insertion sort, and the set
+ * of overlapping pairs is maintained from the endpoint swaps.  When objects
+ * move only a little between frames, few swaps are needed and Update() runs
+ * in close to O(n) time.
+ *
+ * Boxes are treated as closed, so touching boxes overlap.  Each box may be
+ * padded by a fixed amount, so that pairs within distance 2*padding are
+ * reported as well.
+ */
+class SweepAndPrune
+{
+ public:
+  SweepAndPrune(Real padding=0);
+  ///Removes all boxes
+  void Clear();
+  ///Adds a new box, returns its id
+  int Add(const AABB3D& bb);
+  ///Removes a box.  The id may be reused by a later Add() call
+  void Remove(int id);
+  ///Changes a box.  Takes effect on the next call to Update()
+  void Set(int id,const AABB3D& bb);
+  ///Returns the (unpadded) box given by Add() or Set()
+  const AABB3D& Get(int id) const { return boxes[id]; }
+  bool IsValid(int id) const { return id >= 0 && id < (int)valid.size() && valid[id]; }
+  ///Brings the pair set up to date with all changes since the last update
+  void Update();
+  ///Calls Update(), then returns all overlapping pairs (a,b) with a < b,
+  ///sorted lexicographically
+  void OverlappingPairs(std::vector<std::pair<int,int> >& pairs);
+  ///Calls Update(), then returns the ids of the boxes overlapping id
+  void Overlapping(int id,std::vector<int>& ids);
+  ///Returns the number of currently overlapping pairs (as of the last
+  ///Update())
+  size_t NumOverlappingPairs() const { return pairs.size(); }
+
+  struct Endpoint
+  {
+    Real value;
+    int id;
+    bool isMax;
+  };
+
+  Real padding;
+  std::vector<AABB3D> boxes;
+  std::vector<bool> valid;
+  std::vector<int> freeIds;
+  std::vector<Endpoint> endpoints[3];
+  ///set to true when so many boxes were added that a full rebuild is cheaper
+  ///than the incremental update
+  bool rebuild;
+  int numAdded;
+  UNORDERED_SET_TEMPLATE<unsigned long long> pairs;
+
+ private:
+  bool PaddedOverlap(int a,int b) const;
+  void Rebuild();
+  void AddPair(int a,int b);
+  void RemovePair(int a,int b);
+};
+
+/** @ingroup Geometry
+ * @brief A broadphase for a scene of AnyCollisionGeometry3D objects.
+ *
+ * Geometries are registered with Add().  They should be moved through
+ * SetTransform(), or Refresh() should be called after they are moved in some
+ * other way.  OverlappingPairs() and NearbyPairs() return candidate pairs
+ * from the bounding boxes alone, while CollidingPairs() and
+ * WithinDistancePairs() also run the narrowphase on the candidates.
+ *
+ * Distance queries are supported up to maxDistance, which is fixed at
+ * construction because it determines how much the boxes are padded.
+ *
+ * The geometries are not owned by the broadphase, and their collision data
+ * should be initialized before they are added.
+ */
+class AnyCollisionBroadphase
+{
+ public:
+  AnyCollisionBroadphase(Real maxDistance=0);
+  void Clear();
+  int Add(AnyCollisionGeometry3D* geom);
+  void Remove(int id);
+  ///Calls geometries[id]->SetTransform(T) and updates its bounding box
+  void SetTransform(int id,const RigidTransform& T);
+  ///Updates the bounding box of geometry id after it has moved
+  void Refresh(int id);
+  ///Updates the bounding boxes of all geometries
+  void RefreshAll();
+  ///Returns the pairs whose bounding boxes overlap
+  void OverlappingPairs(std::vector<std::pair<int,int> >& pairs);
+  ///Returns the pairs whose bounding boxes are within distance d.  d must be
+  ///no greater than maxDistance.
+  void NearbyPairs(Real d,std::vector<std::pair<int,int> >& pairs);
+  ///Returns the pairs that collide
+  void CollidingPairs(std::vector<std::pair<int,int> >& pairs);
+  ///Returns the pairs that are within distance d.  d must be no greater than
+  ///maxDistance.
+  void WithinDistancePairs(Real d,std::vector<std::pair<int,int> >& pairs);
+
+  Real maxDistance;
+  std::vector<AnyCollisionGeometry3D*> geometries;
+  SweepAndPrune sap;
+};
+
+} //namespace Geometry
+
+#endif
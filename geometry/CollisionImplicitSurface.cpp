@@ -0,0 +1,129 @@
+#include "CollisionImplicitSurface.h"
+#include <math3d/clip.h>
+
+namespace Geometry {
+
+CollisionImplicitSurface::CollisionImplicitSurface()
+  :conservative(false)
+{
+  currentTransform.setIdentity();
+}
+
+CollisionImplicitSurface::CollisionImplicitSurface(const Meshing::VolumeGrid& grid)
+  :Meshing::VolumeGrid(grid),conservative(false)
+{
+  currentTransform.setIdentity();
+  InitCollisions();
+}
+
+void CollisionImplicitSurface::InitCollisions()
+{
+  pyramid.Build(value);
+}
+
+Real CollisionImplicitSurface::Value(const Vector3& pt) const
+{
+  return TrilinearInterpolate(pt) + bb.distance(pt);
+}
+
+//cell index of coordinate x along an axis with n cells spanning [a,b],
+//clamped to [0,n-1]
+inline int ClampedIndex(Real x,Real a,Real b,int n)
+{
+  Real u = (x-a)/(b-a)*n;
+  if(!(u >= 0)) return 0;
+  if(u >= n-1) return n-1;
+  return (int)u;
+}
+
+int CollisionImplicitSurface::CellElement(const Vector3& pt) const
+{
+  int i=ClampedIndex(pt.x,bb.bmin.x,bb.bmax.x,value.m);
+  int j=ClampedIndex(pt.y,bb.bmin.y,bb.bmax.y,value.n);
+  int k=ClampedIndex(pt.z,bb.bmin.z,bb.bmax.z,value.p);
+  return i*value.n*value.p + j*value.p + k;
+}
+
+void CollisionImplicitSurface::ValueBounds(const AABB3D& range,Real& vmin,Real& vmax) const
+{
+  pyramid.GetInterpolationBounds(*this,range,vmin,vmax);
+  if(pyramid.IsEmpty()) return;
+  //add the distance outside of the bounding box.  The maximum distance is
+  //attained at a corner of the range.
+  vmin += bb.distance(range);
+  Real dmax = 0;
+  for(int c=0;c<8;c++) {
+    Vector3 corner((c&1)?range.bmax.x:range.bmin.x,(c&2)?range.bmax.y:range.bmin.y,(c&4)?range.bmax.z:range.bmin.z);
+    dmax = ::Max(dmax,bb.distance(corner));
+  }
+  vmax += dmax;
+}
+
+Real CollisionImplicitSurface::ValueLowerBound(const AABB3D& range) const
+{
+  Real vmin,vmax;
+  pyramid.GetInterpolationBounds(*this,range,vmin,vmax);
+  if(pyramid.IsEmpty()) return Inf;
+  return vmin + bb.distance(range);
+}
+
+bool RayCast(const CollisionImplicitSurface& s,Real levelSet,const Ray3D& r,Vector3& pt)
+{
+  Ray3D rlocal;
+  s.currentTransform.mulInverse(r.source,rlocal.source);
+  s.currentTransform.R.mulTranspose(r.direction,rlocal.direction);
+  if(!RayCastLocal(s,levelSet,rlocal,pt)) return false;
+  pt = s.currentTransform*pt;
+  return true;
+}
+
+bool RayCastLocal(const CollisionImplicitSurface& s,Real levelSet,const Ray3D& r,Vector3& pt)
+{
+  if(s.pyramid.IsEmpty()) return false;
+  Real len = r.direction.norm();
+  if(FuzzyZero(len)) return false;
+  Vector3 d = r.direction/len;
+  //the value outside of bbx is greater than the level set
+  Real gmin = s.pyramid.minValues.back()(0,0,0);
+  AABB3D bbx = s.bb;
+  Real expand = ::Max(levelSet - gmin,Real(0));
+  bbx.bmin -= Vector3(expand);
+  bbx.bmax += Vector3(expand);
+  Real tmin=0,tmax=Inf;
+  if(!ClipLine(r.source,d,bbx,tmin,tmax)) return false;
+
+  Vector3 h = s.GetCellSize();
+  Real eps = 1e-3*::Min(h.x,::Min(h.y,h.z));
+  const int maxIters = 10000;
+  Real t = tmin;
+  IntTriple cell,imin,imax;
+  for(int iters=0;iters<maxIters;iters++) {
+    if(t > tmax) return false;
+    pt = r.source + t*d;
+    Real v = s.Value(pt) - levelSet;
+    if(v <= eps) return true;
+    //outside of bb the value is the sum of two distances, each of which
+    //changes by at most the step size
+    Real tnext = t + (s.bb.contains(pt) ? v : 0.5*v);
+    //skip the rest of the largest block known to be above the level set
+    s.GetIndex(pt,cell);
+    if(s.pyramid.GetEmptyBlock(cell,levelSet,imin,imax)) {
+      AABB3D block;
+      s.GetCell(imin,block);
+      AABB3D temp;
+      s.GetCell(imax,temp);
+      block.bmax = temp.bmax;
+      //blocks at the boundary extend outside of the grid
+      for(int k=0;k<3;k++) {
+	if(imin[k] == 0) block.bmin[k] = bbx.bmin[k];
+	if(imax[k] == s.pyramid.size[k]-1) block.bmax[k] = bbx.bmax[k];
+      }
+      Real u1=t,u2=Inf;
+      if(ClipLine(r.source,d,block,u1,u2) && u2 > tnext) tnext = u2;
+    }
+    t = tnext;
+  }
+  return false;
+}
+
+} //namespace Geometry
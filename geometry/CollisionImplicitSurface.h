@@ -0,0 +1,74 @@
+#ifndef GEOMETRY_COLLISION_IMPLICIT_SURFACE_H
+#define GEOMETRY_COLLISION_IMPLICIT_SURFACE_H
+
+#include <KrisLibrary/meshing/VolumeGrid.h>
+#include <KrisLibrary/math3d/primitives.h>
+#include <KrisLibrary/math3d/Ray3D.h>
+
+namespace Geometry {
+
+  using namespace Math3D;
+
+/** @ingroup Geometry
+ * @brief An implicit surface (a signed distance grid) with value bounds
+ * that enable fast collision and proximity queries.
+ *
+ * A min/max pyramid over the values (see Meshing::VolumeGridPyramid) bounds
+ * the values that TrilinearInterpolate can return over any region.  Queries
+ * use it to skip large regions of empty space.
+ *
+ * Outside of the grid's bounding box, the value is the value at the closest
+ * point on the box plus the distance to the box (see Value).
+ *
+ * The values must be set first, then InitCollisions() must be called.  Like
+ * CollisionMesh, the current transform must be set before making queries.
+ */
+class CollisionImplicitSurface : public Meshing::VolumeGrid
+{
+ public:
+  CollisionImplicitSurface();
+  CollisionImplicitSurface(const Meshing::VolumeGrid& grid);
+  ///Builds the value pyramid.  Needs to be called any time the values
+  ///change.
+  void InitCollisions();
+  ///Returns the value at pt, given in the local frame
+  Real Value(const Vector3& pt) const;
+  ///Returns the index of the cell closest to pt (given in the local frame),
+  ///numbered like the elements of value
+  int CellElement(const Vector3& pt) const;
+  ///Bounds the value over range (given in the local frame) using the
+  ///pyramid.
+  void ValueBounds(const AABB3D& range,Real& vmin,Real& vmax) const;
+  ///Returns a lower bound on the value over range (in the local frame)
+  Real ValueLowerBound(const AABB3D& range) const;
+
+  ///The transformation of the grid in space
+  RigidTransform currentTransform;
+  ///Min / max values of the grid over blocks of cells
+  Meshing::VolumeGridPyramid pyramid;
+  /** If true, collision queries against meshes, boxes, and other grids are
+   * conservative: they never miss a contact, but may report one when the
+   * geometries are within about half a cell of the margin.  Otherwise,
+   * (default) they test samples spaced about half a cell apart, and may
+   * miss contacts thinner than that.  This assumes the values are a
+   * distance field, i.e., change by at most the distance between points.
+   */
+  bool conservative;
+};
+
+/** @brief Casts a ray at the level set {x | value(x) = levelSet} of the
+ * surface, using sphere tracing accelerated by the pyramid.  The ray is given
+ * in world coordinates.  Returns true if there's a hit, and the hit point in
+ * world coordinates is returned in pt.
+ *
+ * As with the conservative flag, this assumes the values are a distance
+ * field.  The ray stops at the first point where the value is within about
+ * 1e-3 cells of the level set, or at its origin if that is inside.
+ */
+bool RayCast(const CollisionImplicitSurface& s,Real levelSet,const Ray3D& r,Vector3& pt);
+///Same as above, but the ray and the hit point are in local coordinates
+bool RayCastLocal(const CollisionImplicitSurface& s,Real levelSet,const Ray3D& r,Vector3& pt);
+
+} //namespace Geometry
+
+#endif
@@ -1,7 +1,19 @@
 #include "CollisionMesh.h"
 #include "PenetrationDepth.h"
 #include <math3d/clip.h>
+#include <utils/threadutils.h>
+#include <utils/fileutils.h>
 #include <iostream>
+#include <fstream>
+#include <map>
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif //_WIN32
 using namespace Meshing;
 using namespace std;
 
@@ -141,6 +153,246 @@ const CollisionMesh& CollisionMesh::operator = (const CollisionMesh& model)
 }
 
 
+static string collisionMeshCacheDirectory;
+
+void SetCollisionMeshCacheDirectory(const string& dir)
+{
+  collisionMeshCacheDirectory = dir;
+}
+
+const string& GetCollisionMeshCacheDirectory()
+{
+  return collisionMeshCacheDirectory;
+}
+
+/* Collision data file layout: the header, then the vertices, mesh
+ * triangles, PQP triangles, and PQP bounding volumes as raw arrays, each
+ * starting on an 8-byte boundary.  The sizes in the header guard against
+ * loading a file written with a different Real / PQP_REAL type, BV type, or
+ * byte order.
+ *
+ * Inside CollisionMesh, Tri names TriMesh::Tri, so PQP's triangle type is
+ * written ::Tri.
+ */
+struct CollisionMeshFileHeader
+{
+  char magic[8];
+  int version;
+  int endianTest;
+  int realSize,vector3Size,triSize,pqpRealSize,pqpTriSize,bvSize;
+  int bvType;
+  int numVerts,numTris,numPQPTris,numBVs;
+  int reserved;
+  char hash[16];
+};
+
+static const char collisionMeshMagic[8] = {'K','L','P','Q','P','B','V','H'};
+static const int collisionMeshFileVersion = 1;
+
+inline size_t Align8(size_t n) { return (n+7) & ~size_t(7); }
+
+static void MakeCollisionMeshHeader(const CollisionMesh& mesh,const string& hash,CollisionMeshFileHeader& header)
+{
+  memset(&header,0,sizeof(header));
+  memcpy(header.magic,collisionMeshMagic,8);
+  header.version = collisionMeshFileVersion;
+  header.endianTest = 0x01020304;
+  header.realSize = sizeof(Real);
+  header.vector3Size = sizeof(Vector3);
+  header.triSize = sizeof(IntTriple);
+  header.pqpRealSize = sizeof(PQP_REAL);
+  header.pqpTriSize = sizeof(::Tri);
+  header.bvSize = sizeof(BV);
+  header.bvType = PQP_BV_TYPE;
+  header.numVerts = (int)mesh.verts.size();
+  header.numTris = (int)mesh.tris.size();
+  header.numPQPTris = (mesh.pqpModel ? mesh.pqpModel->num_tris : 0);
+  header.numBVs = (mesh.pqpModel ? mesh.pqpModel->num_bvs : 0);
+  memcpy(header.hash,hash.c_str(),Min(hash.length(),sizeof(header.hash)));
+}
+
+//returns the total file size implied by the header, or 0 if the header
+//doesn't match this build
+static size_t CheckCollisionMeshHeader(const CollisionMeshFileHeader& header)
+{
+  CollisionMeshFileHeader ref;
+  CollisionMesh empty;
+  MakeCollisionMeshHeader(empty,"",ref);
+  if(memcmp(header.magic,ref.magic,8) != 0) return 0;
+  if(header.version != ref.version || header.endianTest != ref.endianTest) return 0;
+  if(header.realSize != ref.realSize || header.vector3Size != ref.vector3Size || header.triSize != ref.triSize) return 0;
+  if(header.pqpRealSize != ref.pqpRealSize || header.pqpTriSize != ref.pqpTriSize || header.bvSize != ref.bvSize || header.bvType != ref.bvType) return 0;
+  if(header.numVerts < 0 || header.numTris < 0 || header.numPQPTris < 0 || header.numBVs < 0) return 0;
+  size_t n = Align8(sizeof(header));
+  n += Align8(size_t(header.numVerts)*sizeof(Vector3));
+  n += Align8(size_t(header.numTris)*sizeof(IntTriple));
+  n += Align8(size_t(header.numPQPTris)*sizeof(::Tri));
+  n += Align8(size_t(header.numBVs)*sizeof(BV));
+  return n;
+}
+
+static void WriteAligned(ostream& out,const void* data,size_t n)
+{
+  static const char zeros[8] = {0,0,0,0,0,0,0,0};
+  if(n > 0) out.write((const char*)data,n);
+  if(Align8(n) > n) out.write(zeros,Align8(n)-n);
+}
+
+string CollisionMesh::ContentHash() const
+{
+  //64-bit FNV-1a over the raw vertex and triangle data
+  unsigned long long h = 14695981039346656037ULL;
+  const unsigned long long prime = 1099511628211ULL;
+  const unsigned char* v = (const unsigned char*)(verts.empty() ? NULL : &verts[0]);
+  for(size_t i=0;i<verts.size()*sizeof(Vector3);i++) {
+    h ^= v[i];
+    h *= prime;
+  }
+  const unsigned char* t = (const unsigned char*)(tris.empty() ? NULL : &tris[0]);
+  for(size_t i=0;i<tris.size()*sizeof(IntTriple);i++) {
+    h ^= t[i];
+    h *= prime;
+  }
+  char buf[17];
+  snprintf(buf,17,"%08x%08x",(unsigned int)(h>>32),(unsigned int)(h&0xffffffff));
+  return string(buf);
+}
+
+bool CollisionMesh::SaveCollisionData(const char* fn) const
+{
+  if(!tris.empty() && !pqpModel) {
+    fprintf(stderr,"CollisionMesh::SaveCollisionData: InitCollisions() was not called\n");
+    return false;
+  }
+  CollisionMeshFileHeader header;
+  MakeCollisionMeshHeader(*this,ContentHash(),header);
+  ofstream out(fn,ios::out|ios::binary);
+  if(!out) return false;
+  WriteAligned(out,&header,sizeof(header));
+  WriteAligned(out,(verts.empty() ? NULL : &verts[0]),verts.size()*sizeof(Vector3));
+  WriteAligned(out,(tris.empty() ? NULL : &tris[0]),tris.size()*sizeof(IntTriple));
+  if(pqpModel) {
+    WriteAligned(out,pqpModel->tris,size_t(pqpModel->num_tris)*sizeof(::Tri));
+    WriteAligned(out,pqpModel->b,size_t(pqpModel->num_bvs)*sizeof(BV));
+  }
+  out.close();
+  return !out.fail();
+}
+
+//Reads the header of a mapped collision data file and returns pointers to
+//its arrays.  Returns false if the file doesn't match this build.
+static bool ParseCollisionMeshFile(const FileUtils::MappedFile& file,CollisionMeshFileHeader& header,const char*& verts,const char*& tris,const char*& pqpTris,const char*& bvs)
+{
+  if(file.size < sizeof(header)) return false;
+  memcpy(&header,file.data,sizeof(header));
+  size_t n = CheckCollisionMeshHeader(header);
+  if(n == 0 || n != file.size) return false;
+  const char* p = file.data + Align8(sizeof(header));
+  verts = p;
+  p += Align8(size_t(header.numVerts)*sizeof(Vector3));
+  tris = p;
+  p += Align8(size_t(header.numTris)*sizeof(IntTriple));
+  pqpTris = p;
+  p += Align8(size_t(header.numPQPTris)*sizeof(::Tri));
+  bvs = p;
+  return true;
+}
+
+//PQP_Model frees its arrays with delete[], so the data is copied out of
+//the mapping
+static PQP_Model* MakePQPModel(const CollisionMeshFileHeader& header,const char* pqpTris,const char* bvs)
+{
+  if(header.numPQPTris == 0) return NULL;
+  PQP_Model* pqp = new PQP_Model;
+  const ::Tri* srcTris = reinterpret_cast<const ::Tri*>(pqpTris);
+  pqp->tris = new ::Tri[header.numPQPTris];
+  for(int i=0;i<header.numPQPTris;i++)
+    pqp->tris[i] = srcTris[i];
+  pqp->num_tris = pqp->num_tris_alloced = header.numPQPTris;
+  const BV* srcBVs = reinterpret_cast<const BV*>(bvs);
+  pqp->b = new BV[header.numBVs];
+  for(int i=0;i<header.numBVs;i++)
+    pqp->b[i] = srcBVs[i];
+  pqp->num_bvs = pqp->num_bvs_alloced = header.numBVs;
+  //PQP_BUILD_STATE_PROCESSED, which is private to PQP.cpp
+  pqp->build_state = 2;
+  return pqp;
+}
+
+bool CollisionMesh::LoadCollisionData(const char* fn)
+{
+  FileUtils::MappedFile file;
+  if(!file.Open(fn)) return false;
+  CollisionMeshFileHeader header;
+  const char *vdata,*tdata,*pqpTris,*bvs;
+  if(!ParseCollisionMeshFile(file,header,vdata,tdata,pqpTris,bvs)) {
+    fprintf(stderr,"CollisionMesh::LoadCollisionData: %s is not a compatible collision data file\n",fn);
+    return false;
+  }
+  SafeDelete(pqpModel);
+  ClearTopology();
+  const Vector3* srcVerts = reinterpret_cast<const Vector3*>(vdata);
+  const IntTriple* srcTris = reinterpret_cast<const IntTriple*>(tdata);
+  verts.assign(srcVerts,srcVerts+header.numVerts);
+  tris.assign(srcTris,srcTris+header.numTris);
+  pqpModel = MakePQPModel(header,pqpTris,bvs);
+  if(pqpModel) CalcVertexNeighbors();
+  return true;
+}
+
+//numbers the temporary files written by InitCollisionsCached
+static Mutex tempFileMutex;
+static int tempFileCounter = 0;
+
+void CollisionMesh::InitCollisionsCached()
+{
+  if(collisionMeshCacheDirectory.empty() || tris.empty()) {
+    InitCollisions();
+    return;
+  }
+  string hash = ContentHash();
+  string fn = collisionMeshCacheDirectory + "/" + hash + ".pqp";
+  FileUtils::MappedFile file;
+  if(file.Open(fn.c_str())) {
+    CollisionMeshFileHeader header;
+    const char *vdata,*tdata,*pqpTris,*bvs;
+    //the mesh itself is compared, not just the hash
+    if(ParseCollisionMeshFile(file,header,vdata,tdata,pqpTris,bvs) &&
+       header.numVerts == (int)verts.size() && header.numTris == (int)tris.size() &&
+       memcmp(vdata,&verts[0],verts.size()*sizeof(Vector3)) == 0 &&
+       memcmp(tdata,&tris[0],tris.size()*sizeof(IntTriple)) == 0) {
+      SafeDelete(pqpModel);
+      pqpModel = MakePQPModel(header,pqpTris,bvs);
+      CalcVertexNeighbors();
+      return;
+    }
+    file.Close();
+  }
+  InitCollisions();
+  if(!FileUtils::IsDirectory(collisionMeshCacheDirectory.c_str()))
+    FileUtils::MakeDirectoryRecursive(collisionMeshCacheDirectory.c_str());
+  //write to a temporary file and rename it, so that other processes never
+  //map a partially written file.  The temporary name is unique to this
+  //process and call, so concurrent writers don't clobber each other
+  int tempIndex;
+  {
+    ScopedLock lock(tempFileMutex);
+    tempIndex = tempFileCounter++;
+  }
+  char suffix[64];
+  snprintf(suffix,64,".%d.%d.tmp",(int)getpid(),tempIndex);
+  string tempfn = fn + suffix;
+  if(!SaveCollisionData(tempfn.c_str())) {
+    fprintf(stderr,"CollisionMesh::InitCollisionsCached: could not write %s\n",tempfn.c_str());
+    remove(tempfn.c_str());
+    return;
+  }
+  //if this fails (e.g., on Windows when another process has already
+  //written fn) the existing file is kept
+  if(rename(tempfn.c_str(),fn.c_str()) != 0)
+    remove(tempfn.c_str());
+}
+
 CollisionMeshQuery::CollisionMeshQuery()
   :m1(NULL),m2(NULL),
    penetration1(NULL),penetration2(NULL)
@@ -734,6 +986,158 @@ void CollisionMeshQueryEnhanced::PenetrationPoints(Vector3& p1,Vector3& p2,Vecto
 
 
 
+CollisionMeshBatchQuery::CollisionMeshBatchQuery()
+  :relErr(0),numPruned(0),numTested(0)
+{}
+
+void CollisionMeshBatchQuery::Clear()
+{
+  items.resize(0);
+  numPruned = numTested = 0;
+}
+
+int CollisionMeshBatchQuery::Add(const CollisionMesh& m1,const CollisionMesh& m2,QueryType type,Real tol)
+{
+  Item item;
+  item.m1 = &m1;
+  item.m2 = &m2;
+  item.type = type;
+  item.tol = tol;
+  item.result = false;
+  item.pruned = false;
+  item.distance = Inf;
+  item.t1 = item.t2 = -1;
+  items.push_back(item);
+  return (int)items.size()-1;
+}
+
+struct BatchQueryData
+{
+  CollisionMeshBatchQuery* query;
+  vector<int> active;
+};
+
+void batch_query_item_func(void* ptr,int index)
+{
+  BatchQueryData* data = reinterpret_cast<BatchQueryData*>(ptr);
+  CollisionMeshBatchQuery::Item& item = data->query->items[data->active[index]];
+  const CollisionMesh* m1 = item.m1, *m2 = item.m2;
+  PQP_REAL R1[3][3],T1[3],R2[3][3],T2[3];
+  RigidTransformToPQP(m1->currentTransform,R1,T1);
+  RigidTransformToPQP(m2->currentTransform,R2,T2);
+  if(item.type == CollisionMeshBatchQuery::QueryCollide) {
+    PQP_CollideResult res;
+    int ret=PQP_Collide(&res,R1,T1,m1->pqpModel,R2,T2,m2->pqpModel,PQP_FIRST_CONTACT);
+    if(ret != PQP_OK) {
+      fprintf(stderr,"CollisionMeshBatchQuery: PQP_Collide error %d on item %d\n",ret,data->active[index]);
+      return;
+    }
+    item.result = (res.Colliding()!=0);
+    if(item.result) {
+      item.distance = 0;
+      item.t1 = res.Id1(0);
+      item.t2 = res.Id2(0);
+    }
+  }
+  else if(item.type == CollisionMeshBatchQuery::QueryWithinDistance) {
+    PQP_ToleranceResult res;
+    int ret=PQP_Tolerance(&res,R1,T1,m1->pqpModel,R2,T2,m2->pqpModel,item.tol);
+    if(ret != PQP_OK) {
+      fprintf(stderr,"CollisionMeshBatchQuery: PQP_Tolerance error %d on item %d\n",ret,data->active[index]);
+      return;
+    }
+    item.result = (res.CloserThanTolerance()!=0);
+    if(item.result) {
+      item.distance = 0;
+      item.t1 = res.tid1;
+      item.t2 = res.tid2;
+    }
+  }
+  else {
+    PQP_DistanceResult res;
+    res.t1 = res.t2 = 0;
+    int ret=PQP_Distance(&res,R1,T1,m1->pqpModel,R2,T2,m2->pqpModel,data->query->relErr,item.tol);
+    if(ret != PQP_OK) {
+      fprintf(stderr,"CollisionMeshBatchQuery: PQP_Distance error %d on item %d\n",ret,data->active[index]);
+      return;
+    }
+    item.distance = res.Distance();
+    item.result = (item.distance <= 0);
+    item.t1 = res.tid1;
+    item.t2 = res.tid2;
+  }
+}
+
+int CollisionMeshBatchQuery::Solve(int numThreads)
+{
+  //compute the world bounding box of each distinct mesh only once
+  map<const CollisionMesh*,int> meshIndex;
+  vector<AABB3D> bbs;
+  vector<int> index1(items.size()),index2(items.size());
+  for(size_t i=0;i<items.size();i++) {
+    for(int k=0;k<2;k++) {
+      const CollisionMesh* m = (k==0 ? items[i].m1 : items[i].m2);
+      map<const CollisionMesh*,int>::iterator it = meshIndex.find(m);
+      int index;
+      if(it == meshIndex.end()) {
+        index = (int)bbs.size();
+        meshIndex[m] = index;
+        bbs.resize(bbs.size()+1);
+        if(m->pqpModel == NULL || m->tris.empty()) 
+          bbs.back().minimize();
+        else {
+          Box3D bb;
+          GetBB(*m,bb);
+          bb.getAABB(bbs.back());
+        }
+      }
+      else index = it->second;
+      if(k==0) index1[i] = index;
+      else index2[i] = index;
+    }
+  }
+
+  //prune the pairs whose boxes are separated
+  BatchQueryData data;
+  data.query = this;
+  numPruned = 0;
+  for(size_t i=0;i<items.size();i++) {
+    Item& item = items[i];
+    item.result = false;
+    item.pruned = false;
+    item.distance = Inf;
+    item.t1 = item.t2 = -1;
+    if(item.m1->pqpModel == NULL || item.m2->pqpModel == NULL || item.m1->tris.empty() || item.m2->tris.empty()) {
+      item.pruned = true;
+      numPruned++;
+      continue;
+    }
+    if(item.type != QueryDistance) {
+      const AABB3D& a = bbs[index1[i]];
+      const AABB3D& b = bbs[index2[i]];
+      Real tol = (item.type == QueryWithinDistance ? item.tol : 0);
+      if(a.bmin.x > b.bmax.x + tol || b.bmin.x > a.bmax.x + tol ||
+         a.bmin.y > b.bmax.y + tol || b.bmin.y > a.bmax.y + tol ||
+         a.bmin.z > b.bmax.z + tol || b.bmin.z > a.bmax.z + tol) {
+        item.pruned = true;
+        numPruned++;
+        continue;
+      }
+    }
+    data.active.push_back((int)i);
+  }
+  numTested = (int)data.active.size();
+
+  ParallelFor((int)data.active.size(),batch_query_item_func,&data,numThreads);
+
+  int numTrue = 0;
+  for(size_t i=0;i<items.size();i++)
+    if(items[i].result) numTrue++;
+  return numTrue;
+}
+
+
+
 
 
 
@@ -4,6 +4,7 @@
 #include <KrisLibrary/meshing/TriMeshTopology.h>
 #include <KrisLibrary/math3d/geometry3d.h>
 #include <limits.h>
+#include <string>
 
 class PQP_Model;
 class PQP_Results;
@@ -33,6 +34,19 @@ class CollisionMesh : public Meshing::TriMeshWithTopology
   ~CollisionMesh();
   const CollisionMesh& operator = (const CollisionMesh& model);
   void InitCollisions();
+  ///Same as InitCollisions(), except that if a cache directory is set (see
+  ///SetCollisionMeshCacheDirectory), the hierarchy is loaded from the cache
+  ///when this mesh has been seen before, and saved to it otherwise.
+  void InitCollisionsCached();
+  ///Saves the mesh and its PQP hierarchy in a binary format.
+  ///InitCollisions() must have been called first.
+  bool SaveCollisionData(const char* fn) const;
+  ///Loads the mesh and PQP hierarchy from a file written by
+  ///SaveCollisionData.  Returns false if the file is missing or damaged, or
+  ///was written by a build with a different PQP configuration.
+  bool LoadCollisionData(const char* fn);
+  ///Returns a hash of the vertices and triangles, as 16 hex digits
+  std::string ContentHash() const;
   inline void UpdateTransform(const RigidTransform& f) {currentTransform = f;}
   void GetTransform(RigidTransform& f) const {f=currentTransform; }
 
@@ -40,6 +54,17 @@ class CollisionMesh : public Meshing::TriMeshWithTopology
   RigidTransform currentTransform;
 };
 
+/** @ingroup Geometry
+ * @brief Sets the directory where CollisionMesh::InitCollisionsCached
+ * stores PQP hierarchies, named by the mesh's content hash.
+ *
+ * The default is empty, which disables the cache.  The directory is
+ * created if needed.  Files written by an incompatible build are rebuilt
+ * and overwritten.
+ */
+void SetCollisionMeshCacheDirectory(const std::string& dir);
+const std::string& GetCollisionMeshCacheDirectory();
+
 /** @ingroup Geometry
  * @brief A general-purpose distance querying class.
  *
@@ -123,6 +148,57 @@ class CollisionMeshQueryEnhanced : public CollisionMeshQuery
 };
 
 
+/** @ingroup Geometry
+ * @brief Runs a batch of mesh-mesh proximity queries in one call.
+ *
+ * Each pair is added with Add(), then Solve() is called.  Solve() first
+ * computes the world-space bounding box of each distinct mesh once, and
+ * discards the pairs whose boxes are farther apart than the query tolerance.
+ * The remaining PQP traversals are spread over a pool of worker threads.
+ * Results are written into the items array.
+ *
+ * The meshes must not be modified or moved while Solve() is running.
+ * @sa CollisionMeshQuery
+ */
+class CollisionMeshBatchQuery
+{
+ public:
+  enum QueryType { QueryCollide, QueryWithinDistance, QueryDistance };
+  struct Item
+  {
+    const CollisionMesh *m1, *m2;
+    QueryType type;
+    ///For QueryWithinDistance, the tolerance.  For QueryDistance, the
+    ///absolute error.
+    Real tol;
+    ///Output: true if colliding / within tolerance.  For QueryDistance,
+    ///true if the distance is <= 0.
+    bool result;
+    ///Output: true if the pair was rejected by its bounding boxes
+    bool pruned;
+    ///Output for QueryDistance: the distance.  For the other types, this is
+    ///0 if the query is true and Inf otherwise.
+    Real distance;
+    ///Output: the triangles attaining the result, or -1 if not available
+    int t1,t2;
+  };
+
+  CollisionMeshBatchQuery();
+  void Clear();
+  ///Adds a query on the pair (m1,m2), returns its index in items
+  int Add(const CollisionMesh& m1,const CollisionMesh& m2,QueryType type,Real tol=0);
+  ///Solves all queries, returns the number of pairs with result=true.  If
+  ///numThreads <= 0, the number of hardware threads is used.  If PQP fails
+  ///on a pair, an error is printed and its outputs keep their defaults
+  ///(result=false, distance=Inf, t1=t2=-1).
+  int Solve(int numThreads=0);
+
+  std::vector<Item> items;
+  ///Relative error used for QueryDistance (default 0)
+  Real relErr;
+  ///Statistics from the last Solve() call
+  int numPruned,numTested;
+};
 
 /** @addtogroup Geometry */
 /**\@{*/
@@ -1,16 +1,17 @@
 #include "CollisionPointCloud.h"
 #include <Timer.h>
+#include <algorithm>
 
 namespace Geometry {
 
 CollisionPointCloud::CollisionPointCloud()
-  :gridResolution(0),grid(3)
+  :gridResolution(0)
 {
   currentTransform.setIdentity();
 }
 
 CollisionPointCloud::CollisionPointCloud(const Meshing::PointCloud3D& _pc)
-  :Meshing::PointCloud3D(_pc),gridResolution(0),grid(3)
+  :Meshing::PointCloud3D(_pc),gridResolution(0)
 {
   currentTransform.setIdentity();
   InitCollisions();
@@ -18,14 +19,15 @@ CollisionPointCloud::CollisionPointCloud(const Meshing::PointCloud3D& _pc)
 
 CollisionPointCloud::CollisionPointCloud(const CollisionPointCloud& _pc)
   :Meshing::PointCloud3D(_pc),bblocal(_pc.bblocal),currentTransform(_pc.currentTransform),
-   gridResolution(_pc.gridResolution),grid(_pc.grid),
+   gridResolution(_pc.gridResolution),grid(_pc.grid),gridPoints(_pc.gridPoints),
    octree(_pc.octree)
 {}
 
 void CollisionPointCloud::InitCollisions()
 {
   bblocal.minimize();
-  grid.buckets.clear();
+  grid.Clear();
+  gridPoints.resize(0);
   octree = NULL;
   if(points.empty()) 
     return;
@@ -50,23 +52,41 @@ void CollisionPointCloud::InitCollisions()
     }
     res = h;
   }
-  grid.hinv.set(1.0/res);
-  int validptcount = 0;
+  //degenerate (e.g., flat) point clouds, and cells too small for the
+  //packed grid keys
+  Real maxdim = Max(bblocal.bmax.x-bblocal.bmin.x,bblocal.bmax.y-bblocal.bmin.y,bblocal.bmax.z-bblocal.bmin.z);
+  if(!(res > 0) || !IsFinite(res)) res = (maxdim > 0 ? maxdim : 1.0);
+  Real maxabs = Max(bblocal.bmin.maxAbsElement(),bblocal.bmax.maxAbsElement());
+  if(maxabs > res*Real(PackedGridHash<3,int>::Packer::MaxCoord()))
+    res = maxabs/Real(PackedGridHash<3,int>::Packer::MaxCoord());
+  grid.SetResolution(res);
+  //sort the points by cell, and store the range of each cell in the hash
+  vector<pair<unsigned long long,int> > cellPoints;
+  cellPoints.reserve(points.size());
+  PackedGridHash<3,pair<int,int> >::Index ind;
   for(size_t i=0;i<points.size();i++) {
     if(IsFinite(points[i].x)) {
-      Vector p(3,points[i]);
-      GridSubdivision::Index ind;
-      grid.PointToIndex(p,ind);
-      grid.Insert(ind,&points[i]);
-      validptcount++;
+      grid.PointToIndex(&points[i].x,ind);
+      cellPoints.push_back(pair<unsigned long long,int>(PackedGridHash<3,int>::Packer::Pack(ind.idx),(int)i));
     }
   }
+  sort(cellPoints.begin(),cellPoints.end());
+  gridPoints.resize(cellPoints.size());
+  for(size_t i=0;i<cellPoints.size();i++)
+    gridPoints[i] = cellPoints[i].second;
+  int validptcount = (int)cellPoints.size();
+  int nmax = 0;
+  for(size_t i=0;i<cellPoints.size();) {
+    size_t j=i+1;
+    while(j<cellPoints.size() && cellPoints[j].first == cellPoints[i].first) j++;
+    PackedGridHash<3,int>::Packer::Unpack(cellPoints[i].first,ind.idx);
+    grid.Set(ind,pair<int,int>((int)i,(int)(j-i)));
+    nmax = Max(nmax,(int)(j-i));
+    i = j;
+  }
   printf("CollisionPointCloud::InitCollisions: %d valid points, res %g, time %gs\n",validptcount,res,timer.ElapsedTime());
   //print stats
-  int nmax = 0;
-  for(GridSubdivision::HashTable::const_iterator i=grid.buckets.begin();i!=grid.buckets.end();i++)
-    nmax = Max(nmax,(int)i->second.size());
-  printf("  %d nonempty grid buckets, max size %d, avg %g\n",grid.buckets.size(),nmax,Real(points.size())/grid.buckets.size());
+  printf("  %d nonempty grid buckets, max size %d, avg %g\n",(int)grid.Size(),nmax,Real(validptcount)/grid.Size());
   timer.Reset();
 
   //initialize the octree, 10 points per cell, res is minimum cell size
@@ -96,6 +116,40 @@ void GetBB(const CollisionPointCloud& pc,Box3D& b)
   b.setTransformed(pc.bblocal,pc.currentTransform);
 }
 
+typedef PackedGridHash<3,pair<int,int> >::Index GridIndex;
+
+//data passed to the grid cell callbacks
+struct GridPointQuery
+{
+  const CollisionPointCloud* pc;
+  const GeometricPrimitive3D* g;
+  Real tol;
+  std::vector<int>* ids;
+  size_t maxContacts;
+};
+
+bool withinDistanceCellTest(const GridIndex& index,const pair<int,int>& cell,void* userData)
+{
+  const GridPointQuery* q = reinterpret_cast<const GridPointQuery*>(userData);
+  const int* ids = &q->pc->gridPoints[cell.first];
+  for(int i=0;i<cell.second;i++)
+    if(q->g->Distance(q->pc->points[ids[i]]) <= q->tol)
+      return false;
+  return true;
+}
+
+bool nearbyCellTest(const GridIndex& index,const pair<int,int>& cell,void* userData)
+{
+  GridPointQuery* q = reinterpret_cast<GridPointQuery*>(userData);
+  const int* ids = &q->pc->gridPoints[cell.first];
+  for(int i=0;i<cell.second;i++)
+    if(q->g->Distance(q->pc->points[ids[i]]) <= q->tol) {
+      q->ids->push_back(ids[i]);
+      if(q->ids->size() >= q->maxContacts) return false;
+    }
+  return true;
+}
+
 static Real gWithinDistanceTestThreshold = 0;
 static GeometricPrimitive3D* gWithinDistanceTestObject = NULL;
 bool withinDistanceTest(void* obj)
@@ -121,13 +175,17 @@ bool WithinDistance(const CollisionPointCloud& pc,const GeometricPrimitive3D& g,
   AABB3D gbb = glocal.GetAABB();  
   gbb.setIntersection(pc.bblocal);
 
-  //octree overlap method
-  vector<Vector3> points;
-  vector<int> ids;
-  pc.octree->BoxQuery(gbb.bmin-Vector3(tol),gbb.bmax+Vector3(tol),points,ids);
-  for(size_t i=0;i<points.size();i++) 
-    if(glocal.Distance(points[i]) <= tol) return true;
-  return false;
+  //grid method
+  gbb.bmin -= Vector3(tol);
+  gbb.bmax += Vector3(tol);
+  GridPointQuery q;
+  q.pc = &pc;
+  q.g = &glocal;
+  q.tol = tol;
+  q.ids = NULL;
+  q.maxContacts = 0;
+  bool collisionFree = pc.grid.BoxQuery(&gbb.bmin.x,&gbb.bmax.x,withinDistanceCellTest,&q);
+  return !collisionFree;
 
   /*
   //grid enumeration method
@@ -208,15 +266,16 @@ void NearbyPoints(const CollisionPointCloud& pc,const GeometricPrimitive3D& g,Re
   AABB3D gbb = glocal.GetAABB();
   gbb.setIntersection(pc.bblocal);
 
-  //octree overlap method
-  vector<Vector3> points;
-  vector<int> ids;
-  pc.octree->BoxQuery(gbb.bmin-Vector3(tol),gbb.bmax+Vector3(tol),points,ids);
-  for(size_t i=0;i<points.size();i++) 
-    if(glocal.Distance(points[i]) <= tol) {
-      pointIds.push_back(ids[i]);
-      if(pointIds.size()>=maxContacts) return;
-    }
+  //grid method
+  gbb.bmin -= Vector3(tol);
+  gbb.bmax += Vector3(tol);
+  GridPointQuery q;
+  q.pc = &pc;
+  q.g = &glocal;
+  q.tol = tol;
+  q.ids = &pointIds;
+  q.maxContacts = maxContacts;
+  pc.grid.BoxQuery(&gbb.bmin.x,&gbb.bmax.x,nearbyCellTest,&q);
   return;
 
   /*
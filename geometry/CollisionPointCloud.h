@@ -5,7 +5,7 @@
 #include <KrisLibrary/math3d/geometry3d.h>
 #include <KrisLibrary/utils/SmartPointer.h>
 #include <limits.h>
-#include "GridSubdivision.h"
+#include "PackedGridHash.h"
 #include "Octree.h"
 
 namespace Geometry {
@@ -30,7 +30,11 @@ class CollisionPointCloud : public Meshing::PointCloud3D
   ///The transformation of the point cloud in space 
   RigidTransform currentTransform;
   Real gridResolution; ///< default value is 0, which auto-determines from point cloud
-  GridSubdivision grid;
+  ///Maps each occupied grid cell to the range (start,count) of its points in
+  ///gridPoints
+  PackedGridHash<3,std::pair<int,int> > grid;
+  ///Indices of the (finite) points, sorted by grid cell
+  std::vector<int> gridPoints;
   SmartPointer<OctreePointSet> octree;
 };
 
@@ -0,0 +1,389 @@
+#include "FlatKDTree.h"
+#include <utils/threadutils.h>
+#include <errors.h>
+#include <algorithm>
+using namespace Geometry;
+using namespace std;
+
+//the max depth of a median-split tree is log2(n)+1, so this is plenty
+#define FLAT_KDTREE_STACK_SIZE 128
+
+struct FlatKDTreeDimCmp
+{
+  const vector<Vector>& pts;
+  int d;
+  FlatKDTreeDimCmp(const vector<Vector>& _pts,int _d) : pts(_pts),d(_d) {}
+  bool operator () (int a,int b) const { return pts[a][d] < pts[b][d]; }
+};
+
+FlatKDTree::FlatKDTree()
+  :dims(0),norm(2)
+{}
+
+void FlatKDTree::Clear()
+{
+  nodes.clear();
+  coords.clear();
+  ids.clear();
+}
+
+void FlatKDTree::SetMetric(Real _norm,const Vector& _weights)
+{
+  norm = _norm;
+  weights = _weights;
+}
+
+void FlatKDTree::Build(const vector<Vector>& pts,int maxLeafSize)
+{
+  vector<int> all(pts.size());
+  for(size_t i=0;i<pts.size();i++) all[i] = (int)i;
+  Build(pts,all,maxLeafSize);
+}
+
+void FlatKDTree::Build(const vector<Vector>& pts,const vector<int>& _ids,int maxLeafSize)
+{
+  Clear();
+  if(_ids.empty()) return;
+  if(maxLeafSize < 1) maxLeafSize = 1;
+  dims = pts[_ids[0]].n;
+  vector<int> order = _ids;
+  nodes.reserve(2*(order.size()/maxLeafSize+1));
+  BuildRecurse(order,0,(int)order.size(),pts,maxLeafSize);
+  ids = order;
+  coords.resize(order.size()*dims);
+  for(size_t i=0;i<order.size();i++) {
+    const Vector& p = pts[order[i]];
+    Assert(p.n == dims);
+    for(int j=0;j<dims;j++) coords[i*dims+j] = p[j];
+  }
+}
+
+int FlatKDTree::BuildRecurse(vector<int>& order,int start,int end,const vector<Vector>& pts,int maxLeafSize)
+{
+  int index = (int)nodes.size();
+  nodes.resize(nodes.size()+1);
+  nodes[index].splitDim = -1;
+  nodes[index].splitVal = 0;
+  nodes[index].neg = start;
+  nodes[index].pos = end-start;
+  if(end - start <= maxLeafSize) return index;
+
+  //split along the dimension of largest spread
+  int splitDim = -1;
+  Real maxSpread = 0;
+  for(int j=0;j<dims;j++) {
+    Real vmin=Inf,vmax=-Inf;
+    for(int i=start;i<end;i++) {
+      Real v = pts[order[i]][j];
+      if(v < vmin) vmin = v;
+      if(v > vmax) vmax = v;
+    }
+    if(vmax - vmin > maxSpread) {
+      maxSpread = vmax-vmin;
+      splitDim = j;
+    }
+  }
+  if(splitDim < 0) return index;  //all points identical
+
+  int mid = (start+end)/2;
+  nth_element(order.begin()+start,order.begin()+mid,order.begin()+end,FlatKDTreeDimCmp(pts,splitDim));
+  Real splitVal = pts[order[mid]][splitDim];
+  int neg = BuildRecurse(order,start,mid,pts,maxLeafSize);
+  int pos = BuildRecurse(order,mid,end,pts,maxLeafSize);
+  //nodes may have been reallocated during recursion
+  nodes[index].splitDim = splitDim;
+  nodes[index].splitVal = splitVal;
+  nodes[index].neg = neg;
+  nodes[index].pos = pos;
+  return index;
+}
+
+//Distances are compared in a "reduced" form that avoids roots: the sum of
+//w*|dx|^norm for finite norms, and the max of w*|dx| for the L-inf norm.
+Real FlatKDTree::ReducedDistance(const Real* a,const Real* b) const
+{
+  Real sum = 0;
+  if(weights.empty()) {
+    if(norm == 2) {
+      for(int i=0;i<dims;i++) sum += Sqr(a[i]-b[i]);
+    }
+    else if(norm == 1) {
+      for(int i=0;i<dims;i++) sum += Abs(a[i]-b[i]);
+    }
+    else if(IsInf(norm)) {
+      for(int i=0;i<dims;i++) sum = Max(sum,Abs(a[i]-b[i]));
+    }
+    else {
+      for(int i=0;i<dims;i++) sum += Pow(Abs(a[i]-b[i]),norm);
+    }
+  }
+  else {
+    if(norm == 2) {
+      for(int i=0;i<dims;i++) sum += weights[i]*Sqr(a[i]-b[i]);
+    }
+    else if(norm == 1) {
+      for(int i=0;i<dims;i++) sum += weights[i]*Abs(a[i]-b[i]);
+    }
+    else if(IsInf(norm)) {
+      for(int i=0;i<dims;i++) sum = Max(sum,weights[i]*Abs(a[i]-b[i]));
+    }
+    else {
+      for(int i=0;i<dims;i++) sum += weights[i]*Pow(Abs(a[i]-b[i]),norm);
+    }
+  }
+  return sum;
+}
+
+Real FlatKDTree::ReducedPlaneDistance(Real d,int dim) const
+{
+  Real w = (weights.empty() ? 1.0 : weights[dim]);
+  if(norm == 2) return w*Sqr(d);
+  else if(norm == 1 || IsInf(norm)) return w*Abs(d);
+  else return w*Pow(Abs(d),norm);
+}
+
+Real FlatKDTree::ToReduced(Real d) const
+{
+  if(IsInf(d)) return d;
+  if(norm == 2) return Sqr(d);
+  else if(norm == 1 || IsInf(norm)) return d;
+  else return Pow(d,norm);
+}
+
+Real FlatKDTree::FromReduced(Real r) const
+{
+  if(IsInf(r)) return r;
+  if(norm == 2) return Sqrt(r);
+  else if(norm == 1 || IsInf(norm)) return r;
+  else return Pow(r,Inv(norm));
+}
+
+Real FlatKDTree::Distance(const Vector& pt,int i) const
+{
+  if(pt.stride != 1) return Distance(Vector(pt),i);
+  return FromReduced(ReducedDistance(pt.getStart(),PointCoords(i)));
+}
+
+int FlatKDTree::_PointWithin(const Real* pt,Real& rdist) const
+{
+  int best = -1;
+  if(nodes.empty()) return best;
+  int stack[FLAT_KDTREE_STACK_SIZE];
+  Real bounds[FLAT_KDTREE_STACK_SIZE];
+  int n=1;
+  stack[0] = 0;
+  bounds[0] = 0;
+  while(n > 0) {
+    n--;
+    if(bounds[n] > rdist) continue;
+    const Node& node = nodes[stack[n]];
+    if(node.IsLeaf()) {
+      int end = node.Start()+node.Count();
+      for(int i=node.Start();i<end;i++) {
+        Real d = ReducedDistance(pt,&coords[i*dims]);
+        if(d < rdist) {
+          rdist = d;
+          best = i;
+        }
+      }
+      continue;
+    }
+    Real d = pt[node.splitDim] - node.splitVal;
+    int nearChild = (d >= 0 ? node.pos : node.neg);
+    int farChild = (d >= 0 ? node.neg : node.pos);
+    Assert(n+2 <= FLAT_KDTREE_STACK_SIZE);
+    stack[n] = farChild;
+    bounds[n] = ReducedPlaneDistance(d,node.splitDim);
+    n++;
+    stack[n] = nearChild;
+    bounds[n] = 0;
+    n++;
+  }
+  return best;
+}
+
+int FlatKDTree::ClosestPoint(const Vector& pt,Real& dist) const
+{
+  dist = Inf;
+  return PointWithin(pt,dist);
+}
+
+int FlatKDTree::PointWithin(const Vector& pt,Real& dist) const
+{
+  Assert(ids.empty() || pt.n == dims);
+  if(pt.stride != 1) return PointWithin(Vector(pt),dist);
+  Real rdist = ToReduced(dist);
+  int i = _PointWithin(pt.getStart(),rdist);
+  if(i < 0) return -1;
+  dist = FromReduced(rdist);
+  return ids[i];
+}
+
+void FlatKDTree::_KClosestPoints(const Real* pt,int k,Real* rdist,int* idx) const
+{
+  //rdist/idx are kept sorted by increasing distance, rdist[k-1] is the bound
+  if(nodes.empty() || k <= 0) return;
+  int stack[FLAT_KDTREE_STACK_SIZE];
+  Real bounds[FLAT_KDTREE_STACK_SIZE];
+  int n=1;
+  stack[0] = 0;
+  bounds[0] = 0;
+  while(n > 0) {
+    n--;
+    if(bounds[n] > rdist[k-1]) continue;
+    const Node& node = nodes[stack[n]];
+    if(node.IsLeaf()) {
+      int end = node.Start()+node.Count();
+      for(int i=node.Start();i<end;i++) {
+        Real d = ReducedDistance(pt,&coords[i*dims]);
+        if(d < rdist[k-1]) {
+          int j=k-1;
+          while(j > 0 && rdist[j-1] > d) {
+            rdist[j] = rdist[j-1];
+            idx[j] = idx[j-1];
+            j--;
+          }
+          rdist[j] = d;
+          idx[j] = ids[i];
+        }
+      }
+      continue;
+    }
+    Real d = pt[node.splitDim] - node.splitVal;
+    int nearChild = (d >= 0 ? node.pos : node.neg);
+    int farChild = (d >= 0 ? node.neg : node.pos);
+    Assert(n+2 <= FLAT_KDTREE_STACK_SIZE);
+    stack[n] = farChild;
+    bounds[n] = ReducedPlaneDistance(d,node.splitDim);
+    n++;
+    stack[n] = nearChild;
+    bounds[n] = 0;
+    n++;
+  }
+}
+
+void FlatKDTree::KClosestPoints(const Vector& pt,int k,Real* dist,int* idx) const
+{
+  for(int i=0;i<k;i++) {
+    dist[i] = Inf;
+    idx[i] = -1;
+  }
+  MergeKClosestPoints(pt,k,dist,idx);
+}
+
+void FlatKDTree::MergeKClosestPoints(const Vector& pt,int k,Real* dist,int* idx) const
+{
+  Assert(ids.empty() || pt.n == dims);
+  if(pt.stride != 1) {
+    MergeKClosestPoints(Vector(pt),k,dist,idx);
+    return;
+  }
+  for(int i=0;i<k;i++) dist[i] = ToReduced(dist[i]);
+  _KClosestPoints(pt.getStart(),k,dist,idx);
+  for(int i=0;i<k;i++) dist[i] = FromReduced(dist[i]);
+}
+
+void FlatKDTree::ClosePoints(const Vector& pt,Real radius,vector<Real>& distances,vector<int>& _ids) const
+{
+  if(nodes.empty()) return;
+  Assert(pt.n == dims);
+  if(pt.stride != 1) {
+    ClosePoints(Vector(pt),radius,distances,_ids);
+    return;
+  }
+  Real rrad = ToReduced(radius);
+  const Real* p = pt.getStart();
+  int stack[FLAT_KDTREE_STACK_SIZE];
+  int n=1;
+  stack[0] = 0;
+  while(n > 0) {
+    n--;
+    const Node& node = nodes[stack[n]];
+    if(node.IsLeaf()) {
+      int end = node.Start()+node.Count();
+      for(int i=node.Start();i<end;i++) {
+        Real d = ReducedDistance(p,&coords[i*dims]);
+        if(d < rrad) {
+          distances.push_back(FromReduced(d));
+          _ids.push_back(ids[i]);
+        }
+      }
+      continue;
+    }
+    Real d = p[node.splitDim] - node.splitVal;
+    Real bound = ReducedPlaneDistance(d,node.splitDim);
+    Assert(n+2 <= FLAT_KDTREE_STACK_SIZE);
+    if(d >= 0) {
+      if(bound <= rrad) stack[n++] = node.neg;
+      stack[n++] = node.pos;
+    }
+    else {
+      if(bound <= rrad) stack[n++] = node.pos;
+      stack[n++] = node.neg;
+    }
+  }
+}
+
+struct FlatKDTreeBatchData
+{
+  const FlatKDTree* tree;
+  const vector<Vector>* pts;
+  int k;
+  Real radius;
+  vector<vector<Real> >* distances;
+  vector<vector<int> >* ids;
+};
+
+void flat_kdtree_knn_func(void* ptr,int i)
+{
+  FlatKDTreeBatchData* data = reinterpret_cast<FlatKDTreeBatchData*>(ptr);
+  vector<Real>& dist = (*data->distances)[i];
+  vector<int>& ids = (*data->ids)[i];
+  dist.resize(data->k);
+  ids.resize(data->k);
+  data->tree->KClosestPoints((*data->pts)[i],data->k,&dist[0],&ids[0]);
+  //may have fewer than k points
+  for(int j=0;j<data->k;j++)
+    if(ids[j] < 0) {
+      dist.resize(j);
+      ids.resize(j);
+      break;
+    }
+}
+
+void flat_kdtree_close_func(void* ptr,int i)
+{
+  FlatKDTreeBatchData* data = reinterpret_cast<FlatKDTreeBatchData*>(ptr);
+  (*data->distances)[i].resize(0);
+  (*data->ids)[i].resize(0);
+  data->tree->ClosePoints((*data->pts)[i],data->radius,(*data->distances)[i],(*data->ids)[i]);
+}
+
+void FlatKDTree::KClosestPoints(const vector<Vector>& pts,int k,vector<vector<Real> >& distances,vector<vector<int> >& _ids,int numThreads) const
+{
+  distances.resize(pts.size());
+  _ids.resize(pts.size());
+  if(k <= 0) return;
+  FlatKDTreeBatchData data;
+  data.tree = this;
+  data.pts = &pts;
+  data.k = k;
+  data.radius = 0;
+  data.distances = &distances;
+  data.ids = &_ids;
+  ParallelFor((int)pts.size(),flat_kdtree_knn_func,&data,numThreads);
+}
+
+void FlatKDTree::ClosePoints(const vector<Vector>& pts,Real radius,vector<vector<Real> >& distances,vector<vector<int> >& _ids,int numThreads) const
+{
+  distances.resize(pts.size());
+  _ids.resize(pts.size());
+  FlatKDTreeBatchData data;
+  data.tree = this;
+  data.pts = &pts;
+  data.k = 0;
+  data.radius = radius;
+  data.distances = &distances;
+  data.ids = &_ids;
+  ParallelFor((int)pts.size(),flat_kdtree_close_func,&data,numThreads);
+}
@@ -0,0 +1,102 @@
+#ifndef GEOMETRY_FLAT_KDTREE_H
+#define GEOMETRY_FLAT_KDTREE_H
+
+#include <KrisLibrary/math/vector.h>
+#include <vector>
+
+namespace Geometry {
+
+  using namespace Math;
+
+/** @ingroup Geometry
+ * @brief A static kd-tree stored in flat arrays.
+ *
+ * Unlike KDTree, the nodes are kept in one contiguous array and the point
+ * coordinates are copied into one contiguous buffer, ordered so that each
+ * leaf refers to a contiguous range.  The tree is built all at once with
+ * median splits on the dimension of largest spread, and queries use an
+ * explicit stack, so building and querying do no per-node allocation.
+ *
+ * Distances use the L-n norm, optionally weighted as in
+ * Distance_Weighted(x,y,norm,weights).
+ *
+ * The tree cannot be modified after Build().  For incremental use, see
+ * FlatKDTreePointLocation.
+ */
+class FlatKDTree
+{
+ public:
+  struct Node
+  {
+    ///split dimension, or -1 if this is a leaf
+    int splitDim;
+    Real splitVal;
+    ///for internal nodes, the children on the negative / positive side of
+    ///splitVal.  For leaves, the range of points [start,start+count)
+    int neg,pos;
+    inline bool IsLeaf() const { return splitDim < 0; }
+    inline int Start() const { return neg; }
+    inline int Count() const { return pos; }
+  };
+
+  FlatKDTree();
+  ///Builds the tree from all of the given points, with ids 0,...,n-1
+  void Build(const std::vector<Vector>& pts,int maxLeafSize=8);
+  ///Builds the tree from the subset of points given by ids
+  void Build(const std::vector<Vector>& pts,const std::vector<int>& ids,int maxLeafSize=8);
+  void Clear();
+  ///Sets the norm and (optional) weights used in queries
+  void SetMetric(Real norm,const Vector& weights);
+  inline int Size() const { return (int)ids.size(); }
+  inline bool Empty() const { return ids.empty(); }
+  inline int Dims() const { return dims; }
+  ///Returns a pointer to the coordinates of the i'th stored point (in tree
+  ///order).  Its id is ids[i].
+  inline const Real* PointCoords(int i) const { return &coords[i*dims]; }
+
+  ///Returns the id of the closest point to pt, and its distance in dist.
+  ///Returns -1 if the tree is empty.
+  int ClosestPoint(const Vector& pt,Real& dist) const;
+  ///Returns the id of the closest point within distance dist of pt, and
+  ///sets dist to its distance.  Returns -1 if there is no point within dist.
+  int PointWithin(const Vector& pt,Real& dist) const;
+  ///Appends the ids and distances of the points within the given radius
+  void ClosePoints(const Vector& pt,Real radius,std::vector<Real>& distances,std::vector<int>& ids) const;
+  ///Returns the ids and distances of the k closest points to pt, sorted by
+  ///increasing distance.  dist and idx must point to arrays of length k.
+  ///Unfilled entries have idx = -1 and dist = Inf.
+  void KClosestPoints(const Vector& pt,int k,Real* dist,int* idx) const;
+  ///Same as KClosestPoints, but the arrays already contain a sorted
+  ///candidate list (e.g., from another tree) that is updated with the
+  ///points in this tree.
+  void MergeKClosestPoints(const Vector& pt,int k,Real* dist,int* idx) const;
+
+  ///Batched KNN query on many points, run over numThreads threads (0 uses
+  ///all hardware threads).  Results are sorted by increasing distance.
+  void KClosestPoints(const std::vector<Vector>& pts,int k,std::vector<std::vector<Real> >& distances,std::vector<std::vector<int> >& ids,int numThreads=0) const;
+  ///Batched radius query on many points, run over numThreads threads
+  void ClosePoints(const std::vector<Vector>& pts,Real radius,std::vector<std::vector<Real> >& distances,std::vector<std::vector<int> >& ids,int numThreads=0) const;
+
+  ///Returns the distance between the query pt and the i'th stored point
+  Real Distance(const Vector& pt,int i) const;
+
+  int dims;
+  Real norm;
+  Vector weights;
+  std::vector<Node> nodes;
+  std::vector<Real> coords;
+  std::vector<int> ids;
+
+ private:
+  int BuildRecurse(std::vector<int>& order,int start,int end,const std::vector<Vector>& pts,int maxLeafSize);
+  Real ReducedDistance(const Real* a,const Real* b) const;
+  Real ReducedPlaneDistance(Real d,int dim) const;
+  Real ToReduced(Real d) const;
+  Real FromReduced(Real r) const;
+  int _PointWithin(const Real* pt,Real& rdist) const;
+  void _KClosestPoints(const Real* pt,int k,Real* rdist,int* idx) const;
+};
+
+} //namespace Geometry
+
+#endif
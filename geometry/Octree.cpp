@@ -430,8 +430,8 @@ void OctreePointSet::BoxQuery(const Vector3& bmin,const Vector3& bmax,vector<Vec
   for(size_t i=0;i<boxnodes.size();i++) {
     const vector<int>& pindices = indexLists[boxnodes[i]];
     for(size_t k=0;k<pindices.size();k++)
-      if(bb.contains(points[pindices[k]])) {
-	points.push_back(points[pindices[k]]);
+      if(bb.contains(this->points[pindices[k]])) {
+	points.push_back(this->points[pindices[k]]);
 	ids.push_back(this->ids[pindices[k]]);
       }
   }
@@ -605,6 +605,50 @@ int OctreePointSet::_KNearestNeighbors(const OctreeNode& n,const Vector3& c,vect
 void OctreePointSet::FitToPoints()
 {
   fit = true;
+  //reorder the points depth-first
+  vector<Vector3> newpoints;
+  vector<int> newids;
+  newpoints.reserve(points.size());
+  newids.reserve(ids.size());
+  rangeFirst.resize(nodes.size());
+  rangeLast.resize(nodes.size());
+  fill(rangeFirst.begin(),rangeFirst.end(),0);
+  fill(rangeLast.begin(),rangeLast.end(),0);
+  vector<pair<int,int> > stack(1,pair<int,int>(0,0));
+  while(!stack.empty()) {
+    int index = stack.back().first;
+    int child = stack.back().second;
+    const OctreeNode& n = nodes[index];
+    if(child == 0) rangeFirst[index] = (int)newpoints.size();
+    if(IsLeaf(n)) {
+      vector<int>& pindices = indexLists[index];
+      for(size_t j=0;j<pindices.size();j++) {
+	newpoints.push_back(points[pindices[j]]);
+	newids.push_back(ids[pindices[j]]);
+	pindices[j] = (int)newpoints.size()-1;
+      }
+      child = 8;
+    }
+    if(child == 8) {
+      rangeLast[index] = (int)newpoints.size();
+      stack.pop_back();
+    }
+    else {
+      stack.back().second++;
+      stack.push_back(pair<int,int>(n.childIndices[child],0));
+    }
+  }
+  points.swap(newpoints);
+  ids.swap(newids);
+  xs.resize(points.size());
+  ys.resize(points.size());
+  zs.resize(points.size());
+  for(size_t i=0;i<points.size();i++) {
+    xs[i] = points[i].x;
+    ys[i] = points[i].y;
+    zs[i] = points[i].z;
+  }
+
   //assume topological sort, go backwards
   for(size_t i=0;i<nodes.size();i++) {
     int index=(int)nodes.size()-1-(int)i;
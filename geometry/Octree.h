@@ -129,7 +129,21 @@ class OctreePointSet : public Octree
   ///Fits AABBs to point sets.  May speed up query times.  IMPORTANT: can no
   ///longer use Lookup, Child, or Add after this is called because the octree
   ///subdivision property will no longer hold.
+  ///
+  ///This also reorders the points in depth-first order, so that the points
+  ///under each node occupy a contiguous range of Points() / PointIDs() and
+  ///of the coordinate arrays PointsX/Y/Z().
   void FitToPoints();
+  ///Returns the range [first,last) of the points under the given node.  Only
+  ///valid after FitToPoints().
+  inline void GetPointRange(int node,int& first,int& last) const { first=rangeFirst[node]; last=rangeLast[node]; }
+  inline const vector<Vector3>& Points() const { return points; }
+  inline const vector<int>& PointIDs() const { return ids; }
+  ///The coordinates of Points(), stored separately for batched processing.
+  ///Only valid after FitToPoints().
+  inline const Real* PointsX() const { return xs.empty() ? NULL : &xs[0]; }
+  inline const Real* PointsY() const { return ys.empty() ? NULL : &ys[0]; }
+  inline const Real* PointsZ() const { return zs.empty() ? NULL : &zs[0]; }
 
  protected:
   Real _NearestNeighbor(const OctreeNode& n,const Vector3& c,Vector3& closest,int& id,Real minDist) const;
@@ -145,6 +159,8 @@ class OctreePointSet : public Octree
   vector<Vector3> points;
   vector<int> ids;
   bool fit;
+  vector<int> rangeFirst,rangeLast;
+  vector<Real> xs,ys,zs;
 };
 
 /** @brief Stores a function f(x) on an octree grid.  Allows for O(d) setting,
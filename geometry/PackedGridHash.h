@@ -0,0 +1,411 @@
+#ifndef GEOMETRY_PACKED_GRID_HASH_H
+#define GEOMETRY_PACKED_GRID_HASH_H
+
+#include <KrisLibrary/math/math.h>
+#include <KrisLibrary/errors.h>
+#include <vector>
+
+namespace Geometry {
+
+using namespace Math;
+
+/** @ingroup Geometry
+ * @brief Packs a D-dimensional integer cell index into a 64-bit key by
+ * interleaving the bits of its coordinates (Morton / Z order).
+ *
+ * Each coordinate must lie in [-2^(Bits-1),2^(Bits-1)), where
+ * Bits = min(64/D,32).  Cells that are close in space have keys that
+ * are usually close, too.
+ */
+template <int D>
+struct MortonKey
+{
+  typedef unsigned long long Key;
+  enum { Bits = (64/D < 32 ? 64/D : 32) };
+
+  static inline bool InRange(const int* idx)
+  {
+    for(int k=0;k<D;k++)
+      if(idx[k] < MinCoord() || idx[k] > MaxCoord()) return false;
+    return true;
+  }
+  static inline int MinCoord() { return -(int)((1ULL<<(Bits-1))-1)-1; }
+  static inline int MaxCoord() { return (int)((1ULL<<(Bits-1))-1); }
+  static inline Key Pack(const int* idx)
+  {
+    Key res = 0;
+    for(int k=0;k<D;k++) {
+      Key u = (Key)((unsigned int)idx[k]-(unsigned int)MinCoord());
+      for(int b=0;b<Bits;b++)
+        res |= ((u>>b)&1ULL) << (b*D+k);
+    }
+    return res;
+  }
+  static inline void Unpack(Key key,int* idx)
+  {
+    for(int k=0;k<D;k++) {
+      Key u = 0;
+      for(int b=0;b<Bits;b++)
+        u |= ((key>>(b*D+k))&1ULL) << b;
+      idx[k] = (int)((long long)u+MinCoord());
+    }
+  }
+};
+
+///Spreads the low 21 bits of x so there are two zero bits between each
+inline unsigned long long MortonSpread3(unsigned long long x)
+{
+  x &= 0x1fffff;
+  x = (x | x << 32) & 0x1f00000000ffffULL;
+  x = (x | x << 16) & 0x1f0000ff0000ffULL;
+  x = (x | x << 8) & 0x100f00f00f00f00fULL;
+  x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+  x = (x | x << 2) & 0x1249249249249249ULL;
+  return x;
+}
+
+///Inverse of MortonSpread3
+inline unsigned long long MortonCompact3(unsigned long long x)
+{
+  x &= 0x1249249249249249ULL;
+  x = (x ^ (x >> 2)) & 0x10c30c30c30c30c3ULL;
+  x = (x ^ (x >> 4)) & 0x100f00f00f00f00fULL;
+  x = (x ^ (x >> 8)) & 0x1f0000ff0000ffULL;
+  x = (x ^ (x >> 16)) & 0x1f00000000ffffULL;
+  x = (x ^ (x >> 32)) & 0x1fffff;
+  return x;
+}
+
+///The 3D case is by far the most common, so it uses magic-number bit
+///spreading rather than a loop over bits.
+template <>
+inline MortonKey<3>::Key MortonKey<3>::Pack(const int* idx)
+{
+  return MortonSpread3((Key)((unsigned int)idx[0]-(unsigned int)MinCoord()))
+    | (MortonSpread3((Key)((unsigned int)idx[1]-(unsigned int)MinCoord())) << 1)
+    | (MortonSpread3((Key)((unsigned int)idx[2]-(unsigned int)MinCoord())) << 2);
+}
+
+template <>
+inline void MortonKey<3>::Unpack(Key key,int* idx)
+{
+  idx[0] = (int)MortonCompact3(key) + MinCoord();
+  idx[1] = (int)MortonCompact3(key >> 1) + MinCoord();
+  idx[2] = (int)MortonCompact3(key >> 2) + MinCoord();
+}
+
+/** @ingroup Geometry
+ * @brief A hash from the cells of a D-dimensional grid to values of type T.
+ *
+ * Unlike GridHash, the dimension is fixed at compile time, cell indices are
+ * plain int arrays, and cells are packed into 64-bit Morton keys that are
+ * stored in a flat open-addressing (linear probing) table.  Lookups,
+ * insertions of existing cells, and the queries do not allocate memory.
+ *
+ * The table keeps the range [imin,imax] of all cells that have been set,
+ * which is used to clip box queries.  Erasing does not shrink the range.
+ */
+template <int D,class T>
+class PackedGridHash
+{
+public:
+  typedef MortonKey<D> Packer;
+  typedef typename Packer::Key Key;
+  struct Index
+  {
+    inline int& operator [] (int k) { return idx[k]; }
+    inline int operator [] (int k) const { return idx[k]; }
+    int idx[D];
+  };
+  ///called once per cell in the query range, return false to stop
+  ///enumerating
+  typedef bool (*QueryCallback)(const Index& index,const T& value,void* userData);
+
+  PackedGridHash(Real h=1);
+  void SetResolution(Real h);
+  void SetResolution(const Real h[D]);
+  inline size_t Size() const { return count; }
+  inline bool Empty() const { return count == 0; }
+  void Clear();
+  ///Makes room for n cells without rehashing
+  void Reserve(size_t n);
+
+  ///Returns a reference to the value at cell i, inserting a default value if
+  ///it does not exist
+  T& operator [] (const Index& i);
+  void Set(const Index& i,const T& value);
+  ///Returns a pointer to the value at cell i, or NULL if it is not set
+  T* Get(const Index& i);
+  const T* Get(const Index& i) const;
+  bool Contains(const Index& i) const { return Find(Packer::Pack(i.idx)) >= 0; }
+  bool Erase(const Index& i);
+
+  inline void PointToIndex(const Real* p,Index& i) const
+  {
+    for(int k=0;k<D;k++) i[k] = (int)Floor(p[k]*hinv[k]);
+  }
+  inline void IndexBucketBounds(const Index& i,Real* bmin,Real* bmax) const
+  {
+    for(int k=0;k<D;k++) {
+      bmin[k] = Real(i[k])/hinv[k];
+      bmax[k] = Real(i[k]+1)/hinv[k];
+    }
+  }
+  ///Returns the number of cells in the range [imin,imax] clipped to the
+  ///occupied range.  The clipped range is returned in cmin, cmax.
+  size_t ClipRange(const Index& imin,const Index& imax,Index& cmin,Index& cmax) const;
+  ///Calls f on each occupied cell in the range imin to imax.  Enumerates
+  ///either the cells of the range or the occupied cells of the table,
+  ///whichever is fewer.  Returns false if f returned false.
+  bool IndexQuery(const Index& imin,const Index& imax,QueryCallback f,void* userData) const;
+  ///Same, but for the bounding box from bmin to bmax
+  bool BoxQuery(const Real* bmin,const Real* bmax,QueryCallback f,void* userData) const;
+
+  //direct access to the table, e.g., for enumeration
+  inline size_t Capacity() const { return keys.size(); }
+  inline bool IsOccupied(size_t slot) const { return states[slot] == Full; }
+  inline Key SlotKey(size_t slot) const { return keys[slot]; }
+  inline void SlotIndex(size_t slot,Index& i) const { Packer::Unpack(keys[slot],i.idx); }
+  inline T& SlotValue(size_t slot) { return values[slot]; }
+  inline const T& SlotValue(size_t slot) const { return values[slot]; }
+
+  Real hinv[D];
+  Index imin,imax;
+
+private:
+  enum { Empty_=0, Full=1, Deleted=2 };
+  inline size_t HashSlot(Key k) const { return (size_t)((k*0x9E3779B97F4A7C15ULL) >> shift); }
+  int Find(Key k) const;
+  size_t Insert(Key k,bool& inserted);
+  void Grow(size_t newCapacity);
+
+  std::vector<Key> keys;
+  std::vector<T> values;
+  std::vector<unsigned char> states;
+  size_t count,used;
+  int shift;
+};
+
+template <int D,class T>
+PackedGridHash<D,T>::PackedGridHash(Real h)
+  :count(0),used(0),shift(64)
+{
+  SetResolution(h);
+  for(int k=0;k<D;k++) { imin[k] = 0; imax[k] = -1; }
+}
+
+template <int D,class T>
+void PackedGridHash<D,T>::SetResolution(Real h)
+{
+  Assert(h > 0);
+  for(int k=0;k<D;k++) hinv[k] = 1.0/h;
+}
+
+template <int D,class T>
+void PackedGridHash<D,T>::SetResolution(const Real h[D])
+{
+  for(int k=0;k<D;k++) {
+    Assert(h[k] > 0);
+    hinv[k] = 1.0/h[k];
+  }
+}
+
+template <int D,class T>
+void PackedGridHash<D,T>::Clear()
+{
+  keys.clear();
+  values.clear();
+  states.clear();
+  count = used = 0;
+  shift = 64;
+  for(int k=0;k<D;k++) { imin[k] = 0; imax[k] = -1; }
+}
+
+template <int D,class T>
+void PackedGridHash<D,T>::Reserve(size_t n)
+{
+  //keep the load factor at most 1/2
+  size_t cap = 16;
+  while(cap < n*2) cap *= 2;
+  if(cap > keys.size()) Grow(cap);
+}
+
+template <int D,class T>
+void PackedGridHash<D,T>::Grow(size_t newCapacity)
+{
+  std::vector<Key> oldKeys;
+  std::vector<T> oldValues;
+  std::vector<unsigned char> oldStates;
+  keys.swap(oldKeys);
+  values.swap(oldValues);
+  states.swap(oldStates);
+  keys.resize(newCapacity);
+  values.resize(newCapacity);
+  states.resize(newCapacity,(unsigned char)Empty_);
+  shift = 64;
+  for(size_t c=newCapacity;c>1;c>>=1) shift--;
+  count = used = 0;
+  for(size_t i=0;i<oldKeys.size();i++) {
+    if(oldStates[i] != Full) continue;
+    bool inserted;
+    size_t s = Insert(oldKeys[i],inserted);
+    values[s] = oldValues[i];
+  }
+}
+
+template <int D,class T>
+int PackedGridHash<D,T>::Find(Key k) const
+{
+  if(keys.empty()) return -1;
+  size_t mask = keys.size()-1;
+  size_t s = HashSlot(k);
+  while(states[s] != Empty_) {
+    if(states[s] == Full && keys[s] == k) return (int)s;
+    s = (s+1)&mask;
+  }
+  return -1;
+}
+
+template <int D,class T>
+size_t PackedGridHash<D,T>::Insert(Key k,bool& inserted)
+{
+  if((used+1)*2 > keys.size()) {
+    //double the size, or just clear out the deleted slots if there are many
+    if(keys.empty()) Grow(16);
+    else if((count+1)*4 > keys.size()) Grow(keys.size()*2);
+    else Grow(keys.size());
+  }
+  size_t mask = keys.size()-1;
+  size_t s = HashSlot(k);
+  int firstDeleted = -1;
+  while(states[s] != Empty_) {
+    if(states[s] == Full) {
+      if(keys[s] == k) { inserted = false; return s; }
+    }
+    else if(firstDeleted < 0) firstDeleted = (int)s;
+    s = (s+1)&mask;
+  }
+  if(firstDeleted >= 0) s = (size_t)firstDeleted;
+  else used++;
+  keys[s] = k;
+  states[s] = Full;
+  count++;
+  inserted = true;
+  return s;
+}
+
+template <int D,class T>
+T& PackedGridHash<D,T>::operator [] (const Index& i)
+{
+  Assert(Packer::InRange(i.idx));
+  bool inserted;
+  size_t s = Insert(Packer::Pack(i.idx),inserted);
+  if(inserted) {
+    values[s] = T();
+    for(int k=0;k<D;k++) {
+      if(imin[k] > imax[k]) imin[k] = imax[k] = i[k];
+      else if(i[k] < imin[k]) imin[k] = i[k];
+      else if(i[k] > imax[k]) imax[k] = i[k];
+    }
+  }
+  return values[s];
+}
+
+template <int D,class T>
+void PackedGridHash<D,T>::Set(const Index& i,const T& value)
+{
+  (*this)[i] = value;
+}
+
+template <int D,class T>
+T* PackedGridHash<D,T>::Get(const Index& i)
+{
+  if(!Packer::InRange(i.idx)) return NULL;
+  int s = Find(Packer::Pack(i.idx));
+  if(s < 0) return NULL;
+  return &values[s];
+}
+
+template <int D,class T>
+const T* PackedGridHash<D,T>::Get(const Index& i) const
+{
+  if(!Packer::InRange(i.idx)) return NULL;
+  int s = Find(Packer::Pack(i.idx));
+  if(s < 0) return NULL;
+  return &values[s];
+}
+
+template <int D,class T>
+bool PackedGridHash<D,T>::Erase(const Index& i)
+{
+  if(!Packer::InRange(i.idx)) return false;
+  int s = Find(Packer::Pack(i.idx));
+  if(s < 0) return false;
+  states[s] = Deleted;
+  values[s] = T();
+  count--;
+  return true;
+}
+
+template <int D,class T>
+size_t PackedGridHash<D,T>::ClipRange(const Index& qmin,const Index& qmax,Index& cmin,Index& cmax) const
+{
+  size_t n=1;
+  for(int k=0;k<D;k++) {
+    cmin[k] = Max(qmin[k],imin[k]);
+    cmax[k] = Min(qmax[k],imax[k]);
+    if(cmax[k] < cmin[k]) return 0;
+    n *= size_t(cmax[k]-cmin[k]+1);
+  }
+  return n;
+}
+
+template <int D,class T>
+bool PackedGridHash<D,T>::IndexQuery(const Index& qmin,const Index& qmax,QueryCallback f,void* userData) const
+{
+  Index cmin,cmax;
+  size_t numCells = ClipRange(qmin,qmax,cmin,cmax);
+  if(numCells == 0) return true;
+  Index i;
+  if(numCells > count) {
+    //walk the table
+    for(size_t s=0;s<keys.size();s++) {
+      if(states[s] != Full) continue;
+      Packer::Unpack(keys[s],i.idx);
+      bool inside = true;
+      for(int k=0;k<D;k++)
+        if(i[k] < cmin[k] || i[k] > cmax[k]) { inside = false; break; }
+      if(inside && !f(i,values[s],userData)) return false;
+    }
+    return true;
+  }
+  //walk the cells of the range, odometer-style
+  i = cmin;
+  while(true) {
+    int s = Find(Packer::Pack(i.idx));
+    if(s >= 0 && !f(i,values[s],userData)) return false;
+    int k=0;
+    for(;k<D;k++) {
+      if(i[k] < cmax[k]) { i[k]++; break; }
+      i[k] = cmin[k];
+    }
+    if(k == D) break;
+  }
+  return true;
+}
+
+template <int D,class T>
+bool PackedGridHash<D,T>::BoxQuery(const Real* bmin,const Real* bmax,QueryCallback f,void* userData) const
+{
+  Index qmin,qmax;
+  for(int k=0;k<D;k++) {
+    //clamp before converting so huge boxes don't overflow an int
+    qmin[k] = (int)Max(Floor(bmin[k]*hinv[k]),Real(Packer::MinCoord()));
+    qmax[k] = (int)Min(Floor(bmax[k]*hinv[k]),Real(Packer::MaxCoord()));
+  }
+  return IndexQuery(qmin,qmax,f,userData);
+}
+
+} //namespace Geometry
+
+#endif
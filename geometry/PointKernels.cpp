@@ -0,0 +1,248 @@
+#include "PointKernels.h"
+#include <math/simd.h>
+
+#if defined(MATH_DOUBLE) && (defined(__x86_64__) || defined(_M_X64))
+#define POINT_KERNELS_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(MATH_DOUBLE) && defined(__x86_64__) && defined(__GNUC__)
+#define POINT_KERNELS_HAVE_AVX2 1
+#include <immintrin.h>
+#define POINT_KERNELS_AVX2_TARGET __attribute__((target("avx2,fma")))
+#endif
+
+namespace Geometry {
+
+enum { KernelScalar=Math::SIMDScalar, KernelSSE2=Math::SIMDSSE2, KernelAVX2=Math::SIMDAVX2 };
+
+static int CurrentKernel()
+{
+#if POINT_KERNELS_HAVE_AVX2
+  return Math::BestSIMDLevel();
+#elif POINT_KERNELS_HAVE_SSE2
+  return (Math::BestSIMDLevel() >= KernelSSE2 ? (int)KernelSSE2 : (int)KernelScalar);
+#else
+  return KernelScalar;
+#endif
+}
+
+const char* PointKernelName()
+{
+  return Math::SIMDLevelName(CurrentKernel());
+}
+
+/* The squared distance from p to a triangle abc is computed without
+ * branches:
+ * - if p projects inside the triangle, the squared distance to its plane,
+ *   n.(p-a)^2/|n|^2;
+ * - otherwise the least squared distance to the three edges, each found by
+ *   clamping the projection parameter to [0,1].
+ * p projects inside if mi.(p-vi) > 0 for the inward edge normals mi.  For
+ * degenerate triangles the mi are zero, so only the edges are used.
+ */
+struct TriangleData
+{
+  Vector3 v[3];    //vertices
+  Vector3 e[3];    //edges v[i+1]-v[i]
+  Real inve2[3];   //1/|e[i]|^2, or 0
+  Vector3 m[3];    //inward edge normals
+  Vector3 n;       //normal (not normalized)
+  Real invn2;      //1/|n|^2, or 0
+  TriangleData(const Triangle3D& tri) {
+    v[0] = tri.a; v[1] = tri.b; v[2] = tri.c;
+    for(int i=0;i<3;i++) {
+      e[i] = v[(i+1)%3]-v[i];
+      Real l2 = e[i].normSquared();
+      inve2[i] = (l2 > 0 ? 1.0/l2 : 0.0);
+    }
+    n.setCross(e[0],e[1]);
+    Real n2 = n.normSquared();
+    invn2 = (n2 > 0 ? 1.0/n2 : 0.0);
+    for(int i=0;i<3;i++) {
+      if(n2 > 0) m[i].setCross(n,e[i]);
+      else m[i].setZero();
+    }
+  }
+};
+
+inline Real PointTriangleDistance2(const TriangleData& t,const Vector3& p)
+{
+  Vector3 pv[3];
+  bool inside = true;
+  Real dedge = Inf;
+  for(int i=0;i<3;i++) {
+    pv[i] = p - t.v[i];
+    if(!(t.m[i].dot(pv[i]) > 0)) inside = false;
+    Real u = Clamp(pv[i].dot(t.e[i])*t.inve2[i],0.0,1.0);
+    dedge = Min(dedge,(pv[i]-u*t.e[i]).normSquared());
+  }
+  if(inside) return Sqr(t.n.dot(pv[0]))*t.invn2;
+  return dedge;
+}
+
+#if POINT_KERNELS_HAVE_AVX2
+
+POINT_KERNELS_AVX2_TARGET
+static inline __m256d Dot3_AVX2(__m256d ax,__m256d ay,__m256d az,__m256d bx,__m256d by,__m256d bz)
+{
+  return _mm256_fmadd_pd(az,bz,_mm256_fmadd_pd(ay,by,_mm256_mul_pd(ax,bx)));
+}
+
+POINT_KERNELS_AVX2_TARGET
+static void PointTriangleDistance2_AVX2(const Real* x,const Real* y,const Real* z,int n,const TriangleData& t,Real* d2)
+{
+  __m256d zero = _mm256_setzero_pd(), one = _mm256_set1_pd(1.0);
+  __m256d vx[3],vy[3],vz[3],ex[3],ey[3],ez[3],mx[3],my[3],mz[3],inve2[3];
+  for(int k=0;k<3;k++) {
+    vx[k] = _mm256_set1_pd(t.v[k].x); vy[k] = _mm256_set1_pd(t.v[k].y); vz[k] = _mm256_set1_pd(t.v[k].z);
+    ex[k] = _mm256_set1_pd(t.e[k].x); ey[k] = _mm256_set1_pd(t.e[k].y); ez[k] = _mm256_set1_pd(t.e[k].z);
+    mx[k] = _mm256_set1_pd(t.m[k].x); my[k] = _mm256_set1_pd(t.m[k].y); mz[k] = _mm256_set1_pd(t.m[k].z);
+    inve2[k] = _mm256_set1_pd(t.inve2[k]);
+  }
+  __m256d nx = _mm256_set1_pd(t.n.x), ny = _mm256_set1_pd(t.n.y), nz = _mm256_set1_pd(t.n.z);
+  __m256d invn2 = _mm256_set1_pd(t.invn2);
+  int i=0;
+  for(;i+4<=n;i+=4) {
+    __m256d px = _mm256_loadu_pd(x+i), py = _mm256_loadu_pd(y+i), pz = _mm256_loadu_pd(z+i);
+    __m256d inside = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+    __m256d dedge = _mm256_set1_pd(Inf);
+    __m256d dplane = zero;
+    for(int k=0;k<3;k++) {
+      __m256d qx = _mm256_sub_pd(px,vx[k]), qy = _mm256_sub_pd(py,vy[k]), qz = _mm256_sub_pd(pz,vz[k]);
+      inside = _mm256_and_pd(inside,_mm256_cmp_pd(Dot3_AVX2(mx[k],my[k],mz[k],qx,qy,qz),zero,_CMP_GT_OQ));
+      if(k == 0) {
+	__m256d dn = Dot3_AVX2(nx,ny,nz,qx,qy,qz);
+	dplane = _mm256_mul_pd(_mm256_mul_pd(dn,dn),invn2);
+      }
+      __m256d u = _mm256_mul_pd(Dot3_AVX2(qx,qy,qz,ex[k],ey[k],ez[k]),inve2[k]);
+      u = _mm256_min_pd(_mm256_max_pd(u,zero),one);
+      qx = _mm256_fnmadd_pd(u,ex[k],qx);
+      qy = _mm256_fnmadd_pd(u,ey[k],qy);
+      qz = _mm256_fnmadd_pd(u,ez[k],qz);
+      dedge = _mm256_min_pd(dedge,Dot3_AVX2(qx,qy,qz,qx,qy,qz));
+    }
+    _mm256_storeu_pd(d2+i,_mm256_blendv_pd(dedge,dplane,inside));
+  }
+  for(;i<n;i++)
+    d2[i] = PointTriangleDistance2(t,Vector3(x[i],y[i],z[i]));
+}
+
+POINT_KERNELS_AVX2_TARGET
+static void PointPointDistance2_AVX2(const Real* x,const Real* y,const Real* z,int n,const Vector3& p,Real* d2)
+{
+  __m256d cx = _mm256_set1_pd(p.x), cy = _mm256_set1_pd(p.y), cz = _mm256_set1_pd(p.z);
+  int i=0;
+  for(;i+4<=n;i+=4) {
+    __m256d qx = _mm256_sub_pd(_mm256_loadu_pd(x+i),cx);
+    __m256d qy = _mm256_sub_pd(_mm256_loadu_pd(y+i),cy);
+    __m256d qz = _mm256_sub_pd(_mm256_loadu_pd(z+i),cz);
+    _mm256_storeu_pd(d2+i,Dot3_AVX2(qx,qy,qz,qx,qy,qz));
+  }
+  for(;i<n;i++)
+    d2[i] = Sqr(x[i]-p.x)+Sqr(y[i]-p.y)+Sqr(z[i]-p.z);
+}
+
+#endif //POINT_KERNELS_HAVE_AVX2
+
+#if POINT_KERNELS_HAVE_SSE2
+
+static inline __m128d Dot3_SSE2(__m128d ax,__m128d ay,__m128d az,__m128d bx,__m128d by,__m128d bz)
+{
+  return _mm_add_pd(_mm_add_pd(_mm_mul_pd(ax,bx),_mm_mul_pd(ay,by)),_mm_mul_pd(az,bz));
+}
+
+static void PointTriangleDistance2_SSE2(const Real* x,const Real* y,const Real* z,int n,const TriangleData& t,Real* d2)
+{
+  __m128d zero = _mm_setzero_pd(), one = _mm_set1_pd(1.0);
+  __m128d vx[3],vy[3],vz[3],ex[3],ey[3],ez[3],mx[3],my[3],mz[3],inve2[3];
+  for(int k=0;k<3;k++) {
+    vx[k] = _mm_set1_pd(t.v[k].x); vy[k] = _mm_set1_pd(t.v[k].y); vz[k] = _mm_set1_pd(t.v[k].z);
+    ex[k] = _mm_set1_pd(t.e[k].x); ey[k] = _mm_set1_pd(t.e[k].y); ez[k] = _mm_set1_pd(t.e[k].z);
+    mx[k] = _mm_set1_pd(t.m[k].x); my[k] = _mm_set1_pd(t.m[k].y); mz[k] = _mm_set1_pd(t.m[k].z);
+    inve2[k] = _mm_set1_pd(t.inve2[k]);
+  }
+  __m128d nx = _mm_set1_pd(t.n.x), ny = _mm_set1_pd(t.n.y), nz = _mm_set1_pd(t.n.z);
+  __m128d invn2 = _mm_set1_pd(t.invn2);
+  int i=0;
+  for(;i+2<=n;i+=2) {
+    __m128d px = _mm_loadu_pd(x+i), py = _mm_loadu_pd(y+i), pz = _mm_loadu_pd(z+i);
+    __m128d inside = _mm_cmpeq_pd(zero,zero);
+    __m128d dedge = _mm_set1_pd(Inf);
+    __m128d dplane = zero;
+    for(int k=0;k<3;k++) {
+      __m128d qx = _mm_sub_pd(px,vx[k]), qy = _mm_sub_pd(py,vy[k]), qz = _mm_sub_pd(pz,vz[k]);
+      inside = _mm_and_pd(inside,_mm_cmpgt_pd(Dot3_SSE2(mx[k],my[k],mz[k],qx,qy,qz),zero));
+      if(k == 0) {
+	__m128d dn = Dot3_SSE2(nx,ny,nz,qx,qy,qz);
+	dplane = _mm_mul_pd(_mm_mul_pd(dn,dn),invn2);
+      }
+      __m128d u = _mm_mul_pd(Dot3_SSE2(qx,qy,qz,ex[k],ey[k],ez[k]),inve2[k]);
+      u = _mm_min_pd(_mm_max_pd(u,zero),one);
+      qx = _mm_sub_pd(qx,_mm_mul_pd(u,ex[k]));
+      qy = _mm_sub_pd(qy,_mm_mul_pd(u,ey[k]));
+      qz = _mm_sub_pd(qz,_mm_mul_pd(u,ez[k]));
+      dedge = _mm_min_pd(dedge,Dot3_SSE2(qx,qy,qz,qx,qy,qz));
+    }
+    _mm_storeu_pd(d2+i,_mm_or_pd(_mm_and_pd(inside,dplane),_mm_andnot_pd(inside,dedge)));
+  }
+  for(;i<n;i++)
+    d2[i] = PointTriangleDistance2(t,Vector3(x[i],y[i],z[i]));
+}
+
+static void PointPointDistance2_SSE2(const Real* x,const Real* y,const Real* z,int n,const Vector3& p,Real* d2)
+{
+  __m128d cx = _mm_set1_pd(p.x), cy = _mm_set1_pd(p.y), cz = _mm_set1_pd(p.z);
+  int i=0;
+  for(;i+2<=n;i+=2) {
+    __m128d qx = _mm_sub_pd(_mm_loadu_pd(x+i),cx);
+    __m128d qy = _mm_sub_pd(_mm_loadu_pd(y+i),cy);
+    __m128d qz = _mm_sub_pd(_mm_loadu_pd(z+i),cz);
+    _mm_storeu_pd(d2+i,Dot3_SSE2(qx,qy,qz,qx,qy,qz));
+  }
+  for(;i<n;i++)
+    d2[i] = Sqr(x[i]-p.x)+Sqr(y[i]-p.y)+Sqr(z[i]-p.z);
+}
+
+#endif //POINT_KERNELS_HAVE_SSE2
+
+void PointTriangleDistance2(const Real* x,const Real* y,const Real* z,int n,const Triangle3D& tri,Real* d2)
+{
+  TriangleData t(tri);
+  switch(CurrentKernel()) {
+#if POINT_KERNELS_HAVE_AVX2
+  case KernelAVX2:
+    PointTriangleDistance2_AVX2(x,y,z,n,t,d2);
+    return;
+#endif
+#if POINT_KERNELS_HAVE_SSE2
+  case KernelSSE2:
+    PointTriangleDistance2_SSE2(x,y,z,n,t,d2);
+    return;
+#endif
+  default:
+    for(int i=0;i<n;i++)
+      d2[i] = PointTriangleDistance2(t,Vector3(x[i],y[i],z[i]));
+  }
+}
+
+void PointPointDistance2(const Real* x,const Real* y,const Real* z,int n,const Vector3& p,Real* d2)
+{
+  switch(CurrentKernel()) {
+#if POINT_KERNELS_HAVE_AVX2
+  case KernelAVX2:
+    PointPointDistance2_AVX2(x,y,z,n,p,d2);
+    return;
+#endif
+#if POINT_KERNELS_HAVE_SSE2
+  case KernelSSE2:
+    PointPointDistance2_SSE2(x,y,z,n,p,d2);
+    return;
+#endif
+  default:
+    for(int i=0;i<n;i++)
+      d2[i] = Sqr(x[i]-p.x)+Sqr(y[i]-p.y)+Sqr(z[i]-p.z);
+  }
+}
+
+} //namespace Geometry
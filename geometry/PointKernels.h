@@ -0,0 +1,33 @@
+#ifndef GEOMETRY_POINT_KERNELS_H
+#define GEOMETRY_POINT_KERNELS_H
+
+#include <KrisLibrary/math3d/primitives.h>
+#include <KrisLibrary/math3d/Triangle3D.h>
+
+/** @file geometry/PointKernels.h
+ * @ingroup Geometry
+ * @brief Batched distance computations between many points and a single
+ * triangle or point.
+ *
+ * The points are given as separate x, y, and z coordinate arrays, like
+ * OctreePointSet::PointsX/Y/Z().  The kernels are vectorized with AVX2 or
+ * SSE2 when the processor supports it and Real is double.
+ */
+
+namespace Geometry {
+
+  using namespace Math3D;
+
+///Sets d2[i] to the squared distance from point i to tri, for i in [0,n).
+///Degenerate triangles are handled as segments or points.
+void PointTriangleDistance2(const Real* x,const Real* y,const Real* z,int n,const Triangle3D& tri,Real* d2);
+
+///Sets d2[i] to the squared distance from point i to p, for i in [0,n).
+void PointPointDistance2(const Real* x,const Real* y,const Real* z,int n,const Vector3& p,Real* d2);
+
+///Returns the name of the kernels in use: "avx2", "sse2", or "scalar"
+const char* PointKernelName();
+
+} //namespace Geometry
+
+#endif
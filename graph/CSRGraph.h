@@ -0,0 +1,281 @@
+#ifndef GRAPH_CSR_GRAPH_H
+#define GRAPH_CSR_GRAPH_H
+
+#include <KrisLibrary/math/math.h>
+#include "Graph.h"
+#include <KrisLibrary/structs/FixedSizeHeap.h>
+#include <vector>
+#include <algorithm>
+
+namespace Graph {
+
+/** @ingroup Graph
+ * @brief An immutable snapshot of a Graph in compressed sparse row form.
+ *
+ * The adjacency list of node n is the range [offsets[n],offsets[n+1]) of
+ * the targets / edgeIndex arrays, sorted by target.  edgeIndex refers to
+ * an entry of edgeData, which holds one copy of each edge's data.  For an
+ * undirected snapshot, each edge appears in the adjacency lists of both
+ * of its endpoints, like with UndirectedEdgeIterator.
+ *
+ * Traversal touches only a few contiguous arrays, so this is much faster
+ * than the map-based Graph on large graphs.  Node data is not copied; the
+ * node indices are the same as in the original graph.
+ *
+ * Use CSRShortestPathProblem for shortest paths / A* and
+ * ConnectedComponents::Compute for connected components.
+ */
+template <class EdgeData>
+class CSRGraph
+{
+public:
+  CSRGraph() : directed(true) { offsets.resize(1,0); }
+  ///Freezes g into this structure.  If directed is false, the edges are
+  ///treated as undirected.
+  template <class NodeData>
+  void Set(const Graph<NodeData,EdgeData>& g,bool directed=true);
+  void Clear();
+
+  inline int NumNodes() const { return (int)offsets.size()-1; }
+  inline int NumEdges() const { return (int)edgeData.size(); }
+  inline int Degree(int n) const { return offsets[n+1]-offsets[n]; }
+  ///Returns the edge data of edge i->j, or NULL if it doesn't exist
+  const EdgeData* FindEdge(int i,int j) const;
+  inline bool HasEdge(int i,int j) const { return FindEdge(i,j) != NULL; }
+  inline int Begin(int n) const { return offsets[n]; }
+  inline int End(int n) const { return offsets[n+1]; }
+  inline int Target(int k) const { return targets[k]; }
+  inline const EdgeData& Edge(int k) const { return edgeData[edgeIndex[k]]; }
+
+  bool directed;
+  std::vector<int> offsets;
+  std::vector<int> targets;
+  std::vector<int> edgeIndex;
+  std::vector<EdgeData> edgeData;
+};
+
+/** @ingroup Graph
+ * @brief Single-source shortest paths and A* on a CSRGraph.
+ *
+ * Has the same interface and results as ShortestPathProblem's FindPath,
+ * FindAPath and FindAllPaths, but runs on a CSRGraph snapshot, so the
+ * direction of traversal is determined by the snapshot.
+ *
+ * WeightFunc is called as w(edgeData,source,target) and returns a Weight.
+ * Heuristic is called as h(node) and returns an admissible, consistent
+ * estimate of the distance from node to the target.
+ */
+template <class EdgeData>
+class CSRShortestPathProblem
+{
+ public:
+  CSRShortestPathProblem(const CSRGraph<EdgeData>& g);
+
+  void InitializeSource(int s);
+  void InitializeSources(const std::vector<int>& s);
+
+  template <typename WeightFunc>
+  void FindPath(int t,WeightFunc w);
+  template <typename WeightFunc>
+  int FindAPath(const std::vector<int>& t,WeightFunc w);
+  template <typename WeightFunc>
+  inline void FindAllPaths(WeightFunc w) { FindPath(-1,w); }
+  ///A* search from the initialized source(s) to t.  Only the nodes that
+  ///were expanded have correct distances afterward.  Returns true if t is
+  ///reachable.
+  template <typename WeightFunc,typename Heuristic>
+  bool FindPathAStar(int t,WeightFunc w,Heuristic h);
+
+  const CSRGraph<EdgeData>& g;
+
+  std::vector<int> p;
+  std::vector<Weight> d;
+};
+
+//definition of CSRGraph
+
+template <class EdgeData>
+template <class NodeData>
+void CSRGraph<EdgeData>::Set(const Graph<NodeData,EdgeData>& g,bool _directed)
+{
+  typedef typename Graph<NodeData,EdgeData>::ConstEdgeIterator ConstEdgeIterator;
+  directed = _directed;
+  int nn = g.NumNodes();
+  edgeData.resize(0);
+  edgeData.reserve(g.NumEdges());
+  offsets.resize(nn+1);
+  std::fill(offsets.begin(),offsets.end(),0);
+  //count the degrees
+  for(int i=0;i<nn;i++) {
+    offsets[i+1] += (int)g.edges[i].size();
+    if(!directed)
+      for(ConstEdgeIterator e=g.edges[i].begin();e!=g.edges[i].end();e++)
+        offsets[e->first+1]++;
+  }
+  for(int i=0;i<nn;i++) offsets[i+1] += offsets[i];
+  targets.resize(offsets[nn]);
+  edgeIndex.resize(offsets[nn]);
+  std::vector<int> fill(offsets.begin(),offsets.end()-1);
+  for(int i=0;i<nn;i++) {
+    for(ConstEdgeIterator e=g.edges[i].begin();e!=g.edges[i].end();e++) {
+      int index = (int)edgeData.size();
+      edgeData.push_back(*e->second);
+      targets[fill[i]] = e->first;
+      edgeIndex[fill[i]] = index;
+      fill[i]++;
+      if(!directed) {
+        targets[fill[e->first]] = i;
+        edgeIndex[fill[e->first]] = index;
+        fill[e->first]++;
+      }
+    }
+  }
+  if(!directed) {
+    //the outgoing edges are sorted by target, but the incoming ones are
+    //interleaved with them
+    std::vector<std::pair<int,int> > temp;
+    for(int i=0;i<nn;i++) {
+      temp.resize(0);
+      for(int k=offsets[i];k<offsets[i+1];k++)
+        temp.push_back(std::pair<int,int>(targets[k],edgeIndex[k]));
+      std::sort(temp.begin(),temp.end());
+      for(int k=offsets[i];k<offsets[i+1];k++) {
+        targets[k] = temp[k-offsets[i]].first;
+        edgeIndex[k] = temp[k-offsets[i]].second;
+      }
+    }
+  }
+}
+
+template <class EdgeData>
+void CSRGraph<EdgeData>::Clear()
+{
+  offsets.resize(1);
+  offsets[0] = 0;
+  targets.clear();
+  edgeIndex.clear();
+  edgeData.clear();
+}
+
+template <class EdgeData>
+const EdgeData* CSRGraph<EdgeData>::FindEdge(int i,int j) const
+{
+  std::vector<int>::const_iterator b=targets.begin()+offsets[i],e=targets.begin()+offsets[i+1];
+  std::vector<int>::const_iterator k=std::lower_bound(b,e,j);
+  if(k == e || *k != j) return NULL;
+  return &edgeData[edgeIndex[k-targets.begin()]];
+}
+
+//definition of CSRShortestPathProblem
+
+template <class EdgeData>
+CSRShortestPathProblem<EdgeData>::CSRShortestPathProblem(const CSRGraph<EdgeData>& _g)
+  :g(_g)
+{}
+
+template <class EdgeData>
+void CSRShortestPathProblem<EdgeData>::InitializeSource(int s)
+{
+  int nn = g.NumNodes();
+  p.resize(nn);
+  d.resize(nn);
+  std::fill(p.begin(),p.end(),-1);
+  std::fill(d.begin(),d.end(),Weight(Math::dInf));
+  d[s] = 0;
+}
+
+template <class EdgeData>
+void CSRShortestPathProblem<EdgeData>::InitializeSources(const std::vector<int>& s)
+{
+  int nn = g.NumNodes();
+  p.resize(nn);
+  d.resize(nn);
+  std::fill(p.begin(),p.end(),-1);
+  std::fill(d.begin(),d.end(),Weight(Math::dInf));
+  for(size_t i=0;i<s.size();i++)
+    d[s[i]] = 0;
+}
+
+template <class EdgeData>
+template <typename WeightFunc>
+void CSRShortestPathProblem<EdgeData>::FindPath(int t,WeightFunc w)
+{
+  int nn=g.NumNodes();
+  //only reached nodes go into the heap
+  FixedSizeHeap<Weight> H(nn);
+  for(int i=0;i<nn;i++)
+    if(!Math::IsInf(d[i])) H.push(i,-d[i]);
+
+  while(!H.empty()) {
+    int u = H.top(); H.pop();
+    if(u == t) return;
+    Weight du = d[u];
+    for(int k=g.offsets[u];k<g.offsets[u+1];k++) {
+      int v=g.targets[k];
+      Weight dvu = du + w(g.edgeData[g.edgeIndex[k]],u,v);
+      if(d[v] > dvu) {
+        d[v] = dvu;
+        p[v] = u;
+        H.adjust(v,-dvu);
+      }
+    }
+  }
+}
+
+template <class EdgeData>
+template <typename WeightFunc>
+int CSRShortestPathProblem<EdgeData>::FindAPath(const std::vector<int>& t,WeightFunc w)
+{
+  int nn=g.NumNodes();
+  std::vector<bool> isTarget(nn,false);
+  for(size_t i=0;i<t.size();i++) isTarget[t[i]] = true;
+  FixedSizeHeap<Weight> H(nn);
+  for(int i=0;i<nn;i++)
+    if(!Math::IsInf(d[i])) H.push(i,-d[i]);
+
+  while(!H.empty()) {
+    int u = H.top(); H.pop();
+    if(isTarget[u]) return u;
+    Weight du = d[u];
+    for(int k=g.offsets[u];k<g.offsets[u+1];k++) {
+      int v=g.targets[k];
+      Weight dvu = du + w(g.edgeData[g.edgeIndex[k]],u,v);
+      if(d[v] > dvu) {
+        d[v] = dvu;
+        p[v] = u;
+        H.adjust(v,-dvu);
+      }
+    }
+  }
+  return -1;
+}
+
+template <class EdgeData>
+template <typename WeightFunc,typename Heuristic>
+bool CSRShortestPathProblem<EdgeData>::FindPathAStar(int t,WeightFunc w,Heuristic h)
+{
+  int nn=g.NumNodes();
+  FixedSizeHeap<Weight> H(nn);
+  for(int i=0;i<nn;i++)
+    if(!Math::IsInf(d[i])) H.push(i,-(d[i]+h(i)));
+
+  while(!H.empty()) {
+    int u = H.top(); H.pop();
+    if(u == t) return true;
+    Weight du = d[u];
+    for(int k=g.offsets[u];k<g.offsets[u+1];k++) {
+      int v=g.targets[k];
+      Weight dvu = du + w(g.edgeData[g.edgeIndex[k]],u,v);
+      if(d[v] > dvu) {
+        d[v] = dvu;
+        p[v] = u;
+        H.adjust(v,-(dvu+h(v)));
+      }
+    }
+  }
+  return false;
+}
+
+} //namespace Graph
+
+#endif
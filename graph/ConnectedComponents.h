@@ -2,6 +2,7 @@
 #define GRAPH_CONNECTED_COMPONENTS_H
 
 #include "UndirectedGraph.h"
+#include "CSRGraph.h"
 #include <KrisLibrary/utils/unionfind.h>
 
 namespace Graph {
@@ -18,6 +19,14 @@ class ConnectedComponents
       }
     }
   }
+  template <class Edge>
+  void Compute(const CSRGraph<Edge>& G) {
+    int nn = G.NumNodes();
+    sets.Initialize(nn);
+    for(int i=0;i<nn;i++)
+      for(int k=G.offsets[i];k<G.offsets[i+1];k++)
+        sets.Union(i,G.targets[k]);
+  }
   void Resize(int numNodes) { sets.Initialize(numNodes); }
   void Clear() { Resize(0); }
   void AddEdge(int i,int j) { sets.Union(i,j); }
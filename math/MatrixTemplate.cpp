@@ -1,5 +1,6 @@
 #include "MatrixTemplate.h"
 #include "fastarray.h"
+#include "gemm.h"
 #include "complex.h"
 #include <KrisLibrary/myfile.h>
 #include <iostream>
@@ -31,6 +32,39 @@ const char* MatrixError_InvalidCol = "Matrix column index [%d] out of range";
 #define MYGENARGS getStart(),istride,jstride
 #define GENARGS(a) a.getStart(),a.istride,a.jstride
 
+//float and double products use the blocked kernels of gemm.h
+template <class T>
+inline void dense_multiply(T* X,int xis,int xjs,const T* A,int ais,int ajs,const T* B,int bis,int bjs,int m,int n,int p)
+{
+  gen_array2d_multiply(X,xis,xjs,A,ais,ajs,B,bis,bjs,m,n,p);
+}
+
+inline void dense_multiply(float* X,int xis,int xjs,const float* A,int ais,int ajs,const float* B,int bis,int bjs,int m,int n,int p)
+{
+  gemm_multiply(X,xis,xjs,A,ais,ajs,B,bis,bjs,m,n,p);
+}
+
+inline void dense_multiply(double* X,int xis,int xjs,const double* A,int ais,int ajs,const double* B,int bis,int bjs,int m,int n,int p)
+{
+  gemm_multiply(X,xis,xjs,A,ais,ajs,B,bis,bjs,m,n,p);
+}
+
+template <class T>
+inline void dense_vector_multiply(T* x,int xs,const T* A,int ais,int ajs,const T* b,int bs,int m,int n)
+{
+  gen_array2d_vector_multiply(x,xs,A,ais,ajs,b,bs,m,n);
+}
+
+inline void dense_vector_multiply(float* x,int xs,const float* A,int ais,int ajs,const float* b,int bs,int m,int n)
+{
+  gemv_multiply(x,xs,A,ais,ajs,b,bs,m,n);
+}
+
+inline void dense_vector_multiply(double* x,int xs,const double* A,int ais,int ajs,const double* b,int bs,int m,int n)
+{
+  gemv_multiply(x,xs,A,ais,ajs,b,bs,m,n);
+}
+
 template <class T>
 MatrixTemplate<T>::MatrixTemplate()
 :vals(NULL),capacity(0),allocated(false),
@@ -384,7 +418,7 @@ void MatrixTemplate<T>::mul(const MyT& a, const MyT& b)
     RaiseErrorFmt(WHERE_AM_I,MatrixError_ArgIncompatibleDimensions);
   CHECKRESIZE(a.m,b.n);
 
-  gen_array2d_multiply(MYGENARGS,GENARGS(a),GENARGS(b),
+  dense_multiply(MYGENARGS,GENARGS(a),GENARGS(b),
     m,a.n,n);
 }
 
@@ -395,7 +429,8 @@ void MatrixTemplate<T>::mulTransposeA(const MyT& a, const MyT& b)
     RaiseErrorFmt(WHERE_AM_I,MatrixError_ArgIncompatibleDimensions);
   CHECKRESIZE(a.n,b.n);
 
-  gen_array2d_multiply_transposeA(MYGENARGS,GENARGS(a),GENARGS(b),
+  //A^t has the strides of A swapped
+  dense_multiply(MYGENARGS,a.getStart(),a.jstride,a.istride,GENARGS(b),
     m,a.m,n);
 }
 
@@ -406,7 +441,8 @@ void MatrixTemplate<T>::mulTransposeB(const MyT& a, const MyT& b)
     RaiseErrorFmt(WHERE_AM_I,MatrixError_ArgIncompatibleDimensions);
   CHECKRESIZE(a.m,b.m);
 
-  gen_array2d_multiply_transposeB(MYGENARGS,GENARGS(a),GENARGS(b),
+  //B^t has the strides of B swapped
+  dense_multiply(MYGENARGS,GENARGS(a),b.getStart(),b.jstride,b.istride,
     m,a.n,n);
 }
 
@@ -426,7 +462,7 @@ void MatrixTemplate<T>::mul(const VectorT& a, VectorT& b) const
     RaiseErrorFmt(WHERE_AM_I,MatrixError_DestIncompatibleDimensions);
   }
 
-  gen_array2d_vector_multiply(b.getStart(),b.stride,
+  dense_vector_multiply(b.getStart(),b.stride,
     getStart(),istride,jstride, 
     a.getStart(),a.stride, 
     m, n);
@@ -448,10 +484,10 @@ void MatrixTemplate<T>::mulTranspose(const VectorT& a, VectorT& b) const
     RaiseErrorFmt(WHERE_AM_I,MatrixError_DestIncompatibleDimensions);
   }
 
-  gen_array2d_vector_multiply_transpose(b.getStart(),b.stride,
-    getStart(),istride,jstride, 
+  dense_vector_multiply(b.getStart(),b.stride,
+    getStart(),jstride,istride, 
     a.getStart(),a.stride, 
-    m, n);
+    n, m);
 }
 
 template <class T>
@@ -14,9 +14,14 @@
 #include "MatrixPrinter.h"
 #include "VectorPrinter.h"
 #include "metric.h"
+#include "fastarray.h"
+#include "gemm.h"
 #include <errors.h>
+#include <Timer.h>
 #include <utils/fileutils.h>
 #include <string.h>
+#include <stdio.h>
+#include <limits>
 #include <fstream>
 #include <iostream>
 using namespace std;
@@ -68,6 +73,7 @@ void SelfTest()
   QuadratureSelfTest();
   BlockVectorSelfTest();
   BlockMatrixSelfTest();
+  GEMMSelfTest();
 }
 
 void BasicSelfTest()
@@ -347,6 +353,192 @@ void BLASSelfTest()
 
 //void LAPACKSelfTest();
 
+static const char* gemmKernels[3] = {"scalar","sse2","avx2"};
+
+template <class T>
+void RandomizeMatrix(MatrixTemplate<T>& A)
+{
+  for(int i=0;i<A.m;i++)
+    for(int j=0;j<A.n;j++)
+      A(i,j) = (T)Rand(-One,One);
+}
+
+//returns false if some entry of x differs from the reference r by more
+//than the rounding error of a length-n inner product
+template <class T>
+bool GEMMCheck(const MatrixTemplate<T>& x,const MatrixTemplate<T>& r,int n,const char* op)
+{
+  T tol = T(4*(n+1))*numeric_limits<T>::epsilon();
+  for(int i=0;i<x.m;i++)
+    for(int j=0;j<x.n;j++)
+      if(!(Abs(x(i,j)-r(i,j)) <= tol)) {
+	cout<<"Error! "<<gemm_kernel_name()<<" "<<op<<" is wrong at "<<i<<","<<j<<" ("<<x.m<<"x"<<n<<"x"<<x.n<<"): "<<x(i,j)<<" vs "<<r(i,j)<<endl;
+	return false;
+      }
+  return true;
+}
+
+template <class T>
+bool GEMMCheck(const VectorTemplate<T>& x,const VectorTemplate<T>& r,int n,const char* op)
+{
+  T tol = T(4*(n+1))*numeric_limits<T>::epsilon();
+  for(int i=0;i<x.n;i++)
+    if(!(Abs(x(i)-r(i)) <= tol)) {
+      cout<<"Error! "<<gemm_kernel_name()<<" "<<op<<" is wrong at "<<i<<" ("<<x.n<<"x"<<n<<"): "<<x(i)<<" vs "<<r(i)<<endl;
+      return false;
+    }
+  return true;
+}
+
+//tests X=A*B with A mxn and B nxp, plain, transposed, and strided
+template <class T>
+bool GEMMTestProduct(int m,int n,int p)
+{
+  MatrixTemplate<T> A(m,n),B(n,p),At,Bt,X,R(m,p);
+  RandomizeMatrix(A);
+  RandomizeMatrix(B);
+  At.setTranspose(A);
+  Bt.setTranspose(B);
+  gen_array2d_multiply(R.getStart(),R.istride,R.jstride,
+		       A.getStart(),A.istride,A.jstride,
+		       B.getStart(),B.istride,B.jstride,m,n,p);
+  X.mul(A,B);
+  if(!GEMMCheck(X,R,n,"A*B")) return false;
+  X.mulTransposeA(At,B);
+  if(!GEMMCheck(X,R,n,"At^T*B")) return false;
+  X.mulTransposeB(A,Bt);
+  if(!GEMMCheck(X,R,n,"A*Bt^T")) return false;
+  //transposed references and strided sub-matrices
+  MatrixTemplate<T> Aref,Bref,bigA(2*m+1,2*n+1),bigB(2*p+1,3*n+1),bigX(2*m+1,3*p+2,T(0)),Xref;
+  Aref.setRef(bigA,1,1,2,2,m,n);
+  Aref.copy(A);
+  MatrixTemplate<T> Btref;
+  Btref.setRef(bigB,1,2,2,3,p,n);
+  Btref.copy(Bt);
+  Bref.setRefTranspose(Btref);
+  Xref.setRef(bigX,1,2,2,3,m,p);
+  Xref.mul(Aref,Bref);
+  if(!GEMMCheck(Xref,R,n,"strided A*B")) return false;
+  MatrixTemplate<T> XtRef,Rt;
+  XtRef.setRefTranspose(Xref);
+  XtRef.mul(Btref,At);
+  Rt.setTranspose(R);
+  if(!GEMMCheck(XtRef,Rt,n,"strided B^T*A^T")) return false;
+  return true;
+}
+
+//tests x=A*b with A mxn, for rows and for columns of A contiguous
+template <class T>
+bool GEMMTestVector(int m,int n)
+{
+  MatrixTemplate<T> A(m,n),At;
+  RandomizeMatrix(A);
+  At.setTranspose(A);
+  VectorTemplate<T> b(n),x,r(m);
+  for(int i=0;i<n;i++) b(i) = (T)Rand(-One,One);
+  gen_array2d_vector_multiply(r.getStart(),r.stride,A.getStart(),A.istride,A.jstride,b.getStart(),b.stride,m,n);
+  A.mul(b,x);
+  if(!GEMMCheck(x,r,n,"A*b")) return false;
+  At.mulTranspose(b,x);
+  if(!GEMMCheck(x,r,n,"At^T*b")) return false;
+  MatrixTemplate<T> Aref;
+  Aref.setRefTranspose(At);
+  Aref.mul(b,x);
+  if(!GEMMCheck(x,r,n,"column-major A*b")) return false;
+  //strided vectors
+  VectorTemplate<T> bigb(3*n),bref,bigx(2*m,T(0)),xref;
+  bref.setRef(bigb,1,3,n);
+  bref.copy(b);
+  xref.setRef(bigx,1,2,m);
+  A.mul(bref,xref);
+  if(!GEMMCheck(xref,r,n,"strided A*b")) return false;
+  return true;
+}
+
+void GEMMSelfTest()
+{
+  cout<<"Self-testing gemm kernels"<<endl;
+  //sizes on both sides of the kernel tiles (4, 6, 8, 16) and of the
+  //GEMM_MC=96 and GEMM_KC=256 blocks
+  const int sizes[] = {1,3,5,7,9,13,17,33,95,97,255,257};
+  const int numSizes = sizeof(sizes)/sizeof(int);
+  string kernel = gemm_kernel_name();
+  for(int k=0;k<3;k++) {
+    if(!gemm_set_kernel(gemmKernels[k])) continue;
+    for(int i=0;i<numSizes;i++)
+      for(int j=0;j<numSizes;j++) {
+	int m=sizes[i],n=sizes[j],p=sizes[(i+j)%numSizes];
+	if(!GEMMTestProduct<double>(m,n,p) || !GEMMTestProduct<float>(m,n,p)) Abort();
+	if(!GEMMTestVector<double>(m,n) || !GEMMTestVector<float>(m,n)) Abort();
+      }
+  }
+  gemm_set_kernel(kernel.c_str());
+  cout<<"Done"<<endl;
+}
+
+template <class T>
+void GEMMBenchmark(const char* type)
+{
+  const int sizes[] = {6,16,32,64,128,256,512,1000};
+  string kernel = gemm_kernel_name();
+  printf("%s A*B, ms per call\n",type);
+  printf("   n      naive     scalar       sse2       avx2\n");
+  for(int s=0;s<8;s++) {
+    int n=sizes[s];
+    MatrixTemplate<T> A(n,n),B(n,n),X(n,n);
+    RandomizeMatrix(A);
+    RandomizeMatrix(B);
+    int iters = Max(1,int(2e8/(2.0*n*n*n)));
+    Timer timer;
+    for(int i=0;i<iters;i++)
+      gen_array2d_multiply(X.getStart(),X.istride,X.jstride,
+			   A.getStart(),A.istride,A.jstride,
+			   B.getStart(),B.istride,B.jstride,n,n,n);
+    printf("%4d %10.4f",n,timer.ElapsedTime()/iters*1000.0);
+    for(int k=0;k<3;k++) {
+      if(!gemm_set_kernel(gemmKernels[k])) { printf("          -"); continue; }
+      timer.Reset();
+      for(int i=0;i<iters;i++) X.mul(A,B);
+      printf(" %10.4f",timer.ElapsedTime()/iters*1000.0);
+    }
+    printf("\n");
+  }
+  printf("%s A*b / A^T*b, ms per call\n",type);
+  printf("   n         naive               scalar                sse2                avx2\n");
+  for(int s=0;s<8;s++) {
+    int n=sizes[s];
+    MatrixTemplate<T> A(n,n);
+    RandomizeMatrix(A);
+    VectorTemplate<T> b(n,T(1)),x(n);
+    int iters = Max(10,int(2e8/(2.0*n*n)));
+    Timer timer;
+    for(int i=0;i<iters;i++)
+      gen_array2d_vector_multiply(x.getStart(),1,A.getStart(),A.istride,A.jstride,b.getStart(),1,n,n);
+    double t = timer.ElapsedTime()/iters;
+    timer.Reset();
+    for(int i=0;i<iters;i++)
+      gen_array2d_vector_multiply_transpose(x.getStart(),1,A.getStart(),A.istride,A.jstride,b.getStart(),1,n,n);
+    printf("%4d %9.5f/%9.5f",n,t*1000.0,timer.ElapsedTime()/iters*1000.0);
+    for(int k=0;k<3;k++) {
+      if(!gemm_set_kernel(gemmKernels[k])) { printf("           -/-       "); continue; }
+      timer.Reset();
+      for(int i=0;i<iters;i++) A.mul(b,x);
+      t = timer.ElapsedTime()/iters;
+      timer.Reset();
+      for(int i=0;i<iters;i++) A.mulTranspose(b,x);
+      printf(" %9.5f/%9.5f",t*1000.0,timer.ElapsedTime()/iters*1000.0);
+    }
+    printf("\n");
+  }
+  gemm_set_kernel(kernel.c_str());
+}
+
+void GEMMBenchmark()
+{
+  GEMMBenchmark<double>("double");
+  GEMMBenchmark<float>("float");
+}
+
 
 
 
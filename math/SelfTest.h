@@ -15,6 +15,11 @@ void QuadratureSelfTest();
 void BlockVectorSelfTest();
 void BlockMatrixSelfTest();
 void BLASSelfTest();
+///Checks the gemm.h products of every supported kernel against the loops
+///of fastarray.h
+void GEMMSelfTest();
+///Prints the time of square float and double products for each kernel
+void GEMMBenchmark();
 void LAPACKSelfTest();
 
 class RealFunction;
@@ -1,6 +1,9 @@
 #include "SparseMatrixTemplate.h"
 #include "complex.h"
+#include "random.h"
+#include <utils/threadutils.h>
 #include <iostream>
+#include <algorithm>
 using namespace std;
 
 namespace Math {
@@ -535,6 +538,594 @@ std::istream& operator >> (std::istream& in, SparseMatrixTemplate_RM<T>& A)
 }
 
 
+//matrices with fewer entries than this are multiplied on a single thread
+static const int kParallelProductMinEntries = 20000;
+
+///Dot product of a compressed row with the contiguous vector y
+template <class T>
+inline T CompressedRowDot(const int* idx,const T* val,int n,const T* y)
+{
+  //independent accumulators let the compiler pipeline the loop
+  T s0(0),s1(0),s2(0),s3(0);
+  int k=0;
+  for(;k+4<=n;k+=4) {
+    s0 += val[k]*y[idx[k]];
+    s1 += val[k+1]*y[idx[k+1]];
+    s2 += val[k+2]*y[idx[k+2]];
+    s3 += val[k+3]*y[idx[k+3]];
+  }
+  for(;k<n;k++)
+    s0 += val[k]*y[idx[k]];
+  return (s0+s1)+(s2+s3);
+}
+
+///Returns a contiguous version of v, using temp as storage if necessary
+template <class T>
+inline const T* ContiguousData(const VectorTemplate<T>& v,VectorTemplate<T>& temp)
+{
+  if(v.stride == 1) return v.getStart();
+  temp.copy(v);
+  return temp.getStart();
+}
+
+template <class T>
+struct CRProductData
+{
+  const SparseMatrixTemplate_CR<T>* A;
+  const T* y;
+  VectorTemplate<T>* x;
+  //for mul: row ranges; for mulTranspose: row ranges and per-block results
+  std::vector<int> blockStart;
+  std::vector<VectorTemplate<T> > blockResult;
+  bool add;
+};
+
+template <class T>
+static void cr_mul_batch_func(void* _data,int block)
+{
+  CRProductData<T>* data = (CRProductData<T>*)_data;
+  const SparseMatrixTemplate_CR<T>& A = *data->A;
+  VectorTemplate<T>& x = *data->x;
+  for(int i=data->blockStart[block];i<data->blockStart[block+1];i++) {
+    T sum = CompressedRowDot(A.rowIndices(i),A.rowValues(i),A.numRowEntries(i),data->y);
+    if(data->add) x(i) += sum;
+    else x(i) = sum;
+  }
+}
+
+template <class T>
+static void cr_mul_transpose_batch_func(void* _data,int block)
+{
+  CRProductData<T>* data = (CRProductData<T>*)_data;
+  const SparseMatrixTemplate_CR<T>& A = *data->A;
+  VectorTemplate<T>& x = data->blockResult[block];
+  x.resize(A.n);
+  x.setZero();
+  T* xp = x.getStart();
+  for(int i=data->blockStart[block];i<data->blockStart[block+1];i++) {
+    const int* idx = A.rowIndices(i);
+    const T* val = A.rowValues(i);
+    T yi = data->y[i];
+    for(int k=0;k<A.numRowEntries(i);k++)
+      xp[idx[k]] += val[k]*yi;
+  }
+}
+
+///Splits the rows of A into numBlocks ranges with about the same number of
+///entries
+template <class T>
+static void CRSplitRows(const SparseMatrixTemplate_CR<T>& A,int numBlocks,std::vector<int>& blockStart)
+{
+  blockStart.resize(numBlocks+1);
+  blockStart[0] = 0;
+  for(int b=1;b<numBlocks;b++) {
+    int target = int((long long)A.num_entries*b/numBlocks);
+    blockStart[b] = int(std::lower_bound(A.row_offsets,A.row_offsets+A.m,target)-A.row_offsets);
+    if(blockStart[b] < blockStart[b-1]) blockStart[b] = blockStart[b-1];
+  }
+  blockStart[numBlocks] = A.m;
+}
+
+template <class T>
+static int CRNumThreads(const SparseMatrixTemplate_CR<T>& A)
+{
+  if(A.numThreads == 1 || A.num_entries < kParallelProductMinEntries) return 1;
+  int n = (A.numThreads <= 0 ? ThreadHardwareConcurrency() : A.numThreads);
+  return (n < 1 ? 1 : n);
+}
+
+template <class T>
+SparseMatrixTemplate_CR<T>::SparseMatrixTemplate_CR()
+  :row_offsets(NULL),col_indices(NULL),val_array(NULL),m(0),n(0),num_entries(0),numThreads(1)
+{}
+
+template <class T>
+SparseMatrixTemplate_CR<T>::SparseMatrixTemplate_CR(const MyT& rhs)
+  :row_offsets(NULL),col_indices(NULL),val_array(NULL),m(0),n(0),num_entries(0),numThreads(rhs.numThreads)
+{
+  copy(rhs);
+}
+
+template <class T>
+SparseMatrixTemplate_CR<T>::~SparseMatrixTemplate_CR()
+{
+  clear();
+}
+
+template <class T>
+const SparseMatrixTemplate_CR<T>& SparseMatrixTemplate_CR<T>::operator = (const MyT& rhs)
+{
+  copy(rhs);
+  return *this;
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::initialize(int _m, int _n, int _num_entries)
+{
+  Assert(_m >= 0 && _n >= 0 && _num_entries >= 0);
+  clear();
+  m = _m;
+  n = _n;
+  num_entries = _num_entries;
+  row_offsets = new int[m+1];
+  std::fill(row_offsets,row_offsets+m+1,0);
+  row_offsets[m] = num_entries;
+  if(num_entries > 0) {
+    col_indices = new int[num_entries];
+    val_array = new T[num_entries];
+  }
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::resize(int _m, int _n, int _num_entries)
+{
+  Assert(_m >= 0 && _n >= 0 && _num_entries >= 0);
+  if(_m == m && _num_entries == num_entries) {
+    n = _n;
+    return;
+  }
+  int* new_offsets = new int[_m+1];
+  int* new_indices = (_num_entries > 0 ? new int[_num_entries] : NULL);
+  T* new_vals = (_num_entries > 0 ? new T[_num_entries] : NULL);
+  //keep the existing rows and entries that fit
+  int keepRows = Min(m,_m);
+  int keepEntries = Min(num_entries,_num_entries);
+  for(int i=0;i<=_m;i++)
+    new_offsets[i] = (i <= keepRows && row_offsets ? Min(row_offsets[i],keepEntries) : keepEntries);
+  new_offsets[_m] = _num_entries;
+  if(keepEntries > 0) {
+    std::copy(col_indices,col_indices+keepEntries,new_indices);
+    std::copy(val_array,val_array+keepEntries,new_vals);
+  }
+  int threads = numThreads;
+  clear();
+  numThreads = threads;
+  row_offsets = new_offsets;
+  col_indices = new_indices;
+  val_array = new_vals;
+  m = _m;
+  n = _n;
+  num_entries = _num_entries;
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::clear()
+{
+  SafeArrayDelete(row_offsets);
+  SafeArrayDelete(col_indices);
+  SafeArrayDelete(val_array);
+  m = n = num_entries = 0;
+}
+
+template <class T>
+T* SparseMatrixTemplate_CR<T>::getEntry(int i,int j)
+{
+  Assert(isValidRow(i));
+  int* b=rowIndices(i),*e=b+numRowEntries(i);
+  int* k=std::lower_bound(b,e,j);
+  if(k == e || *k != j) return NULL;
+  return val_array + (k-col_indices);
+}
+
+template <class T>
+const T* SparseMatrixTemplate_CR<T>::getEntry(int i,int j) const
+{
+  Assert(isValidRow(i));
+  const int* b=rowIndices(i),*e=b+numRowEntries(i);
+  const int* k=std::lower_bound(b,e,j);
+  if(k == e || *k != j) return NULL;
+  return val_array + (k-col_indices);
+}
+
+template <class T>
+T SparseMatrixTemplate_CR<T>::operator () (int i,int j) const
+{
+  const T* v = getEntry(i,j);
+  if(v) return *v;
+  return T(0);
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::copy(const MyT& A)
+{
+  if(this == &A) return;
+  initialize(A.m,A.n,A.num_entries);
+  std::copy(A.row_offsets,A.row_offsets+A.m+1,row_offsets);
+  std::copy(A.col_indices,A.col_indices+A.num_entries,col_indices);
+  std::copy(A.val_array,A.val_array+A.num_entries,val_array);
+}
+
+template <class T>
+template <class T2>
+void SparseMatrixTemplate_CR<T>::copy(const SparseMatrixTemplate_CR<T2>& A)
+{
+  initialize(A.m,A.n,A.num_entries);
+  std::copy(A.row_offsets,A.row_offsets+A.m+1,row_offsets);
+  std::copy(A.col_indices,A.col_indices+A.num_entries,col_indices);
+  for(int k=0;k<num_entries;k++)
+    val_array[k] = T(A.val_array[k]);
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::set(const MatrixT& A,T zeroTol)
+{
+  int nnz=0;
+  for(int i=0;i<A.m;i++)
+    for(int j=0;j<A.n;j++)
+      if(Abs(A(i,j)) > Abs(zeroTol)) nnz++;
+  initialize(A.m,A.n,nnz);
+  int k=0;
+  for(int i=0;i<A.m;i++) {
+    row_offsets[i] = k;
+    for(int j=0;j<A.n;j++)
+      if(Abs(A(i,j)) > Abs(zeroTol)) {
+        col_indices[k] = j;
+        val_array[k] = A(i,j);
+        k++;
+      }
+  }
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::set(const SparseMatrixTemplate_RM<T>& A)
+{
+  initialize(A.m,A.n,(int)A.numNonZeros());
+  int k=0;
+  for(int i=0;i<A.m;i++) {
+    row_offsets[i] = k;
+    for(typename SparseMatrixTemplate_RM<T>::ConstRowIterator it=A.rows[i].begin();it!=A.rows[i].end();it++) {
+      col_indices[k] = it->first;
+      val_array[k] = it->second;
+      k++;
+    }
+  }
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::setTranspose(const SparseMatrixTemplate_RM<T>& A)
+{
+  initialize(A.n,A.m,(int)A.numNonZeros());
+  //count the entries of each column, then fill in row order so that each
+  //column comes out sorted
+  row_offsets[m] = 0;
+  for(int i=0;i<A.m;i++)
+    for(typename SparseMatrixTemplate_RM<T>::ConstRowIterator it=A.rows[i].begin();it!=A.rows[i].end();it++)
+      row_offsets[it->first+1]++;
+  for(int j=0;j<m;j++) row_offsets[j+1] += row_offsets[j];
+  std::vector<int> fill(row_offsets,row_offsets+m);
+  for(int i=0;i<A.m;i++)
+    for(typename SparseMatrixTemplate_RM<T>::ConstRowIterator it=A.rows[i].begin();it!=A.rows[i].end();it++) {
+      int k = fill[it->first]++;
+      col_indices[k] = i;
+      val_array[k] = it->second;
+    }
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::setTranspose(const MyT& A)
+{
+  Assert(this != &A);
+  initialize(A.n,A.m,A.num_entries);
+  row_offsets[m] = 0;
+  for(int k=0;k<A.num_entries;k++)
+    row_offsets[A.col_indices[k]+1]++;
+  for(int j=0;j<m;j++) row_offsets[j+1] += row_offsets[j];
+  std::vector<int> fill(row_offsets,row_offsets+m);
+  for(int i=0;i<A.m;i++)
+    for(int k=A.row_offsets[i];k<A.row_offsets[i+1];k++) {
+      int dest = fill[A.col_indices[k]]++;
+      col_indices[dest] = i;
+      val_array[dest] = A.val_array[k];
+    }
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::get(MatrixT& A) const
+{
+  A.resize(m,n,Zero);
+  for(int i=0;i<m;i++)
+    for(int k=row_offsets[i];k<row_offsets[i+1];k++)
+      A(i,col_indices[k]) = val_array[k];
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::get(SparseMatrixTemplate_RM<T>& A) const
+{
+  A.initialize(m,n);
+  for(int i=0;i<m;i++)
+    for(int k=row_offsets[i];k<row_offsets[i+1];k++)
+      A.rows[i].push_back(col_indices[k],val_array[k]);
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::mul(const MyT& A, T s)
+{
+  copy(A);
+  inplaceMul(s);
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::mul(const VectorT& y, VectorT& x) const
+{
+  if(x.n == 0) x.resize(m);
+  if(x.n != m) {
+    FatalError("Destination vector has incorrect dimensions");
+  }
+  if(y.n != n) {
+    FatalError("Source vector has incorrect dimensions");
+  }
+  VectorT temp;
+  if(&x == &y) temp.copy(y);
+  CRProductData<T> data;
+  data.A = this;
+  data.y = (&x == &y ? temp.getStart() : ContiguousData(y,temp));
+  data.x = &x;
+  data.add = false;
+  int threads = CRNumThreads(*this);
+  int numBlocks = (threads == 1 ? 1 : threads*4);
+  CRSplitRows(*this,numBlocks,data.blockStart);
+  ParallelFor(numBlocks,cr_mul_batch_func<T>,&data,threads);
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::madd(const VectorT& y,VectorT& x) const
+{
+  if(x.n != m) {
+    FatalError("Destination vector has incorrect dimensions");
+  }
+  if(y.n != n) {
+    FatalError("Source vector has incorrect dimensions");
+  }
+  VectorT temp;
+  if(&x == &y) temp.copy(y);
+  CRProductData<T> data;
+  data.A = this;
+  data.y = (&x == &y ? temp.getStart() : ContiguousData(y,temp));
+  data.x = &x;
+  data.add = true;
+  int threads = CRNumThreads(*this);
+  int numBlocks = (threads == 1 ? 1 : threads*4);
+  CRSplitRows(*this,numBlocks,data.blockStart);
+  ParallelFor(numBlocks,cr_mul_batch_func<T>,&data,threads);
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::mulTranspose(const VectorT& y, VectorT& x) const
+{
+  if(x.n == 0) x.resize(n);
+  if(x.n != n) {
+    FatalError("Destination vector has incorrect dimensions");
+  }
+  x.setZero();
+  maddTranspose(y,x);
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::maddTranspose(const VectorT& y,VectorT& x) const
+{
+  if(x.n != n) {
+    FatalError("Destination vector has incorrect dimensions");
+  }
+  if(y.n != m) {
+    FatalError("Source vector has incorrect dimensions");
+  }
+  VectorT temp;
+  if(&x == &y) temp.copy(y);
+  const T* yp = (&x == &y ? temp.getStart() : ContiguousData(y,temp));
+  int threads = CRNumThreads(*this);
+  if(threads == 1) {
+    for(int i=0;i<m;i++) {
+      T yi = yp[i];
+      for(int k=row_offsets[i];k<row_offsets[i+1];k++)
+        x(col_indices[k]) += val_array[k]*yi;
+    }
+    return;
+  }
+  //each thread scatters into its own vector, which are summed afterward
+  CRProductData<T> data;
+  data.A = this;
+  data.y = yp;
+  data.x = &x;
+  data.add = true;
+  CRSplitRows(*this,threads,data.blockStart);
+  data.blockResult.resize(threads);
+  ParallelFor(threads,cr_mul_transpose_batch_func<T>,&data,threads);
+  for(int b=0;b<threads;b++)
+    x.inc(data.blockResult[b]);
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::mul(const MatrixT& w, MatrixT& v) const
+{
+  if(w.m != n) {
+    FatalError("A matrix has incorrect # of rows");
+  }
+  if(v.isEmpty()) v.resize(m,w.n);
+  if(m != v.m) {
+    FatalError("X matrix has incorrect # of rows");
+  }
+  if(w.n != v.n) {
+    FatalError("X matrix has incorrect # of columns");
+  }
+  for(int i=0;i<w.n;i++) {
+    VectorT wi,vi;
+    w.getColRef(i,wi);
+    v.getColRef(i,vi);
+    mul(wi,vi);
+  }
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::mulTranspose(const MatrixT& w, MatrixT& v) const
+{
+  if(w.m != m) {
+    FatalError("A matrix has incorrect # of rows");
+  }
+  if(v.isEmpty()) v.resize(n,w.n);
+  if(n != v.m) {
+    FatalError("X matrix has incorrect # of rows");
+  }
+  if(w.n != v.n) {
+    FatalError("X matrix has incorrect # of columns");
+  }
+  for(int i=0;i<w.n;i++) {
+    VectorT wi,vi;
+    w.getColRef(i,wi);
+    v.getColRef(i,vi);
+    mulTranspose(wi,vi);
+  }
+}
+
+template <class T>
+T SparseMatrixTemplate_CR<T>::dotRow(int i, const VectorT& v) const
+{
+  Assert(v.n == n);
+  T sum(0);
+  for(int k=row_offsets[i];k<row_offsets[i+1];k++)
+    sum += val_array[k]*v(col_indices[k]);
+  return sum;
+}
+
+template <class T>
+T SparseMatrixTemplate_CR<T>::dotCol(int j, const VectorT& v) const
+{
+  Assert(v.n == m);
+  T sum(0);
+  for(int i=0;i<m;i++) {
+    const T* a = getEntry(i,j);
+    if(a) sum += (*a)*v(i);
+  }
+  return sum;
+}
+
+template <class T>
+T SparseMatrixTemplate_CR<T>::dotSymmL(int i, const VectorT& v) const
+{
+  Assert(isSquare());
+  Assert(v.n == n);
+  //lower triangle of row i, then the transpose of the rows below i
+  T sum(0);
+  for(int k=row_offsets[i];k<row_offsets[i+1];k++)
+    if(col_indices[k] <= i)
+      sum += val_array[k]*v(col_indices[k]);
+  for(int r=i+1;r<m;r++) {
+    const T* a = getEntry(r,i);
+    if(a) sum += (*a)*v(r);
+  }
+  return sum;
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::inplaceMul(T c)
+{
+  for(int k=0;k<num_entries;k++) val_array[k] *= c;
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::inplaceDiv(T c)
+{
+  for(int k=0;k<num_entries;k++) val_array[k] /= c;
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::inplaceMulRow(int i,T c)
+{
+  for(int k=row_offsets[i];k<row_offsets[i+1];k++) val_array[k] *= c;
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::inplaceMulCol(int j,T c)
+{
+  for(int k=0;k<num_entries;k++)
+    if(col_indices[k] == j) val_array[k] *= c;
+}
+
+template <class T>
+bool SparseMatrixTemplate_CR<T>::isValid() const
+{
+  if(m < 0 || n < 0 || num_entries < 0) return false;
+  if(m == 0 && row_offsets == NULL) return num_entries == 0;
+  if(row_offsets[0] != 0 || row_offsets[m] != num_entries) return false;
+  for(int i=0;i<m;i++) {
+    if(row_offsets[i] > row_offsets[i+1]) return false;
+    for(int k=row_offsets[i];k<row_offsets[i+1];k++) {
+      if(col_indices[k] < 0 || col_indices[k] >= n) return false;
+      if(k > row_offsets[i] && col_indices[k] <= col_indices[k-1]) return false;
+    }
+  }
+  return true;
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::self_test()
+{
+  self_test(10,10,30);
+  self_test(100,50,1000);
+  self_test(2000,2000,50000);
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::self_test(int m, int n, int nnz)
+{
+  SparseMatrixTemplate_RM<T> A(m,n);
+  for(int k=0;k<nnz;k++)
+    A(RandInt(m),RandInt(n)) = T(Rand(-1,1));
+  MatrixT Ad;
+  A.get(Ad);
+  MyT Acr,At;
+  Acr.set(A);
+  At.setTranspose(A);
+  if(!Acr.isValid() || !At.isValid()) {
+    printf("SparseMatrixTemplate_CR: invalid structure\n");
+    return;
+  }
+  VectorT y(n),z(m),x,xd,w,wd;
+  for(int j=0;j<n;j++) y(j) = T(Rand(-1,1));
+  for(int i=0;i<m;i++) z(i) = T(Rand(-1,1));
+  Acr.numThreads = 0;
+  Acr.mul(y,x);
+  Ad.mul(y,xd);
+  xd -= x;
+  Acr.mulTranspose(z,w);
+  Ad.mulTranspose(z,wd);
+  wd -= w;
+  VectorT wt;
+  At.mul(z,wt);
+  wt -= w;
+  printf("SparseMatrixTemplate_CR(%d x %d, %d entries): mul error %g, mulTranspose error %g, transpose error %g\n",m,n,Acr.num_entries,(double)Abs(xd.maxAbsElement()),(double)Abs(wd.maxAbsElement()),(double)Abs(wt.maxAbsElement()));
+}
+
+template <class T>
+std::ostream& operator << (std::ostream& out, const SparseMatrixTemplate_CR<T>& A)
+{
+  out<<A.m<<" "<<A.n<<" "<<A.num_entries<<endl;
+  for(int i=0;i<A.m;i++)
+    for(int k=A.row_offsets[i];k<A.row_offsets[i+1];k++)
+      out<<i<<" "<<A.col_indices[k]<<"   "<<A.val_array[k]<<endl;
+  return out;
+}
+
+
 //specialization for complex
 template <> void SparseMatrixTemplate_RM<Complex>::setAdjoint(const MyT& A)
 {
@@ -554,9 +1145,18 @@ template istream& operator >> (istream& in, SparseMatrixTemplate_RM<float>& v);
 template istream& operator >> (istream& in, SparseMatrixTemplate_RM<double>& v);
 template istream& operator >> (istream& in, SparseMatrixTemplate_RM<Complex>& v);
 
+template class SparseMatrixTemplate_CR<float>;
+template class SparseMatrixTemplate_CR<double>;
+template class SparseMatrixTemplate_CR<Complex>;
+template ostream& operator << (ostream& out, const SparseMatrixTemplate_CR<float>& v);
+template ostream& operator << (ostream& out, const SparseMatrixTemplate_CR<double>& v);
+template ostream& operator << (ostream& out, const SparseMatrixTemplate_CR<Complex>& v);
+
 template void SparseMatrixTemplate_RM<float>::copy(const SparseMatrixTemplate_RM<double>& a);
 template void SparseMatrixTemplate_RM<double>::copy(const SparseMatrixTemplate_RM<float>& a);
 template void SparseMatrixTemplate_RM<Complex>::copy(const SparseMatrixTemplate_RM<float>& a);
 template void SparseMatrixTemplate_RM<Complex>::copy(const SparseMatrixTemplate_RM<double>& a);
+template void SparseMatrixTemplate_CR<float>::copy(const SparseMatrixTemplate_CR<double>& a);
+template void SparseMatrixTemplate_CR<double>::copy(const SparseMatrixTemplate_CR<float>& a);
 
 } // namespace Math
@@ -120,6 +120,14 @@ class SparseMatrixTemplate_RM
  * Like the above, except the rows are all fixed in a compressed,
  * contiguous block of index/value pairs.  The number of nonzero
  * entries (and their locations) must be known in advance.
+ *
+ * Usually built once from a SparseMatrixTemplate_RM with set(), after
+ * which products are much faster than with the map-based rows.
+ * setTranspose() builds the compressed-column form of a matrix, which
+ * turns A^t*y products into cache-friendly row products.
+ *
+ * The vector products run on multiple threads if numThreads != 1 and the
+ * matrix is large enough to make it worthwhile.
  */
 template <class T>
 class SparseMatrixTemplate_CR
@@ -130,20 +138,31 @@ class SparseMatrixTemplate_CR
   typedef MatrixTemplate<T> MatrixT;
 
   SparseMatrixTemplate_CR();
+  SparseMatrixTemplate_CR(const MyT&);
   ~SparseMatrixTemplate_CR();
+  const MyT& operator = (const MyT&);
+  ///Allocates the arrays.  The caller fills in row_offsets, col_indices,
+  ///and val_array.
   void initialize(int m, int n, int num_entries);
   void resize(int m, int n, int num_entries);
   void clear();
 
   T* getEntry(int i,int j);
   const T* getEntry(int i,int j) const;
+  ///Returns the (i,j) entry, or 0 if it doesn't exist
+  T operator () (int i,int j) const;
 
   void copy(const MyT&);
   template <class T2>
   void copy(const SparseMatrixTemplate_CR<T2>&);
   void set(const MatrixT&,T zeroTol=Zero);
+  void set(const SparseMatrixTemplate_RM<T>&);
+  ///Sets this to the transpose of A, i.e., the compressed-column form of A
+  void setTranspose(const SparseMatrixTemplate_RM<T>& A);
+  void setTranspose(const MyT& A);
   void getCopy(MyT& m) const { m.copy(*this); }
   void get(MatrixT&) const;
+  void get(SparseMatrixTemplate_RM<T>&) const;
 
   void mul(const MyT&, T s);
   void mul(const VectorT& y, VectorT& x) const;		 //x = this*y;
@@ -188,6 +207,9 @@ class SparseMatrixTemplate_CR
 
   int m,n;
   int num_entries;
+  ///Number of threads used in vector products.  0 uses all hardware
+  ///threads.  Default 1.
+  int numThreads;
 
   static void self_test();
   static void self_test(int m, int n, int nnz);
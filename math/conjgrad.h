@@ -69,7 +69,9 @@ struct JacobiPreconditioner
  * system Ax=b using the Conjugate Gradient method.
  * Uses any type of matrix A with a method A.mul(x,b) (b=Ax) where 
  * b,x are vectors, and any preconditioner P with method P.solve(r,x)
- * x = P*r where r,x are vectors.
+ * x = P*r where r,x are vectors.  For large sparse systems, use
+ * SparseMatrix_CR, whose products are contiguous and can be
+ * multithreaded.
  *
  * CG follows the algorithm described on p. 15 in the 
  * SIAM Templates book.
@@ -0,0 +1,588 @@
+#include "gemm.h"
+#include "math.h"
+#include "fastarray.h"
+#include "simd.h"
+#include <vector>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define GEMM_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define GEMM_HAVE_AVX2 1
+#include <immintrin.h>
+#define GEMM_AVX2_TARGET __attribute__((target("avx2,fma")))
+#endif
+
+namespace Math {
+
+//Block sizes.  A is packed in blocks of GEMM_MC x GEMM_KC (which should fit
+//in L2 cache) and B in blocks of GEMM_KC x GEMM_NC.  GEMM_MC and GEMM_NC
+//must be multiples of all kernel tile sizes.
+const static int GEMM_KC = 256;
+const static int GEMM_MC = 96;
+const static int GEMM_NC = 2048;
+//Products with fewer multiply-adds than these use the loops of fastarray.h
+const static int GEMM_MIN_OPS = 512;
+const static int GEMV_MIN_OPS = 64;
+
+enum { KernelScalar=SIMDScalar, KernelSSE2=SIMDSSE2, KernelAVX2=SIMDAVX2 };
+//set by gemm_set_kernel, -1 for the best supported kernels
+static int gKernelOverride = -1;
+
+static int CurrentKernel()
+{
+  if(gKernelOverride >= 0) return gKernelOverride;
+  return BestSIMDLevel();
+}
+
+const char* gemm_kernel_name()
+{
+  return SIMDLevelName(CurrentKernel());
+}
+
+bool gemm_set_kernel(const char* name)
+{
+  int kernel = SIMDLevelFromName(name);
+  if(kernel < 0 || !SIMDSupported(kernel)) return false;
+  gKernelOverride = kernel;
+  return true;
+}
+
+
+
+//// GEMM micro-kernels.  Each computes the MR x NR tile C = A*B where A is
+//// a packed MR x kc panel (column by column) and B is a packed kc x NR panel
+//// (row by row).  C is stored row-major.
+
+template <class T,int MR,int NR>
+static void gemm_kernel_scalar(int kc,const T* A,const T* B,T* C)
+{
+  T c[MR*NR];
+  for(int i=0;i<MR*NR;i++) c[i] = 0;
+  for(int k=0;k<kc;k++,A+=MR,B+=NR)
+    for(int i=0;i<MR;i++)
+      for(int j=0;j<NR;j++)
+        c[i*NR+j] += A[i]*B[j];
+  for(int i=0;i<MR*NR;i++) C[i] = c[i];
+}
+
+#if GEMM_HAVE_SSE2
+
+//4x4 tile, 2 doubles per register
+static void gemm_kernel_sse2(int kc,const double* A,const double* B,double* C)
+{
+  __m128d c00=_mm_setzero_pd(),c01=_mm_setzero_pd(),c10=_mm_setzero_pd(),c11=_mm_setzero_pd();
+  __m128d c20=_mm_setzero_pd(),c21=_mm_setzero_pd(),c30=_mm_setzero_pd(),c31=_mm_setzero_pd();
+  for(int k=0;k<kc;k++,A+=4,B+=4) {
+    __m128d b0=_mm_loadu_pd(B),b1=_mm_loadu_pd(B+2);
+    __m128d a;
+    a=_mm_set1_pd(A[0]); c00=_mm_add_pd(c00,_mm_mul_pd(a,b0)); c01=_mm_add_pd(c01,_mm_mul_pd(a,b1));
+    a=_mm_set1_pd(A[1]); c10=_mm_add_pd(c10,_mm_mul_pd(a,b0)); c11=_mm_add_pd(c11,_mm_mul_pd(a,b1));
+    a=_mm_set1_pd(A[2]); c20=_mm_add_pd(c20,_mm_mul_pd(a,b0)); c21=_mm_add_pd(c21,_mm_mul_pd(a,b1));
+    a=_mm_set1_pd(A[3]); c30=_mm_add_pd(c30,_mm_mul_pd(a,b0)); c31=_mm_add_pd(c31,_mm_mul_pd(a,b1));
+  }
+  _mm_storeu_pd(C,c00); _mm_storeu_pd(C+2,c01);
+  _mm_storeu_pd(C+4,c10); _mm_storeu_pd(C+6,c11);
+  _mm_storeu_pd(C+8,c20); _mm_storeu_pd(C+10,c21);
+  _mm_storeu_pd(C+12,c30); _mm_storeu_pd(C+14,c31);
+}
+
+//4x8 tile, 4 floats per register
+static void gemm_kernel_sse2(int kc,const float* A,const float* B,float* C)
+{
+  __m128 c00=_mm_setzero_ps(),c01=_mm_setzero_ps(),c10=_mm_setzero_ps(),c11=_mm_setzero_ps();
+  __m128 c20=_mm_setzero_ps(),c21=_mm_setzero_ps(),c30=_mm_setzero_ps(),c31=_mm_setzero_ps();
+  for(int k=0;k<kc;k++,A+=4,B+=8) {
+    __m128 b0=_mm_loadu_ps(B),b1=_mm_loadu_ps(B+4);
+    __m128 a;
+    a=_mm_set1_ps(A[0]); c00=_mm_add_ps(c00,_mm_mul_ps(a,b0)); c01=_mm_add_ps(c01,_mm_mul_ps(a,b1));
+    a=_mm_set1_ps(A[1]); c10=_mm_add_ps(c10,_mm_mul_ps(a,b0)); c11=_mm_add_ps(c11,_mm_mul_ps(a,b1));
+    a=_mm_set1_ps(A[2]); c20=_mm_add_ps(c20,_mm_mul_ps(a,b0)); c21=_mm_add_ps(c21,_mm_mul_ps(a,b1));
+    a=_mm_set1_ps(A[3]); c30=_mm_add_ps(c30,_mm_mul_ps(a,b0)); c31=_mm_add_ps(c31,_mm_mul_ps(a,b1));
+  }
+  _mm_storeu_ps(C,c00); _mm_storeu_ps(C+4,c01);
+  _mm_storeu_ps(C+8,c10); _mm_storeu_ps(C+12,c11);
+  _mm_storeu_ps(C+16,c20); _mm_storeu_ps(C+20,c21);
+  _mm_storeu_ps(C+24,c30); _mm_storeu_ps(C+28,c31);
+}
+
+#endif //GEMM_HAVE_SSE2
+
+#if GEMM_HAVE_AVX2
+
+#define GEMM_AVX2_ROW_PD(i) \
+  a=_mm256_broadcast_sd(A+i); \
+  c##i##0=_mm256_fmadd_pd(a,b0,c##i##0); \
+  c##i##1=_mm256_fmadd_pd(a,b1,c##i##1);
+
+//6x8 tile, 4 doubles per register
+GEMM_AVX2_TARGET
+static void gemm_kernel_avx2(int kc,const double* A,const double* B,double* C)
+{
+  __m256d c00=_mm256_setzero_pd(),c01=_mm256_setzero_pd(),c10=_mm256_setzero_pd(),c11=_mm256_setzero_pd();
+  __m256d c20=_mm256_setzero_pd(),c21=_mm256_setzero_pd(),c30=_mm256_setzero_pd(),c31=_mm256_setzero_pd();
+  __m256d c40=_mm256_setzero_pd(),c41=_mm256_setzero_pd(),c50=_mm256_setzero_pd(),c51=_mm256_setzero_pd();
+  for(int k=0;k<kc;k++,A+=6,B+=8) {
+    __m256d b0=_mm256_loadu_pd(B),b1=_mm256_loadu_pd(B+4);
+    __m256d a;
+    GEMM_AVX2_ROW_PD(0)
+    GEMM_AVX2_ROW_PD(1)
+    GEMM_AVX2_ROW_PD(2)
+    GEMM_AVX2_ROW_PD(3)
+    GEMM_AVX2_ROW_PD(4)
+    GEMM_AVX2_ROW_PD(5)
+  }
+  _mm256_storeu_pd(C,c00); _mm256_storeu_pd(C+4,c01);
+  _mm256_storeu_pd(C+8,c10); _mm256_storeu_pd(C+12,c11);
+  _mm256_storeu_pd(C+16,c20); _mm256_storeu_pd(C+20,c21);
+  _mm256_storeu_pd(C+24,c30); _mm256_storeu_pd(C+28,c31);
+  _mm256_storeu_pd(C+32,c40); _mm256_storeu_pd(C+36,c41);
+  _mm256_storeu_pd(C+40,c50); _mm256_storeu_pd(C+44,c51);
+}
+
+#define GEMM_AVX2_ROW_PS(i) \
+  a=_mm256_broadcast_ss(A+i); \
+  c##i##0=_mm256_fmadd_ps(a,b0,c##i##0); \
+  c##i##1=_mm256_fmadd_ps(a,b1,c##i##1);
+
+//6x16 tile, 8 floats per register
+GEMM_AVX2_TARGET
+static void gemm_kernel_avx2(int kc,const float* A,const float* B,float* C)
+{
+  __m256 c00=_mm256_setzero_ps(),c01=_mm256_setzero_ps(),c10=_mm256_setzero_ps(),c11=_mm256_setzero_ps();
+  __m256 c20=_mm256_setzero_ps(),c21=_mm256_setzero_ps(),c30=_mm256_setzero_ps(),c31=_mm256_setzero_ps();
+  __m256 c40=_mm256_setzero_ps(),c41=_mm256_setzero_ps(),c50=_mm256_setzero_ps(),c51=_mm256_setzero_ps();
+  for(int k=0;k<kc;k++,A+=6,B+=16) {
+    __m256 b0=_mm256_loadu_ps(B),b1=_mm256_loadu_ps(B+8);
+    __m256 a;
+    GEMM_AVX2_ROW_PS(0)
+    GEMM_AVX2_ROW_PS(1)
+    GEMM_AVX2_ROW_PS(2)
+    GEMM_AVX2_ROW_PS(3)
+    GEMM_AVX2_ROW_PS(4)
+    GEMM_AVX2_ROW_PS(5)
+  }
+  _mm256_storeu_ps(C,c00); _mm256_storeu_ps(C+8,c01);
+  _mm256_storeu_ps(C+16,c10); _mm256_storeu_ps(C+24,c11);
+  _mm256_storeu_ps(C+32,c20); _mm256_storeu_ps(C+40,c21);
+  _mm256_storeu_ps(C+48,c30); _mm256_storeu_ps(C+56,c31);
+  _mm256_storeu_ps(C+64,c40); _mm256_storeu_ps(C+72,c41);
+  _mm256_storeu_ps(C+80,c50); _mm256_storeu_ps(C+88,c51);
+}
+
+#endif //GEMM_HAVE_AVX2
+
+template <class T>
+struct GemmKernel
+{
+  int mr,nr;
+  void (*func)(int kc,const T* A,const T* B,T* C);
+};
+
+template <class T>
+static GemmKernel<T> GetGemmKernel()
+{
+  GemmKernel<T> k;
+  switch(CurrentKernel()) {
+#if GEMM_HAVE_AVX2
+  case KernelAVX2:
+    k.mr = 6; k.nr = 32/sizeof(T)*2; k.func = gemm_kernel_avx2; return k;
+#endif
+#if GEMM_HAVE_SSE2
+  case KernelSSE2:
+    k.mr = 4; k.nr = 16/sizeof(T)*2; k.func = gemm_kernel_sse2; return k;
+#endif
+  default:
+    k.mr = 4; k.nr = 4; k.func = gemm_kernel_scalar<T,4,4>; return k;
+  }
+}
+
+//packs the mc x kc block of A into panels of mr rows, zero-padding the last
+template <class T>
+static void gemm_pack_A(const T* A,int ais,int ajs,int mc,int kc,int mr,T* Ap)
+{
+  for(int i=0;i<mc;i+=mr,A+=mr*ais) {
+    int ib = Min(mr,mc-i);
+    const T* Ak = A;
+    for(int k=0;k<kc;k++,Ak+=ajs,Ap+=mr) {
+      const T* a = Ak;
+      int ii;
+      for(ii=0;ii<ib;ii++,a+=ais) Ap[ii] = *a;
+      for(;ii<mr;ii++) Ap[ii] = 0;
+    }
+  }
+}
+
+//packs the kc x nc block of B into panels of nr columns, zero-padding the last
+template <class T>
+static void gemm_pack_B(const T* B,int bis,int bjs,int kc,int nc,int nr,T* Bp)
+{
+  for(int j=0;j<nc;j+=nr,B+=nr*bjs) {
+    int jb = Min(nr,nc-j);
+    const T* Bk = B;
+    for(int k=0;k<kc;k++,Bk+=bis,Bp+=nr) {
+      const T* b = Bk;
+      int jj;
+      for(jj=0;jj<jb;jj++,b+=bjs) Bp[jj] = *b;
+      for(;jj<nr;jj++) Bp[jj] = 0;
+    }
+  }
+}
+
+template <class T>
+static void gemm_blocked(T* X,int xis,int xjs,
+                         const T* A,int ais,int ajs,
+                         const T* B,int bis,int bjs,
+                         int m,int n,int p)
+{
+  GemmKernel<T> K = GetGemmKernel<T>();
+  int kcMax = Min(GEMM_KC,n);
+  int mcMax = Min(GEMM_MC,((m+K.mr-1)/K.mr)*K.mr);
+  int ncMax = Min(GEMM_NC,((p+K.nr-1)/K.nr)*K.nr);
+  std::vector<T> Ap(mcMax*kcMax),Bp(ncMax*kcMax);
+  T tile[6*16];
+  for(int jc=0;jc<p;jc+=GEMM_NC) {
+    int nc = Min(GEMM_NC,p-jc);
+    for(int pc=0;pc<n;pc+=GEMM_KC) {
+      int kc = Min(GEMM_KC,n-pc);
+      bool first = (pc==0);
+      gemm_pack_B(B+pc*bis+jc*bjs,bis,bjs,kc,nc,K.nr,&Bp[0]);
+      for(int ic=0;ic<m;ic+=GEMM_MC) {
+        int mc = Min(GEMM_MC,m-ic);
+        gemm_pack_A(A+ic*ais+pc*ajs,ais,ajs,mc,kc,K.mr,&Ap[0]);
+        for(int jr=0;jr<nc;jr+=K.nr) {
+          int jb = Min(K.nr,nc-jr);
+          for(int ir=0;ir<mc;ir+=K.mr) {
+            int ib = Min(K.mr,mc-ir);
+            K.func(kc,&Ap[ir*kc],&Bp[jr*kc],tile);
+            //add the tile into X
+            T* Xi = X+(ic+ir)*xis+(jc+jr)*xjs;
+            const T* c = tile;
+            for(int ii=0;ii<ib;ii++,Xi+=xis,c+=K.nr) {
+              T* x = Xi;
+              if(first)
+                for(int jj=0;jj<jb;jj++,x+=xjs) *x = c[jj];
+              else
+                for(int jj=0;jj<jb;jj++,x+=xjs) *x += c[jj];
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+template <class T>
+static void gemm_multiply_template(T* X,int xis,int xjs,
+                                   const T* A,int ais,int ajs,
+                                   const T* B,int bis,int bjs,
+                                   int m,int n,int p)
+{
+  if(m <= 0 || p <= 0) return;
+  if(n <= 0) {
+    gen_array2d_fill(X,xis,xjs,T(0),m,p);
+    return;
+  }
+  if(double(m)*double(n)*double(p) < GEMM_MIN_OPS || m < 4 || p < 4) {
+    gen_array2d_multiply(X,xis,xjs,A,ais,ajs,B,bis,bjs,m,n,p);
+    return;
+  }
+  gemm_blocked(X,xis,xjs,A,ais,ajs,B,bis,bjs,m,n,p);
+}
+
+void gemm_multiply(float* X,int xis,int xjs,
+                   const float* A,int ais,int ajs,
+                   const float* B,int bis,int bjs,
+                   int m,int n,int p)
+{
+  gemm_multiply_template(X,xis,xjs,A,ais,ajs,B,bis,bjs,m,n,p);
+}
+
+void gemm_multiply(double* X,int xis,int xjs,
+                   const double* A,int ais,int ajs,
+                   const double* B,int bis,int bjs,
+                   int m,int n,int p)
+{
+  gemm_multiply_template(X,xis,xjs,A,ais,ajs,B,bis,bjs,m,n,p);
+}
+
+
+
+//// GEMV kernels.  dot4 computes the dot products of 4 contiguous rows
+//// A, A+ais, A+2ais, A+3ais with the contiguous b.  axpy4 adds
+//// b[0..3] times the 4 contiguous columns A, A+ajs, A+2ajs, A+3ajs to the
+//// contiguous x.
+
+template <class T>
+static void gemv_dot4_scalar(const T* A,int ais,const T* b,int n,T* out)
+{
+  const T *a0=A,*a1=A+ais,*a2=A+2*ais,*a3=A+3*ais;
+  T s0=0,s1=0,s2=0,s3=0;
+  for(int k=0;k<n;k++) {
+    s0 += a0[k]*b[k];
+    s1 += a1[k]*b[k];
+    s2 += a2[k]*b[k];
+    s3 += a3[k]*b[k];
+  }
+  out[0]=s0; out[1]=s1; out[2]=s2; out[3]=s3;
+}
+
+template <class T>
+static void gemv_axpy4_scalar(T* x,const T* A,int ajs,const T* b,int m)
+{
+  const T *a0=A,*a1=A+ajs,*a2=A+2*ajs,*a3=A+3*ajs;
+  T b0=b[0],b1=b[1],b2=b[2],b3=b[3];
+  for(int i=0;i<m;i++)
+    x[i] += b0*a0[i] + b1*a1[i] + b2*a2[i] + b3*a3[i];
+}
+
+#if GEMM_HAVE_SSE2
+
+static inline double hsum(__m128d v)
+{
+  double temp[2];
+  _mm_storeu_pd(temp,v);
+  return temp[0]+temp[1];
+}
+
+static inline float hsum(__m128 v)
+{
+  float temp[4];
+  _mm_storeu_ps(temp,v);
+  return (temp[0]+temp[1])+(temp[2]+temp[3]);
+}
+
+static void gemv_dot4_sse2(const double* A,int ais,const double* b,int n,double* out)
+{
+  const double *a0=A,*a1=A+ais,*a2=A+2*ais,*a3=A+3*ais;
+  __m128d s0=_mm_setzero_pd(),s1=_mm_setzero_pd(),s2=_mm_setzero_pd(),s3=_mm_setzero_pd();
+  int k=0;
+  for(;k+2<=n;k+=2) {
+    __m128d bk=_mm_loadu_pd(b+k);
+    s0=_mm_add_pd(s0,_mm_mul_pd(_mm_loadu_pd(a0+k),bk));
+    s1=_mm_add_pd(s1,_mm_mul_pd(_mm_loadu_pd(a1+k),bk));
+    s2=_mm_add_pd(s2,_mm_mul_pd(_mm_loadu_pd(a2+k),bk));
+    s3=_mm_add_pd(s3,_mm_mul_pd(_mm_loadu_pd(a3+k),bk));
+  }
+  out[0]=hsum(s0); out[1]=hsum(s1); out[2]=hsum(s2); out[3]=hsum(s3);
+  for(;k<n;k++) {
+    out[0] += a0[k]*b[k];
+    out[1] += a1[k]*b[k];
+    out[2] += a2[k]*b[k];
+    out[3] += a3[k]*b[k];
+  }
+}
+
+static void gemv_dot4_sse2(const float* A,int ais,const float* b,int n,float* out)
+{
+  const float *a0=A,*a1=A+ais,*a2=A+2*ais,*a3=A+3*ais;
+  __m128 s0=_mm_setzero_ps(),s1=_mm_setzero_ps(),s2=_mm_setzero_ps(),s3=_mm_setzero_ps();
+  int k=0;
+  for(;k+4<=n;k+=4) {
+    __m128 bk=_mm_loadu_ps(b+k);
+    s0=_mm_add_ps(s0,_mm_mul_ps(_mm_loadu_ps(a0+k),bk));
+    s1=_mm_add_ps(s1,_mm_mul_ps(_mm_loadu_ps(a1+k),bk));
+    s2=_mm_add_ps(s2,_mm_mul_ps(_mm_loadu_ps(a2+k),bk));
+    s3=_mm_add_ps(s3,_mm_mul_ps(_mm_loadu_ps(a3+k),bk));
+  }
+  out[0]=hsum(s0); out[1]=hsum(s1); out[2]=hsum(s2); out[3]=hsum(s3);
+  for(;k<n;k++) {
+    out[0] += a0[k]*b[k];
+    out[1] += a1[k]*b[k];
+    out[2] += a2[k]*b[k];
+    out[3] += a3[k]*b[k];
+  }
+}
+
+#endif //GEMM_HAVE_SSE2
+
+#if GEMM_HAVE_AVX2
+
+GEMM_AVX2_TARGET
+static inline double hsum(__m256d v)
+{
+  return hsum(_mm_add_pd(_mm256_castpd256_pd128(v),_mm256_extractf128_pd(v,1)));
+}
+
+GEMM_AVX2_TARGET
+static inline float hsum(__m256 v)
+{
+  return hsum(_mm_add_ps(_mm256_castps256_ps128(v),_mm256_extractf128_ps(v,1)));
+}
+
+GEMM_AVX2_TARGET
+static void gemv_dot4_avx2(const double* A,int ais,const double* b,int n,double* out)
+{
+  const double *a0=A,*a1=A+ais,*a2=A+2*ais,*a3=A+3*ais;
+  __m256d s0=_mm256_setzero_pd(),s1=_mm256_setzero_pd(),s2=_mm256_setzero_pd(),s3=_mm256_setzero_pd();
+  int k=0;
+  for(;k+4<=n;k+=4) {
+    __m256d bk=_mm256_loadu_pd(b+k);
+    s0=_mm256_fmadd_pd(_mm256_loadu_pd(a0+k),bk,s0);
+    s1=_mm256_fmadd_pd(_mm256_loadu_pd(a1+k),bk,s1);
+    s2=_mm256_fmadd_pd(_mm256_loadu_pd(a2+k),bk,s2);
+    s3=_mm256_fmadd_pd(_mm256_loadu_pd(a3+k),bk,s3);
+  }
+  out[0]=hsum(s0); out[1]=hsum(s1); out[2]=hsum(s2); out[3]=hsum(s3);
+  for(;k<n;k++) {
+    out[0] += a0[k]*b[k];
+    out[1] += a1[k]*b[k];
+    out[2] += a2[k]*b[k];
+    out[3] += a3[k]*b[k];
+  }
+}
+
+GEMM_AVX2_TARGET
+static void gemv_dot4_avx2(const float* A,int ais,const float* b,int n,float* out)
+{
+  const float *a0=A,*a1=A+ais,*a2=A+2*ais,*a3=A+3*ais;
+  __m256 s0=_mm256_setzero_ps(),s1=_mm256_setzero_ps(),s2=_mm256_setzero_ps(),s3=_mm256_setzero_ps();
+  int k=0;
+  for(;k+8<=n;k+=8) {
+    __m256 bk=_mm256_loadu_ps(b+k);
+    s0=_mm256_fmadd_ps(_mm256_loadu_ps(a0+k),bk,s0);
+    s1=_mm256_fmadd_ps(_mm256_loadu_ps(a1+k),bk,s1);
+    s2=_mm256_fmadd_ps(_mm256_loadu_ps(a2+k),bk,s2);
+    s3=_mm256_fmadd_ps(_mm256_loadu_ps(a3+k),bk,s3);
+  }
+  out[0]=hsum(s0); out[1]=hsum(s1); out[2]=hsum(s2); out[3]=hsum(s3);
+  for(;k<n;k++) {
+    out[0] += a0[k]*b[k];
+    out[1] += a1[k]*b[k];
+    out[2] += a2[k]*b[k];
+    out[3] += a3[k]*b[k];
+  }
+}
+
+GEMM_AVX2_TARGET
+static void gemv_axpy4_avx2(double* x,const double* A,int ajs,const double* b,int m)
+{
+  const double *a0=A,*a1=A+ajs,*a2=A+2*ajs,*a3=A+3*ajs;
+  __m256d b0=_mm256_set1_pd(b[0]),b1=_mm256_set1_pd(b[1]),b2=_mm256_set1_pd(b[2]),b3=_mm256_set1_pd(b[3]);
+  int i=0;
+  for(;i+4<=m;i+=4) {
+    __m256d xi=_mm256_loadu_pd(x+i);
+    xi=_mm256_fmadd_pd(_mm256_loadu_pd(a0+i),b0,xi);
+    xi=_mm256_fmadd_pd(_mm256_loadu_pd(a1+i),b1,xi);
+    xi=_mm256_fmadd_pd(_mm256_loadu_pd(a2+i),b2,xi);
+    xi=_mm256_fmadd_pd(_mm256_loadu_pd(a3+i),b3,xi);
+    _mm256_storeu_pd(x+i,xi);
+  }
+  for(;i<m;i++)
+    x[i] += b[0]*a0[i] + b[1]*a1[i] + b[2]*a2[i] + b[3]*a3[i];
+}
+
+GEMM_AVX2_TARGET
+static void gemv_axpy4_avx2(float* x,const float* A,int ajs,const float* b,int m)
+{
+  const float *a0=A,*a1=A+ajs,*a2=A+2*ajs,*a3=A+3*ajs;
+  __m256 b0=_mm256_set1_ps(b[0]),b1=_mm256_set1_ps(b[1]),b2=_mm256_set1_ps(b[2]),b3=_mm256_set1_ps(b[3]);
+  int i=0;
+  for(;i+8<=m;i+=8) {
+    __m256 xi=_mm256_loadu_ps(x+i);
+    xi=_mm256_fmadd_ps(_mm256_loadu_ps(a0+i),b0,xi);
+    xi=_mm256_fmadd_ps(_mm256_loadu_ps(a1+i),b1,xi);
+    xi=_mm256_fmadd_ps(_mm256_loadu_ps(a2+i),b2,xi);
+    xi=_mm256_fmadd_ps(_mm256_loadu_ps(a3+i),b3,xi);
+    _mm256_storeu_ps(x+i,xi);
+  }
+  for(;i<m;i++)
+    x[i] += b[0]*a0[i] + b[1]*a1[i] + b[2]*a2[i] + b[3]*a3[i];
+}
+
+#endif //GEMM_HAVE_AVX2
+
+template <class T>
+struct GemvKernel
+{
+  void (*dot4)(const T* A,int ais,const T* b,int n,T* out);
+  void (*axpy4)(T* x,const T* A,int ajs,const T* b,int m);
+};
+
+template <class T>
+static GemvKernel<T> GetGemvKernel()
+{
+  GemvKernel<T> k;
+  switch(CurrentKernel()) {
+#if GEMM_HAVE_AVX2
+  case KernelAVX2:
+    k.dot4 = gemv_dot4_avx2; k.axpy4 = gemv_axpy4_avx2; return k;
+#endif
+#if GEMM_HAVE_SSE2
+  case KernelSSE2:
+    //the compiler vectorizes the scalar axpy with SSE2 by itself
+    k.dot4 = gemv_dot4_sse2; k.axpy4 = gemv_axpy4_scalar<T>; return k;
+#endif
+  default:
+    k.dot4 = gemv_dot4_scalar<T>; k.axpy4 = gemv_axpy4_scalar<T>; return k;
+  }
+}
+
+template <class T>
+static void gemv_multiply_template(T* x,int xs,
+                                   const T* A,int ais,int ajs,
+                                   const T* b,int bs,
+                                   int m,int n)
+{
+  if(double(m)*double(n) < GEMV_MIN_OPS || m < 4 || n < 4) {
+    gen_array2d_vector_multiply(x,xs,A,ais,ajs,b,bs,m,n);
+    return;
+  }
+  if(ajs == 1 && bs == 1) {
+    //contiguous rows: dot products, 4 rows at a time
+    GemvKernel<T> K = GetGemvKernel<T>();
+    T out[4];
+    int i=0;
+    for(;i+4<=m;i+=4) {
+      K.dot4(A+i*ais,ais,b,n,out);
+      x[i*xs] = out[0];
+      x[(i+1)*xs] = out[1];
+      x[(i+2)*xs] = out[2];
+      x[(i+3)*xs] = out[3];
+    }
+    for(;i<m;i++)
+      x[i*xs] = gen_array_sum_product(A+i*ais,1,b,1,n);
+  }
+  else if(ais == 1 && xs == 1) {
+    //contiguous columns: x = sum of bj*Aj, 4 columns at a time
+    GemvKernel<T> K = GetGemvKernel<T>();
+    for(int i=0;i<m;i++) x[i] = 0;
+    T bj[4];
+    int j=0;
+    for(;j+4<=n;j+=4) {
+      bj[0] = b[j*bs];
+      bj[1] = b[(j+1)*bs];
+      bj[2] = b[(j+2)*bs];
+      bj[3] = b[(j+3)*bs];
+      K.axpy4(x,A+j*ajs,ajs,bj,m);
+    }
+    for(;j<n;j++) {
+      const T* a = A+j*ajs;
+      T c = b[j*bs];
+      for(int i=0;i<m;i++) x[i] += c*a[i];
+    }
+  }
+  else
+    gen_array2d_vector_multiply(x,xs,A,ais,ajs,b,bs,m,n);
+}
+
+void gemv_multiply(float* x,int xs,
+                   const float* A,int ais,int ajs,
+                   const float* b,int bs,
+                   int m,int n)
+{
+  gemv_multiply_template(x,xs,A,ais,ajs,b,bs,m,n);
+}
+
+void gemv_multiply(double* x,int xs,
+                   const double* A,int ais,int ajs,
+                   const double* b,int bs,
+                   int m,int n)
+{
+  gemv_multiply_template(x,xs,A,ais,ajs,b,bs,m,n);
+}
+
+} //namespace Math
@@ -0,0 +1,56 @@
+#ifndef MATH_GEMM_H
+#define MATH_GEMM_H
+
+/** @file math/gemm.h
+ * @ingroup Math
+ * @brief Built-in cache-blocked matrix-matrix and matrix-vector products
+ * for float and double arrays.
+ *
+ * Arguments follow the gen_array2d_* functions of fastarray.h: a matrix
+ * is given by its start pointer, row stride, and column stride.
+ *
+ * gemm_multiply copies blocks of A and B into contiguous buffers and runs
+ * a register-blocked kernel on them, so it accepts any strides, including
+ * transposed arguments.  gemv_multiply is vectorized when A has a unit row
+ * or column stride, and otherwise uses the loops of fastarray.h.  Small
+ * products also use the fastarray.h loops.
+ *
+ * The kernels are chosen at runtime: AVX2+FMA if the processor supports
+ * it, otherwise SSE2 on x86-64, otherwise plain C++.
+ *
+ * MatrixTemplate<float> and MatrixTemplate<double> use these for mul,
+ * mulTransposeA, mulTransposeB, and matrix-vector mul / mulTranspose.
+ */
+
+namespace Math {
+
+/// X = A*B.  X is mxp, A is mxn, B is nxp.  X must not overlap A or B.
+void gemm_multiply(float* X,int xis,int xjs,
+                   const float* A,int ais,int ajs,
+                   const float* B,int bis,int bjs,
+                   int m,int n,int p);
+void gemm_multiply(double* X,int xis,int xjs,
+                   const double* A,int ais,int ajs,
+                   const double* B,int bis,int bjs,
+                   int m,int n,int p);
+
+/// x = A*b.  A is mxn.  x must not overlap A or b.
+void gemv_multiply(float* x,int xs,
+                   const float* A,int ais,int ajs,
+                   const float* b,int bs,
+                   int m,int n);
+void gemv_multiply(double* x,int xs,
+                   const double* A,int ais,int ajs,
+                   const double* b,int bs,
+                   int m,int n);
+
+/// Returns the name of the kernels in use: "avx2", "sse2", or "scalar"
+const char* gemm_kernel_name();
+/// Selects the kernels by name ("avx2", "sse2", or "scalar"), e.g., for
+/// benchmarking.  Returns false if they aren't supported on this processor.
+/// Not thread safe: call this while no products are running.
+bool gemm_set_kernel(const char* name);
+
+} //namespace Math
+
+#endif
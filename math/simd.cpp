@@ -0,0 +1,56 @@
+#include "simd.h"
+#include <string.h>
+
+namespace Math {
+
+static bool DetectAVX2()
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+  return false;
+#endif
+}
+
+bool SIMDSupported(int level)
+{
+  switch(level) {
+  case SIMDScalar: return true;
+#if defined(__x86_64__) || defined(_M_X64)
+  case SIMDSSE2: return true;
+#endif
+  case SIMDAVX2:
+    {
+      //function-local statics are initialized once, even with threads
+      static const bool avx2 = DetectAVX2();
+      return avx2;
+    }
+  default: return false;
+  }
+}
+
+int BestSIMDLevel()
+{
+  static const int level = (SIMDSupported(SIMDAVX2) ? SIMDAVX2 : (SIMDSupported(SIMDSSE2) ? SIMDSSE2 : SIMDScalar));
+  return level;
+}
+
+const char* SIMDLevelName(int level)
+{
+  switch(level) {
+  case SIMDAVX2: return "avx2";
+  case SIMDSSE2: return "sse2";
+  default: return "scalar";
+  }
+}
+
+int SIMDLevelFromName(const char* name)
+{
+  if(0==strcmp(name,"avx2")) return SIMDAVX2;
+  if(0==strcmp(name,"sse2")) return SIMDSSE2;
+  if(0==strcmp(name,"scalar")) return SIMDScalar;
+  return -1;
+}
+
+} //namespace Math
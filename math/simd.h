@@ -0,0 +1,29 @@
+#ifndef MATH_SIMD_H
+#define MATH_SIMD_H
+
+/** @file math/simd.h
+ * @ingroup Math
+ * @brief Runtime selection of the SIMD instruction set used by the
+ * built-in vectorized kernels (math/gemm.h, geometry/PointKernels.h).
+ */
+
+namespace Math {
+
+/// Kernel variants, in increasing order of preference
+enum SIMDLevel { SIMDScalar=0, SIMDSSE2=1, SIMDAVX2=2 };
+
+/// Returns true if this build can contain kernels for the given level, and
+/// the processor supports them.  SSE2 needs an x86-64 build, and AVX2
+/// (with FMA) additionally needs GCC-style target attributes.
+bool SIMDSupported(int level);
+/// Returns the best supported level.  The processor is queried only once,
+/// and this may be called from several threads at once.
+int BestSIMDLevel();
+/// Returns "avx2", "sse2", or "scalar"
+const char* SIMDLevelName(int level);
+/// Returns the level with the given name, or -1 if the name is unknown
+int SIMDLevelFromName(const char* name);
+
+} //namespace Math
+
+#endif
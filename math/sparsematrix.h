@@ -7,6 +7,7 @@
 namespace Math {
 
 typedef SparseMatrixTemplate_RM<Real> SparseMatrix;
+typedef SparseMatrixTemplate_CR<Real> SparseMatrix_CR;
 
 } //namespace Math
 
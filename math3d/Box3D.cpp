@@ -101,10 +101,13 @@ bool Box3D::intersects(const Box3D& b) const
   toLocalReorient(b.zbasis,bzlocal);
   Vector3 halfdims = dims*0.5;
   Vector3 bhalfdims = b.dims*0.5;
+  //obb_disjoint takes the axes of b as the columns of B
   PQP_REAL B[3][3],T[3],AD[3],BD[3];
-  bxlocal.get(B[0]);
-  bylocal.get(B[1]);
-  bzlocal.get(B[2]);
+  for(int i=0;i<3;i++) {
+    B[i][0] = bxlocal[i];
+    B[i][1] = bylocal[i];
+    B[i][2] = bzlocal[i];
+  }
   bclocal.get(T);
   halfdims.get(AD);
   bhalfdims.get(BD);
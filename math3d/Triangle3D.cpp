@@ -188,48 +188,44 @@ Vector2 Triangle3D::closestPointCoords(const Point3D& in) const
 	D = dot(e1,x0);
 	E = dot(e2,x0);
 	Real det = A*C-B*B;
-	if(det == Zero) { //collapsed to a line
-	  //cout<<"Triangle3D::closestPointCoords(): Warning, triangle is actually a line!!!"<<endl;
-		return Vector2(Zero);
-	}
-
 	Vector2 pc (B*E-C*D,B*D-A*E);
-	if(pc.x < Zero) {  //check edge 2
-		//t = dot(in-a,e2)/dot(e2,e2) = -E/C
-		Real t;
-		if(-E <= Zero) t=Zero;
-		else if(-E >= C) t=One;
-		else t = -E/C;
-		return Vector2(Zero,t);
-	}
-	else if(pc.y < Zero) { //check edge 1
-		//t = dot(in-a,e1)/dot(e1,e1) = -D/A
-		Real t;
-		if(-D <= Zero) t=Zero;
-		else if(-D >= A) t=One;
-		else t = -D/A;
-		return Vector2(t,Zero);
-	}
-	else if(pc.x+pc.y > det) { //check edge 3
-	  //edge from b->c
-	  //xloc=in-b=(in-a)+(b-a)=-x0-e1
-	  //dir=c-b=e2-e1
-		//t = -dot(e1+x0,e2-e1)/dot(e2-e1,e2-e1)
-		//= -[dot(e1,e2) - dot(e1,e1) + dot(x0,e2) - dot(x0,e1)]/(dot(e2,e2) - 2dot(e2,e1) + dot(e1,e1)]
-		//= -(B-A+E-D)/(C-2B+A)
-		Real numer = -(B-A+E-D);
-		Real denom = (A-Two*B+C);
-		Real t;
-		//t = numer/denom with denom >= 0
-		if(numer <= Zero) t=Zero;
-		else if(numer >= denom) t=One;
-		else t = numer/denom;
-		return Vector2(One-t,t);
-	}
-	else {
+	if(det > Zero && pc.x >= Zero && pc.y >= Zero && pc.x+pc.y <= det) {
 		pc /= det;
 		return pc;
 	}
+	//the closest point is on the boundary, but not necessarily on the edge
+	//facing the point's region, so take the closest of the three edges.
+	//Also handles triangles that have collapsed to a line or point.
+	//|x0 + u e1 + v e2|^2 = |x0|^2 + 2uD + 2vE + u^2A + 2uvB + v^2C
+	Real F = dot(x0,x0);
+	//edge 1, from a->b
+	Real t1;
+	if(-D <= Zero) t1=Zero;
+	else if(-D >= A) t1=One;
+	else t1 = -D/A;
+	Real d1 = F + Two*t1*D + t1*t1*A;
+	//edge 2, from a->c
+	Real t2;
+	if(-E <= Zero) t2=Zero;
+	else if(-E >= C) t2=One;
+	else t2 = -E/C;
+	Real d2 = F + Two*t2*E + t2*t2*C;
+	//edge 3, from b->c
+	//xloc=in-b=(in-a)+(b-a)=-x0-e1
+	//dir=c-b=e2-e1
+	//t = -dot(e1+x0,e2-e1)/dot(e2-e1,e2-e1)
+	//= -(B-A+E-D)/(C-2B+A)
+	Real numer = -(B-A+E-D);
+	Real denom = (A-Two*B+C);
+	Real t3;
+	if(numer <= Zero) t3=Zero;
+	else if(numer >= denom) t3=One;
+	else t3 = numer/denom;
+	Real u3=One-t3,v3=t3;
+	Real d3 = F + Two*u3*D + Two*v3*E + u3*u3*A + Two*u3*v3*B + v3*v3*C;
+	if(d1 <= d2 && d1 <= d3) return Vector2(t1,Zero);
+	else if(d2 <= d3) return Vector2(Zero,t2);
+	return Vector2(u3,v3);
 }
 
 Point3D Triangle3D::closestPoint(const Point3D& x) const
@@ -7,7 +7,12 @@
 #include <sstream>
 #include <fstream>
 #include <utils/SimpleFile.h>
+#include <utils/fileutils.h>
+#include <utils/threadutils.h>
 #include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <limits.h>
 #include <errors.h>
 
 #if HAVE_ASSIMP
@@ -32,11 +37,30 @@ namespace Meshing {
 static string gTexturePath;
 bool LoadOBJ(const char* fn,FILE* f,TriMesh& tri,GeometryAppearance& app);
 
+//returns the lowercase extension of fn
+static string LowerExtension(const char* fn)
+{
+  string ext = FileExtension(fn);
+  Lowercase(ext);
+  return ext;
+}
+
+//loads with the native STL / PLY / OBJ loaders.  Returns false if ext is
+//not one of them or loading fails
+static bool LoadNative(const char* fn,const string& ext,TriMesh& tri)
+{
+  if(ext == "stl") return LoadSTL(fn,tri);
+  else if(ext == "ply") return LoadPLY(fn,tri);
+  else if(ext == "obj") return LoadOBJ(fn,tri);
+  return false;
+}
+
 ///Returns true if the extension is a file type that we can load from
 bool CanLoadTriMeshExt(const char* ext)
 {
   if(0==strcmp(ext,"tri")) return true;
   else if(0==strcmp(ext,"off")) return true;
+  else if(0==strcmp(ext,"stl") || 0==strcmp(ext,"ply") || 0==strcmp(ext,"obj")) return true;
   else {
 #if HAVE_ASSIMP
     Assimp::Importer importer;
@@ -52,6 +76,7 @@ bool CanSaveTriMeshExt(const char* ext)
 {
   if(0==strcmp(ext,"tri")) return true;
   else if(0==strcmp(ext,"off")) return true;
+  else if(0==strcmp(ext,"stl") || 0==strcmp(ext,"ply") || 0==strcmp(ext,"obj")) return true;
   else {
 #if HAVE_ASSIMP
     //TODO: check exporter
@@ -65,10 +90,12 @@ bool CanSaveTriMeshExt(const char* ext)
 bool Import(const char* fn,TriMesh& tri)
 {
   const char* ext=FileExtension(fn);
+  string lext = LowerExtension(fn);
   if(0==strcmp(ext,"tri")) {
     return LoadMultipleTriMeshes(fn,tri);
   }
   else {
+    if(LoadNative(fn,lext,tri)) return true;
 #if HAVE_ASSIMP
     if(!LoadAssimp(fn,tri)) {
       fprintf(stderr,"Import(TriMesh): file %s could not be loaded\n",fn);
@@ -88,6 +115,10 @@ bool Import(const char* fn,TriMesh& tri)
       if(!in) return false;
       return LoadOFF(in,tri);
     }
+    else if(lext == "stl" || lext == "ply" || lext == "obj") {
+      fprintf(stderr,"Import(TriMesh): file %s could not be loaded\n",fn);
+      return false;
+    }
     else {
       fprintf(stderr,"Import(TriMesh): file extension %s not recognized\n",ext);
       return false;
@@ -100,6 +131,7 @@ bool Import(const char* fn,TriMesh& tri)
 bool Import(const char* fn,TriMesh& tri,GeometryAppearance& app)
 {
   const char* ext=FileExtension(fn);
+  string lext = LowerExtension(fn);
   if(0==strcmp(ext,"tri")) {
     return LoadMultipleTriMeshes(fn,tri);
   }
@@ -108,6 +140,8 @@ bool Import(const char* fn,TriMesh& tri,GeometryAppearance& app)
       FILE* f = fopen(fn,"r");
       if(f && LoadOBJ(fn,f,tri,app)) return true;
     }
+    //STL has no appearance information
+    if(lext == "stl" && LoadSTL(fn,tri)) return true;
 #if HAVE_ASSIMP
     //setup texture path to same directory as fn
     char* buf = new char[strlen(fn)+1];
@@ -133,6 +167,10 @@ bool Import(const char* fn,TriMesh& tri,GeometryAppearance& app)
       if(!in) return false;
       return LoadOFF(in,tri);
     }
+    else if(lext == "ply" || lext == "obj") {
+      //vertex colors and materials are not read
+      return LoadNative(fn,lext,tri);
+    }
     else {
       fprintf(stderr,"Import(TriMesh): file extension %s not recognized\n",ext);
       return false;
@@ -151,6 +189,10 @@ bool Export(const char* fn,const TriMesh& tri)
     out<<tri;
     return true;
   }
+  string lext = LowerExtension(fn);
+  if(lext == "stl") return SaveSTL(fn,tri);
+  else if(lext == "ply") return SavePLY(fn,tri);
+  else if(lext == "obj") return SaveOBJ(fn,tri);
   else {
 #if HAVE_ASSIMP
     if(!SaveAssimp(fn,tri)) {
@@ -484,6 +526,813 @@ bool LoadOBJ(const char* fn,FILE* f,TriMesh& tri,GeometryAppearance& app)
 
 
 
+/*************************************************************************
+ * Buffer-based loaders and savers for STL, PLY, and OBJ.
+ *
+ * The loaders parse a memory-mapped copy of the file and never go
+ * through iostreams.
+ ************************************************************************/
+
+static inline bool IsLittleEndian()
+{
+  int x = 1;
+  return *(const char*)&x == 1;
+}
+
+static inline void SwapBytes(char* p,int n)
+{
+  for(int i=0;i<n/2;i++) std::swap(p[i],p[n-1-i]);
+}
+
+static inline bool IsLineSpace(char c) { return c==' ' || c=='\t' || c=='\r'; }
+
+static inline const char* SkipLineSpace(const char* p,const char* end)
+{
+  while(p < end && IsLineSpace(*p)) p++;
+  return p;
+}
+
+static inline const char* SkipSpace(const char* p,const char* end)
+{
+  while(p < end && isspace((unsigned char)*p)) p++;
+  return p;
+}
+
+static inline const char* SkipLine(const char* p,const char* end)
+{
+  const char* eol = (const char*)memchr(p,'\n',end-p);
+  return (eol ? eol+1 : end);
+}
+
+static inline const char* SkipToken(const char* p,const char* end)
+{
+  while(p < end && !isspace((unsigned char)*p)) p++;
+  return p;
+}
+
+//parses a signed integer and advances p
+static inline bool ParseInt(const char*& p,const char* end,int& value)
+{
+  const char* c = p;
+  bool neg = false;
+  if(c < end && (*c == '-' || *c == '+')) { neg = (*c == '-'); c++; }
+  if(c >= end || !isdigit((unsigned char)*c)) return false;
+  long long v = 0;
+  while(c < end && isdigit((unsigned char)*c)) {
+    v = v*10 + (*c-'0');
+    if(v > INT_MAX) return false;
+    c++;
+  }
+  value = (int)(neg ? -v : v);
+  p = c;
+  return true;
+}
+
+//parses a floating point number and advances p.  Numbers with at most 19
+//significant digits and small exponents are computed exactly from the
+//digits (Clinger's fast path), the rest go through strtod.
+static bool ParseReal(const char*& p,const char* end,double& value)
+{
+  static const double pow10[23] = {1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9,1e10,1e11,1e12,1e13,1e14,1e15,1e16,1e17,1e18,1e19,1e20,1e21,1e22};
+  const char* c = p;
+  bool neg = false;
+  if(c < end && (*c == '-' || *c == '+')) { neg = (*c == '-'); c++; }
+  unsigned long long mantissa = 0;
+  int numDigits = 0, exp10 = 0;
+  bool anyDigits = false;
+  while(c < end && isdigit((unsigned char)*c)) {
+    if(mantissa != 0 || *c != '0') numDigits++;
+    if(numDigits <= 19) mantissa = mantissa*10 + (*c-'0');
+    else exp10++;
+    anyDigits = true;
+    c++;
+  }
+  if(c < end && *c == '.') {
+    c++;
+    while(c < end && isdigit((unsigned char)*c)) {
+      if(mantissa != 0 || *c != '0') numDigits++;
+      if(numDigits <= 19) {
+	mantissa = mantissa*10 + (*c-'0');
+	exp10--;
+      }
+      anyDigits = true;
+      c++;
+    }
+  }
+  if(!anyDigits) {
+    //inf, nan, etc
+    char buf[64];
+    int n = 0;
+    const char* t = p;
+    while(t < end && n < 63 && !isspace((unsigned char)*t)) buf[n++] = *t++;
+    buf[n] = 0;
+    char* tend;
+    value = strtod(buf,&tend);
+    if(tend == buf) return false;
+    p += (tend-buf);
+    return true;
+  }
+  if(c < end && (*c == 'e' || *c == 'E')) {
+    const char* e = c+1;
+    int expval;
+    if(ParseInt(e,end,expval)) {
+      exp10 += expval;
+      c = e;
+    }
+  }
+  if(numDigits <= 19 && mantissa < (1ULL<<53) && exp10 >= -22 && exp10 <= 22) {
+    double v = (double)mantissa;
+    if(exp10 < 0) v /= pow10[-exp10];
+    else v *= pow10[exp10];
+    value = (neg ? -v : v);
+    p = c;
+    return true;
+  }
+  char buf[128];
+  size_t n = Min(size_t(c-p),sizeof(buf)-1);
+  memcpy(buf,p,n);
+  buf[n] = 0;
+  value = strtod(buf,NULL);
+  p = c;
+  return true;
+}
+
+//writes x with the fewest digits (15 or 17) that read back exactly
+static void WriteReal(FILE* f,double x)
+{
+  char buf[32];
+  snprintf(buf,32,"%.15g",x);
+  if(strtod(buf,NULL) != x) snprintf(buf,32,"%.17g",x);
+  fputs(buf,f);
+}
+
+/** Assigns indices to vertices, merging exact duplicates, using an
+ * open-addressing hash table.
+ */
+class VertexWelder
+{
+public:
+  VertexWelder(vector<Vector3>& _verts,size_t expected)
+    :verts(_verts)
+  {
+    size_t n = 16;
+    while(n < expected*2) n *= 2;
+    slots.assign(n,-1);
+  }
+
+  int Add(const Vector3& v)
+  {
+    if(verts.size()*2 >= slots.size()) Grow();
+    size_t mask = slots.size()-1;
+    size_t h = Hash(v) & mask;
+    while(true) {
+      int s = slots[h];
+      if(s < 0) {
+	slots[h] = (int)verts.size();
+	verts.push_back(v);
+	return slots[h];
+      }
+      const Vector3& w = verts[s];
+      if(w.x == v.x && w.y == v.y && w.z == v.z) return s;
+      h = (h+1) & mask;
+    }
+  }
+
+private:
+  static inline unsigned long long Bits(Real x)
+  {
+    if(x == 0) x = 0;  //-0 and 0 compare equal, so must hash equal
+    double d = x;
+    unsigned long long b;
+    memcpy(&b,&d,sizeof(b));
+    return b;
+  }
+
+  static inline size_t Hash(const Vector3& v)
+  {
+    unsigned long long h = Bits(v.x)*0x9E3779B97F4A7C15ULL;
+    h ^= Bits(v.y)*0xC2B2AE3D27D4EB4FULL;
+    h ^= Bits(v.z)*0x165667B19E3779F9ULL;
+    h ^= h >> 29;
+    return (size_t)h;
+  }
+
+  void Grow()
+  {
+    slots.assign(slots.size()*2,-1);
+    size_t mask = slots.size()-1;
+    for(size_t i=0;i<verts.size();i++) {
+      size_t h = Hash(verts[i]) & mask;
+      while(slots[h] >= 0) h = (h+1) & mask;
+      slots[h] = (int)i;
+    }
+  }
+
+  vector<Vector3>& verts;
+  vector<int> slots;
+};
+
+typedef bool (*BufferLoader)(const char* data,size_t size,TriMesh& tri);
+
+static bool LoadMappedFile(const char* fn,BufferLoader loader,TriMesh& tri)
+{
+  FileUtils::MappedFile file;
+  if(!file.Open(fn)) {
+    fprintf(stderr,"Unable to open or map file %s\n",fn);
+    return false;
+  }
+  return loader(file.data,file.size,tri);
+}
+
+bool LoadSTL(const char* fn,TriMesh& tri)
+{
+  return LoadMappedFile(fn,LoadSTL,tri);
+}
+
+//reads numTris binary facets, ignoring any bytes after them
+static void LoadBinarySTL(const char* data,unsigned int numTris,TriMesh& tri)
+{
+  tri.verts.resize(0);
+  tri.tris.resize(numTris);
+  VertexWelder welder(tri.verts,numTris/2+16);
+  bool swap = !IsLittleEndian();
+  float v[9];
+  for(unsigned int i=0;i<numTris;i++) {
+    //skip the normal
+    memcpy(v,data+84+size_t(i)*50+12,36);
+    if(swap) for(int k=0;k<9;k++) SwapBytes((char*)&v[k],4);
+    tri.tris[i].a = welder.Add(Vector3(v[0],v[1],v[2]));
+    tri.tris[i].b = welder.Add(Vector3(v[3],v[4],v[5]));
+    tri.tris[i].c = welder.Add(Vector3(v[6],v[7],v[8]));
+  }
+}
+
+//only the vertex lines matter
+static bool LoadASCIISTL(const char* data,size_t size,TriMesh& tri)
+{
+  const char* p = data;
+  const char* end = data+size;
+  VertexWelder welder(tri.verts,size/200+16);
+  int corner[3];
+  int numCorners = 0;
+  Vector3 x;
+  while(true) {
+    p = SkipSpace(p,end);
+    if(p >= end) break;
+    const char* tok = p;
+    p = SkipToken(p,end);
+    if(p-tok == 6 && strncmp(tok,"vertex",6) == 0) {
+      for(int k=0;k<3;k++) {
+	p = SkipSpace(p,end);
+	double val;
+	if(!ParseReal(p,end,val)) {
+	  fprintf(stderr,"LoadSTL: invalid vertex at byte %d\n",(int)(tok-data));
+	  return false;
+	}
+	x[k] = val;
+      }
+      corner[numCorners++] = welder.Add(x);
+      if(numCorners == 3) {
+	tri.tris.push_back(IntTriple(corner[0],corner[1],corner[2]));
+	numCorners = 0;
+      }
+    }
+  }
+  if(numCorners != 0) {
+    fprintf(stderr,"LoadSTL: number of vertices is not a multiple of 3\n");
+    return false;
+  }
+  return true;
+}
+
+bool LoadSTL(const char* data,size_t size,TriMesh& tri)
+{
+  tri.verts.resize(0);
+  tri.tris.resize(0);
+  //ASCII files start with "solid", but so do some binary files.  A file
+  //whose size is exactly that implied by the binary triangle count is
+  //binary.  Some writers pad binary files, so a larger file is binary too
+  //unless it parses as ASCII with at least one facet
+  unsigned int numTris = 0;
+  bool binaryFits = false;
+  if(size >= 84) {
+    memcpy(&numTris,data+80,4);
+    if(!IsLittleEndian()) SwapBytes((char*)&numTris,4);
+    size_t binarySize = 84 + size_t(numTris)*50;
+    if(size == binarySize) {
+      LoadBinarySTL(data,numTris,tri);
+      return true;
+    }
+    binaryFits = (numTris > 0 && size > binarySize);
+  }
+  if(size >= 5 && strncmp(data,"solid",5) == 0) {
+    bool res = LoadASCIISTL(data,size,tri);
+    if(res && !tri.tris.empty()) return true;
+    //no facets: maybe a padded binary file whose header starts with "solid"
+    if(!binaryFits) return res;
+  }
+  else if(!binaryFits) {
+    fprintf(stderr,"LoadSTL: not a binary or ASCII STL file\n");
+    return false;
+  }
+  LoadBinarySTL(data,numTris,tri);
+  return true;
+}
+
+bool SaveSTL(const char* fn,const TriMesh& tri,bool binary)
+{
+  FILE* f = fopen(fn,(binary ? "wb" : "w"));
+  if(!f) return false;
+  Vector3 n;
+  if(binary) {
+    char header[80];
+    memset(header,0,80);
+    strcpy(header,"binary STL written by KrisLibrary");
+    fwrite(header,1,80,f);
+    unsigned int numTris = (unsigned int)tri.tris.size();
+    bool swap = !IsLittleEndian();
+    if(swap) SwapBytes((char*)&numTris,4);
+    fwrite(&numTris,4,1,f);
+    char rec[50];
+    memset(rec,0,50);
+    float v[12];
+    for(size_t i=0;i<tri.tris.size();i++) {
+      n = tri.TriangleNormal(i);
+      const Vector3& a=tri.verts[tri.tris[i].a],&b=tri.verts[tri.tris[i].b],&c=tri.verts[tri.tris[i].c];
+      v[0]=n.x; v[1]=n.y; v[2]=n.z;
+      v[3]=a.x; v[4]=a.y; v[5]=a.z;
+      v[6]=b.x; v[7]=b.y; v[8]=b.z;
+      v[9]=c.x; v[10]=c.y; v[11]=c.z;
+      if(swap) for(int k=0;k<12;k++) SwapBytes((char*)&v[k],4);
+      memcpy(rec,v,48);
+      fwrite(rec,1,50,f);
+    }
+  }
+  else {
+    fprintf(f,"solid mesh\n");
+    for(size_t i=0;i<tri.tris.size();i++) {
+      n = tri.TriangleNormal(i);
+      fprintf(f,"facet normal %g %g %g\n  outer loop\n",n.x,n.y,n.z);
+      for(int k=0;k<3;k++) {
+	const Vector3& v = tri.verts[tri.tris[i][k]];
+	fputs("    vertex ",f);
+	WriteReal(f,v.x); fputc(' ',f);
+	WriteReal(f,v.y); fputc(' ',f);
+	WriteReal(f,v.z); fputc('\n',f);
+      }
+      fprintf(f,"  endloop\nendfacet\n");
+    }
+    fprintf(f,"endsolid mesh\n");
+  }
+  bool ok = !ferror(f);
+  fclose(f);
+  return ok;
+}
+
+
+
+enum { PLYInt8, PLYUInt8, PLYInt16, PLYUInt16, PLYInt32, PLYUInt32, PLYFloat32, PLYFloat64, PLYInvalid };
+
+static int PLYType(const string& name)
+{
+  if(name == "char" || name == "int8") return PLYInt8;
+  if(name == "uchar" || name == "uint8") return PLYUInt8;
+  if(name == "short" || name == "int16") return PLYInt16;
+  if(name == "ushort" || name == "uint16") return PLYUInt16;
+  if(name == "int" || name == "int32") return PLYInt32;
+  if(name == "uint" || name == "uint32") return PLYUInt32;
+  if(name == "float" || name == "float32") return PLYFloat32;
+  if(name == "double" || name == "float64") return PLYFloat64;
+  return PLYInvalid;
+}
+
+static const int plyTypeSize[8] = {1,1,2,2,4,4,4,8};
+
+struct PLYProperty
+{
+  string name;
+  int type;
+  ///for list properties, the type of the count, otherwise PLYInvalid
+  int countType;
+};
+
+struct PLYElement
+{
+  string name;
+  size_t count;
+  vector<PLYProperty> properties;
+};
+
+static inline double ReadPLYBinary(const char* p,int type,bool swap)
+{
+  char buf[8];
+  int n = plyTypeSize[type];
+  memcpy(buf,p,n);
+  if(swap) SwapBytes(buf,n);
+  switch(type) {
+  case PLYInt8: return *(const signed char*)buf;
+  case PLYUInt8: return *(const unsigned char*)buf;
+  case PLYInt16: return *(const short*)buf;
+  case PLYUInt16: return *(const unsigned short*)buf;
+  case PLYInt32: return *(const int*)buf;
+  case PLYUInt32: return *(const unsigned int*)buf;
+  case PLYFloat32: return *(const float*)buf;
+  default: return *(const double*)buf;
+  }
+}
+
+//reads one value of an element, in either format, and advances p
+static inline bool ReadPLYValue(const char*& p,const char* end,int type,int format,bool swap,double& value)
+{
+  if(format == 0) {
+    p = SkipSpace(p,end);
+    return ParseReal(p,end,value);
+  }
+  if(p + plyTypeSize[type] > end) return false;
+  value = ReadPLYBinary(p,type,swap);
+  p += plyTypeSize[type];
+  return true;
+}
+
+bool LoadPLY(const char* fn,TriMesh& tri)
+{
+  return LoadMappedFile(fn,LoadPLY,tri);
+}
+
+bool LoadPLY(const char* data,size_t size,TriMesh& tri)
+{
+  tri.verts.resize(0);
+  tri.tris.resize(0);
+  const char* p = data;
+  const char* end = data+size;
+  if(size < 4 || strncmp(data,"ply",3) != 0) {
+    fprintf(stderr,"LoadPLY: not a PLY file\n");
+    return false;
+  }
+  //parse the header
+  int format = -1;  //0: ascii, 1: binary little endian, 2: binary big endian
+  vector<PLYElement> elements;
+  bool foundEnd = false;
+  p = SkipLine(p,end);
+  while(p < end && !foundEnd) {
+    const char* eol = SkipLine(p,end);
+    stringstream ss(string(p,eol));
+    p = eol;
+    string word;
+    if(!(ss >> word)) continue;
+    if(word == "format") {
+      string fmt;
+      ss >> fmt;
+      if(fmt == "ascii") format = 0;
+      else if(fmt == "binary_little_endian") format = 1;
+      else if(fmt == "binary_big_endian") format = 2;
+      else {
+	fprintf(stderr,"LoadPLY: unknown format %s\n",fmt.c_str());
+	return false;
+      }
+    }
+    else if(word == "element") {
+      PLYElement e;
+      long long count;
+      ss >> e.name >> count;
+      if(!ss || count < 0) {
+	fprintf(stderr,"LoadPLY: invalid element line\n");
+	return false;
+      }
+      e.count = (size_t)count;
+      elements.push_back(e);
+    }
+    else if(word == "property") {
+      if(elements.empty()) {
+	fprintf(stderr,"LoadPLY: property before element\n");
+	return false;
+      }
+      PLYProperty prop;
+      string type;
+      ss >> type;
+      if(type == "list") {
+	string countType,itemType;
+	ss >> countType >> itemType;
+	prop.countType = PLYType(countType);
+	prop.type = PLYType(itemType);
+	if(prop.countType == PLYInvalid || prop.type == PLYInvalid) {
+	  fprintf(stderr,"LoadPLY: invalid list property types %s %s\n",countType.c_str(),itemType.c_str());
+	  return false;
+	}
+      }
+      else {
+	prop.countType = PLYInvalid;
+	prop.type = PLYType(type);
+	if(prop.type == PLYInvalid) {
+	  fprintf(stderr,"LoadPLY: invalid property type %s\n",type.c_str());
+	  return false;
+	}
+      }
+      ss >> prop.name;
+      elements.back().properties.push_back(prop);
+    }
+    else if(word == "end_header") foundEnd = true;
+    //comment, obj_info are skipped
+  }
+  if(!foundEnd || format < 0) {
+    fprintf(stderr,"LoadPLY: invalid header\n");
+    return false;
+  }
+  bool swap = (format == 1 && !IsLittleEndian()) || (format == 2 && IsLittleEndian());
+  //read the elements
+  vector<int> face;
+  for(size_t e=0;e<elements.size();e++) {
+    const PLYElement& el = elements[e];
+    bool isVertex = (el.name == "vertex");
+    bool isFace = (el.name == "face");
+    int coord[3] = {-1,-1,-1};
+    int indexProp = -1;
+    for(size_t k=0;k<el.properties.size();k++) {
+      const PLYProperty& prop = el.properties[k];
+      if(isVertex && prop.countType == PLYInvalid) {
+	if(prop.name == "x") coord[0] = (int)k;
+	else if(prop.name == "y") coord[1] = (int)k;
+	else if(prop.name == "z") coord[2] = (int)k;
+      }
+      if(isFace && prop.countType != PLYInvalid && (prop.name == "vertex_indices" || prop.name == "vertex_index"))
+	indexProp = (int)k;
+    }
+    if(isVertex && (coord[0] < 0 || coord[1] < 0 || coord[2] < 0)) {
+      fprintf(stderr,"LoadPLY: vertex element is missing x, y, or z\n");
+      return false;
+    }
+    if(el.properties.empty()) continue;
+    //the count comes from the header, so check it against the bytes left
+    //before allocating.  ASCII records have no fixed size, so for those the
+    //arrays grow as the elements are read
+    if(format != 0) {
+      size_t minSize = 0;
+      for(size_t k=0;k<el.properties.size();k++) {
+	const PLYProperty& prop = el.properties[k];
+	minSize += plyTypeSize[prop.countType == PLYInvalid ? prop.type : prop.countType];
+      }
+      if(el.count > size_t(end-p)/minSize) {
+	fprintf(stderr,"LoadPLY: %s element count %lu exceeds the file size\n",el.name.c_str(),(unsigned long)el.count);
+	return false;
+      }
+    }
+    if(isVertex) {
+      tri.verts.resize(0);
+      if(format != 0) tri.verts.reserve(el.count);
+    }
+    if(isFace && format != 0) tri.tris.reserve(el.count);
+    for(size_t i=0;i<el.count;i++) {
+      if(isVertex) tri.verts.push_back(Vector3(Zero));
+      for(size_t k=0;k<el.properties.size();k++) {
+	const PLYProperty& prop = el.properties[k];
+	double value;
+	if(prop.countType == PLYInvalid) {
+	  if(!ReadPLYValue(p,end,prop.type,format,swap,value)) {
+	    fprintf(stderr,"LoadPLY: premature end of %s element %d\n",el.name.c_str(),(int)i);
+	    return false;
+	  }
+	  if(isVertex) {
+	    if((int)k == coord[0]) tri.verts.back().x = value;
+	    else if((int)k == coord[1]) tri.verts.back().y = value;
+	    else if((int)k == coord[2]) tri.verts.back().z = value;
+	  }
+	}
+	else {
+	  //each list item takes at least one byte (ASCII) or its size
+	  size_t itemSize = (format == 0 ? 1 : plyTypeSize[prop.type]);
+	  if(!ReadPLYValue(p,end,prop.countType,format,swap,value) || value < 0 || value > double(size_t(end-p)/itemSize)) {
+	    fprintf(stderr,"LoadPLY: invalid list in %s element %d\n",el.name.c_str(),(int)i);
+	    return false;
+	  }
+	  int n = (int)value;
+	  bool keep = ((int)k == indexProp);
+	  if(keep) face.resize(n);
+	  for(int j=0;j<n;j++) {
+	    if(!ReadPLYValue(p,end,prop.type,format,swap,value)) {
+	      fprintf(stderr,"LoadPLY: premature end of %s element %d\n",el.name.c_str(),(int)i);
+	      return false;
+	    }
+	    if(keep) face[j] = (int)value;
+	  }
+	  if(keep) {
+	    for(int j=0;j<n;j++)
+	      if(face[j] < 0 || face[j] >= (int)tri.verts.size()) {
+		fprintf(stderr,"LoadPLY: face %d has out of range vertex %d\n",(int)i,face[j]);
+		return false;
+	      }
+	    for(int j=2;j<n;j++)
+	      tri.tris.push_back(IntTriple(face[0],face[j-1],face[j]));
+	  }
+	}
+      }
+    }
+  }
+  return true;
+}
+
+bool SavePLY(const char* fn,const TriMesh& tri,bool binary)
+{
+  FILE* f = fopen(fn,(binary ? "wb" : "w"));
+  if(!f) return false;
+  fprintf(f,"ply\n");
+  if(binary) fprintf(f,"format %s 1.0\n",(IsLittleEndian() ? "binary_little_endian" : "binary_big_endian"));
+  else fprintf(f,"format ascii 1.0\n");
+  fprintf(f,"comment written by KrisLibrary\n");
+  fprintf(f,"element vertex %d\n",(int)tri.verts.size());
+  fprintf(f,"property double x\nproperty double y\nproperty double z\n");
+  fprintf(f,"element face %d\n",(int)tri.tris.size());
+  fprintf(f,"property list uchar int vertex_indices\n");
+  fprintf(f,"end_header\n");
+  if(binary) {
+    for(size_t i=0;i<tri.verts.size();i++) {
+      double v[3] = {tri.verts[i].x,tri.verts[i].y,tri.verts[i].z};
+      fwrite(v,sizeof(double),3,f);
+    }
+    char rec[13];
+    rec[0] = 3;
+    for(size_t i=0;i<tri.tris.size();i++) {
+      memcpy(rec+1,&tri.tris[i].a,4);
+      memcpy(rec+5,&tri.tris[i].b,4);
+      memcpy(rec+9,&tri.tris[i].c,4);
+      fwrite(rec,1,13,f);
+    }
+  }
+  else {
+    for(size_t i=0;i<tri.verts.size();i++) {
+      WriteReal(f,tri.verts[i].x); fputc(' ',f);
+      WriteReal(f,tri.verts[i].y); fputc(' ',f);
+      WriteReal(f,tri.verts[i].z); fputc('\n',f);
+    }
+    for(size_t i=0;i<tri.tris.size();i++)
+      fprintf(f,"3 %d %d %d\n",tri.tris[i].a,tri.tris[i].b,tri.tris[i].c);
+  }
+  bool ok = !ferror(f);
+  fclose(f);
+  return ok;
+}
+
+
+
+///A range of whole lines of an OBJ file, and what was parsed from it
+struct OBJChunk
+{
+  const char* begin,*end;
+  vector<Vector3> verts;
+  ///triangle vertex indices.  Positive OBJ indices are stored as global
+  ///indices, negative (relative) ones as indices into this chunk's verts,
+  ///listed in relative so that the chunk's offset can be added later
+  vector<int> indices;
+  vector<size_t> relative;
+  string error;
+};
+
+static void ParseOBJChunk(OBJChunk& chunk)
+{
+  const char* p = chunk.begin;
+  const char* end = chunk.end;
+  vector<int> face;
+  vector<bool> faceRelative;
+  while(p < end) {
+    p = SkipLineSpace(p,end);
+    if(p+1 < end && IsLineSpace(p[1])) {
+      if(*p == 'v') {
+	p += 2;
+	Vector3 x;
+	for(int k=0;k<3;k++) {
+	  p = SkipLineSpace(p,end);
+	  double val;
+	  if(!ParseReal(p,end,val)) {
+	    chunk.error = "invalid v line \""+string(p,SkipLine(p,end))+"\"";
+	    return;
+	  }
+	  x[k] = val;
+	}
+	chunk.verts.push_back(x);
+      }
+      else if(*p == 'f') {
+	p += 2;
+	face.resize(0);
+	faceRelative.resize(0);
+	while(true) {
+	  p = SkipLineSpace(p,end);
+	  if(p >= end || *p == '\n') break;
+	  int v;
+	  if(!ParseInt(p,end,v) || v == 0) {
+	    chunk.error = "invalid f line \""+string(p,SkipLine(p,end))+"\"";
+	    return;
+	  }
+	  //skip /vt/vn
+	  p = SkipToken(p,end);
+	  if(v > 0) {
+	    face.push_back(v-1);
+	    faceRelative.push_back(false);
+	  }
+	  else {
+	    face.push_back((int)chunk.verts.size()+v);
+	    faceRelative.push_back(true);
+	  }
+	}
+	if(face.size() < 3) {
+	  chunk.error = "f line with fewer than 3 vertices";
+	  return;
+	}
+	for(size_t i=2;i<face.size();i++) {
+	  size_t corners[3] = {0,i-1,i};
+	  for(int k=0;k<3;k++) {
+	    if(faceRelative[corners[k]]) chunk.relative.push_back(chunk.indices.size());
+	    chunk.indices.push_back(face[corners[k]]);
+	  }
+	}
+      }
+    }
+    //vt, vn, g, o, s, usemtl, mtllib, comments, etc. are skipped
+    p = SkipLine(p,end);
+  }
+}
+
+static void ParseOBJChunkFunc(void* data,int i)
+{
+  ParseOBJChunk((*reinterpret_cast<vector<OBJChunk>*>(data))[i]);
+}
+
+bool LoadOBJ(const char* fn,TriMesh& tri,int numThreads)
+{
+  FileUtils::MappedFile file;
+  if(!file.Open(fn)) {
+    fprintf(stderr,"Unable to open or map file %s\n",fn);
+    return false;
+  }
+  return LoadOBJ(file.data,file.size,tri,numThreads);
+}
+
+bool LoadOBJ(const char* data,size_t size,TriMesh& tri,int numThreads)
+{
+  //split into chunks of about 1MB, on line boundaries
+  const size_t chunkSize = 1<<20;
+  vector<OBJChunk> chunks;
+  const char* end = data+size;
+  const char* p = data;
+  while(p < end) {
+    OBJChunk chunk;
+    chunk.begin = p;
+    p = (size_t(end-p) > chunkSize ? SkipLine(p+chunkSize,end) : end);
+    chunk.end = p;
+    chunks.push_back(chunk);
+  }
+  ParallelFor((int)chunks.size(),ParseOBJChunkFunc,&chunks,numThreads);
+  //concatenate
+  vector<size_t> vertOffset(chunks.size()+1,0),indexOffset(chunks.size()+1,0);
+  for(size_t i=0;i<chunks.size();i++) {
+    if(!chunks[i].error.empty()) {
+      fprintf(stderr,"LoadOBJ: %s\n",chunks[i].error.c_str());
+      return false;
+    }
+    vertOffset[i+1] = vertOffset[i] + chunks[i].verts.size();
+    indexOffset[i+1] = indexOffset[i] + chunks[i].indices.size();
+  }
+  tri.verts.resize(vertOffset.back());
+  tri.tris.resize(indexOffset.back()/3);
+  int numVerts = (int)tri.verts.size();
+  int* indices = (tri.tris.empty() ? NULL : &tri.tris[0].a);
+  for(size_t i=0;i<chunks.size();i++) {
+    OBJChunk& chunk = chunks[i];
+    copy(chunk.verts.begin(),chunk.verts.end(),tri.verts.begin()+vertOffset[i]);
+    for(size_t k=0;k<chunk.relative.size();k++)
+      chunk.indices[chunk.relative[k]] += (int)vertOffset[i];
+    for(size_t k=0;k<chunk.indices.size();k++) {
+      int v = chunk.indices[k];
+      if(v < 0 || v >= numVerts) {
+	fprintf(stderr,"LoadOBJ: face vertex %d is out of bounds 1,...,%d\n",v+1,numVerts);
+	return false;
+      }
+      indices[indexOffset[i]+k] = v;
+    }
+    //free memory as we go
+    vector<Vector3>().swap(chunk.verts);
+    vector<int>().swap(chunk.indices);
+  }
+  return true;
+}
+
+bool SaveOBJ(const char* fn,const TriMesh& tri)
+{
+  FILE* f = fopen(fn,"w");
+  if(!f) return false;
+  for(size_t i=0;i<tri.verts.size();i++) {
+    fputs("v ",f);
+    WriteReal(f,tri.verts[i].x); fputc(' ',f);
+    WriteReal(f,tri.verts[i].y); fputc(' ',f);
+    WriteReal(f,tri.verts[i].z); fputc('\n',f);
+  }
+  for(size_t i=0;i<tri.tris.size();i++)
+    fprintf(f,"f %d %d %d\n",tri.tris[i].a+1,tri.tris[i].b+1,tri.tris[i].c+1);
+  bool ok = !ferror(f);
+  fclose(f);
+  return ok;
+}
+
+
+
 #if HAVE_ASSIMP
 
 
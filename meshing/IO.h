@@ -37,6 +37,33 @@ bool LoadOFF(std::istream& in,TriMesh& tri);
 ///Saves to the GeomView Object File Format (OFF)
 bool SaveOFF(std::ostream& out,const TriMesh& tri);
 
+///Loads from an ASCII or binary STL file.  Vertices with identical
+///coordinates are merged.
+bool LoadSTL(const char* fn,TriMesh& tri);
+///Loads an STL file from a memory buffer
+bool LoadSTL(const char* data,size_t size,TriMesh& tri);
+///Saves to STL.  Binary STL stores coordinates as floats.
+bool SaveSTL(const char* fn,const TriMesh& tri,bool binary=true);
+
+///Loads from an ASCII or binary PLY file.  Only the vertex x,y,z
+///properties and the face vertex_indices lists are read, and polygons are
+///split into triangle fans.
+bool LoadPLY(const char* fn,TriMesh& tri);
+///Loads a PLY file from a memory buffer
+bool LoadPLY(const char* data,size_t size,TriMesh& tri);
+///Saves to PLY with double precision coordinates
+bool SavePLY(const char* fn,const TriMesh& tri,bool binary=true);
+
+///Loads the geometry of a Wavefront OBJ file.  Texture coordinates,
+///normals, groups, and materials are ignored; use Import() with an
+///appearance to get colors and textures.  Large files are parsed in chunks
+///over up to numThreads threads (<= 0 uses all hardware threads).
+bool LoadOBJ(const char* fn,TriMesh& tri,int numThreads=0);
+///Loads an OBJ file from a memory buffer
+bool LoadOBJ(const char* data,size_t size,TriMesh& tri,int numThreads=0);
+///Saves to OBJ
+bool SaveOBJ(const char* fn,const TriMesh& tri);
+
 ///Loads using Assimp if available on your system
 bool LoadAssimp(const char* fn,TriMesh& tri);
 ///Loads using Assimp if available on your system
@@ -5,6 +5,8 @@
 #include "MarchingCubes.h"
 #include <math3d/interpolate.h>
 #include <math/function.h>
+#include "VolumeGrid.h"
+#include <algorithm>
 
 namespace Meshing {
 
@@ -605,6 +607,87 @@ void MarchingCubes(Real (*input)(Real,Real,Real),Real isoLevel,const AABB3D& bb,
 }
 
 
+//meshes the cube with lowest corner x and size dh, given the values at its
+//corners in the order of EvaluateCube
+static void MarchCube(const Real vals[8],Real isoLevel,const Vector3& x,const Vector3& dh,TriMesh& m)
+{
+  Vector3 verts[12];
+  int vertMap[12];
+  IntTriple tri;
+  int cubeIndex = 0;
+  if (vals[0] < isoLevel) cubeIndex |= 1;
+  if (vals[1] < isoLevel) cubeIndex |= 2;
+  if (vals[2] < isoLevel) cubeIndex |= 4;
+  if (vals[3] < isoLevel) cubeIndex |= 8;
+  if (vals[4] < isoLevel) cubeIndex |= 16;
+  if (vals[5] < isoLevel) cubeIndex |= 32;
+  if (vals[6] < isoLevel) cubeIndex |= 64;
+  if (vals[7] < isoLevel) cubeIndex |= 128;
+
+  if (MCEdgeTable[cubeIndex] == 0) return;
+
+  if (MCEdgeTable[cubeIndex] & 1) {
+    Real u=SegmentCrossing(vals[0], vals[1], isoLevel);
+    verts[0] = EvalCubeEdge(x,dh,u,0,1);
+  }
+  if (MCEdgeTable[cubeIndex] & 2) {
+    Real u=SegmentCrossing(vals[1], vals[2], isoLevel);
+    verts[1] = EvalCubeEdge(x,dh,u,1,2);
+  }
+  if (MCEdgeTable[cubeIndex] & 4) {
+    Real u=SegmentCrossing(vals[2], vals[3], isoLevel);
+    verts[2] = EvalCubeEdge(x,dh,u,2,3);
+  }
+  if (MCEdgeTable[cubeIndex] & 8) {
+    Real u=SegmentCrossing(vals[3], vals[0], isoLevel);
+    verts[3] = EvalCubeEdge(x,dh,u,3,0);
+  }
+  if (MCEdgeTable[cubeIndex] & 16) {
+    Real u=SegmentCrossing(vals[4], vals[5], isoLevel);
+    verts[4] = EvalCubeEdge(x,dh,u,4,5);
+  }
+  if (MCEdgeTable[cubeIndex] & 32) {
+    Real u=SegmentCrossing(vals[5], vals[6], isoLevel);
+    verts[5] = EvalCubeEdge(x,dh,u,5,6);
+  }
+  if (MCEdgeTable[cubeIndex] & 64) {
+    Real u=SegmentCrossing(vals[6], vals[7], isoLevel);
+    verts[6] = EvalCubeEdge(x,dh,u,6,7);
+  }
+  if (MCEdgeTable[cubeIndex] & 128) {
+    Real u=SegmentCrossing(vals[7], vals[4], isoLevel);
+    verts[7] = EvalCubeEdge(x,dh,u,7,4);
+  }
+  if (MCEdgeTable[cubeIndex] & 256) {
+    Real u=SegmentCrossing(vals[0], vals[4], isoLevel);
+    verts[8] = EvalCubeEdge(x,dh,u,0,4);
+  }
+  if (MCEdgeTable[cubeIndex] & 512) {
+    Real u=SegmentCrossing(vals[1], vals[5], isoLevel);
+    verts[9] = EvalCubeEdge(x,dh,u,1,5);
+  }
+  if (MCEdgeTable[cubeIndex] & 1024) {
+    Real u=SegmentCrossing(vals[2], vals[6], isoLevel);
+    verts[10] = EvalCubeEdge(x,dh,u,2,6);
+  }
+  if (MCEdgeTable[cubeIndex] & 2048) {
+    Real u=SegmentCrossing(vals[3], vals[7], isoLevel);
+    verts[11] = EvalCubeEdge(x,dh,u,3,7);
+  }
+
+  //get the mapping from tri vertices to mesh vertices
+  for(int* t=MCTriTable[cubeIndex];*t!=-1; t++) {
+    vertMap[*t] = (int)m.verts.size();
+    m.verts.push_back(verts[*t]);
+  }
+  for(int* t=MCTriTable[cubeIndex];*t!=-1; t+=3) {
+    tri.a = vertMap[*t];
+    tri.b = vertMap[*(t+1)];
+    tri.c = vertMap[*(t+2)];
+    m.tris.push_back(tri);
+  }
+}
+
 void MarchingCubes(const Array3D<Real>& input,Real isoLevel,const AABB3D& bb,TriMesh& m)
 {
   m.verts.resize(0);
@@ -612,15 +695,12 @@ void MarchingCubes(const Array3D<Real>& input,Real isoLevel,const AABB3D& bb,Tri
   m.verts.reserve(input.m*input.n);
   m.tris.reserve(input.m*input.n);
   Real vals[8];
-  Vector3 verts[12];
-  int vertMap[12];
   Vector3 x;
   Vector3 dh(bb.bmax-bb.bmin);
   dh.x /= Real(input.m-1);
   dh.y /= Real(input.n-1);
   dh.z /= Real(input.p-1);
 
-  IntTriple tri;
   x = bb.bmin;
   for (int i=0;i<input.m-1;i++,x.x += dh.x) {
     x.y = bb.bmin.y;
@@ -628,81 +708,7 @@ void MarchingCubes(const Array3D<Real>& input,Real isoLevel,const AABB3D& bb,Tri
       x.z = bb.bmin.z;
       for (int k=0;k<input.p-1;k++,x.z += dh.z) {
 	EvaluateCube(input,i,j,k,vals);
-	
-	int cubeIndex = 0;
-	if (vals[0] < isoLevel) cubeIndex |= 1;
-	if (vals[1] < isoLevel) cubeIndex |= 2;
-	if (vals[2] < isoLevel) cubeIndex |= 4;
-	if (vals[3] < isoLevel) cubeIndex |= 8;
-	if (vals[4] < isoLevel) cubeIndex |= 16;
-	if (vals[5] < isoLevel) cubeIndex |= 32;
-	if (vals[6] < isoLevel) cubeIndex |= 64;
-	if (vals[7] < isoLevel) cubeIndex |= 128;
-
-	if (MCEdgeTable[cubeIndex] == 0) {
-	  continue;
-	}
-
-	if (MCEdgeTable[cubeIndex] & 1) {
-	  Real u=SegmentCrossing(vals[0], vals[1], isoLevel);
-	  verts[0] = EvalCubeEdge(x,dh,u,0,1);
-	}
-	if (MCEdgeTable[cubeIndex] & 2) {
-	  Real u=SegmentCrossing(vals[1], vals[2], isoLevel);
-	  verts[1] = EvalCubeEdge(x,dh,u,1,2);
-	}
-	if (MCEdgeTable[cubeIndex] & 4) {
-	  Real u=SegmentCrossing(vals[2], vals[3], isoLevel);
-	  verts[2] = EvalCubeEdge(x,dh,u,2,3);
-	}
-	if (MCEdgeTable[cubeIndex] & 8) {
-	  Real u=SegmentCrossing(vals[3], vals[0], isoLevel);
-	  verts[3] = EvalCubeEdge(x,dh,u,3,0);
-	}
-	if (MCEdgeTable[cubeIndex] & 16) {
-	  Real u=SegmentCrossing(vals[4], vals[5], isoLevel);
-	  verts[4] = EvalCubeEdge(x,dh,u,4,5);
-	}
-	if (MCEdgeTable[cubeIndex] & 32) {
-	  Real u=SegmentCrossing(vals[5], vals[6], isoLevel);
-	  verts[5] = EvalCubeEdge(x,dh,u,5,6);
-	}
-	if (MCEdgeTable[cubeIndex] & 64) {
-	  Real u=SegmentCrossing(vals[6], vals[7], isoLevel);
-	  verts[6] = EvalCubeEdge(x,dh,u,6,7);
-	}
-	if (MCEdgeTable[cubeIndex] & 128) {
-	  Real u=SegmentCrossing(vals[7], vals[4], isoLevel);
-	  verts[7] = EvalCubeEdge(x,dh,u,7,4);
-	}
-	if (MCEdgeTable[cubeIndex] & 256) {
-	  Real u=SegmentCrossing(vals[0], vals[4], isoLevel);
-	  verts[8] = EvalCubeEdge(x,dh,u,0,4);
-	}
-	if (MCEdgeTable[cubeIndex] & 512) {
-	  Real u=SegmentCrossing(vals[1], vals[5], isoLevel);
-	  verts[9] = EvalCubeEdge(x,dh,u,1,5);
-	}
-	if (MCEdgeTable[cubeIndex] & 1024) {
-	  Real u=SegmentCrossing(vals[2], vals[6], isoLevel);
-	  verts[10] = EvalCubeEdge(x,dh,u,2,6);
-	}
-	if (MCEdgeTable[cubeIndex] & 2048) {
-	  Real u=SegmentCrossing(vals[3], vals[7], isoLevel);
-	  verts[11] = EvalCubeEdge(x,dh,u,3,7);
-	}
-
-	//get the mapping from tri vertices to mesh vertices
-	for(int* t=MCTriTable[cubeIndex];*t!=-1; t++) {
-	  vertMap[*t] = (int)m.verts.size();
-	  m.verts.push_back(verts[*t]);
-	}
-	for(int* t=MCTriTable[cubeIndex];*t!=-1; t+=3) {
-	  tri.a = vertMap[*t];
-	  tri.b = vertMap[*(t+1)];
-	  tri.c = vertMap[*(t+2)];
-	  m.tris.push_back(tri);
-	}
+	MarchCube(vals,isoLevel,x,dh,m);
       }
     }
   }
@@ -710,6 +716,32 @@ void MarchingCubes(const Array3D<Real>& input,Real isoLevel,const AABB3D& bb,Tri
   //TODO: merge vertices
 }
 
+void MarchingCubes(const Array3D<Real>& input,Real isoLevel,const AABB3D& bb,const VolumeGridPyramid& pyramid,TriMesh& m)
+{
+  m.verts.resize(0);
+  m.tris.resize(0);
+  std::vector<IntTriple> cubes;
+  pyramid.GetIsoCubes(input,isoLevel,cubes);
+  //output in the same order as the unaccelerated version
+  std::sort(cubes.begin(),cubes.end());
+  m.verts.reserve(cubes.size()*2);
+  m.tris.reserve(cubes.size()*2);
+  Real vals[8];
+  Vector3 x;
+  Vector3 dh(bb.bmax-bb.bmin);
+  dh.x /= Real(input.m-1);
+  dh.y /= Real(input.n-1);
+  dh.z /= Real(input.p-1);
+  for(size_t c=0;c<cubes.size();c++) {
+    const IntTriple& index = cubes[c];
+    x.set(bb.bmin.x+index.a*dh.x,bb.bmin.y+index.b*dh.y,bb.bmin.z+index.c*dh.z);
+    EvaluateCube(input,index.a,index.b,index.c,vals);
+    MarchCube(vals,isoLevel,x,dh,m);
+  }
+
+  //TODO: merge vertices
+}
+
 void CubeToMesh(const Real origvals[8],Real isoLevel,const AABB3D& bb,TriMesh& m)
 {
   m.verts.resize(0);
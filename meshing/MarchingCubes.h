@@ -16,6 +16,8 @@ namespace Math {
 
 namespace Meshing {
 
+  class VolumeGridPyramid;
+
   /** @addtogroup Meshing */
   /*@{*/
 
@@ -28,6 +30,11 @@ void MarchingCubes(Real (*f)(Real,Real,Real),Real isoval,const AABB3D& bb,const
 /// Takes a 3D grid as input, meshes the isosurface at f(x)=isoval
 void MarchingCubes(const Array3D<Real>& input,Real isoval,const AABB3D& bb,TriMesh& m);
 
+/// Same as above, but only visits the cubes that the min/max pyramid of input
+/// shows to contain the isosurface.  Much faster when the surface covers a
+/// small part of the grid.
+void MarchingCubes(const Array3D<Real>& input,Real isoval,const AABB3D& bb,const VolumeGridPyramid& pyramid,TriMesh& m);
+
 /// Takes values of a function f at a cube's vertices as input,
 /// meshes the isosurface at f(x)=isoval
 /// cube vertex indices are given by the index's last 3 bits in xyz order
@@ -1,369 +1,815 @@
 #include "PointCloud.h"
 #include <iostream>
 #include <math3d/AABB3D.h>
-#include <utils/SimpleParser.h>
 #include <utils/stringutils.h>
-#include <utils/ioutils.h>
+#include <utils/fileutils.h>
+#include <utils/lzf.h>
 #include <errors.h>
 #include <sstream>
 #include <fstream>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <algorithm>
 
 using namespace Meshing;
 
-class PCLParser : public SimpleParser
-{
-public:
-  enum {NORMAL, READING_FIELDS, READING_TYPES, READING_SIZES, READING_COUNTS };
-  PCLParser(istream& in,PointCloud3D& _pc)
-    :SimpleParser(in),pc(_pc),state(NORMAL),numPoints(-1)
-  {}
-  virtual bool IsComment(char c) const { return c=='#'; }
-  virtual bool IsToken(char c) const { return !IsSpace(c) && !IsComment(c); }
-  virtual bool IsPunct(char c) const { return !IsSpace(c) && !IsComment(c) && !IsToken(c); }
-  virtual Result InputToken(const string& word) {
-    if(state == READING_FIELDS) {
-      pc.propertyNames.push_back(word);
-    }
-    else if(state == READING_TYPES) {
-      if(word != "F" && word != "U" && word != "I") {
-	fprintf(stderr,"PCD parser: Invalid PCD TYPE %s\n",word.c_str());
-	return Error;
-      }
-      types.push_back(word);
+PCDHeader::PCDHeader()
+  :numPoints(-1)
+{}
+
+///Parses the remaining tokens of ss as positive integers
+static bool ReadPCDIntegers(istream& ss,const char* name,vector<int>& items)
+{
+  items.resize(0);
+  string word;
+  while(ss >> word) {
+    if(!IsValidInteger(word.c_str()) || atoi(word.c_str()) <= 0) {
+      fprintf(stderr,"PCD parser: Invalid PCD %s %s, must be a positive integer\n",name,word.c_str());
+      return false;
     }
-    else if(state == READING_COUNTS) {
-      if(!IsValidInteger(word.c_str())) {
-	fprintf(stderr,"PCD parser: Invalid PCD COUNT string %s, must be integer\n",word.c_str());
-	return Error;
-      }
-      stringstream ss(word);
-      int count;
-      ss>>count;
-      if(count != 1) {
-	fprintf(stderr,"PCD parser: Invalid PCD COUNT %s, we only handle counts of 1\n",word.c_str());
-	return Error;
-      }
-      counts.push_back(count);
+    items.push_back(atoi(word.c_str()));
+  }
+  return true;
+}
+
+bool PCDHeader::Read(istream& in)
+{
+  string line;
+  while(getline(in,line)) {
+    size_t comment = line.find('#');
+    if(comment != string::npos) line.erase(comment);
+    stringstream ss(line);
+    string word;
+    if(!(ss >> word)) continue;
+    if(word == "FIELDS" || word == "COLUMNS") {
+      fields.resize(0);
+      while(ss >> word) fields.push_back(word);
+    }
+    else if(word == "SIZE") {
+      if(!ReadPCDIntegers(ss,"SIZE",sizes)) return false;
+    }
+    else if(word == "COUNT") {
+      if(!ReadPCDIntegers(ss,"COUNT",counts)) return false;
+      for(size_t i=0;i<counts.size();i++)
+        if(counts[i] != 1) {
+          fprintf(stderr,"PCD parser: Invalid PCD COUNT %d, we only handle counts of 1\n",counts[i]);
+          return false;
+        }
     }
-    else if(state == READING_SIZES) {
-      if(!IsValidInteger(word.c_str())) {
-	fprintf(stderr,"PCD parser: Invalid PCD SIZE string %s, must be integer\n",word.c_str());
-	return Error;
+    else if(word == "TYPE") {
+      types.resize(0);
+      while(ss >> word) {
+        if(word != "F" && word != "U" && word != "I") {
+          fprintf(stderr,"PCD parser: Invalid PCD TYPE %s\n",word.c_str());
+          return false;
+        }
+        types.push_back(word[0]);
       }
-      stringstream ss(word);
-      int size;
-      ss>>size;
-      if(size <= 0) {
-	fprintf(stderr,"PCD parser: Invalid PCD SIZE %s, must be positive\n",word.c_str());
-	return Error;
+    }
+    else if(word == "POINTS") {
+      if(!(ss >> numPoints) || numPoints < 0) {
+        fprintf(stderr,"PCD parser: Unable to read integer POINTS\n");
+        return false;
       }
-      sizes.push_back(size);
+    }
+    else if(word == "DATA") {
+      getline(ss,dataFormat);
+      dataFormat = Strip(dataFormat);
+      return true;
     }
     else {
-      if(word == "POINTS") {
-	string points;
-	ReadLine(points);
-	stringstream ss(points);
-	ss>>numPoints;
-	if(!ss) {
-	  fprintf(stderr,"PCD parser: Unable to read integer POINTS\n");
-	  return Error;
-	}
-      }
-      else if(word == "FIELDS") {
-	state = READING_FIELDS;
-      }
-      else if(word == "COUNT") {
-	state = READING_COUNTS;
-      }
-      else if(word == "TYPE") {
-	state = READING_TYPES;
+      string value;
+      getline(ss,value);
+      settings[word] = Strip(value);
+      if(word == "VERSION" && settings[word] != "0.7" && settings[word] != ".7")
+        fprintf(stderr,"PCD parser: Warning, PCD version 0.7 expected, got %s\n",settings[word].c_str());
+    }
+  }
+  fprintf(stderr,"PCD parser: No DATA element\n");
+  return false;
+}
+
+bool PCDHeader::Check()
+{
+  if(dataFormat != "ascii" && dataFormat != "binary" && dataFormat != "binary_compressed") {
+    fprintf(stderr,"PCD parser: DATA is not specified as ascii, binary, or binary_compressed\n");
+    return false;
+  }
+  if(numPoints < 0) {
+    fprintf(stderr,"PCD parser: DATA specified before POINTS element\n");
+    return false;
+  }
+  if(dataFormat == "ascii") {
+    if(sizes.empty()) sizes.resize(fields.size(),4);
+    if(types.empty()) types.resize(fields.size(),'F');
+  }
+  if(counts.empty()) counts.resize(fields.size(),1);
+  if(sizes.size() != fields.size()) {
+    fprintf(stderr,"PCD parser: Invalid number of SIZE elements\n");
+    return false;
+  }
+  if(types.size() != fields.size()) {
+    fprintf(stderr,"PCD parser: Invalid number of TYPE elements\n");
+    return false;
+  }
+  if(counts.size() != fields.size()) {
+    fprintf(stderr,"PCD parser: Invalid number of COUNT elements\n");
+    return false;
+  }
+  if(dataFormat != "ascii") {
+    for(size_t i=0;i<fields.size();i++) {
+      bool valid = (types[i] == 'F' ? (sizes[i] == 4 || sizes[i] == 8) : (sizes[i] == 1 || sizes[i] == 2 || sizes[i] == 4 || sizes[i] == 8));
+      if(!valid) {
+        fprintf(stderr,"PCD parser: Invalid size %d for TYPE %c\n",sizes[i],types[i]);
+        return false;
       }
-      else if(word == "SIZE") {
-	state = READING_SIZES;
+    }
+  }
+  return true;
+}
+
+int PCDHeader::PointSize() const
+{
+  int size = 0;
+  for(size_t i=0;i<sizes.size();i++)
+    size += sizes[i]*(counts.empty() ? 1 : counts[i]);
+  return size;
+}
+
+bool PCDHeader::Write(ostream& out) const
+{
+  out<<"# .PCD v0.7 - Point Cloud Data file format"<<endl;
+  if(settings.find("VERSION") != settings.end())
+    out<<"VERSION "<<settings.find("VERSION")->second<<"\n";
+  else
+    out<<"VERSION 0.7"<<"\n";
+  out<<"FIELDS";
+  for(size_t i=0;i<fields.size();i++) out<<" "<<fields[i];
+  out<<"\n";
+  out<<"SIZE";
+  for(size_t i=0;i<sizes.size();i++) out<<" "<<sizes[i];
+  out<<"\n";
+  out<<"TYPE";
+  for(size_t i=0;i<types.size();i++) out<<" "<<types[i];
+  out<<"\n";
+  out<<"COUNT";
+  for(size_t i=0;i<fields.size();i++) out<<" "<<(counts.empty() ? 1 : counts[i]);
+  out<<"\n";
+  //keep the organized cloud dimensions if they still match
+  map<string,string>::const_iterator w=settings.find("WIDTH"),h=settings.find("HEIGHT");
+  if(w != settings.end() && h != settings.end() && atoi(w->second.c_str())*atoi(h->second.c_str()) == numPoints)
+    out<<"WIDTH "<<w->second<<"\n"<<"HEIGHT "<<h->second<<"\n";
+  else
+    out<<"WIDTH "<<numPoints<<"\n"<<"HEIGHT 1"<<"\n";
+  for(map<string,string>::const_iterator i=settings.begin();i!=settings.end();i++) {
+    if(i->first == "VERSION" || i->first == "WIDTH" || i->first == "HEIGHT") continue;
+    out<<i->first<<" "<<i->second<<"\n";
+  }
+  out<<"POINTS "<<numPoints<<"\n";
+  out<<"DATA "<<dataFormat<<"\n";
+  return (bool)out;
+}
+
+//PCL stores packed rgb / rgba colors as the bits of a float
+inline bool IsPackedColorField(const PCDHeader& header,size_t i)
+{
+  return header.types[i]=='F' && header.sizes[i]==4 && (header.fields[i]=="rgb" || header.fields[i]=="rgba");
+}
+
+template <class T>
+static void DecodePCDColumn(const char* src,size_t stride,int n,Real* dst)
+{
+  T v;
+  for(int i=0;i<n;i++,src+=stride) {
+    memcpy(&v,src,sizeof(T));
+    dst[i] = Real(v);
+  }
+}
+
+///Decodes n values of field i of a binary PCD file, stride bytes apart
+static void DecodePCDField(const PCDHeader& header,size_t i,const char* src,size_t stride,int n,Real* dst)
+{
+  if(IsPackedColorField(header,i)) {
+    DecodePCDColumn<int>(src,stride,n,dst);
+    return;
+  }
+  switch(header.types[i]) {
+  case 'F':
+    if(header.sizes[i]==4) DecodePCDColumn<float>(src,stride,n,dst);
+    else DecodePCDColumn<double>(src,stride,n,dst);
+    break;
+  case 'U':
+    if(header.sizes[i]==1) DecodePCDColumn<unsigned char>(src,stride,n,dst);
+    else if(header.sizes[i]==2) DecodePCDColumn<unsigned short>(src,stride,n,dst);
+    else if(header.sizes[i]==4) DecodePCDColumn<unsigned int>(src,stride,n,dst);
+    else DecodePCDColumn<unsigned long long>(src,stride,n,dst);
+    break;
+  default:
+    if(header.sizes[i]==1) DecodePCDColumn<signed char>(src,stride,n,dst);
+    else if(header.sizes[i]==2) DecodePCDColumn<short>(src,stride,n,dst);
+    else if(header.sizes[i]==4) DecodePCDColumn<int>(src,stride,n,dst);
+    else DecodePCDColumn<long long>(src,stride,n,dst);
+    break;
+  }
+}
+
+///Decodes n point records of DATA binary into rows [first,first+n) of props
+static void DecodePCDBinary(const PCDHeader& header,const char* data,int n,PointCloudProperties& props,int first)
+{
+  size_t pointSize = (size_t)header.PointSize();
+  size_t ofs = 0;
+  for(size_t i=0;i<header.fields.size();i++) {
+    DecodePCDField(header,i,data+ofs,pointSize,n,props.Column((int)i)+first);
+    ofs += header.sizes[i];
+  }
+}
+
+///Decodes a DATA binary_compressed block, which starts with the compressed
+///and uncompressed sizes.  The uncompressed data stores the fields one
+///after another.
+static bool DecodePCDCompressed(const PCDHeader& header,const char* data,size_t len,PointCloudProperties& props)
+{
+  unsigned int sizes[2];
+  if(len < sizeof(sizes)) {
+    fprintf(stderr,"PCD parser: Premature end of compressed DATA element\n");
+    return false;
+  }
+  memcpy(sizes,data,sizeof(sizes));
+  if(sizeof(sizes)+sizes[0] > len) {
+    fprintf(stderr,"PCD parser: Premature end of compressed DATA element\n");
+    return false;
+  }
+  if((size_t)sizes[1] != (size_t)header.numPoints*header.PointSize()) {
+    fprintf(stderr,"PCD parser: Compressed DATA size %u doesn't match %d points\n",sizes[1],header.numPoints);
+    return false;
+  }
+  if(sizes[1] == 0) return true;
+  vector<char> buffer(sizes[1]);
+  if(LZFDecompress(data+sizeof(sizes),sizes[0],&buffer[0],sizes[1]) != sizes[1]) {
+    fprintf(stderr,"PCD parser: Error decompressing DATA element\n");
+    return false;
+  }
+  size_t ofs = 0;
+  for(size_t i=0;i<header.fields.size();i++) {
+    DecodePCDField(header,i,&buffer[ofs],header.sizes[i],header.numPoints,props.Column((int)i));
+    ofs += size_t(header.sizes[i])*header.numPoints;
+  }
+  return true;
+}
+
+///Reads n lines of DATA ascii into rows [first,first+n) of props
+static bool ReadPCDAscii(istream& in,int n,PointCloudProperties& props,int first)
+{
+  string line;
+  int numFields = props.NumProperties();
+  for(int i=first;i<first+n;) {
+    if(!getline(in,line)) {
+      fprintf(stderr,"PCD parser: Premature end of DATA element\n");
+      return false;
+    }
+    const char* c = line.c_str();
+    while(isspace((unsigned char)*c)) c++;
+    if(*c == 0) continue;
+    for(int j=0;j<numFields;j++) {
+      char* end;
+      props(i,j) = Real(strtod(c,&end));
+      if(end == c) {
+        fprintf(stderr,"PCD parser: DATA element %d has length %d, but %d properties specified\n",i,j,numFields);
+        return false;
       }
-      else if(word == "DATA") {
-	string datatype;
-	if(!ReadLine(datatype)) return Error;
-	datatype = Strip(datatype);
-	if(datatype == "binary") {
-	  //pull in the endline
-	  int c = in.get();
-	  assert(c == '\n');
-	  //read in binary data
-	  if(numPoints < 0) {
-	    fprintf(stderr,"PCD parser: DATA specified before POINTS element\n");
-	    return Error;
-	  }
-	  if(sizes.size() != pc.propertyNames.size()) {
-	    fprintf(stderr,"PCD parser: Invalid number of SIZE elements\n");
-	    return Error;
-	  }
-	  if(types.size() != pc.propertyNames.size()) {
-	    fprintf(stderr,"PCD parser: Invalid number of TYPE elements\n");
-	    return Error;
-	  }
-	  int pointsize = 0;
-	  for(size_t i=0;i<sizes.size();i++)
-	    pointsize += sizes[i];
-	  vector<char> buffer(pointsize);
-	  for(int i=0;i<numPoints;i++) {
-	    in.read(&buffer[0],pointsize);
-	    if(!in) {
-	      fprintf(stderr,"PCD parser: Error reading data for point %d\n",i);
-	      return Error;
-	    }
-	    //parse the point and add it
-	    Vector v(pc.propertyNames.size());
-	    int ofs = 0;
-	    for(size_t j=0;j<sizes.size();j++) {
-	      if(types[j] == "F") {
-		if(sizes[j] == 4) {
-		  float f;
-		  memcpy(&f,&buffer[ofs],sizes[j]);
-		  v[j] = f;
-		}
-		else if(sizes[j] == 8) {
-		  double f;
-		  memcpy(&f,&buffer[ofs],sizes[j]);
-		  v[j] = f;
-		}
-		else {
-		  fprintf(stderr,"PCD parser: Invalid float size %d\n",sizes[j]);
-		  return Error;
-		}
-	      }
-	      else if(types[j] == "U") {
-		if(sizes[j] > 4) {
-		  fprintf(stderr,"PCD parser: Invalid unsigned int size %d\n",sizes[j]);
-		  return Error;		  
-		}
-		unsigned i=0;
-		memcpy(&i,&buffer[ofs],sizes[j]);
-		v[j] = Real(i);
-	      }
-	      else if(types[j] == "I") {
-		fprintf(stderr,"PCD parser: Invalid int size %d\n",sizes[j]);
-		int i=0;
-		memcpy(&i,&buffer[ofs],sizes[j]);
-		v[j] = Real(i);
-	      }
-	      else {
-		fprintf(stderr,"PCD parser: Invalid type %s\n",types[i].c_str());
-		return Error;
-	      }
-	      ofs += sizes[j];
-	    }
-	    pc.properties.push_back(v);
-	  }
-	}
-	else if(datatype == "ascii") {
-	  if(numPoints < 0) {
-	    fprintf(stderr,"PCD parser: DATA specified before POINTS element\n");
-	    return Error;
-	  }
-	  string line;
-	  for(int i=0;i<numPoints;i++) {
-	    int c = in.get();
-	    assert(c=='\n' || c==EOF);
-	    lineno++;
-	    if(c==EOF) {
-	      fprintf(stderr,"PCD parser: Premature end of DATA element\n");
-	      return Error;
-	    }
-	    if(!ReadLine(line)) {
-	      fprintf(stderr,"PCD parser: Error reading point %d\n",i);
-	      return Error;
-	    }
-	    vector<string> elements = Split(line," ");
-	    if(elements.size() != pc.propertyNames.size()) {
-	      fprintf(stderr,"PCD parser: DATA element %d has length %d, but %d properties specified\n",i,elements.size(),pc.propertyNames.size());
-	      return Error;
-	    }
-	    Vector v(elements.size());
-	    for(size_t k=0;k<elements.size();k++) {
-	      stringstream ss(elements[k]);
-	      SafeInputFloat(ss,v[k]);
-	    }
-	    pc.properties.push_back(v);
-	  }
-	}
-	else {
-	  fprintf(stderr,"PCD parser: DATA is not spcified as ascii or binary\n");
-	  return Error;
-	}
+      c = end;
+    }
+    while(isspace((unsigned char)*c)) c++;
+    if(*c != 0) {
+      fprintf(stderr,"PCD parser: DATA element %d has more than %d properties\n",i,numFields);
+      return false;
+    }
+    i++;
+  }
+  return true;
+}
+
+///Extracts the points after the properties are read
+static bool PCDFinishLoad(PointCloud3D& pc,const PCDHeader& header)
+{
+  int elemIndex[3] = {pc.PropertyIndex("x"),pc.PropertyIndex("y"),pc.PropertyIndex("z")};
+  if(elemIndex[0]<0 || elemIndex[1]<0 || elemIndex[2]<0) {
+    fprintf(stderr,"PCD parser: Warning, PCD file does not have x, y or z\n");
+    fprintf(stderr,"  Properties:");
+    for(size_t i=0;i<pc.propertyNames.size();i++)
+      fprintf(stderr," \"%s\"",pc.propertyNames[i].c_str());
+    fprintf(stderr,"\n");
+    return true;
+  }
+
+  //HACK: ascii files may contain float RGB and RGBA elements.  Convert
+  //float bytes to integer via memory cast
+  if(header.dataFormat == "ascii") {
+    for(size_t k=0;k<pc.propertyNames.size();k++) {
+      if(IsPackedColorField(header,k)) {
+        bool docast = false;
+        Real* col = pc.properties.Column((int)k);
+        for(int i=0;i<pc.properties.NumPoints();i++) {
+          float f = float(col[i]);
+          if(f < 1.0 && f > 0.0) {
+            docast=true;
+            break;
+          }
+        }
+        if(docast) {
+          for(int i=0;i<pc.properties.NumPoints();i++) {
+            float f = float(col[i]);
+            int rgb;
+            memcpy(&rgb,&f,sizeof(int));
+            col[i] = (Real)rgb;
+          }
+        }
       }
-      else {
-	string value;
-	if(!ReadLine(value)) return Error;
-	pc.settings[word] = Strip(value);
-
-	if(word == "VERSION") {
-	  if(pc.settings[word] != "0.7" && pc.settings[word] != ".7") {
-	    fprintf(stderr,"PCD parser: Warning, PCD version 0.7 expected, got %s\n",pc.settings[word].c_str());
-	  }
-	}
-	else {
-	  //printf("PCD parser: Read property \"%s\" = \"%s\"\n",word.c_str(),pc.settings[word].c_str());
-	}
+    }
+  }
+
+  //parse out the points
+  pc.points.resize(pc.properties.NumPoints());
+  const Real* x=pc.properties.Column(elemIndex[0]),*y=pc.properties.Column(elemIndex[1]),*z=pc.properties.Column(elemIndex[2]);
+  for(size_t i=0;i<pc.points.size();i++)
+    pc.points[i].set(x[i],y[i],z[i]);
+
+  if(pc.propertyNames.size()==3 && elemIndex[0]==0 && elemIndex[1]==1 && elemIndex[2]==2) {
+    //x,y,z are the only properties, go ahead and take them out
+    pc.propertyNames.resize(0);
+    pc.properties.Clear();
+  }
+  return true;
+}
+
+///Writes the n values src[0],src[srcStride],... as floats of the given
+///size spaced dstStride bytes apart
+static void EncodePCDField(const Real* src,size_t srcStride,int n,bool packedColor,int size,char* dst,size_t dstStride)
+{
+  for(int i=0;i<n;i++,src+=srcStride,dst+=dstStride) {
+    if(packedColor) {
+      int col = int(*src);
+      memcpy(dst,&col,4);
+    }
+    else if(size == 8) {
+      double d = double(*src);
+      memcpy(dst,&d,8);
+    }
+    else {
+      float f = float(*src);
+      memcpy(dst,&f,4);
+    }
+  }
+}
+
+///Returns true if the n values src[0],src[stride],... are unchanged by
+///conversion to float
+static bool FitsInFloat(const Real* src,size_t stride,int n)
+{
+  for(int i=0;i<n;i++,src+=stride)
+    if(Real(float(*src)) != *src && !(*src != *src)) return false;
+  return true;
+}
+
+PointCloudProperties::PointCloudProperties()
+  :data(NULL),numPoints(0),numProperties(0),capacity(0),allocated(false)
+{}
+
+PointCloudProperties::PointCloudProperties(const PointCloudProperties& rhs)
+  :data(NULL),numPoints(0),numProperties(0),capacity(0),allocated(false)
+{
+  operator = (rhs);
+}
+
+PointCloudProperties::~PointCloudProperties()
+{
+  Clear();
+}
+
+const PointCloudProperties& PointCloudProperties::operator = (const PointCloudProperties& rhs)
+{
+  if(this == &rhs) return *this;
+  Clear();
+  if(rhs.numPoints*rhs.numProperties > 0) {
+    data = new Real[rhs.numPoints*rhs.numProperties];
+    allocated = true;
+    for(int j=0;j<rhs.numProperties;j++)
+      copy(rhs.Column(j),rhs.Column(j)+rhs.numPoints,data+j*rhs.numPoints);
+  }
+  numPoints = capacity = rhs.numPoints;
+  numProperties = rhs.numProperties;
+  return *this;
+}
+
+void PointCloudProperties::Clear()
+{
+  if(allocated) delete [] data;
+  data = NULL;
+  numPoints = numProperties = capacity = 0;
+  allocated = false;
+}
+
+//copies the table into a new owned buffer with the given dimensions
+static void Reallocate(PointCloudProperties& t,int numPoints,int numProperties,int capacity,Real initval)
+{
+  Real* newdata = NULL;
+  if(capacity*numProperties > 0) {
+    newdata = new Real[capacity*numProperties];
+    int np = Min(t.numPoints,numPoints);
+    for(int j=0;j<numProperties;j++) {
+      Real* col = newdata+j*capacity;
+      if(j < t.numProperties) {
+        copy(t.Column(j),t.Column(j)+np,col);
+        fill(col+np,col+numPoints,initval);
       }
+      else
+        fill(col,col+numPoints,initval);
     }
-    return Continue;
   }
-  virtual Result InputPunct(const string& punct) { return Continue; }
-  virtual Result InputEndLine()
-  {
-    if(state != NORMAL) state=NORMAL;
-    return Continue;
+  t.Clear();
+  t.data = newdata;
+  t.allocated = (newdata != NULL);
+  t.numPoints = numPoints;
+  t.numProperties = numProperties;
+  t.capacity = capacity;
+}
+
+void PointCloudProperties::Resize(int _numPoints,int _numProperties,Real initval)
+{
+  Assert(_numPoints >= 0 && _numProperties >= 0);
+  if(_numPoints == numPoints && _numProperties == numProperties) return;
+  if(allocated && _numProperties == numProperties && _numPoints <= capacity) {
+    if(_numPoints > numPoints)
+      for(int j=0;j<numProperties;j++)
+        fill(Column(j)+numPoints,Column(j)+_numPoints,initval);
+    numPoints = _numPoints;
+    return;
   }
+  Reallocate(*this,_numPoints,_numProperties,_numPoints,initval);
+}
+
+void PointCloudProperties::Reserve(int _capacity)
+{
+  if(_capacity <= capacity) return;
+  Reallocate(*this,numPoints,numProperties,_capacity,0);
+}
+
+void PointCloudProperties::SetRef(Real* _data,int _numPoints,int _numProperties)
+{
+  Clear();
+  data = _data;
+  numPoints = capacity = _numPoints;
+  numProperties = _numProperties;
+  allocated = false;
+}
+
+void PointCloudProperties::GetPoint(int i,Vector& v) const
+{
+  v.resize(numProperties);
+  for(int j=0;j<numProperties;j++)
+    v[j] = data[j*capacity+i];
+}
+
+void PointCloudProperties::GetPointRef(int i,Vector& v)
+{
+  v.clear();
+  if(numProperties == 0) return;
+  v.setRef(data,capacity*numProperties,i,capacity,numProperties);
+}
+
+void PointCloudProperties::SetPoint(int i,const Vector& v)
+{
+  Assert(v.n == numProperties);
+  for(int j=0;j<numProperties;j++)
+    data[j*capacity+i] = v[j];
+}
+
+void PointCloudProperties::AddProperty(Real initval)
+{
+  Resize(numPoints,numProperties+1,initval);
+}
+
+void PointCloudProperties::RemoveProperty(int j)
+{
+  Assert(j >= 0 && j < numProperties);
+  if(!allocated) {
+    //don't modify the external buffer
+    PointCloudProperties temp(*this);
+    *this = temp;
+  }
+  for(int k=j+1;k<numProperties;k++)
+    copy(Column(k),Column(k)+numPoints,Column(k-1));
+  numProperties--;
+  if(numProperties == 0) Clear();
+}
+
+void PointCloudProperties::GetSubset(const vector<int>& indices,PointCloudProperties& sub) const
+{
+  sub.Clear();
+  sub.Resize((int)indices.size(),numProperties);
+  for(int j=0;j<numProperties;j++) {
+    const Real* col = Column(j);
+    Real* subcol = sub.Column(j);
+    for(size_t k=0;k<indices.size();k++)
+      subcol[k] = col[indices[k]];
+  }
+}
+
+void PointCloudProperties::push_back(const Vector& v)
+{
+  if(numPoints == 0 && numProperties != v.n) Resize(0,v.n);
+  if(numPoints == capacity || !allocated) Reserve(Max(2*numPoints,16));
+  Resize(numPoints+1,numProperties);
+  SetPoint(numPoints-1,v);
+}
 
-  PointCloud3D& pc;
-  int state;
-  int numPoints;
-  //for binary data
-  vector<string> types;
-  vector<int> sizes;
-  vector<int> counts;
-};
+const PointCloudProperties::Row& PointCloudProperties::Row::operator = (const Vector& v)
+{
+  if(table->numProperties == 0 && v.n > 0) {
+    table->Resize(table->numPoints,v.n);
+    n = v.n;
+  }
+  table->SetPoint(index,v);
+  return *this;
+}
 
 
 void PointCloud3D::Clear()
 {
   points.clear();
   propertyNames.clear();
-  properties.clear();
+  properties.Clear();
   settings.clear();
 }
 
 bool PointCloud3D::LoadPCL(const char* fn)
 {
-  ifstream in(fn,ios::in);
-  if(!in) return false;
-  if(!LoadPCL(in)) return false;
-  in.close();
-  return true;
+  FileUtils::MappedFile file;
+  if(!file.Open(fn)) {
+    ifstream in(fn,ios::in|ios::binary);
+    if(!in) return false;
+    return LoadPCL(in);
+  }
+  //find the end of the DATA line
+  size_t dataStart = 0;
+  bool found = false;
+  while(dataStart < file.size && !found) {
+    const char* line = file.data+dataStart;
+    const char* eol = (const char*)memchr(line,'\n',file.size-dataStart);
+    size_t len = (eol ? size_t(eol-line) : file.size-dataStart);
+    while(len > 0 && isspace((unsigned char)*line)) { line++; len--; }
+    if(len >= 4 && strncmp(line,"DATA",4)==0) found = true;
+    dataStart = (eol ? size_t(eol-file.data)+1 : file.size);
+  }
+  PCDHeader header;
+  stringstream ss(string(file.data,dataStart));
+  if(!header.Read(ss) || !header.Check()) {
+    fprintf(stderr,"PCD parser: Unable to parse PCD file\n");
+    return false;
+  }
+  if(header.dataFormat == "ascii") {
+    file.Close();
+    ifstream in(fn,ios::in|ios::binary);
+    if(!in) return false;
+    return LoadPCL(in);
+  }
+  Clear();
+  propertyNames = header.fields;
+  settings = header.settings;
+  properties.Resize(header.numPoints,(int)header.fields.size());
+  const char* data = file.data+dataStart;
+  size_t len = file.size-dataStart;
+  if(header.dataFormat == "binary") {
+    if(len < (size_t)header.numPoints*header.PointSize()) {
+      fprintf(stderr,"PCD parser: Premature end of binary DATA element\n");
+      return false;
+    }
+    DecodePCDBinary(header,data,header.numPoints,properties,0);
+  }
+  else {
+    if(!DecodePCDCompressed(header,data,len,properties)) return false;
+  }
+  return PCDFinishLoad(*this,header);
 }
 
-bool PointCloud3D::SavePCL(const char* fn) const
+bool PointCloud3D::SavePCL(const char* fn,const string& format) const
 {
-  ofstream out(fn,ios::out);
+  ofstream out(fn,ios::out|ios::binary);
   if(!out) return false;
-  if(!SavePCL(out)) return false;
+  if(!SavePCL(out,format)) return false;
   out.close();
   return true;
 }
 
 bool PointCloud3D::LoadPCL(istream& in)
 {
-  PCLParser parser(in,*this);
-  if(!parser.Read()) {
+  PCDHeader header;
+  if(!header.Read(in) || !header.Check()) {
     fprintf(stderr,"PCD parser: Unable to parse PCD file\n");
     return false;
   }
-  int elemIndex[3] = {-1,-1,-1};
-  for(size_t i=0;i<propertyNames.size();i++) {
-    if(propertyNames[i]=="x") elemIndex[0] = (int)i;
-    if(propertyNames[i]=="y") elemIndex[1] = (int)i;
-    if(propertyNames[i]=="z") elemIndex[2] = (int)i;
+  Clear();
+  propertyNames = header.fields;
+  settings = header.settings;
+  properties.Resize(header.numPoints,(int)header.fields.size());
+  if(header.dataFormat == "ascii") {
+    if(!ReadPCDAscii(in,header.numPoints,properties,0)) return false;
   }
-  if(elemIndex[0]<0 || elemIndex[1]<0 || elemIndex[2]<0) {
-    fprintf(stderr,"PCD parser: Warning, PCD file does not have x, y or z\n");
-    fprintf(stderr,"  Properties:");
-    for(size_t i=0;i<propertyNames.size();i++)
-      fprintf(stderr," \"%s\"",propertyNames[i].c_str());
-    fprintf(stderr,"\n");
-    return true;
+  else if(header.dataFormat == "binary") {
+    //read in blocks to keep the temporary buffer small
+    const int blockSize = 16384;
+    int pointSize = header.PointSize();
+    vector<char> buffer((size_t)Min(blockSize,header.numPoints)*pointSize);
+    for(int i=0;i<header.numPoints;i+=blockSize) {
+      int n = Min(blockSize,header.numPoints-i);
+      in.read(&buffer[0],(size_t)n*pointSize);
+      if(!in) {
+        fprintf(stderr,"PCD parser: Error reading data for point %d\n",i+(int)(in.gcount()/pointSize));
+        return false;
+      }
+      DecodePCDBinary(header,&buffer[0],n,properties,i);
+    }
+  }
+  else {
+    unsigned int sizes[2];
+    if(!in.read((char*)sizes,sizeof(sizes))) {
+      fprintf(stderr,"PCD parser: Premature end of compressed DATA element\n");
+      return false;
+    }
+    vector<char> buffer(sizeof(sizes)+sizes[0]);
+    memcpy(&buffer[0],sizes,sizeof(sizes));
+    if(sizes[0] > 0 && !in.read(&buffer[sizeof(sizes)],sizes[0])) {
+      fprintf(stderr,"PCD parser: Premature end of compressed DATA element\n");
+      return false;
+    }
+    if(!DecodePCDCompressed(header,&buffer[0],buffer.size(),properties)) return false;
   }
+  return PCDFinishLoad(*this,header);
+}
 
-  //HACK: for float RGB and RGBA elements, convert float bytes
-  //to integer via memory cast
-  Assert(propertyNames.size() == parser.types.size());
-  for(size_t k=0;k<propertyNames.size();k++) {
-    if(parser.types[k] == "F" && (propertyNames[k] == "rgb" || propertyNames[k] == "rgba")) { 
-      bool docast = false;
-      for(size_t i=0;i<properties.size();i++) {
-	Vector& v = properties[i];
-	float f = float(v[k]);
-	if(f < 1.0 && f > 0.0) {
-	  docast=true;
-	  break;
-	}
+bool PointCloud3D::SavePCL(ostream& out,const string& format) const
+{
+  if(format != "ascii" && format != "binary" && format != "binary_compressed") {
+    fprintf(stderr,"PointCloud3D::SavePCL: invalid format %s\n",format.c_str());
+    return false;
+  }
+  bool addxyz = !HasXYZAsProperties();
+  PCDHeader header;
+  header.settings = settings;
+  header.dataFormat = format;
+  if(addxyz) {
+    header.fields.push_back("x");
+    header.fields.push_back("y");
+    header.fields.push_back("z");
+  }
+  header.fields.insert(header.fields.end(),propertyNames.begin(),propertyNames.end());
+  header.types.resize(header.fields.size(),'F');
+  header.counts.resize(header.fields.size(),1);
+  if(!properties.Empty())
+    header.numPoints = properties.NumPoints();
+  else
+    header.numPoints = (int)points.size();
+  //x, y, z and packed colors are F4 as in PCL.  Other properties are F8
+  //if F4 would lose precision (e.g., timestamps, or integer labels above
+  //2^24), so that a loaded cloud saves back with its values intact.
+  header.sizes.resize(header.fields.size(),4);
+  for(size_t j=(addxyz ? 3 : 0);j<header.fields.size();j++) {
+    const string& name = header.fields[j];
+    if(name == "x" || name == "y" || name == "z" || IsPackedColorField(header,j)) continue;
+    if(!FitsInFloat(properties.Column(addxyz ? (int)j-3 : (int)j),1,header.numPoints))
+      header.sizes[j] = 8;
+  }
+  if(!header.Write(out)) return false;
+
+  if(format == "ascii") {
+    if(propertyNames.empty()) {
+      for(size_t i=0;i<points.size();i++)
+        out<<points[i]<<"\n";
+    }
+    else {
+      int offset = (addxyz ? 3 : 0);
+      streamsize precision = out.precision();
+      for(int i=0;i<properties.NumPoints();i++) {
+        if(addxyz)
+          out<<points[i]<<" ";
+        for(int j=0;j<properties.NumProperties();j++) {
+          if(header.sizes[j+offset] == 8 || IsPackedColorField(header,j+offset)) {
+            out.precision(17);
+            out<<properties(i,j)<<" ";
+            out.precision(precision);
+          }
+          else
+            out<<properties(i,j)<<" ";
+        }
+        out<<"\n";
       }
-      if(docast) {
-	//fprintf(stderr,"PointCloud::LoadPCL: Warning, casting RGB colors to integers via direct memory cast\n");
-	for(size_t i=0;i<properties.size();i++) {
-	  Vector& v = properties[i];
-	  float f = float(v[k]);
-	  int rgb = *((int*)&f);
-	  v[k] = (Real)rgb;
-	}
+    }
+    return (bool)out;
+  }
+
+  //columns of the x, y, z fields, if present
+  const Real* xyz = (points.empty() ? NULL : &points[0].x);
+  size_t xyzStride = sizeof(Vector3)/sizeof(Real);
+  int numFields = (int)header.fields.size();
+  int pointSize = header.PointSize();
+  vector<size_t> offsets(numFields,0);
+  for(int j=1;j<numFields;j++)
+    offsets[j] = offsets[j-1]+header.sizes[j-1];
+  if(format == "binary") {
+    //encode in blocks to keep the temporary buffer small
+    const int blockSize = 16384;
+    vector<char> buffer((size_t)Min(blockSize,header.numPoints)*pointSize);
+    for(int i=0;i<header.numPoints;i+=blockSize) {
+      int n = Min(blockSize,header.numPoints-i);
+      for(int j=0;j<numFields;j++) {
+        if(addxyz && j < 3)
+          EncodePCDField(xyz+i*xyzStride+j,xyzStride,n,false,4,&buffer[offsets[j]],pointSize);
+        else
+          EncodePCDField(properties.Column(addxyz ? j-3 : j)+i,1,n,IsPackedColorField(header,j),header.sizes[j],&buffer[offsets[j]],pointSize);
       }
+      out.write(&buffer[0],(size_t)n*pointSize);
     }
+    return (bool)out;
   }
 
-  //parse out the points
-  points.resize(properties.size());
-  for(size_t i=0;i<properties.size();i++) {
-    points[i].set(properties[i][elemIndex[0]],properties[i][elemIndex[1]],properties[i][elemIndex[2]]);
+  //binary_compressed: each field is stored contiguously, then compressed
+  size_t rawSize = (size_t)header.numPoints*pointSize;
+  vector<char> raw(rawSize);
+  for(int j=0;j<numFields;j++) {
+    char* dst = (rawSize > 0 ? &raw[offsets[j]*header.numPoints] : NULL);
+    if(addxyz && j < 3)
+      EncodePCDField(xyz+j,xyzStride,header.numPoints,false,4,dst,4);
+    else
+      EncodePCDField(properties.Column(addxyz ? j-3 : j),1,header.numPoints,IsPackedColorField(header,j),header.sizes[j],dst,header.sizes[j]);
+  }
+  vector<char> compressed(LZFMaxCompressedSize(rawSize)+1);
+  unsigned int sizes[2];
+  sizes[0] = (rawSize > 0 ? (unsigned int)LZFCompress(&raw[0],rawSize,&compressed[0],compressed.size()) : 0);
+  sizes[1] = (unsigned int)rawSize;
+  if(rawSize > 0 && sizes[0] == 0) {
+    fprintf(stderr,"PointCloud3D::SavePCL: error compressing data\n");
+    return false;
   }
-  //printf("PCD parser: %d points read\n",points.size());
+  out.write((const char*)sizes,sizeof(sizes));
+  out.write(&compressed[0],sizes[0]);
+  return (bool)out;
+}
 
-  if(properties.size()==3 && elemIndex[0]==0 && elemIndex[1]==1 && elemIndex[2]==2) {
-    //x,y,z are the only properties, go ahead and take them out
-    propertyNames.resize(0);
-    properties.resize(0);
+PCDChunkReader::PCDChunkReader()
+  :numRead(0)
+{}
+
+bool PCDChunkReader::Open(const char* fn)
+{
+  Close();
+  in.open(fn,ios::in|ios::binary);
+  if(!in) return false;
+  header = PCDHeader();
+  if(!header.Read(in) || !header.Check()) {
+    fprintf(stderr,"PCDChunkReader: Unable to parse PCD header\n");
+    Close();
+    return false;
+  }
+  if(header.dataFormat == "binary_compressed") {
+    fprintf(stderr,"PCDChunkReader: binary_compressed data can't be read in chunks\n");
+    Close();
+    return false;
   }
   return true;
 }
 
-bool PointCloud3D::SavePCL(ostream& out) const
+void PCDChunkReader::Close()
 {
-  out<<"# .PCD v0.7 - Point Cloud Data file format"<<endl;
-  if(settings.find("VERSION") != settings.end())
-    out<<"VERSION "<<settings.find("VERSION")->second<<endl;
-  else
-    out<<"VERSION 0.7"<<endl;
-  bool addxyz = !HasXYZAsProperties();
-
-  out<<"FIELDS";
-  if(addxyz)
-    out<<" x y z";
-  for(size_t i=0;i<propertyNames.size();i++)
-    out<<" "<<propertyNames[i];
-  out<<"\n";
-  out<<"TYPE";
-  if(addxyz)
-    out<<" F F F";
-  for(size_t i=0;i<propertyNames.size();i++)
-    out<<" F";
-  out<<"\n";
-
-  if(!properties.empty())
-    out<<"POINTS "<<properties.size()<<"\n";
-  else 
-    out<<"POINTS "<<points.size()<<"\n";
+  if(in.is_open()) in.close();
+  in.clear();
+  numRead = 0;
+}
 
-  for(map<string,string>::const_iterator i=settings.begin();i!=settings.end();i++) {
-    if(i->first == "VERSION") continue;
-    out<<i->first<<" "<<i->second<<"\n";
-  }
-  out<<"DATA ascii"<<"\n";  
-  if(propertyNames.empty()) {
-    for(size_t i=0;i<points.size();i++) 
-      out<<points[i]<<"\n";
+int PCDChunkReader::ReadChunk(int maxPoints,PointCloud3D& chunk)
+{
+  if(!in.is_open()) return -1;
+  int n = Min(maxPoints,header.numPoints-numRead);
+  if(n <= 0) return 0;
+  chunk.Clear();
+  chunk.propertyNames = header.fields;
+  chunk.settings = header.settings;
+  chunk.properties.Resize(n,(int)header.fields.size());
+  if(header.dataFormat == "ascii") {
+    if(!ReadPCDAscii(in,n,chunk.properties,0)) return -1;
   }
   else {
-    for(size_t i=0;i<properties.size();i++) {
-      if(addxyz)
-	out<<points[i]<<" ";
-      for(int j=0;j<properties[i].n;j++)
-	out<<properties[i][j]<<" ";
-      out<<"\n";
+    int pointSize = header.PointSize();
+    buffer.resize((size_t)n*pointSize);
+    if(!in.read(&buffer[0],buffer.size())) {
+      fprintf(stderr,"PCDChunkReader: Error reading data for point %d\n",numRead);
+      return -1;
     }
+    DecodePCDBinary(header,&buffer[0],n,chunk.properties,0);
   }
-  return true;
+  numRead += n;
+  if(!PCDFinishLoad(chunk,header)) return -1;
+  return n;
 }
 
 void PointCloud3D::GetAABB(Vector3& bmin,Vector3& bmax) const
@@ -402,12 +848,15 @@ void PointCloud3D::Transform(const Matrix4& mat)
   for(size_t i=0;i<points.size();i++) {
     Vector3 temp=points[i];
     mat.mulPoint(temp,points[i]);
-    //transform normals if this has them
-    if(hasNormals) {
-      Vector3 temp2;
-      temp.set(properties[i][nxind],properties[i][nyind],properties[i][nzind]);
+  }
+  //transform normals if this has them
+  if(hasNormals) {
+    Real* nx=properties.Column(nxind),*ny=properties.Column(nyind),*nz=properties.Column(nzind);
+    Vector3 temp,temp2;
+    for(int i=0;i<properties.NumPoints();i++) {
+      temp.set(nx[i],ny[i],nz[i]);
       mat.mulVector(temp,temp2);
-      temp2.get(properties[i][nxind],properties[i][nyind],properties[i][nzind]);
+      temp2.get(nx[i],ny[i],nz[i]);
     }
   }
 }
@@ -444,16 +893,10 @@ void PointCloud3D::SetXYZAsProperties(bool isprop)
 	elemIndex[i] = numprops;
 	numprops++;
       }
-    if(properties.empty()) 
-      properties.resize(points.size());
-    for(size_t i=0;i<points.size();i++) {
-      Vector oldprops = properties[i];
-      properties[i].resize(numprops);
-      properties[i].copySubVector(0,oldprops);
-      properties[i][elemIndex[0]] = points[i].x;
-      properties[i][elemIndex[1]] = points[i].y;
-      properties[i][elemIndex[2]] = points[i].z;
-    }
+    properties.Resize((int)points.size(),numprops);
+    Real* x=properties.Column(elemIndex[0]),*y=properties.Column(elemIndex[1]),*z=properties.Column(elemIndex[2]);
+    for(size_t i=0;i<points.size();i++)
+      points[i].get(x[i],y[i],z[i]);
   }
   else {
     //remove from properties
@@ -472,9 +915,10 @@ bool PointCloud3D::GetNormals(vector<Vector3>& normals) const
 {
   int nx=PropertyIndex("normal_x"),ny=PropertyIndex("normal_y"),nz=PropertyIndex("normal_z");
   if(nx < 0 || ny < 0 || nz < 0) return false;
-  normals.resize(properties.size());
-  for(size_t i=0;i<properties.size();i++)
-    normals[i].set(properties[i][nx],properties[i][ny],properties[i][nz]);
+  normals.resize(properties.NumPoints());
+  const Real* x=properties.Column(nx),*y=properties.Column(ny),*z=properties.Column(nz);
+  for(size_t i=0;i<normals.size();i++)
+    normals[i].set(x[i],y[i],z[i]);
   return true;
 }
 
@@ -484,17 +928,21 @@ void PointCloud3D::SetNormals(const vector<Vector3>& normals)
   if(nx < 0) {
     vector<Real> items(points.size());
     SetProperty("normal_x",items);
+    nx = PropertyIndex("normal_x");
   }
   if(ny < 0) {
     vector<Real> items(points.size());
     SetProperty("normal_y",items);
+    ny = PropertyIndex("normal_y");
   }
   if(nz < 0) {
     vector<Real> items(points.size());
     SetProperty("normal_z",items);
+    nz = PropertyIndex("normal_z");
   }
-  for(size_t i=0;i<properties.size();i++)
-    normals[i].get(properties[i][nx],properties[i][ny],properties[i][nz]);
+  Real* x=properties.Column(nx),*y=properties.Column(ny),*z=properties.Column(nz);
+  for(int i=0;i<properties.NumPoints();i++)
+    normals[i].get(x[i],y[i],z[i]);
 }
 bool PointCloud3D::HasColor() const
 {
@@ -676,41 +1124,27 @@ bool PointCloud3D::GetProperty(const string& name,vector<Real>& items) const
 {
   int i = PropertyIndex(name);
   if(i < 0) return false;
-  items.resize(properties.size());
-  for(size_t k=0;k<properties.size();k++)
-    items[k] = properties[k][i];
+  const Real* col = properties.Column(i);
+  items.assign(col,col+properties.NumPoints());
   return true;
 }
 
 void PointCloud3D::SetProperty(const string& name,const vector<Real>& items)
 {
   int i = PropertyIndex(name);
-  if(i >= 0) {
-    for(size_t k=0;k<properties.size();k++) {
-      properties[k][i] = items[k];
-    }
-    return;
-  }
-  else {
+  if(i < 0) {
     //add it
     propertyNames.push_back(name);
-    for(size_t k=0;k<properties.size();k++) {
-      Vector oldval = properties[k];
-      properties[k].resize(propertyNames.size());
-      properties[k].copySubVector(0,oldval);
-      properties[k][propertyNames.size()-1] = items[k];
-    }
+    i = (int)propertyNames.size()-1;
+    properties.Resize((int)points.size(),(int)propertyNames.size());
   }
+  copy(items.begin(),items.begin()+properties.NumPoints(),properties.Column(i));
 }
 void PointCloud3D::RemoveProperty(const string& name)
 {
   int i = PropertyIndex(name);
   if(i >= 0) {
-    for(size_t k=0;k<properties.size();k++) {
-      for(size_t j=i+1;j<propertyNames.size();j++)
-	properties[k][j-1] = properties[k][j];
-      properties[k].n--;
-    }
+    properties.RemoveProperty(i);
     propertyNames.erase(propertyNames.begin()+i);
     return;
   }
@@ -718,17 +1152,43 @@ void PointCloud3D::RemoveProperty(const string& name)
     fprintf(stderr,"PointCloud3D::RemoveProperty: warning, property %s does not exist\n",name.c_str());
 }
 
+void PointCloud3D::SetPropertyRef(const vector<string>& names,Real* data,int numPoints)
+{
+  propertyNames = names;
+  properties.SetRef(data,numPoints,(int)names.size());
+  int elemIndex[3] = {PropertyIndex("x"),PropertyIndex("y"),PropertyIndex("z")};
+  if(elemIndex[0]<0 || elemIndex[1]<0 || elemIndex[2]<0) {
+    if((int)points.size() != numPoints)
+      fprintf(stderr,"PointCloud3D::SetPropertyRef: warning, %d points but %d property rows\n",(int)points.size(),numPoints);
+    return;
+  }
+  points.resize(numPoints);
+  const Real* x=properties.Column(elemIndex[0]),*y=properties.Column(elemIndex[1]),*z=properties.Column(elemIndex[2]);
+  for(int i=0;i<numPoints;i++)
+    points[i].set(x[i],y[i],z[i]);
+}
+
+///Helper for GetSubCloud: copies the points in the list indices
+static void SelectPoints(const PointCloud3D& pc,const vector<int>& indices,PointCloud3D& subcloud)
+{
+  subcloud.Clear();
+  subcloud.propertyNames = pc.propertyNames;
+  subcloud.settings = pc.settings;
+  subcloud.points.resize(indices.size());
+  for(size_t k=0;k<indices.size();k++)
+    subcloud.points[k] = pc.points[indices[k]];
+  if(pc.properties.NumProperties() > 0)
+    pc.properties.GetSubset(indices,subcloud.properties);
+}
+
 void PointCloud3D::GetSubCloud(const Vector3& bmin,const Vector3& bmax,PointCloud3D& subcloud)
 {
   AABB3D bb(bmin,bmax);
-  subcloud.Clear();
-  subcloud.propertyNames = propertyNames;
-  subcloud.settings = settings;
+  vector<int> indices;
   for(size_t i=0;i<points.size();i++)
-    if(bb.contains(points[i])) {
-      subcloud.points.push_back(points[i]);
-      subcloud.properties.push_back(properties[i]);
-    }
+    if(bb.contains(points[i]))
+      indices.push_back((int)i);
+  SelectPoints(*this,indices,subcloud);
 }
 
 void PointCloud3D::GetSubCloud(const string& property,Real value,PointCloud3D& subcloud)
@@ -738,40 +1198,26 @@ void PointCloud3D::GetSubCloud(const string& property,Real value,PointCloud3D& s
 
 void PointCloud3D::GetSubCloud(const string& property,Real minValue,Real maxValue,PointCloud3D& subcloud)
 {
-  subcloud.Clear();
-  subcloud.propertyNames = propertyNames;
-  subcloud.settings = settings;
-  if(property == "x") {
+  vector<int> indices;
+  if(property == "x" || property == "y" || property == "z") {
+    int d = property[0]-'x';
     for(size_t i=0;i<points.size();i++)
-      if(minValue <= points[i].x && points[i].x <= maxValue) {
-	subcloud.points.push_back(points[i]);
-	subcloud.properties.push_back(properties[i]);
-      }
-  }
-  else if(property == "y") {
-    for(size_t i=0;i<points.size();i++)
-      if(minValue <= points[i].y && points[i].y <= maxValue) {
-	subcloud.points.push_back(points[i]);
-	subcloud.properties.push_back(properties[i]);
-      }
-  }
-  else if(property == "z") {
-    for(size_t i=0;i<points.size();i++)
-      if(minValue <= points[i].z && points[i].z <= maxValue) {
-	subcloud.points.push_back(points[i]);
-	subcloud.properties.push_back(properties[i]);
-      }
+      if(minValue <= points[i][d] && points[i][d] <= maxValue)
+        indices.push_back((int)i);
   }
   else {
     int i=PropertyIndex(property);
     if(i < 0) {
+      subcloud.Clear();
+      subcloud.propertyNames = propertyNames;
+      subcloud.settings = settings;
       fprintf(stderr,"PointCloud3D::GetSubCloud: warning, property %s does not exist\n",property.c_str());
       return;
     }
-    for(size_t k=0;k<properties.size();k++)
-      if(minValue <= properties[k][i] && properties[k][i] <= maxValue) {
-	subcloud.points.push_back(points[k]);
-	subcloud.properties.push_back(properties[k]);
-      }
+    const Real* col = properties.Column(i);
+    for(int k=0;k<properties.NumPoints();k++)
+      if(minValue <= col[k] && col[k] <= maxValue)
+        indices.push_back(k);
   }
+  SelectPoints(*this,indices,subcloud);
 }
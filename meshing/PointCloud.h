@@ -6,6 +6,7 @@
 #include <vector>
 #include <map>
 #include <iosfwd>
+#include <fstream>
 #include <string>
 
 namespace Meshing {
@@ -13,11 +14,109 @@ namespace Meshing {
 using namespace Math3D;
 using namespace std;
 
+/** @brief Column-major storage of the per-point properties of a point
+ * cloud.
+ *
+ * Property j of all points is the contiguous array
+ * [Column(j),Column(j)+NumPoints()), so per-property operations walk
+ * memory linearly and the whole table takes a single allocation.  Columns
+ * are capacity entries apart, which is NumPoints() unless points were
+ * added with push_back() or Reserve().
+ *
+ * The table either owns its storage, or refers to an external
+ * column-major buffer set with SetRef, in which case the caller keeps the
+ * buffer alive.  Resizing a referenced table with different dimensions
+ * makes an owned copy first.  Copying a table always makes an owned copy.
+ *
+ * The table also supports the interface of the vector<Vector> that it
+ * replaced: size(), empty(), resize(), push_back() and clear(), and
+ * operator[](i), which gives a Row that reads and writes the properties of
+ * point i in place.
+ */
+class PointCloudProperties
+{
+ public:
+  /** @brief A reference to the properties of one point, standing in for
+   * the per-point Vector of the old row-wise storage.
+   *
+   * Row(j) and Row[j] refer to property j.  Assigning a Vector writes the
+   * row; if the table has no properties yet, it takes on v.n properties.
+   */
+  class Row
+  {
+   public:
+    Row(PointCloudProperties* _table,int _index) :table(_table),index(_index),n(_table->numProperties) {}
+    inline Real& operator[](int j) const { return (*table)(index,j); }
+    inline Real& operator()(int j) const { return (*table)(index,j); }
+    inline int size() const { return n; }
+    inline bool empty() const { return n == 0; }
+    operator Vector() const { Vector v; table->GetPoint(index,v); return v; }
+    const Row& operator = (const Vector& v);
+    const Row& operator = (const Row& r) { return operator = (Vector(r)); }
+
+    PointCloudProperties* table;
+    int index;
+    int n;
+  };
+
+  PointCloudProperties();
+  PointCloudProperties(const PointCloudProperties& rhs);
+  ~PointCloudProperties();
+  const PointCloudProperties& operator = (const PointCloudProperties& rhs);
+  void Clear();
+  ///Resizes the table, keeping the existing values.  New entries are
+  ///initialized to initval.
+  void Resize(int numPoints,int numProperties,Real initval=0);
+  ///Refers to the external column-major buffer data, which holds
+  ///numPoints*numProperties values
+  void SetRef(Real* data,int numPoints,int numProperties);
+  inline bool IsRef() const { return !allocated && data != NULL; }
+  inline bool Empty() const { return numPoints == 0; }
+  inline int NumPoints() const { return numPoints; }
+  inline int NumProperties() const { return numProperties; }
+  inline Real& operator()(int i,int j) { return data[j*capacity+i]; }
+  inline const Real& operator()(int i,int j) const { return data[j*capacity+i]; }
+  inline Real* Column(int j) { return data+j*capacity; }
+  inline const Real* Column(int j) const { return data+j*capacity; }
+  ///Makes room for numPoints points, so that growing to that size does not
+  ///reallocate
+  void Reserve(int numPoints);
+  ///Copies the properties of point i into v
+  void GetPoint(int i,Vector& v) const;
+  ///Sets v to a strided reference to the properties of point i
+  void GetPointRef(int i,Vector& v);
+  void SetPoint(int i,const Vector& v);
+  ///Appends a column initialized to initval
+  void AddProperty(Real initval=0);
+  void RemoveProperty(int j);
+  ///Sets sub to the rows of this in the list indices
+  void GetSubset(const vector<int>& indices,PointCloudProperties& sub) const;
+
+  //row-wise interface of the old vector<Vector> storage
+  inline Row operator[](int i) { return Row(this,i); }
+  inline Vector operator[](int i) const { Vector v; GetPoint(i,v); return v; }
+  inline size_t size() const { return (size_t)numPoints; }
+  inline bool empty() const { return numPoints == 0; }
+  inline void resize(size_t n) { Resize((int)n,numProperties); }
+  inline void clear() { Clear(); }
+  ///Appends a point.  If the table has no points, it takes on v.n
+  ///properties.
+  void push_back(const Vector& v);
+
+  Real* data;
+  int numPoints,numProperties;
+  ///The column stride, >= numPoints
+  int capacity;
+  bool allocated;
+};
+
+
 /** @brief A 3D point cloud class.
  *
  * Points may have optional associated floating point properties
  * like ID, color, normal, etc.  These are named in propertyNames and
- * each property is an entry of a property vector attached to each point.
+ * stored column-wise in properties, so that properties(i,j) is property j
+ * of point i.  SetPropertyRef wraps an existing buffer without copying.
  *
  * The point cloud itself may also have associated settings, as given by
  * the settings map.
@@ -38,10 +137,14 @@ class PointCloud3D
 {
  public:
   void Clear();
+  ///Loads a PCD file.  Binary files are memory-mapped and decoded
+  ///straight into the property columns.
   bool LoadPCL(const char* fn);
-  bool SavePCL(const char* fn) const;
+  ///Saves a PCD file.  format may be "ascii", "binary" or
+  ///"binary_compressed".
+  bool SavePCL(const char* fn,const string& format="ascii") const;
   bool LoadPCL(istream& in);
-  bool SavePCL(ostream& out) const;
+  bool SavePCL(ostream& out,const string& format="ascii") const;
   void GetAABB(Vector3& bmin,Vector3& bmax) const;
   void Transform(const Matrix4& mat);
   int PropertyIndex(const string& name) const;
@@ -66,13 +169,69 @@ class PointCloud3D
   bool GetColors(vector<Real>& r,vector<Real>& g,vector<Real>& b,vector<Real>& a) const;
   void SetColors(const vector<Real>& r,const vector<Real>& g,const vector<Real>& b,bool includeAlpha = false);
   void SetColors(const vector<Real>& r,const vector<Real>& g,const vector<Real>& b,const vector<Real>& a,bool includeAlpha = true);
+  ///Makes the properties refer to the column-major buffer data, which holds
+  ///numPoints*names.size() values and must outlive this cloud.  If x, y
+  ///and z are among the names, points are set from them.
+  void SetPropertyRef(const vector<string>& names,Real* data,int numPoints);
 
   vector<Vector3> points;
   vector<string> propertyNames;
-  vector<Vector> properties;
+  PointCloudProperties properties;
   map<string,string> settings;
 };
 
+/** @brief The header of a PCD file.
+ *
+ * Read() consumes everything up to and including the DATA line, and
+ * Write() produces the same.  Unrecognized entries (VERSION, WIDTH,
+ * HEIGHT, VIEWPOINT, ...) go into settings.
+ */
+struct PCDHeader
+{
+  PCDHeader();
+  bool Read(istream& in);
+  bool Write(ostream& out) const;
+  ///Checks consistency and fills in defaults for missing SIZE, TYPE and
+  ///COUNT entries if the data is ascii
+  bool Check();
+  ///Bytes per point in binary data
+  int PointSize() const;
+
+  vector<string> fields;
+  vector<int> sizes;
+  vector<char> types;
+  vector<int> counts;
+  int numPoints;
+  ///"ascii", "binary", or "binary_compressed"
+  string dataFormat;
+  map<string,string> settings;
+};
+
+/** @brief Reads a PCD file a chunk of points at a time, for clouds that
+ * are too large to hold in memory.
+ *
+ * Supports ascii and binary data.  binary_compressed data is a single
+ * compressed block, so it can't be streamed; load it with LoadPCL.
+ */
+class PCDChunkReader
+{
+ public:
+  PCDChunkReader();
+  bool Open(const char* fn);
+  void Close();
+  ///Replaces the contents of chunk with up to maxPoints of the next
+  ///points.  Returns the number of points read: 0 at the end of the
+  ///file, and -1 on error.
+  int ReadChunk(int maxPoints,PointCloud3D& chunk);
+  inline int NumPoints() const { return header.numPoints; }
+  inline int NumRead() const { return numRead; }
+
+  PCDHeader header;
+  ifstream in;
+  int numRead;
+  vector<char> buffer;
+};
+
 } //namespace Meshing
 
 #endif 
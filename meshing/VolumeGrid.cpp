@@ -541,6 +541,203 @@ ostream& operator << (ostream& out,const Array3D<T>& a)
   return out;
 }
 
+void VolumeGridPyramid::Clear()
+{
+  size.set(0,0,0);
+  minValues.clear();
+  maxValues.clear();
+}
+
+void VolumeGridPyramid::Build(const Array3D<Real>& value)
+{
+  Clear();
+  if(value.m == 0 || value.n == 0 || value.p == 0) return;
+  size = value.size();
+  //level 0: entry i covers cubes 2i..2i+1, i.e., cells 2i..2i+2
+  IntTriple dims((size.a+1)/2,(size.b+1)/2,(size.c+1)/2);
+  minValues.resize(1);
+  maxValues.resize(1);
+  minValues[0].resize(dims.a,dims.b,dims.c);
+  maxValues[0].resize(dims.a,dims.b,dims.c);
+  for(int i=0;i<dims.a;i++) {
+    int i1=2*i,i2=::Min(2*i+2,size.a-1);
+    for(int j=0;j<dims.b;j++) {
+      int j1=2*j,j2=::Min(2*j+2,size.b-1);
+      for(int k=0;k<dims.c;k++) {
+	int k1=2*k,k2=::Min(2*k+2,size.c-1);
+	Real vmin=Inf,vmax=-Inf;
+	for(int x=i1;x<=i2;x++)
+	  for(int y=j1;y<=j2;y++) {
+	    const Real* v=&value(x,y,k1);
+	    for(int z=0;z<=k2-k1;z++) {
+	      if(v[z] < vmin) vmin=v[z];
+	      if(v[z] > vmax) vmax=v[z];
+	    }
+	  }
+	minValues[0](i,j,k) = vmin;
+	maxValues[0](i,j,k) = vmax;
+      }
+    }
+  }
+  //each entry of the next level covers 2x2x2 entries
+  while(dims.a > 1 || dims.b > 1 || dims.c > 1) {
+    const Array3D<Real>& cmin = minValues.back();
+    const Array3D<Real>& cmax = maxValues.back();
+    dims.set((dims.a+1)/2,(dims.b+1)/2,(dims.c+1)/2);
+    Array3D<Real> lmin(dims.a,dims.b,dims.c),lmax(dims.a,dims.b,dims.c);
+    for(int i=0;i<dims.a;i++)
+      for(int j=0;j<dims.b;j++)
+	for(int k=0;k<dims.c;k++) {
+	  Real vmin=Inf,vmax=-Inf;
+	  for(int x=2*i;x<=::Min(2*i+1,cmin.m-1);x++)
+	    for(int y=2*j;y<=::Min(2*j+1,cmin.n-1);y++)
+	      for(int z=2*k;z<=::Min(2*k+1,cmin.p-1);z++) {
+		if(cmin(x,y,z) < vmin) vmin=cmin(x,y,z);
+		if(cmax(x,y,z) > vmax) vmax=cmax(x,y,z);
+	      }
+	  lmin(i,j,k) = vmin;
+	  lmax(i,j,k) = vmax;
+	}
+    minValues.push_back(lmin);
+    maxValues.push_back(lmax);
+  }
+}
+
+void VolumeGridPyramid::GetCubeRange(int level,const IntTriple& index,IntTriple& cmin,IntTriple& cmax) const
+{
+  int shift = level+1;
+  for(int d=0;d<3;d++) {
+    cmin[d] = index[d] << shift;
+    cmax[d] = ::Min(((index[d]+1) << shift)-1,size[d]-1);
+  }
+}
+
+void VolumeGridPyramid::GetBounds(const IntTriple& imin,const IntTriple& imax,Real& vmin,Real& vmax) const
+{
+  vmin = Inf;
+  vmax = -Inf;
+  if(IsEmpty()) return;
+  //cube i covers cells i and i+1
+  IntTriple lo,hi;
+  for(int d=0;d<3;d++) {
+    int a = ::Max(0,::Min(imin[d],size[d]-1));
+    int b = ::Max(0,::Min(imax[d],size[d]-1));
+    if(b < a) return;
+    lo[d] = a;
+    hi[d] = ::Max(a,b-1);
+  }
+  //use the finest level where the range spans at most 4 entries per axis.
+  //Refining the entries on the border of the range would give tighter
+  //bounds, but would visit O(n^2) entries for a range n cells wide.
+  int level = 0;
+  while(level+1 < NumLevels() &&
+	((hi.a>>(level+1))-(lo.a>>(level+1)) > 3 ||
+	 (hi.b>>(level+1))-(lo.b>>(level+1)) > 3 ||
+	 (hi.c>>(level+1))-(lo.c>>(level+1)) > 3))
+    level++;
+  const Array3D<Real>& lmin = minValues[level];
+  const Array3D<Real>& lmax = maxValues[level];
+  int shift = level+1;
+  for(int i=(lo.a>>shift);i<=(hi.a>>shift);i++)
+    for(int j=(lo.b>>shift);j<=(hi.b>>shift);j++)
+      for(int k=(lo.c>>shift);k<=(hi.c>>shift);k++) {
+	if(lmin(i,j,k) < vmin) vmin = lmin(i,j,k);
+	if(lmax(i,j,k) > vmax) vmax = lmax(i,j,k);
+      }
+}
+
+//index of the cell containing coordinate x along an axis with n cells
+//spanning [a,b], clamped to [-1,n] so that far away points don't overflow
+inline int ClampedCellIndex(Real x,Real a,Real b,int n)
+{
+  Real u = (x-a)/(b-a)*n;
+  if(!(u >= -1)) return -1;
+  if(u >= n) return n;
+  return (int)Floor(u);
+}
+
+void VolumeGridPyramid::GetInterpolationBounds(const VolumeGrid& grid,const AABB3D& range,Real& vmin,Real& vmax) const
+{
+  //trilinear interpolation in a cell uses its neighbors too
+  IntTriple imin,imax;
+  imin.a = ClampedCellIndex(range.bmin.x,grid.bb.bmin.x,grid.bb.bmax.x,size.a)-1;
+  imin.b = ClampedCellIndex(range.bmin.y,grid.bb.bmin.y,grid.bb.bmax.y,size.b)-1;
+  imin.c = ClampedCellIndex(range.bmin.z,grid.bb.bmin.z,grid.bb.bmax.z,size.c)-1;
+  imax.a = ClampedCellIndex(range.bmax.x,grid.bb.bmin.x,grid.bb.bmax.x,size.a)+1;
+  imax.b = ClampedCellIndex(range.bmax.y,grid.bb.bmin.y,grid.bb.bmax.y,size.b)+1;
+  imax.c = ClampedCellIndex(range.bmax.z,grid.bb.bmin.z,grid.bb.bmax.z,size.c)+1;
+  for(int d=0;d<3;d++) {
+    imin[d] = ::Min(::Max(imin[d],0),size[d]-1);
+    imax[d] = ::Min(::Max(imax[d],0),size[d]-1);
+  }
+  GetBounds(imin,imax,vmin,vmax);
+}
+
+static void GetIsoCubesRecurse(const VolumeGridPyramid& pyramid,const Array3D<Real>& value,int level,const IntTriple& index,
+			       Real isoval,std::vector<IntTriple>& cubes)
+{
+  //MarchingCubes outputs triangles if some corner is < isoval and some is >= isoval
+  if(!(pyramid.minValues[level](index) < isoval && pyramid.maxValues[level](index) >= isoval)) return;
+  if(level == 0) {
+    IntTriple cmin,cmax;
+    pyramid.GetCubeRange(0,index,cmin,cmax);
+    IntTriple c;
+    for(c.a=cmin.a;c.a<=::Min(cmax.a,value.m-2);c.a++)
+      for(c.b=cmin.b;c.b<=::Min(cmax.b,value.n-2);c.b++)
+	for(c.c=cmin.c;c.c<=::Min(cmax.c,value.p-2);c.c++) {
+	  Real vmin=Inf,vmax=-Inf;
+	  for(int v=0;v<8;v++) {
+	    Real x = value(c.a+(v&1),c.b+((v>>1)&1),c.c+((v>>2)&1));
+	    if(x < vmin) vmin=x;
+	    if(x > vmax) vmax=x;
+	  }
+	  if(vmin < isoval && vmax >= isoval)
+	    cubes.push_back(c);
+	}
+    return;
+  }
+  const Array3D<Real>& child = pyramid.minValues[level-1];
+  IntTriple c;
+  for(c.a=2*index.a;c.a<=::Min(2*index.a+1,child.m-1);c.a++)
+    for(c.b=2*index.b;c.b<=::Min(2*index.b+1,child.n-1);c.b++)
+      for(c.c=2*index.c;c.c<=::Min(2*index.c+1,child.p-1);c.c++)
+	GetIsoCubesRecurse(pyramid,value,level-1,c,isoval,cubes);
+}
+
+void VolumeGridPyramid::GetIsoCubes(const Array3D<Real>& value,Real isoval,std::vector<IntTriple>& cubes) const
+{
+  cubes.resize(0);
+  if(IsEmpty()) return;
+  Assert(value.size() == size);
+  GetIsoCubesRecurse(*this,value,NumLevels()-1,IntTriple(0,0,0),isoval,cubes);
+}
+
+bool VolumeGridPyramid::GetEmptyBlock(const IntTriple& cell,Real threshold,IntTriple& imin,IntTriple& imax) const
+{
+  if(IsEmpty()) return false;
+  IntTriple c;
+  for(int d=0;d<3;d++) c[d] = ::Max(0,::Min(cell[d],size[d]-1));
+  //interpolation in cell c uses cubes c-1 and c.  An entry covering cubes
+  //A..B therefore bounds the interpolation in cells A+1..B, or 0..B if A=0.
+  bool found = false;
+  IntTriple index,cmin,cmax;
+  for(int level=0;level<NumLevels();level++) {
+    for(int d=0;d<3;d++) index[d] = c[d] >> (level+1);
+    if(!(minValues[level](index) > threshold)) break;
+    GetCubeRange(level,index,cmin,cmax);
+    bool contained = true;
+    for(int d=0;d<3;d++)
+      if(cmin[d] > 0 && c[d] == cmin[d]) contained = false;
+    if(!contained) continue;
+    found = true;
+    for(int d=0;d<3;d++) {
+      imin[d] = (cmin[d] > 0 ? cmin[d]+1 : 0);
+      imax[d] = cmax[d];
+    }
+  }
+  return found;
+}
+
 istream& operator >> (istream& in,VolumeGrid& grid)
 {
   in>>grid.bb.bmin>>grid.bb.bmax;
@@ -6,6 +6,7 @@
 #include <KrisLibrary/math3d/primitives.h>
 #include <KrisLibrary/utils/indexing.h>
 #include <iosfwd>
+#include <vector>
 
 namespace Meshing {
 
@@ -88,6 +89,45 @@ class VolumeGrid
   AABB3D bb;
 };
 
+/** @ingroup Meshing
+ * @brief A min/max pyramid over the values of a grid, for bounding the
+ * values over a region in time logarithmic in the grid size.
+ *
+ * Cube (i,j,k) of the grid has the cells i..i+1, j..j+1, k..k+1 as its
+ * corners, like the cubes meshed by MarchingCubes.  An entry of level l
+ * holds the min and max of the values of the 2^(l+1) x 2^(l+1) x 2^(l+1)
+ * cubes starting at cube (i,j,k)*2^(l+1).  The top level has a single
+ * entry.  The pyramid needs about a quarter of the grid's memory.
+ *
+ * Built with Build(), and needs to be rebuilt whenever the values change.
+ */
+class VolumeGridPyramid
+{
+ public:
+  void Build(const Array3D<Real>& value);
+  void Clear();
+  bool IsEmpty() const { return minValues.empty(); }
+  int NumLevels() const { return (int)minValues.size(); }
+  ///Bounds the values of cells imin..imax (inclusive, clamped to the grid)
+  void GetBounds(const IntTriple& imin,const IntTriple& imax,Real& vmin,Real& vmax) const;
+  ///Bounds grid.TrilinearInterpolate over the points in range, which may
+  ///extend outside of grid.bb.  grid must be the grid that was used to
+  ///build the pyramid.
+  void GetInterpolationBounds(const VolumeGrid& grid,const AABB3D& range,Real& vmin,Real& vmax) const;
+  ///Returns the cubes that contain the isosurface at isoval, i.e., those
+  ///where MarchingCubes outputs triangles
+  void GetIsoCubes(const Array3D<Real>& value,Real isoval,std::vector<IntTriple>& cubes) const;
+  ///Finds the largest block of cells imin..imax containing cell, over which
+  ///TrilinearInterpolate is known to be greater than threshold.  Returns
+  ///false if no such block is found.
+  bool GetEmptyBlock(const IntTriple& cell,Real threshold,IntTriple& imin,IntTriple& imax) const;
+  ///Returns the range of cubes covered by entry index of the given level
+  void GetCubeRange(int level,const IntTriple& index,IntTriple& cmin,IntTriple& cmax) const;
+
+  IntTriple size;  ///< the size of the grid
+  std::vector<Array3D<Real> > minValues,maxValues;
+};
+
 std::istream& operator >> (std::istream& in,VolumeGrid& grid);
 std::ostream& operator << (std::ostream& out,const VolumeGrid& grid);
 
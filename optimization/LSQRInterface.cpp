@@ -6,7 +6,7 @@ using namespace std;
 
 struct SparseMatrixMultiplier : public lsqr_func
 {
-  SparseMatrixMultiplier(const dSparseMatrix_RM& _A) :A(_A) { }
+  SparseMatrixMultiplier(const dSparseMatrix_CR& _A) :A(_A) { }
 
   /* compute  y = y + A*x*/
   virtual void MatrixVectorProduct (const dVector& x, dVector& y)
@@ -19,17 +19,25 @@ struct SparseMatrixMultiplier : public lsqr_func
     A.maddTranspose(y,x);
   }
 
-  const dSparseMatrix_RM& A;
+  const dSparseMatrix_CR& A;
 };
 
 LSQRInterface::LSQRInterface()
-  :dampValue(0),relError(0),condLimit(0),maxIters(0),verbose(1)
+  :dampValue(0),relError(0),condLimit(0),maxIters(0),verbose(1),numThreads(1)
 {}
 
 bool LSQRInterface::Solve(const SparseMatrix& A,const Vector& b)
 {
   dSparseMatrix_RM dA; dA.copy(A);
-  SparseMatrixMultiplier func(dA);
+  dSparseMatrix_CR Acr;
+  Acr.set(dA);
+  Acr.numThreads = numThreads;
+  return Solve(Acr,b);
+}
+
+bool LSQRInterface::Solve(const dSparseMatrix_CR& A,const Vector& b)
+{
+  SparseMatrixMultiplier func(A);
   lsqr_input input;
   lsqr_work work;
   lsqr_output output;
@@ -14,6 +14,10 @@ struct LSQRInterface
 {
   LSQRInterface();
   bool Solve(const SparseMatrix& A,const Vector& b);
+  ///Same as above, but for a compressed-row matrix, which avoids the
+  ///conversion when solving many problems with the same A.  Uses
+  ///A.numThreads threads in the matrix products.
+  bool Solve(const dSparseMatrix_CR& A,const Vector& b);
 
   //input quantities
   Vector x0;       ///<initial guess for x -- default set to 0's
@@ -22,6 +26,7 @@ struct LSQRInterface
   Real condLimit;  ///<stop if the estimated condition number of A exceeds condLim
   int maxIters;    ///<maximum number of iterations, set to 0 to use default value
   int verbose;     ///<0 - no output printed, 1 - output to stdout, 2 - output to stderr
+  int numThreads;  ///<threads used in the matrix products of Solve(SparseMatrix), 0 to use all hardware threads (default 1)
 
   //output quantities
   Vector x;        ///<the solution vector
@@ -9,7 +9,10 @@
 #include "PointLocation.h"
 #include "SBL.h"
 #include "FMMMotionPlanner.h"
+#include "FeasibilityCache.h"
+#include "CSpaceHelpers.h"
 #include "Timer.h"
+#include <utils/threadutils.h>
 
 #if HAVE_TINYXML
 #include <tinyxml.h>
@@ -30,10 +33,14 @@ void ToCollection(const MotionPlannerFactory& factory,AnyCollection& items)
   items["gridResolution"] = factory.gridResolution;
   items["randomizeFrequency"] = factory.randomizeFrequency;
   items["pointLocation"] = factory.pointLocation;
+  items["portfolio"] = factory.portfolio;
   items["storeEdges"] = factory.storeEdges;
+  items["threadSafeCSpace"] = factory.threadSafeCSpace;
   items["shortcut"] = factory.shortcut;
   items["restart"] = factory.restart;
   items["restartTermCond"] = factory.restartTermCond;
+  items["feasibilityCacheSize"] = factory.feasibilityCacheSize;
+  items["feasibilityCacheResolution"] = factory.feasibilityCacheResolution;
 }
 
 
@@ -181,6 +188,173 @@ class RestartShortcutMotionPlanner : public RestartMotionPlanner
   vector<MilestonePath> candidatePaths;
 };
 
+/** @brief Owns the cached space that another planner was created on, and
+ * reports the cache statistics.
+ */
+class CachedSpaceMotionPlanner : public PiggybackMotionPlanner
+{
+ public:
+  CachedSpaceMotionPlanner(const SmartPointer<MotionPlannerInterface>& mp,const SmartPointer<CSpace>& space,const SmartPointer<FeasibilityCache>& cache);
+  virtual ~CachedSpaceMotionPlanner();
+  virtual std::string Plan(MilestonePath& path,const HaltingCondition& cond) { return mp->Plan(path,cond); }
+  virtual void GetStats(PropertyMap& stats) const;
+
+  SmartPointer<CSpace> space;
+  SmartPointer<FeasibilityCache> cache;
+};
+
+/** @brief The plan lock of a parallel portfolio, as seen by one member.
+ */
+struct PortfolioPlanLock
+{
+  PortfolioPlanLock(Mutex* _mutex) :mutex(_mutex),held(false) {}
+  Mutex* mutex;
+  ///True while the member's thread holds mutex
+  bool held;
+};
+
+/** @brief Releases a member's plan lock for the lifetime of this object,
+ * if the member holds it.
+ */
+class PortfolioUnlock
+{
+ public:
+  PortfolioUnlock(PortfolioPlanLock* _lock) :lock(_lock),released(_lock->held) {
+    if(released) { lock->held = false; lock->mutex->unlock(); }
+  }
+  ~PortfolioUnlock() {
+    if(released) { lock->mutex->lock(); lock->held = true; }
+  }
+
+  PortfolioPlanLock* lock;
+  bool released;
+};
+
+/** @brief An edge planner of a PortfolioMemberCSpace.  IsVisible() runs
+ * without the plan lock.
+ */
+class PortfolioMemberEdgePlanner : public EdgePlanner
+{
+ public:
+  PortfolioMemberEdgePlanner(const SmartPointer<PortfolioPlanLock>& _lock,EdgePlanner* _e) :lock(_lock),e(_e) {}
+  virtual bool IsVisible() { PortfolioUnlock unlock(lock); return e->IsVisible(); }
+  virtual void Eval(Real u,Config& x) const { e->Eval(u,x); }
+  virtual const Config& Start() const { return e->Start(); }
+  virtual const Config& Goal() const { return e->Goal(); }
+  virtual CSpace* Space() const { return e->Space(); }
+  virtual EdgePlanner* Copy() const { return new PortfolioMemberEdgePlanner(lock,e->Copy()); }
+  virtual EdgePlanner* ReverseCopy() const { return new PortfolioMemberEdgePlanner(lock,e->ReverseCopy()); }
+
+  virtual Real Priority() const { return e->Priority(); }
+  virtual bool Plan() { return e->Plan(); }
+  virtual bool Done() const { return e->Done(); }
+  virtual bool Failed() const { return e->Failed(); }
+
+  SmartPointer<PortfolioPlanLock> lock;
+  SmartPointer<EdgePlanner> e;
+};
+
+/** @brief The space that a member of a parallel portfolio plans on.
+ *
+ * A member holds the portfolio's plan lock while it steps, so sampling,
+ * distances, and the planners' own draws from the global random number
+ * generator (Math::rng) never run in two members at once.  The lock is
+ * released only while configurations and edges are checked, which
+ * CSpace::IsThreadSafe() allows.
+ */
+class PortfolioMemberCSpace : public PiggybackCSpace
+{
+ public:
+  PortfolioMemberCSpace(CSpace* baseSpace,Mutex* planMutex)
+    :PiggybackCSpace(baseSpace),lock(new PortfolioPlanLock(planMutex))
+  {}
+  virtual EdgePlanner* LocalPlanner(const Config& a,const Config& b) {
+    return new PortfolioMemberEdgePlanner(lock,baseSpace->LocalPlanner(a,b));
+  }
+  virtual bool IsFeasible(const Config& x) {
+    PortfolioUnlock unlock(lock);
+    return baseSpace->IsFeasible(x);
+  }
+  virtual bool IsFeasible(const std::vector<Config>& xs,std::vector<bool>& feasible,bool stopOnInfeasible=false) {
+    PortfolioUnlock unlock(lock);
+    return baseSpace->IsFeasible(xs,feasible,stopOnInfeasible);
+  }
+  virtual bool IsThreadSafe() const { return baseSpace->IsThreadSafe(); }
+  virtual Real ObstacleDistance(const Config& a) { return baseSpace->ObstacleDistance(a); }
+
+  SmartPointer<PortfolioPlanLock> lock;
+};
+
+/** @brief Runs several planners on the same problem and keeps the result
+ * of the first one to solve it (if cond.foundSolution is true) or the
+ * lowest-cost one (otherwise).
+ *
+ * If parallel is true, each member plans in its own thread, and the others
+ * are cancelled once one of them finishes the problem.  A step of a member
+ * runs under planMutex, so only the feasibility checks of members that plan
+ * on a PortfolioMemberCSpace overlap.  Otherwise the members take turns on
+ * the calling thread, one iteration each.  The halting condition's
+ * iteration limit applies to each member separately, while its time limit
+ * is measured from the start of Plan() for all members.
+ */
+class PortfolioMotionPlanner : public MotionPlannerInterface
+{
+ public:
+  struct Member
+  {
+    string type;
+    SmartPointer<MotionPlannerInterface> planner;
+    ///The space the planner was created on, if it is a member space
+    SmartPointer<PortfolioMemberCSpace> space;
+    ///Results of the last call to Plan()
+    string result;
+    int numIters;
+    bool solved;
+    Real cost;
+    double solveTime;
+    MilestonePath path;
+    Real lastCheckTime,lastCheckValue;
+  };
+
+  PortfolioMotionPlanner();
+  void Add(const string& type,const SmartPointer<MotionPlannerInterface>& planner);
+  virtual std::string Plan(MilestonePath& path,const HaltingCondition& cond);
+  virtual int PlanMore();
+  virtual int NumIterations() const;
+  virtual int NumMilestones() const;
+  virtual int NumComponents() const;
+  virtual bool CanAddMilestone() const;
+  virtual int AddMilestone(const Config& q);
+  virtual void GetMilestone(int i,Config& q) { members[0].planner->GetMilestone(i,q); }
+  virtual bool IsConnected(int ma,int mb) const;
+  virtual bool IsPointToPoint() const;
+  virtual bool IsOptimizing() const;
+  virtual void GetPath(int ma,int mb,MilestonePath& path);
+  virtual void GetRoadmap(RoadmapPlanner& roadmap) const;
+  virtual bool IsSolved();
+  virtual void GetSolution(MilestonePath& path);
+  virtual void GetStats(PropertyMap& stats) const;
+
+  ///Runs one iteration of member i.  Returns false when it is done
+  bool Step(int i,const HaltingCondition& cond,Timer& timer);
+  ///Marks member i as the one that finished the problem, and tells the
+  ///others to stop
+  void Finish(int i);
+  ///Returns true once a member has finished the problem
+  bool Stopped();
+
+  vector<Member> members;
+  bool parallel;
+  ///Index of the member whose path was kept by Plan(), or -1
+  int winner;
+  ///Set to tell the members to stop planning (guarded by mutex)
+  bool stop;
+  Mutex mutex;
+  ///Held by a member while it steps in parallel mode
+  Mutex planMutex;
+  MilestonePath bestPath;
+};
+
 /** @brief Plans a path and then tries to shortcut it with the remaining time.
  */
 class ShortcutMotionPlanner : public PiggybackMotionPlanner
@@ -323,7 +497,7 @@ class RoadmapPlannerInterface  : public MotionPlannerInterface
 {
  public:
   RoadmapPlannerInterface(CSpace* space)
-    : prm(space),knn(10),connectionThreshold(Inf),numIters(0),ignoreConnectedComponents(false),storeEdges(true)
+    : prm(space),knn(10),connectionThreshold(Inf),numIters(0),maxNumIters(INT_MAX),ignoreConnectedComponents(false),storeEdges(true)
     {}
   virtual ~RoadmapPlannerInterface() {}
   virtual bool IsOptimizing() const { return false; }
@@ -350,7 +524,20 @@ class RoadmapPlannerInterface  : public MotionPlannerInterface
     }
     return res;
   }
+  virtual std::string Plan(MilestonePath& path,const HaltingCondition& cond) {
+    //in parallel mode one PlanMore() call samples a whole batch, so the
+    //samples are capped here rather than by counting calls
+    maxNumIters = (cond.maxIters < INT_MAX-numIters ? numIters+cond.maxIters : INT_MAX);
+    std::string res = MotionPlannerInterface::Plan(path,cond);
+    maxNumIters = INT_MAX;
+    return res;
+  }
   virtual int PlanMore() { 
+    if(prm.numThreads != 1) {  //parallel mode: sample and connect a whole batch
+      int n = Min(prm.BatchSize(),maxNumIters-numIters);
+      if(n <= 0) return -1;
+      return PlanBatch(n);
+    }
     Config q;
     prm.space->Sample(q);
     int n=prm.TestAndAddMilestone(q);
@@ -360,6 +547,23 @@ class RoadmapPlannerInterface  : public MotionPlannerInterface
     numIters++;
     return n;
   }
+  virtual void PlanMore(int n) {
+    if(prm.numThreads != 1) PlanBatch(n);
+    else for(int i=0;i<n;i++) PlanMore();
+  }
+  int PlanBatch(int numSamples) {
+    vector<int> newMilestones;
+    prm.GenerateBatch(numSamples,knn,connectionThreshold,!ignoreConnectedComponents,newMilestones);
+    numIters += numSamples;
+    if(!storeEdges) {
+      for(size_t i=0;i<newMilestones.size();i++) {
+        RoadmapPlanner::Roadmap::Iterator e;
+        for(prm.roadmap.Begin(newMilestones[i],e);!e.end();++e)
+          *e = NULL;
+      }
+    }
+    return (newMilestones.empty() ? -1 : newMilestones.back());
+  }
   virtual int NumIterations() const { return numIters; }
   virtual int NumMilestones() const { return prm.roadmap.NumNodes(); }
   virtual int NumComponents() const { return prm.ccs.NumComponents(); }
@@ -373,6 +577,8 @@ class RoadmapPlannerInterface  : public MotionPlannerInterface
   int knn;
   Real connectionThreshold;
   int numIters;
+  ///Limit on numIters set by Plan() for the parallel mode
+  int maxNumIters;
   bool ignoreConnectedComponents,storeEdges;
 };
 
@@ -1016,6 +1222,22 @@ PiggybackMotionPlanner::PiggybackMotionPlanner(const SmartPointer<MotionPlannerI
   :mp(_mp)
 {}
 
+CachedSpaceMotionPlanner::CachedSpaceMotionPlanner(const SmartPointer<MotionPlannerInterface>& _mp,const SmartPointer<CSpace>& _space,const SmartPointer<FeasibilityCache>& _cache)
+  :PiggybackMotionPlanner(_mp),space(_space),cache(_cache)
+{}
+
+CachedSpaceMotionPlanner::~CachedSpaceMotionPlanner()
+{
+  //the planner must be destroyed before the space it refers to
+  mp = NULL;
+}
+
+void CachedSpaceMotionPlanner::GetStats(PropertyMap& stats) const
+{
+  mp->GetStats(stats);
+  cache->GetStats(stats);
+}
+
 PointToSetMotionPlanner::PointToSetMotionPlanner(const SmartPointer<MotionPlannerInterface>& _mp,const Config& _qstart,CSpace* _goal)
   :PiggybackMotionPlanner(_mp),goalSpace(_goal),sampleGoalPeriod(50),sampleGoalCounter(0)
 {
@@ -1318,14 +1540,77 @@ MotionPlannerFactory::MotionPlannerFactory()
    perturbationRadius(0.1),perturbationIters(5),
    bidirectional(true),
    useGrid(true),gridResolution(0),randomizeFrequency(50),
-   storeEdges(true),shortcut(false),restart(false),
-   restartTermCond("{foundSolution:1,maxIters:1000}")
+   storeEdges(true),threadSafeCSpace(false),shortcut(false),restart(false),
+   restartTermCond("{foundSolution:1,maxIters:1000}"),
+   portfolio("rrt sbl prm"),
+   feasibilityCacheSize(0),feasibilityCacheResolution(1e-6)
 {}
 
 MotionPlannerInterface* MotionPlannerFactory::Create(const MotionPlanningProblem& problem)
 {
   if(problem.startSet) FatalError("MotionPlannerFactory: Cannot do start-set problems yet");
   if(problem.qstart.empty() && (!problem.qgoal.empty() || problem.goalSet!=NULL)) FatalError("MotionPlannerFactory: Goal set specified but start not specified");
+  if(feasibilityCacheSize > 0) {
+    //all planners made for this problem (including restarts) share the
+    //cached space
+    SmartPointer<FeasibilityCache> cache = new FeasibilityCache(feasibilityCacheSize,feasibilityCacheResolution);
+    SmartPointer<CSpace> cspace;
+    ExplicitCSpace* espace = dynamic_cast<ExplicitCSpace*>(problem.space);
+    if(espace) cspace = new CachedExplicitCSpace(espace,cache);
+    else cspace = new CachedCSpace(problem.space,cache);
+    MotionPlanningProblem cachedProblem = problem;
+    cachedProblem.space = cspace;
+    MotionPlannerFactory nocache = *this;
+    nocache.feasibilityCacheSize = 0;
+    MotionPlannerInterface* mp = nocache.Create(cachedProblem);
+    if(!mp) return NULL;
+    return new CachedSpaceMotionPlanner(mp,cspace,cache);
+  }
+  string ltype = type;
+  Lowercase(ltype);
+  if(ltype == "portfolio") {
+    vector<string> types;
+    stringstream ss(portfolio);
+    string t;
+    while(ss >> t) {
+      //allow commas as separators too
+      size_t start = 0, end;
+      while((end = t.find(',',start)) != string::npos) {
+	if(end > start) types.push_back(t.substr(start,end-start));
+	start = end+1;
+      }
+      if(start < t.length()) types.push_back(t.substr(start));
+    }
+    if(types.empty()) {
+      fprintf(stderr,"MotionPlannerFactory: portfolio planner has no members\n");
+      return NULL;
+    }
+    PortfolioMotionPlanner* pmp = new PortfolioMotionPlanner;
+    pmp->parallel = (threadSafeCSpace || problem.space->IsThreadSafe());
+    for(size_t i=0;i<types.size();i++) {
+      MotionPlannerFactory member = *this;
+      member.type = types[i];
+      Lowercase(member.type);
+      MotionPlanningProblem memberProblem = problem;
+      SmartPointer<PortfolioMemberCSpace> space;
+      if(pmp->parallel) {
+	space = new PortfolioMemberCSpace(problem.space,&pmp->planMutex);
+	memberProblem.space = space;
+      }
+      MotionPlannerInterface* mp = NULL;
+      if(member.type == "portfolio")
+	fprintf(stderr,"MotionPlannerFactory: portfolio planners cannot be nested\n");
+      else
+	mp = member.Create(memberProblem);
+      if(!mp) {
+	delete pmp;
+	return NULL;
+      }
+      pmp->Add(member.type,mp);
+      pmp->members.back().space = space;
+    }
+    return pmp;
+  }
   if(!problem.qstart.empty() && problem.goalSet) { //point-to-goal problem
     //pick a multi-query planner for the underlying planner
     string oldtype = type;
@@ -1395,41 +1680,19 @@ MotionPlannerInterface* MotionPlannerFactory::ApplyModifiers(MotionPlannerInterf
 bool ReadPointLocation(const string& str,RoadmapPlanner& planner)
 {
   if(str.empty()) return false; //use default
-  stringstream ss(str);
-  string type;
-  ss>>type;
-  if(type=="random") {
-    planner.pointLocator = new RandomPointLocation(planner.roadmap.nodes);
-    return true;
-  }
-  else if(type=="randombest") {
-    int k;
-    ss >> k;
-    if(!ss) {
-      fprintf(stderr,"Error reading point location string \"randombest [k]\"\n");
-      return false;
-    }
-    planner.pointLocator = new RandomBestPointLocation(planner.roadmap.nodes,planner.space,k);
-    return true;
-  }
-  else if(type=="kdtree") {
-    PropertyMap props;
-    planner.space->Properties(props);
-    int euclidean;
-    if(props.get("euclidean",euclidean) && euclidean == 0)
-      fprintf(stderr,"MotionPlannerFactory: Warning, requesting K-D tree point location for non-euclidean space\n");
+  PointLocationBase* pl = MakePointLocation(str,planner.roadmap.nodes,planner.space);
+  if(!pl) return false;
+  planner.pointLocator = pl;
+  return true;
+}
 
-    vector<Real> weights;
-    if(props.getArray("metricWeights",weights))
-      planner.pointLocator = new KDTreePointLocation(planner.roadmap.nodes,2,weights);
-    else
-      planner.pointLocator = new KDTreePointLocation(planner.roadmap.nodes);
-    return true;
-  }
-  else {
-    fprintf(stderr,"Unsupported point location type %s\n",type.c_str());
-    return false;
-  }
+bool ReadPointLocation(const string& str,TreeRoadmapPlanner& planner)
+{
+  if(str.empty()) return false; //use default
+  PointLocationBase* pl = MakePointLocation(str,planner.pointLocation.points,planner.space);
+  if(!pl) return false;
+  planner.pointLocation.pointLocator = pl;
+  return true;
 }
 
 MotionPlannerInterface* MotionPlannerFactory::CreateRaw(CSpace* space)
@@ -1454,6 +1717,7 @@ MotionPlannerInterface* MotionPlannerFactory::CreateRaw(CSpace* space)
     prm->connectionThreshold = connectionThreshold;
     prm->ignoreConnectedComponents = ignoreConnectedComponents;
     prm->storeEdges=storeEdges;
+    if(threadSafeCSpace || space->IsThreadSafe()) prm->prm.numThreads = 0;
     ReadPointLocation(pointLocation,prm->prm);
     return prm;
   }
@@ -1464,12 +1728,14 @@ MotionPlannerInterface* MotionPlannerFactory::CreateRaw(CSpace* space)
     sbl->sbl->maxExtendDistance = perturbationRadius;
     sbl->sbl->maxExtendIters = perturbationIters;
     sbl->sbl->edgeConnectionThreshold = connectionThreshold;
+    sbl->sbl->pointLocation = pointLocation;
     return sbl;
   }
   else if(type=="sblprt") {
     SBLPRTInterface* sblprt = new SBLPRTInterface(space);
     sblprt->sblprt.maxExtendDistance = perturbationRadius;
     sblprt->sblprt.maxExtendIters = perturbationIters;
+    sblprt->sblprt.pointLocation = pointLocation;
     //Real defaultPPickClosestTree,defaultPPickClosestNode;
     return sblprt;
   }
@@ -1478,12 +1744,14 @@ MotionPlannerInterface* MotionPlannerFactory::CreateRaw(CSpace* space)
       BiRRTInterface* rrt = new BiRRTInterface(space);
       rrt->rrt.connectionThreshold = connectionThreshold;
       rrt->rrt.delta = perturbationRadius;
+      ReadPointLocation(pointLocation,rrt->rrt);
       return rrt;
     }
     else {
       RRTInterface* rrt = new RRTInterface(space);
       rrt->rrt.connectionThreshold = connectionThreshold;
       rrt->rrt.delta = perturbationRadius;
+      ReadPointLocation(pointLocation,rrt->rrt);
       return rrt;
     }
   }
@@ -1491,6 +1759,7 @@ MotionPlannerInterface* MotionPlannerFactory::CreateRaw(CSpace* space)
     PRMStarInterface* prm = new PRMStarInterface(space);
     prm->planner.lazy = false;
     prm->planner.connectionThreshold = connectionThreshold;
+    if(threadSafeCSpace || space->IsThreadSafe()) prm->planner.numThreads = 0;
     ReadPointLocation(pointLocation,prm->planner);
     if(shortcut || restart) 
       printf("MotionPlannerInterface: Warning, shortcut and restart are incompatible with PRM* planner\n");
@@ -1622,11 +1891,16 @@ bool MotionPlannerFactory::Load(TiXmlElement* e)
   e->QueryValueAttribute("gridResolution",&gridResolution);
   e->QueryValueAttribute("randomizeFrequency",&randomizeFrequency);
   e->QueryValueAttribute("storeEdges",&storeEdges);
+  e->QueryValueAttribute("threadSafeCSpace",&threadSafeCSpace);
   e->QueryValueAttribute("shortcut",&shortcut);
   e->QueryValueAttribute("restart",&restart);
   e->QueryValueAttribute("restartTermCond",&restartTermCond);
+  e->QueryValueAttribute("feasibilityCacheSize",&feasibilityCacheSize);
+  e->QueryValueAttribute("feasibilityCacheResolution",&feasibilityCacheResolution);
   if(e->Attribute("pointLocation"))
     pointLocation = e->Attribute("pointLocation");
+  if(e->Attribute("portfolio"))
+    portfolio = e->Attribute("portfolio");
   return true;
 #else
   return false;
@@ -1655,12 +1929,16 @@ bool MotionPlannerFactory::LoadJSON(const string& str)
   items["bidirectional"].as(bidirectional);
   items["useGrid"].as(useGrid);
   items["pointLocation"].as(pointLocation);
+  items["portfolio"].as(portfolio);
   items["gridResolution"].as(gridResolution);
   items["randomizeFrequency"].as(randomizeFrequency);
   items["storeEdges"].as(storeEdges);
+  items["threadSafeCSpace"].as(threadSafeCSpace);
   items["shortcut"].as(shortcut);
   items["restart"].as(restart);
   items["restartTermCond"].as(restartTermCond);
+  items["feasibilityCacheSize"].as(feasibilityCacheSize);
+  items["feasibilityCacheResolution"].as(feasibilityCacheResolution);
   return true;
 }
 
@@ -1970,6 +2248,323 @@ void RestartShortcutMotionPlanner::GetRoadmap(RoadmapPlanner& roadmap) const
 }
 
 
+
+PortfolioMotionPlanner::PortfolioMotionPlanner()
+  :parallel(false),winner(-1),stop(false)
+{}
+
+void PortfolioMotionPlanner::Add(const string& type,const SmartPointer<MotionPlannerInterface>& planner)
+{
+  members.resize(members.size()+1);
+  Member& m = members.back();
+  m.type = type;
+  m.planner = planner;
+  m.numIters = 0;
+  m.solved = false;
+  m.cost = Inf;
+  m.solveTime = 0;
+  m.lastCheckTime = m.lastCheckValue = 0;
+}
+
+void PortfolioMotionPlanner::Finish(int i)
+{
+  ScopedLock lock(mutex);
+  if(!stop) {
+    stop = true;
+    winner = i;
+  }
+}
+
+bool PortfolioMotionPlanner::Stopped()
+{
+  ScopedLock lock(mutex);
+  return stop;
+}
+
+bool PortfolioMotionPlanner::Step(int i,const HaltingCondition& cond,Timer& timer)
+{
+  Member& m = members[i];
+  if(m.numIters >= cond.maxIters) {
+    m.result = "maxIters";
+    return false;
+  }
+  Real t = timer.ElapsedTime();
+  if(t > cond.timeLimit) {
+    m.result = "timeLimit";
+    return false;
+  }
+  //check for cost improvements
+  if(m.solved && t > m.lastCheckTime + cond.costImprovementPeriod) {
+    m.planner->GetSolution(m.path);
+    m.cost = m.path.Length();
+    if(m.cost < cond.costThreshold) {
+      m.result = "costThreshold";
+      Finish(i);
+      return false;
+    }
+    if(m.lastCheckValue - m.cost < cond.costImprovementThreshold) {
+      m.result = "costImprovementThreshold";
+      return false;
+    }
+    m.lastCheckTime = t;
+    m.lastCheckValue = m.cost;
+  }
+  m.planner->PlanMore();
+  m.numIters++;
+  if(!m.solved && m.planner->IsSolved()) {
+    m.solved = true;
+    m.solveTime = t;
+    m.planner->GetSolution(m.path);
+    m.cost = m.path.Length();
+    if(cond.foundSolution) {
+      m.result = "foundSolution";
+      Finish(i);
+      return false;
+    }
+    m.lastCheckTime = t;
+    m.lastCheckValue = m.cost;
+  }
+  return true;
+}
+
+struct PortfolioPlanData
+{
+  PortfolioMotionPlanner* planner;
+  const HaltingCondition* cond;
+  ///Started by Plan() and shared by all members, so they have one deadline.
+  ///Only read by Step(), which runs under planMutex
+  Timer* timer;
+  int index;
+};
+
+void* PortfolioPlanThread(void* data)
+{
+  PortfolioPlanData* pd = reinterpret_cast<PortfolioPlanData*>(data);
+  PortfolioMotionPlanner* planner = pd->planner;
+  int i = pd->index;
+  PortfolioMotionPlanner::Member& m = planner->members[i];
+  while(true) {
+    if(planner->Stopped()) {
+      m.result = "cancelled";
+      break;
+    }
+    bool more;
+    {
+      ScopedLock lock(planner->planMutex);
+      if(m.space) m.space->lock->held = true;
+      more = planner->Step(i,*pd->cond,*pd->timer);
+      if(m.space) m.space->lock->held = false;
+    }
+    if(!more) break;
+    ThreadYield();
+  }
+  return NULL;
+}
+
+std::string PortfolioMotionPlanner::Plan(MilestonePath& path,const HaltingCondition& cond)
+{
+  path.edges.clear();
+  bestPath.edges.clear();
+  stop = false;
+  winner = -1;
+  for(size_t i=0;i<members.size();i++) {
+    members[i].result.clear();
+    members[i].numIters = 0;
+    members[i].solved = false;
+    members[i].cost = Inf;
+    members[i].path.edges.clear();
+  }
+  Timer timer;
+  if(parallel) {
+    //one dedicated thread per member: ParallelFor may run its items one
+    //after another (e.g., when called from inside another ParallelFor)
+    vector<PortfolioPlanData> data(members.size());
+    vector<Thread> threads;
+    for(size_t i=0;i<members.size();i++) {
+      data[i].planner = this;
+      data[i].cond = &cond;
+      data[i].timer = &timer;
+      data[i].index = (int)i;
+      threads.push_back(ThreadStart(PortfolioPlanThread,&data[i]));
+    }
+    for(size_t i=0;i<threads.size();i++)
+      ThreadJoin(threads[i]);
+  }
+  else {
+    vector<bool> active(members.size(),true);
+    int numActive = (int)members.size();
+    while(numActive > 0 && !stop) {
+      for(size_t i=0;i<members.size() && !stop;i++) {
+	if(!active[i]) continue;
+	if(!Step((int)i,cond,timer)) {
+	  active[i] = false;
+	  numActive--;
+	}
+      }
+    }
+    for(size_t i=0;i<members.size();i++)
+      if(active[i]) members[i].result = "cancelled";
+  }
+  //pick the winner, or else the lowest cost solution
+  if(winner < 0) {
+    for(size_t i=0;i<members.size();i++) {
+      if(!members[i].solved) continue;
+      members[i].planner->GetSolution(members[i].path);
+      members[i].cost = members[i].path.Length();
+      if(winner < 0 || members[i].cost < members[winner].cost)
+	winner = (int)i;
+    }
+  }
+  if(winner < 0) return (members.empty() ? string("maxIters") : members[0].result);
+  bestPath = members[winner].path;
+  path = bestPath;
+  return members[winner].result;
+}
+
+int PortfolioMotionPlanner::PlanMore()
+{
+  int res = -1;
+  for(size_t i=0;i<members.size();i++) {
+    int mres = members[i].planner->PlanMore();
+    if(i == 0) res = mres;
+    members[i].numIters++;
+  }
+  return res;
+}
+
+int PortfolioMotionPlanner::NumIterations() const
+{
+  int n=0;
+  for(size_t i=0;i<members.size();i++) n += members[i].planner->NumIterations();
+  return n;
+}
+
+int PortfolioMotionPlanner::NumMilestones() const
+{
+  int n=0;
+  for(size_t i=0;i<members.size();i++) n += members[i].planner->NumMilestones();
+  return n;
+}
+
+int PortfolioMotionPlanner::NumComponents() const
+{
+  int n=0;
+  for(size_t i=0;i<members.size();i++) n += members[i].planner->NumComponents();
+  return n;
+}
+
+bool PortfolioMotionPlanner::CanAddMilestone() const
+{
+  for(size_t i=0;i<members.size();i++)
+    if(!members[i].planner->CanAddMilestone()) return false;
+  return !members.empty();
+}
+
+int PortfolioMotionPlanner::AddMilestone(const Config& q)
+{
+  int res = -1;
+  for(size_t i=0;i<members.size();i++) {
+    int id = members[i].planner->AddMilestone(q);
+    if(i == 0) res = id;
+    else if(id != res) fprintf(stderr,"PortfolioMotionPlanner: Warning, members assigned different milestone ids %d and %d\n",res,id);
+  }
+  return res;
+}
+
+bool PortfolioMotionPlanner::IsConnected(int ma,int mb) const
+{
+  for(size_t i=0;i<members.size();i++)
+    if(members[i].planner->IsConnected(ma,mb)) return true;
+  return false;
+}
+
+bool PortfolioMotionPlanner::IsPointToPoint() const
+{
+  for(size_t i=0;i<members.size();i++)
+    if(members[i].planner->IsPointToPoint()) return true;
+  return false;
+}
+
+bool PortfolioMotionPlanner::IsOptimizing() const
+{
+  for(size_t i=0;i<members.size();i++)
+    if(members[i].planner->IsOptimizing()) return true;
+  return false;
+}
+
+void PortfolioMotionPlanner::GetPath(int ma,int mb,MilestonePath& path)
+{
+  if(winner >= 0 && members[winner].planner->IsConnected(ma,mb)) {
+    members[winner].planner->GetPath(ma,mb,path);
+    return;
+  }
+  for(size_t i=0;i<members.size();i++)
+    if(members[i].planner->IsConnected(ma,mb)) {
+      members[i].planner->GetPath(ma,mb,path);
+      return;
+    }
+  path.edges.clear();
+}
+
+void PortfolioMotionPlanner::GetRoadmap(RoadmapPlanner& roadmap) const
+{
+  if(members.empty()) return;
+  members[(winner >= 0 ? winner : 0)].planner->GetRoadmap(roadmap);
+}
+
+bool PortfolioMotionPlanner::IsSolved()
+{
+  if(!bestPath.edges.empty()) return true;
+  for(size_t i=0;i<members.size();i++)
+    if(members[i].planner->IsSolved()) return true;
+  return false;
+}
+
+void PortfolioMotionPlanner::GetSolution(MilestonePath& path)
+{
+  if(!bestPath.edges.empty()) {
+    path = bestPath;
+    return;
+  }
+  //after manual PlanMore() calls, return the lowest cost solution
+  Real best = Inf;
+  path.edges.clear();
+  MilestonePath temp;
+  for(size_t i=0;i<members.size();i++) {
+    if(!members[i].planner->IsSolved()) continue;
+    members[i].planner->GetSolution(temp);
+    Real cost = temp.Length();
+    if(cost < best) {
+      best = cost;
+      path = temp;
+    }
+  }
+}
+
+void PortfolioMotionPlanner::GetStats(PropertyMap& stats) const
+{
+  MotionPlannerInterface::GetStats(stats);
+  stats.set("numMembers",(int)members.size());
+  stats.set("parallel",(int)parallel);
+  stats.set("winner",(winner >= 0 ? members[winner].type : string("")));
+  for(size_t i=0;i<members.size();i++) {
+    const Member& m = members[i];
+    stringstream ss;
+    ss<<"member"<<i<<".";
+    string prefix = ss.str();
+    PropertyMap mstats;
+    m.planner->GetStats(mstats);
+    for(PropertyMap::const_iterator j=mstats.begin();j!=mstats.end();j++)
+      stats[prefix+j->first] = j->second;
+    stats[prefix+"type"] = m.type;
+    stats[prefix+"result"] = m.result;
+    stats.set(prefix+"solved",(int)m.solved);
+    stats.set(prefix+"cost",m.cost);
+    stats.set(prefix+"solveTime",m.solveTime);
+  }
+}
+
+
 ShortcutMotionPlanner::ShortcutMotionPlanner(const SmartPointer<MotionPlannerInterface>& mp)
   :PiggybackMotionPlanner(mp),numIters(0)
 {}
@@ -197,6 +197,8 @@ class MotionPlanningProblem
  * - lazyrrg*: the Lazy-RRG* algorithm for optimal motion planning
  * - fmm: the fast marching method algorithm for resolution-complete optimal motion planning
  * - fmm*: an anytime fast marching method algorithm for optimal motion planning
+ * - portfolio: runs each of the planner types listed in the portfolio
+ *   setting at once, see below
  * 
  * If KrisLibrary is built with OMPL support, you can also use the type specifier
  * "ompl:[X]" where [X] is one of:
@@ -227,6 +229,24 @@ class MotionPlanningProblem
  *   for that round.
  * - Good results are often obtained by setting both restart=true and
 *    shortcut=true. 
+ *
+ * A portfolio planner is useful when it is not known which planner will do
+ * best on a problem.  Each type listed in portfolio (e.g., "rrt sbl prm*",
+ * or "rrt rrt rrt" for several independent runs of one planner) is created
+ * with the rest of the factory's settings.  If the space is thread safe
+ * (threadSafeCSpace is true or CSpace::IsThreadSafe() returns true) the
+ * members plan in parallel threads, otherwise they take turns on the calling
+ * thread.  Parallel members still sample, measure distances, and draw random
+ * numbers one at a time; only their feasibility and edge checks overlap.
+ * With cond.foundSolution, Plan() returns the first member's
+ * solution and stops the others; otherwise it returns the lowest cost
+ * solution.  GetStats reports the winner and each member's statistics,
+ * prefixed by "member0.", "member1.", etc.
+ *
+ * Setting feasibilityCacheSize > 0 wraps the space in a CachedCSpace (or
+ * CachedExplicitCSpace) so that repeated configuration and edge checks are
+ * answered from a cache shared by all rounds of a restarting planner and by
+ * the shortcutter.  The cache's hit / miss counts are reported by GetStats.
  */
 class MotionPlannerFactory
 {
@@ -265,11 +285,15 @@ class MotionPlannerFactory
   bool useGrid;            ///<for SBL, SBLPRT (default true): for SBL, uses grid-based random point selection
   Real gridResolution;     ///<for SBL, SBLPRT, FMM, FMM* (default 0): if nonzero, for SBL, specifies point selection grid size (default 0.1), for FMM / FMM*, specifies resolution (default 1/8 of domain)
   int randomizeFrequency;  ///<for SBL, SBLPRT (default 50): how often the grid projection is randomly perturbed
-  string pointLocation;    ///<for PRM, RRT*, PRM*, LazyPRM*, LazyRRG* (default ""): specifies a point location data structure ("random", "randombest [k]", "kdtree" supported)
+  string pointLocation;    ///<for PRM, RRT, SBL, SBLPRT, RRT*, PRM*, LazyPRM*, LazyRRG* (default ""): specifies a point location data structure ("random", "randombest [k]", "kdtree", "flatkdtree", "gnat [degree]", "hnsw [M] [efSearch]" supported)
   bool storeEdges;         ///<true if local planner data is stored during planning (false may save memory, default)
+  bool threadSafeCSpace;   ///<for PRM, PRM*: true if the CSpace and its edge planners may be called from multiple threads at once, which enables parallel roadmap construction.  Parallel construction is also used when CSpace::IsThreadSafe() returns true (default false)
   bool shortcut;           ///<true if you wish to perform shortcutting afterwards (default false)
   bool restart;            ///<true if you wish to restart the planner to get better paths with the remaining time (default false)
   string restartTermCond;  ///<used if restart is true, JSON string defining termination condition (default "{foundSolution:1;maxIters:1000}")
+  string portfolio;        ///<for portfolio: planner types to run at once, separated by spaces or commas (default "rrt sbl prm")
+  int feasibilityCacheSize;///<if > 0, caches up to this many configuration / edge feasibility results (default 0)
+  Real feasibilityCacheResolution; ///<quantization resolution of the feasibility cache (default 1e-6)
 };
 
 
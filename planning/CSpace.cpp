@@ -1,5 +1,7 @@
 #include "CSpace.h"
 #include <math/random.h>
+#include <utils/threadutils.h>
+#include <algorithm>
 using namespace std;
 
 void CSpace::SampleNeighborhood(const Config& c,Real r,Config& x)
@@ -9,6 +11,63 @@ void CSpace::SampleNeighborhood(const Config& c,Real r,Config& x)
     x(i) = c(i) + Rand(-r,r);
 }
 
+//Batches are split into at least this many configurations per thread, so
+//that small batches (e.g., the first bisection levels of an edge check)
+//run on the calling thread
+const static int kFeasibilityBatchGrain = 4;
+
+struct CSpaceFeasibilityBatchData
+{
+  CSpace* space;
+  const vector<Config>* xs;
+  vector<char> feasible;
+  bool stopOnInfeasible;
+  //set when an infeasible configuration is found
+  bool stop;
+  Mutex mutex;
+
+  bool Stopped() { ScopedLock lock(mutex); return stop; }
+  void Stop() { ScopedLock lock(mutex); stop = true; }
+};
+
+void cspace_feasibility_batch_func(void* data,int i)
+{
+  CSpaceFeasibilityBatchData* d = reinterpret_cast<CSpaceFeasibilityBatchData*>(data);
+  if(d->stopOnInfeasible && d->Stopped()) return;
+  if(d->space->IsFeasible((*d->xs)[i])) d->feasible[i] = 1;
+  else if(d->stopOnInfeasible) d->Stop();
+}
+
+bool CSpace::IsFeasible(const vector<Config>& xs,vector<bool>& feasible,bool stopOnInfeasible)
+{
+  feasible.resize(xs.size());
+  fill(feasible.begin(),feasible.end(),false);
+  if((int)xs.size() >= 2*kFeasibilityBatchGrain && IsThreadSafe()) {
+    CSpaceFeasibilityBatchData data;
+    data.space = this;
+    data.xs = &xs;
+    data.feasible.resize(xs.size(),0);
+    data.stopOnInfeasible = stopOnInfeasible;
+    data.stop = false;
+    ParallelFor((int)xs.size(),cspace_feasibility_batch_func,&data,0,kFeasibilityBatchGrain);
+    bool all = true;
+    for(size_t i=0;i<xs.size();i++) {
+      feasible[i] = (data.feasible[i] != 0);
+      if(!feasible[i]) all = false;
+    }
+    return all;
+  }
+  bool all = true;
+  for(size_t i=0;i<xs.size();i++) {
+    feasible[i] = IsFeasible(xs[i]);
+    if(!feasible[i]) {
+      all = false;
+      if(stopOnInfeasible) return false;
+    }
+  }
+  return all;
+}
+
 void CSpace::Interpolate(const Config& x, const Config& y, Real u, Config& out)
 {
   out.mul(x,One-u);
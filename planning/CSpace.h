@@ -4,6 +4,7 @@
 #include <KrisLibrary/math/vector.h>
 #include <KrisLibrary/math/metric.h>
 #include <KrisLibrary/utils/PropertyMap.h>
+#include <vector>
 using namespace Math;
 typedef Vector Config;
 
@@ -21,6 +22,28 @@ public:
   virtual bool IsFeasible(const Config&)=0;
   virtual EdgePlanner* LocalPlanner(const Config& a,const Config& b) =0;
 
+  /** @brief Tests the feasibility of a batch of configurations.
+   *
+   * Sets feasible[i] to whether xs[i] is feasible and returns true if all
+   * of them are.  If stopOnInfeasible is true, the test may return false as
+   * soon as an infeasible configuration is found; the configurations that
+   * were not tested are then marked infeasible.
+   *
+   * Subclasses may override this to share work between the configurations,
+   * e.g., forward kinematics and collision setup.  The default calls
+   * IsFeasible(x) on each configuration, in order, or over several threads
+   * if IsThreadSafe() returns true and the batch has at least 8
+   * configurations.  A batch tested from inside another ParallelFor (e.g.,
+   * a parallel roadmap construction) runs on the calling thread.
+   */
+  virtual bool IsFeasible(const std::vector<Config>& xs,std::vector<bool>& feasible,bool stopOnInfeasible=false);
+  ///Returns true if IsFeasible(x), LocalPlanner(a,b), and IsVisible() of
+  ///the returned edge planners may be called from several threads at once,
+  ///while one other thread calls the remaining methods.  Parallel roadmap
+  ///construction and parallel portfolios rely on this.  Default returns
+  ///false.
+  virtual bool IsThreadSafe() const { return false; }
+
   ///optionally overrideable (default uses euclidean space)
   virtual Real Distance(const Config& x, const Config& y) { return Distance_L2(x,y); }
   virtual void Interpolate(const Config& x,const Config& y,Real u,Config& out);
@@ -2,6 +2,7 @@
 #define CSPACE_HELPERS_H
 
 #include "CSpace.h"
+#include "EdgePlanner.h"
 
 /** @brief A helper class that assists with selective overriding
  * of another cspace's methods.
@@ -80,8 +81,8 @@ public:
     map.set("volume",Pow(2.0*radius,center.n));
     Vector vmin=center-Vector(center.n,radius);
     Vector vmax=center+Vector(center.n,radius);
-    map.setArray("minimum",vector<double>(vmin));
-    map.setArray("maximum",vector<double>(vmax));
+    map.setArray("minimum",std::vector<double>(vmin));
+    map.setArray("maximum",std::vector<double>(vmax));
   }
 
   Config center;
@@ -29,22 +29,28 @@ Real Log2(Real r) { return Log(r)*Log2e; }
 bool StraightLineEpsilonPlanner::IsVisible()
 {
   while(dist > epsilon) {
-    depth++;
-    segs *= 2;
-    dist *= Half;
-    Real du2 = 2.0 / (Real)segs;
-    Real u = du2*Half;
-    for(int k=1;k<segs;k+=2,u+=du2) {
-      space->Interpolate(a,b,u,m);
-      if(!space->IsFeasible(m)) {
-	foundInfeasible = true;
-	return false;
-      }
+    if(!CheckNextLevel()) {
+      foundInfeasible = true;
+      return false;
     }
   }
   return !foundInfeasible;
 }
 
+bool StraightLineEpsilonPlanner::CheckNextLevel()
+{
+  depth++;
+  segs *= 2;
+  dist *= Half;
+  //the midpoints of this level are checked as one batch
+  Real du2 = 2.0 / (Real)segs;
+  Real u = du2*Half;
+  batch.resize(segs/2);
+  for(int k=0;k<segs/2;k++,u+=du2)
+    space->Interpolate(a,b,u,batch[k]);
+  return space->IsFeasible(batch,batchFeasible,true);
+}
+
 void StraightLineEpsilonPlanner::Eval(Real u,Config& x) const
 {
   space->Interpolate(a,b,u,x);
@@ -75,18 +81,10 @@ Real StraightLineEpsilonPlanner::Priority() const { return dist; }
 bool StraightLineEpsilonPlanner::Plan() 
 {
   if(foundInfeasible || dist <= epsilon) return false;
-  depth++;
-  segs *= 2;
-  dist *= Half;
-  Real du2 = 2.0 / (Real)segs;
-  Real u = du2*Half;
-  for(int k=1;k<segs;k+=2,u+=du2) {
-    space->Interpolate(a,b,u,m);
-    if(!space->IsFeasible(m)) {
-      dist = 0;
-      foundInfeasible=true;
-      return false;
-    }
+  if(!CheckNextLevel()) {
+    dist = 0;
+    foundInfeasible=true;
+    return false;
   }
   return true;
 }
@@ -104,9 +102,64 @@ StraightLineObstacleDistancePlanner::StraightLineObstacleDistancePlanner(CSpace*
   :a(_a),b(_b),space(_space)
 {}
 
+//The same test as CheckVisibility(a,b,da,db), but the segments are split
+//level by level so that the midpoints of each level are tested as a batch
 bool StraightLineObstacleDistancePlanner::IsVisible()
 {
-  return CheckVisibility(a,b,space->ObstacleDistance(a),space->ObstacleDistance(b));
+  vector<Config> pts(2),nextPts;
+  vector<Real> dists(2),nextDists;
+  pts[0] = a;
+  pts[1] = b;
+  dists[0] = space->ObstacleDistance(a);
+  dists[1] = space->ObstacleDistance(b);
+  //segment i goes from pts[2i] to pts[2i+1]
+  vector<Config> mids;
+  vector<bool> feasible;
+  vector<int> split;
+  while(!pts.empty()) {
+    mids.resize(0);
+    split.resize(0);
+    for(size_t i=0;i<pts.size();i+=2) {
+      Real dmin = Min(dists[i],dists[i+1]);
+      if(dmin < Epsilon) {
+	cout<<"Warning, da or db is close to zero"<<endl;
+	return false;
+      }
+      Real r = space->Distance(pts[i],pts[i+1]);
+      Assert(r >= Zero);
+      if(dmin > r) continue;
+      mids.resize(mids.size()+1);
+      space->Midpoint(pts[i],pts[i+1],mids.back());
+      split.push_back((int)i);
+    }
+    if(mids.empty()) return true;
+    if(!space->IsFeasible(mids,feasible,true)) return false;
+    nextPts.resize(0);
+    nextDists.resize(0);
+    for(size_t k=0;k<mids.size();k++) {
+      int i = split[k];
+#ifndef NDEBUG
+      Real r = space->Distance(pts[i],pts[i+1]);
+      Real ram = space->Distance(pts[i],mids[k]);
+      Real rbm = space->Distance(pts[i+1],mids[k]);
+      Assert(ram < r*0.9 && ram > r*0.1);
+      Assert(rbm < r*0.9 && rbm > r*0.1);
+#endif
+      Real dm = space->ObstacleDistance(mids[k]);
+      Assert(dm >= Zero);
+      nextPts.push_back(pts[i]);
+      nextPts.push_back(mids[k]);
+      nextPts.push_back(mids[k]);
+      nextPts.push_back(pts[i+1]);
+      nextDists.push_back(dists[i]);
+      nextDists.push_back(dm);
+      nextDists.push_back(dm);
+      nextDists.push_back(dists[i+1]);
+    }
+    swap(pts,nextPts);
+    swap(dists,nextDists);
+  }
+  return true;
 }
 
 bool StraightLineObstacleDistancePlanner::CheckVisibility(const Config& a,const Config& b,Real da,Real db)
@@ -122,10 +175,12 @@ bool StraightLineObstacleDistancePlanner::CheckVisibility(const Config& a,const
   Config m;
   space->Midpoint(a,b,m);
   if(!space->IsFeasible(m)) return false;
+#ifndef NDEBUG
   Real ram = space->Distance(a,m);
   Real rbm = space->Distance(b,m);
   Assert(ram < r*0.9 && ram > r*0.1);
   Assert(rbm < r*0.9 && rbm > r*0.1);
+#endif
   Real dm = space->ObstacleDistance(m);
   Assert(dm >= Zero);
   return CheckVisibility(a,m,da,dm)
@@ -168,10 +223,74 @@ BisectionEpsilonEdgePlanner::BisectionEpsilonEdgePlanner(CSpace* _space,Real _ep
   :space(_space),epsilon(_epsilon)
 {}
 
+//Splits all of the remaining segments at once, testing their midpoints as
+//one batch.  Decides visibility as calling Plan() until Done() would, but
+//the midpoints are tested level by level rather than longest first, so an
+//infeasible edge may stop at a different midpoint after a different
+//number of checks.
 bool BisectionEpsilonEdgePlanner::IsVisible()
 {
+  vector<Segment> segs;
+  vector<Config> mids;
+  vector<bool> feasible;
+  Real length = space->Distance(Start(),Goal());
   while(!Done()) {
-    if(!Plan()) return false;
+    segs.resize(0);
+    while(!q.empty()) {
+      segs.push_back(q.top());
+      q.pop();
+    }
+    mids.resize(segs.size());
+    for(size_t i=0;i<segs.size();i++) {
+      list<Config>::iterator a=segs[i].prev, b=a; b++;
+      space->Midpoint(*a,*b,mids[i]);
+    }
+    if(!space->IsFeasible(mids,feasible,true)) {
+      //configurations skipped after the first infeasible one are also
+      //marked infeasible, so find one that really is.  If none is, the
+      //batch is treated as feasible
+      size_t bad=segs.size();
+      for(size_t i=0;i<segs.size();i++)
+	if(!feasible[i] && !space->IsFeasible(mids[i])) {
+	  bad = i;
+	  break;
+	}
+      if(bad < segs.size()) {
+	x = mids[bad];
+	segs[bad].length = Inf;
+	for(size_t i=0;i<segs.size();i++) q.push(segs[i]);
+	return false;
+      }
+    }
+    for(size_t i=0;i<segs.size();i++) {
+      Segment s=segs[i];
+      list<Config>::iterator a=s.prev, b=a; b++;
+      list<Config>::iterator m=path.insert(b,mids[i]);
+      Real l1=space->Distance(*a,mids[i]);
+      Real l2=space->Distance(mids[i],*b);
+      if(l1 > 0.9*s.length || l2 > 0.9*s.length) {
+	printf("Midpoint exceeded 0.9 time segment distance: %g, %g > 0.9*%g\n",l1,l2,s.length);
+	s.length = Inf;
+	q.push(s);
+	for(size_t j=i+1;j<segs.size();j++) q.push(segs[j]);
+	return false;
+      }
+      s.prev = a;
+      s.length = l1;
+      if(s.length > epsilon) q.push(s);
+
+      s.prev = m;
+      s.length = l2;
+      if(s.length > epsilon) q.push(s);
+    }
+    if(Real(q.size())*epsilon > 4.0*length) {
+      Segment s=q.top(); q.pop();
+      s.length = Inf;
+      q.push(s);
+      cout<<"BisectionEpsilonEdgePlanner: Over 4 times as many iterations as needed, quitting."<<endl;
+      cout<<"Original length "<<length<<", epsilon "<<epsilon<<endl;
+      return false;
+    }
   }
   return true;
 }
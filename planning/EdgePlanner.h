@@ -141,11 +141,15 @@ public:
   Real epsilon;
 
 protected:
+  ///Subdivides each segment and tests the new midpoints as one batch
+  bool CheckNextLevel();
+
   bool foundInfeasible;
   Real dist;
   int depth;
   int segs;
-  Config m;
+  std::vector<Config> batch;
+  std::vector<bool> batchFeasible;
 };
 
 /** @ingroup MotionPlanning
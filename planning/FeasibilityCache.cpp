@@ -0,0 +1,265 @@
+#include "FeasibilityCache.h"
+#include <math/math.h>
+#include <algorithm>
+using namespace std;
+
+//quantized coordinates must lie in [-kMaxKey,kMaxKey) to fit in an int
+static const Real kMaxKey = 2147483648.0;
+
+FeasibilityCache::FeasibilityCache(int _capacity,Real _resolution)
+  :capacity(_capacity),resolution(_resolution),numHits(0),numMisses(0),numEvictions(0)
+{}
+
+bool FeasibilityCache::Quantize(const Config& q,Key& key) const
+{
+  Real scale = 1.0/resolution;
+  for(int i=0;i<q.n;i++) {
+    Real v = Floor(q(i)*scale);
+    //written so that NaN fails too
+    if(!(v >= -kMaxKey && v < kMaxKey)) return false;
+    key.push_back((int)v);
+  }
+  return true;
+}
+
+bool FeasibilityCache::ConfigKey(const Config& q,int obstacle,Key& key) const
+{
+  key.resize(0);
+  key.reserve(q.n+1);
+  key.push_back(obstacle);
+  return Quantize(q,key);
+}
+
+bool FeasibilityCache::EdgeKey(const Config& a,const Config& b,int obstacle,Key& key) const
+{
+  key.resize(0);
+  key.reserve(a.n+b.n+1);
+  key.push_back(obstacle);
+  if(!Quantize(a,key) || !Quantize(b,key)) return false;
+  //put the lexicographically smaller endpoint first
+  Key::iterator mid = key.begin()+1+a.n;
+  if(lexicographical_compare(mid,key.end(),key.begin()+1,mid))
+    rotate(key.begin()+1,mid,key.end());
+  return true;
+}
+
+bool FeasibilityCache::Lookup(const Key& key,bool& feasible)
+{
+  ScopedLock lock(mutex);
+  UNORDERED_MAP_TEMPLATE<Key,Entry,Geometry::IndexHash>::iterator i=table.find(key);
+  if(i == table.end()) {
+    numMisses++;
+    return false;
+  }
+  numHits++;
+  feasible = i->second.feasible;
+  //move to the front of the LRU list
+  lru.splice(lru.begin(),lru,i->second.lru);
+  return true;
+}
+
+void FeasibilityCache::Insert(const Key& key,bool feasible)
+{
+  if(capacity <= 0) return;
+  ScopedLock lock(mutex);
+  UNORDERED_MAP_TEMPLATE<Key,Entry,Geometry::IndexHash>::iterator i=table.find(key);
+  if(i != table.end()) {
+    i->second.feasible = feasible;
+    lru.splice(lru.begin(),lru,i->second.lru);
+    return;
+  }
+  while((int)table.size() >= capacity) {
+    table.erase(lru.back());
+    lru.pop_back();
+    numEvictions++;
+  }
+  lru.push_front(key);
+  Entry& e = table[key];
+  e.feasible = feasible;
+  e.lru = lru.begin();
+}
+
+void FeasibilityCache::Clear()
+{
+  ScopedLock lock(mutex);
+  table.clear();
+  lru.clear();
+  numHits = numMisses = numEvictions = 0;
+}
+
+void FeasibilityCache::GetStats(PropertyMap& stats) const
+{
+  ScopedLock lock(mutex);
+  stats.set("cacheHits",numHits);
+  stats.set("cacheMisses",numMisses);
+  stats.set("cacheEvictions",numEvictions);
+  stats.set("cacheSize",(int)table.size());
+}
+
+
+
+CachedEdgePlanner::CachedEdgePlanner(CSpace* space,const SmartPointer<EdgePlanner>& e,FeasibilityCache* _cache,int _obstacle)
+  :PiggybackEdgePlanner(space,e->Start(),e->Goal(),e),cache(_cache),obstacle(_obstacle),status(-1)
+{}
+
+void CachedEdgePlanner::LookupStatus()
+{
+  if(status >= 0) return;
+  FeasibilityCache::Key key;
+  bool visible;
+  if(cache->EdgeKey(a,b,obstacle,key) && cache->Lookup(key,visible))
+    status = (visible ? 2 : 1);
+  else status = 0;
+}
+
+void CachedEdgePlanner::Store(bool visible)
+{
+  FeasibilityCache::Key key;
+  if(cache->EdgeKey(a,b,obstacle,key)) cache->Insert(key,visible);
+  status = (visible ? 2 : 1);
+}
+
+bool CachedEdgePlanner::IsVisible()
+{
+  LookupStatus();
+  if(status > 0) return (status == 2);
+  bool visible = e->IsVisible();
+  Store(visible);
+  return visible;
+}
+
+EdgePlanner* CachedEdgePlanner::Copy() const
+{
+  CachedEdgePlanner* p = new CachedEdgePlanner(space,e->Copy(),cache,obstacle);
+  p->status = status;
+  return p;
+}
+
+EdgePlanner* CachedEdgePlanner::ReverseCopy() const
+{
+  CachedEdgePlanner* p = new CachedEdgePlanner(space,e->ReverseCopy(),cache,obstacle);
+  p->status = status;
+  return p;
+}
+
+bool CachedEdgePlanner::Plan()
+{
+  LookupStatus();
+  if(status > 0) return false;
+  bool res = e->Plan();
+  if(e->Done()) Store(!e->Failed());
+  return res;
+}
+
+bool CachedEdgePlanner::Done() const
+{
+  if(status > 0) return true;
+  return e->Done();
+}
+
+bool CachedEdgePlanner::Failed() const
+{
+  if(status > 0) return (status == 1);
+  return e->Failed();
+}
+
+
+
+CachedCSpace::CachedCSpace(CSpace* baseSpace,const SmartPointer<FeasibilityCache>& _cache)
+  :PiggybackCSpace(baseSpace),cache(_cache)
+{}
+
+bool CachedCSpace::IsFeasible(const Config& x)
+{
+  FeasibilityCache::Key key;
+  if(!cache->ConfigKey(x,-1,key)) return baseSpace->IsFeasible(x);
+  bool feasible;
+  if(cache->Lookup(key,feasible)) return feasible;
+  feasible = baseSpace->IsFeasible(x);
+  cache->Insert(key,feasible);
+  return feasible;
+}
+
+bool CachedCSpace::IsFeasible(const vector<Config>& xs,vector<bool>& feasible,bool stopOnInfeasible)
+{
+  feasible.resize(xs.size());
+  vector<FeasibilityCache::Key> keys(xs.size());
+  vector<bool> hasKey(xs.size());
+  vector<int> missing;
+  vector<Config> missingConfigs;
+  bool allFeasible = true;
+  for(size_t i=0;i<xs.size();i++) {
+    hasKey[i] = cache->ConfigKey(xs[i],-1,keys[i]);
+    bool f;
+    if(hasKey[i] && cache->Lookup(keys[i],f)) {
+      feasible[i] = f;
+      if(!f) {
+	allFeasible = false;
+	if(stopOnInfeasible) {
+	  fill(feasible.begin(),feasible.end(),false);
+	  return false;
+	}
+      }
+    }
+    else {
+      missing.push_back((int)i);
+      missingConfigs.push_back(xs[i]);
+    }
+  }
+  if(missing.empty()) return allFeasible;
+  //the base space may mark untested configurations infeasible when it
+  //stops early, so test them all to keep those out of the cache
+  vector<bool> missingFeasible;
+  baseSpace->IsFeasible(missingConfigs,missingFeasible,false);
+  for(size_t k=0;k<missing.size();k++) {
+    feasible[missing[k]] = missingFeasible[k];
+    if(!missingFeasible[k]) allFeasible = false;
+    if(hasKey[missing[k]]) cache->Insert(keys[missing[k]],missingFeasible[k]);
+  }
+  if(!allFeasible && stopOnInfeasible)
+    fill(feasible.begin(),feasible.end(),false);
+  return allFeasible;
+}
+
+EdgePlanner* CachedCSpace::LocalPlanner(const Config& a,const Config& b)
+{
+  return new CachedEdgePlanner(this,baseSpace->LocalPlanner(a,b),cache);
+}
+
+
+
+CachedExplicitCSpace::CachedExplicitCSpace(ExplicitCSpace* _baseSpace,const SmartPointer<FeasibilityCache>& _cache)
+  :baseSpace(_baseSpace),cache(_cache)
+{}
+
+bool CachedExplicitCSpace::IsFeasible(const Config& x)
+{
+  FeasibilityCache::Key key;
+  if(!cache->ConfigKey(x,-1,key)) return baseSpace->IsFeasible(x);
+  bool feasible;
+  if(cache->Lookup(key,feasible)) return feasible;
+  feasible = baseSpace->IsFeasible(x);
+  cache->Insert(key,feasible);
+  return feasible;
+}
+
+bool CachedExplicitCSpace::IsFeasible(const Config& x,int obstacle)
+{
+  FeasibilityCache::Key key;
+  if(!cache->ConfigKey(x,obstacle,key)) return baseSpace->IsFeasible(x,obstacle);
+  bool feasible;
+  if(cache->Lookup(key,feasible)) return feasible;
+  feasible = baseSpace->IsFeasible(x,obstacle);
+  cache->Insert(key,feasible);
+  return feasible;
+}
+
+EdgePlanner* CachedExplicitCSpace::LocalPlanner(const Config& a,const Config& b)
+{
+  return new ExplicitEdgePlanner(this,a,b);
+}
+
+EdgePlanner* CachedExplicitCSpace::LocalPlanner(const Config& a,const Config& b,int obstacle)
+{
+  return new CachedEdgePlanner(this,baseSpace->LocalPlanner(a,b,obstacle),cache,obstacle);
+}
@@ -0,0 +1,163 @@
+#ifndef PLANNING_FEASIBILITY_CACHE_H
+#define PLANNING_FEASIBILITY_CACHE_H
+
+#include "CSpaceHelpers.h"
+#include "ExplicitCSpace.h"
+#include "EdgePlanner.h"
+#include <KrisLibrary/geometry/GridSubdivision.h>
+#include <KrisLibrary/utils/threadutils.h>
+#include <KrisLibrary/utils/stl_tr1.h>
+#include <list>
+
+/** @ingroup MotionPlanning
+ * @brief A table of feasibility test results for configurations and edges,
+ * keyed by quantized configuration, with least-recently-used eviction.
+ *
+ * Configurations are rounded down to a grid of the given resolution, so
+ * any two configurations in the same grid cell share a result.  The
+ * default resolution is small enough that in practice only repeated
+ * configurations (start / goal, path milestones, shortcut endpoints)
+ * produce hits.  A configuration with a coordinate that does not fit in an
+ * int once divided by the resolution (or that is NaN) has no key, and its
+ * tests are not cached.
+ *
+ * Lookup and Insert may be called from several threads at once.
+ */
+class FeasibilityCache
+{
+public:
+  typedef std::vector<int> Key;
+
+  FeasibilityCache(int capacity=100000,Real resolution=1e-6);
+  ///Makes the key for a configuration test.  obstacle is -1 for the full
+  ///feasibility test.  Returns false if q has no key
+  bool ConfigKey(const Config& q,int obstacle,Key& key) const;
+  ///Makes the key for an edge test.  Edges are assumed to be symmetric,
+  ///so (a,b) and (b,a) get the same key.  Returns false if a or b has no
+  ///key
+  bool EdgeKey(const Config& a,const Config& b,int obstacle,Key& key) const;
+  ///Returns true and sets feasible if the key is stored
+  bool Lookup(const Key& key,bool& feasible);
+  ///Stores a result, evicting the least recently used entry if full
+  void Insert(const Key& key,bool feasible);
+  void Clear();
+  int Size() const { return (int)table.size(); }
+  ///Sets the cacheHits, cacheMisses, cacheEvictions, and cacheSize stats
+  void GetStats(PropertyMap& stats) const;
+
+  int capacity;
+  Real resolution;
+  int numHits,numMisses,numEvictions;
+
+private:
+  typedef std::list<Key> LRUList;
+  struct Entry
+  {
+    bool feasible;
+    LRUList::iterator lru;
+  };
+
+  bool Quantize(const Config& q,Key& key) const;
+
+  UNORDERED_MAP_TEMPLATE<Key,Entry,Geometry::IndexHash> table;
+  LRUList lru;  //front is the most recently used
+  mutable Mutex mutex;
+};
+
+/** @ingroup MotionPlanning
+ * @brief An edge planner that looks up its result in a FeasibilityCache
+ * before running another edge planner, and stores the result once it is
+ * known.
+ *
+ * Works with both IsVisible() and the incremental Plan() / Done() /
+ * Failed() interface, so lazy planners only check an edge once even across
+ * planner instances.
+ *
+ * The cache is not owned, and must outlive the edge planner.  (Holding a
+ * SmartPointer here would update its reference count from every planner
+ * thread that creates an edge.)
+ */
+class CachedEdgePlanner : public PiggybackEdgePlanner
+{
+public:
+  CachedEdgePlanner(CSpace* space,const SmartPointer<EdgePlanner>& e,FeasibilityCache* cache,int obstacle=-1);
+  virtual bool IsVisible();
+  virtual EdgePlanner* Copy() const;
+  virtual EdgePlanner* ReverseCopy() const;
+
+  virtual bool Plan();
+  virtual bool Done() const;
+  virtual bool Failed() const;
+
+  FeasibilityCache* cache;
+  int obstacle;
+  ///-1 if not yet looked up, 0 if not in the cache, 1 if known infeasible,
+  ///2 if known feasible
+  int status;
+
+private:
+  void LookupStatus();
+  void Store(bool visible);
+};
+
+/** @ingroup MotionPlanning
+ * @brief A CSpace that caches the feasibility tests and edge checks of
+ * another space.
+ *
+ * Several planners (e.g., the rounds of a restarting planner, or a planner
+ * and a path shortcutter) can share one cache by using the same
+ * CachedCSpace, or CachedCSpaces built on the same FeasibilityCache.
+ *
+ * Local planners are those of the base space, wrapped in a
+ * CachedEdgePlanner.  Feasibility tests made by the base space's local
+ * planners go directly to the base space and are not cached individually.
+ */
+class CachedCSpace : public PiggybackCSpace
+{
+public:
+  CachedCSpace(CSpace* baseSpace,const SmartPointer<FeasibilityCache>& cache);
+  virtual bool IsFeasible(const Config& x);
+  ///Only the configurations that miss the cache are passed on to the base
+  ///space's batch test.  They are all tested, even with stopOnInfeasible,
+  ///so that only tested results are cached
+  virtual bool IsFeasible(const std::vector<Config>& xs,std::vector<bool>& feasible,bool stopOnInfeasible=false);
+  virtual bool IsThreadSafe() const { return baseSpace->IsThreadSafe(); }
+  virtual EdgePlanner* LocalPlanner(const Config& a,const Config& b);
+  virtual Real ObstacleDistance(const Config& a) { return baseSpace->ObstacleDistance(a); }
+
+  SmartPointer<FeasibilityCache> cache;
+};
+
+/** @ingroup MotionPlanning
+ * @brief An ExplicitCSpace that caches the per-obstacle feasibility tests
+ * and edge checks of another ExplicitCSpace.
+ *
+ * LocalPlanner(a,b) returns an ExplicitEdgePlanner on this space, so that
+ * each obstacle's edge check goes through the cache.
+ */
+class CachedExplicitCSpace : public ExplicitCSpace
+{
+public:
+  CachedExplicitCSpace(ExplicitCSpace* baseSpace,const SmartPointer<FeasibilityCache>& cache);
+  virtual bool IsFeasible(const Config& x);
+  virtual bool IsFeasible(const Config& x,int obstacle);
+  virtual bool IsThreadSafe() const { return baseSpace->IsThreadSafe(); }
+  virtual EdgePlanner* LocalPlanner(const Config& a,const Config& b);
+  virtual EdgePlanner* LocalPlanner(const Config& a,const Config& b,int obstacle);
+  virtual int NumObstacles() { return baseSpace->NumObstacles(); }
+  virtual std::string ObstacleName(int obstacle) { return baseSpace->ObstacleName(obstacle); }
+  virtual Real ObstacleDistance(const Config& a) { return static_cast<CSpace*>(baseSpace)->ObstacleDistance(a); }
+  virtual Real ObstacleDistance(const Config& a,int obstacle) { return baseSpace->ObstacleDistance(a,obstacle); }
+
+  virtual void Sample(Config& x) { baseSpace->Sample(x); }
+  virtual void SampleNeighborhood(const Config& c,Real r,Config& x) { baseSpace->SampleNeighborhood(c,r,x); }
+  virtual Real Distance(const Config& x, const Config& y) { return baseSpace->Distance(x,y); }
+  virtual void Interpolate(const Config& x,const Config& y,Real u,Config& out) { baseSpace->Interpolate(x,y,u,out); }
+  virtual void Midpoint(const Config& x,const Config& y,Config& out) { baseSpace->Midpoint(x,y,out); }
+  virtual void Properties(PropertyMap& map) const { baseSpace->Properties(map); }
+
+  ExplicitCSpace* baseSpace;
+  SmartPointer<FeasibilityCache> cache;
+};
+
+#endif
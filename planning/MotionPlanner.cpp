@@ -3,6 +3,10 @@
 #include <graph/Path.h>
 #include <graph/ShortestPaths.h>
 #include <math/random.h>
+#include <utils/threadutils.h>
+#include <algorithm>
+#include <map>
+#include <set>
 #include <errors.h>
 
 typedef TreeRoadmapPlanner::Node Node;
@@ -56,7 +60,7 @@ struct ClosestMilestoneCallback : public Node::Callback
 
 
 RoadmapPlanner::RoadmapPlanner(CSpace* s)
-  :space(s)
+  :space(s),numThreads(1)
 {
   pointLocator = new NaivePointLocation(roadmap.nodes,s);
 }
@@ -112,83 +116,88 @@ SmartPointer<EdgePlanner> RoadmapPlanner::TestAndConnectEdge(int i,int j)
   }
 }
 
-void RoadmapPlanner::ConnectToNeighbors(int i,Real connectionThreshold,bool ccReject)
+void RoadmapPlanner::NeighborCandidates(int i,Real connectionThreshold,vector<int>& nn)
 {
-  vector<int> nn;
   vector<Real> distances;
-  if(pointLocator->Close(roadmap.nodes[i],connectionThreshold,nn,distances)) {
-    for(size_t k=0;k<nn.size();k++) {
-      int j=nn[k];
-      if(ccReject) { if(ccs.SameComponent(i,j)) continue; }
-      else if(i==(int)j || roadmap.HasEdge(i,j)) continue;
-      TestAndConnectEdge(i,j);
-    }
+  if(pointLocator->Close(roadmap.nodes[i],connectionThreshold,nn,distances)) return;
+  //fall back on naive point location
+  nn.resize(0);
+  for(size_t j=0;j<roadmap.nodes.size();j++) {
+    if(i==(int)j) continue;
+    if(space->Distance(roadmap.nodes[i],roadmap.nodes[j]) < connectionThreshold)
+      nn.push_back((int)j);
   }
-  else {
-    //fall back on naive point location
-    for(size_t j=0;j<roadmap.nodes.size();j++) {
-      if(ccReject) { if(ccs.SameComponent(i,j)) continue; }
-      else if(i==(int)j || roadmap.HasEdge(i,j)) continue;
-      if(space->Distance(roadmap.nodes[i],roadmap.nodes[j]) < connectionThreshold) {
-	TestAndConnectEdge(i,j);
+}
+
+bool RoadmapPlanner::NearestNeighborCandidates(int i,int k,bool ccReject,vector<int>& nn)
+{
+  vector<Real> distances;
+  //assume the k nearest neighbors are sorted by distance
+  if(pointLocator->KNN(roadmap.nodes[i],(ccReject?k*4:k),nn,distances)) return true;
+  //fall back on naive
+  set<pair<Real,int> > knn;
+  pair<Real,int> node;
+  Real worst=Inf;
+  for(size_t j=0;j<roadmap.nodes.size();j++) {
+    if(ccReject) { if(ccs.SameComponent(i,j)) continue; }
+    else if(i==(int)j) continue;
+    node.first = space->Distance(roadmap.nodes[i],roadmap.nodes[j]);
+    node.second = j;
+    if(node.first < worst) {
+      knn.insert(node);
+      
+      if(ccReject) {  //oversample candidate nearest neighbors
+	if((int)knn.size() > k*4)
+	  knn.erase(--knn.end());
+      }
+      else {  //only keep k nearest neighbors
+	if((int)knn.size() > k)
+	  knn.erase(--knn.end());
       }
+      worst = (--knn.end())->first;
     }
   }
+  nn.resize(0);
+  for(set<pair<Real,int> >::const_iterator j=knn.begin();j!=knn.end();j++)
+    nn.push_back(j->second);
+  return false;
+}
+
+void RoadmapPlanner::ConnectToNeighbors(int i,Real connectionThreshold,bool ccReject)
+{
+  vector<int> nn;
+  NeighborCandidates(i,connectionThreshold,nn);
+  for(size_t k=0;k<nn.size();k++) {
+    int j=nn[k];
+    if(ccReject) { if(ccs.SameComponent(i,j)) continue; }
+    else if(i==(int)j || roadmap.HasEdge(i,j)) continue;
+    TestAndConnectEdge(i,j);
+  }
 }
 
 void RoadmapPlanner::ConnectToNearestNeighbors(int i,int k,bool ccReject)
 {
   if(k <= 0) return;
   vector<int> nn;
-  vector<Real> distances;
-  if(pointLocator->KNN(roadmap.nodes[i],(ccReject?k*4:k),nn,distances)) {
-    //assume the k nearest neighbors are sorted by distance
-    int numTests=0;
-    for(size_t m=0;m<nn.size();m++) {
-      int j=nn[m];
-      if(ccReject) { if(ccs.SameComponent(i,j)) continue; }
-      else if(i==(int)j) continue;
-      TestAndConnectEdge(i,j);
-      numTests++;
-      if(numTests == k) break;
-    }
-  }
-  else {
-    //fall back on naive
-    set<pair<Real,int> > knn;
-    pair<Real,int> node;
-    Real worst=Inf;
-    for(size_t j=0;j<roadmap.nodes.size();j++) {
-      if(ccReject) { if(ccs.SameComponent(i,j)) continue; }
-      else if(i==(int)j) continue;
-      node.first = space->Distance(roadmap.nodes[i],roadmap.nodes[j]);
-      node.second = j;
-      if(node.first < worst) {
-	knn.insert(node);
-	
-	if(ccReject) {  //oversample candidate nearest neighbors
-	  if((int)knn.size() > k*4)
-	    knn.erase(--knn.end());
-	}
-	else {  //only keep k nearest neighbors
-	  if((int)knn.size() > k)
-	    knn.erase(--knn.end());
-	}
-	worst = (--knn.end())->first;
-      }
-    }
-    int numTests=0;
-    for(set<pair<Real,int> >::const_iterator j=knn.begin();j!=knn.end();j++) {
-      if(ccReject && ccs.SameComponent(i,j->second)) continue;
-      TestAndConnectEdge(i,j->second);
-      numTests++;
-      if(numTests == k) break;
-    }
+  NearestNeighborCandidates(i,k,ccReject,nn);
+  int numTests=0;
+  for(size_t m=0;m<nn.size();m++) {
+    int j=nn[m];
+    if(ccReject) { if(ccs.SameComponent(i,j)) continue; }
+    else if(i==(int)j) continue;
+    TestAndConnectEdge(i,j);
+    numTests++;
+    if(numTests == k) break;
   }
 }
 
 void RoadmapPlanner::Generate(int numSamples,Real connectionThreshold)
 {
+  if(numThreads != 1) {
+    vector<int> newMilestones;
+    GenerateBatch(numSamples,0,connectionThreshold,true,newMilestones);
+    return;
+  }
   Config x;
   for(int i=0;i<numSamples;i++) {
     GenerateConfig(x);
@@ -197,6 +206,180 @@ void RoadmapPlanner::Generate(int numSamples,Real connectionThreshold)
   }
 }
 
+struct FeasibilityBatchData
+{
+  CSpace* space;
+  const vector<Config>* xs;
+  vector<char> feasible;
+};
+
+void feasibility_batch_func(void* data,int i)
+{
+  FeasibilityBatchData* d = reinterpret_cast<FeasibilityBatchData*>(data);
+  d->feasible[i] = (d->space->IsFeasible((*d->xs)[i]) ? 1 : 0);
+}
+
+struct EdgeBatchData
+{
+  RoadmapPlanner* planner;
+  const vector<pair<int,int> >* edges;
+  vector<SmartPointer<EdgePlanner> >* visible;
+};
+
+void edge_batch_func(void* data,int i)
+{
+  EdgeBatchData* d = reinterpret_cast<EdgeBatchData*>(data);
+  const pair<int,int>& e = (*d->edges)[i];
+  SmartPointer<EdgePlanner> ep = d->planner->space->LocalPlanner(d->planner->roadmap.nodes[e.first],d->planner->roadmap.nodes[e.second]);
+  if(ep->IsVisible()) (*d->visible)[i] = ep;
+}
+
+int RoadmapPlanner::BatchSize() const
+{
+  if(numThreads == 1) return 1;
+  int n = (numThreads <= 0 ? ThreadHardwareConcurrency() : numThreads);
+  //a few samples per thread keeps the threads busy without doing too many
+  //edge checks that connected component rejection would have skipped
+  return Max(n,1)*4;
+}
+
+void RoadmapPlanner::CheckFeasibility(const vector<Config>& xs,vector<bool>& feasible)
+{
+  if(numThreads == 1) {
+    space->IsFeasible(xs,feasible);
+    return;
+  }
+  FeasibilityBatchData data;
+  data.space = space;
+  data.xs = &xs;
+  data.feasible.resize(xs.size());
+  ParallelFor((int)xs.size(),feasibility_batch_func,&data,numThreads);
+  feasible.resize(xs.size());
+  for(size_t i=0;i<xs.size();i++)
+    feasible[i] = (data.feasible[i] != 0);
+}
+
+void RoadmapPlanner::CheckEdges(const vector<pair<int,int> >& edges,vector<SmartPointer<EdgePlanner> >& visible)
+{
+  visible.resize(0);
+  visible.resize(edges.size());
+  EdgeBatchData data;
+  data.planner = this;
+  data.edges = &edges;
+  data.visible = &visible;
+  ParallelFor((int)edges.size(),edge_batch_func,&data,numThreads);
+}
+
+//returns the set of node's component in a scratch union-find over the
+//components that GenerateBatch has touched so far
+static int ScratchComponent(Graph::ConnectedComponents& ccs,map<int,int>& index,UnionFind& scratch,int node)
+{
+  int c = ccs.GetComponent(node);
+  map<int,int>::iterator i = index.find(c);
+  if(i != index.end()) return scratch.FindSet(i->second);
+  int s = scratch.AddEntry();
+  index[c] = s;
+  return s;
+}
+
+void RoadmapPlanner::GenerateBatch(int numSamples,int k,Real connectionThreshold,bool ccReject,vector<int>& newMilestones)
+{
+  if(numThreads == 1) {
+    Config x;
+    for(int i=0;i<numSamples;i++) {
+      GenerateConfig(x);
+      int node=TestAndAddMilestone(x);
+      if(node < 0) continue;
+      newMilestones.push_back(node);
+      if(k > 0) ConnectToNearestNeighbors(node,k,ccReject);
+      else ConnectToNeighbors(node,connectionThreshold,ccReject);
+    }
+    return;
+  }
+  int batchSize = BatchSize();
+  vector<Config> xs;
+  vector<bool> feasible;
+  vector<int> milestones;
+  vector<vector<int> > candidates;
+  vector<bool> located;
+  vector<map<int,int> > edgeIndex;
+  vector<pair<int,int> > edges;
+  vector<SmartPointer<EdgePlanner> > visible;
+  for(int start=0;start<numSamples;start+=batchSize) {
+    int n = Min(batchSize,numSamples-start);
+    xs.resize(n);
+    for(int i=0;i<n;i++)
+      GenerateConfig(xs[i]);
+    CheckFeasibility(xs,feasible);
+
+    //add milestones and find their candidate neighbors in order, so each
+    //milestone only sees the ones before it, as in the serial loop
+    milestones.resize(0);
+    candidates.resize(0);
+    located.resize(0);
+    for(int i=0;i<n;i++) {
+      if(!feasible[i]) continue;
+      int m = AddMilestone(xs[i]);
+      milestones.push_back(m);
+      newMilestones.push_back(m);
+      candidates.resize(milestones.size());
+      if(k > 0) located.push_back(NearestNeighborCandidates(m,k,ccReject,candidates.back()));
+      else {
+        NeighborCandidates(m,connectionThreshold,candidates.back());
+        located.push_back(true);
+      }
+    }
+    //guess which edges the serial loop will test, assuming each test
+    //succeeds.  A scratch union-find tracks the merges that the earlier
+    //milestones of the batch would make
+    edges.resize(0);
+    edgeIndex.resize(0);
+    edgeIndex.resize(milestones.size());
+    map<int,int> scratchIndex;
+    UnionFind scratch;
+    for(size_t b=0;b<milestones.size();b++) {
+      int m = milestones[b];
+      const vector<int>& nn = candidates[b];
+      int numTests = 0;
+      for(size_t p=0;p<nn.size();p++) {
+        int j = nn[p];
+        if(j == m) continue;
+        if(ccReject) {
+          int sm = ScratchComponent(ccs,scratchIndex,scratch,m);
+          int sj = ScratchComponent(ccs,scratchIndex,scratch,j);
+          if(sm == sj) continue;
+          scratch.Union(sm,sj);
+        }
+        edgeIndex[b][j] = (int)edges.size();
+        edges.push_back(pair<int,int>(m,j));
+        numTests++;
+        if(k > 0 && numTests == k) break;
+      }
+    }
+    CheckEdges(edges,visible);
+    //replay the serial loop in order.  Edges that were guessed use the
+    //parallel result, and the others are tested here, so the roadmap is
+    //the same as with numThreads = 1
+    for(size_t b=0;b<milestones.size();b++) {
+      int m = milestones[b];
+      //the naive search skips m's component as it is now, so redo it
+      if(!located[b]) NearestNeighborCandidates(m,k,ccReject,candidates[b]);
+      const vector<int>& nn = candidates[b];
+      int numTests = 0;
+      for(size_t p=0;p<nn.size();p++) {
+        int j = nn[p];
+        if(ccReject) { if(ccs.SameComponent(m,j)) continue; }
+        else if(m == j || roadmap.HasEdge(m,j)) continue;
+        map<int,int>::const_iterator e = edgeIndex[b].find(j);
+        if(e == edgeIndex[b].end()) TestAndConnectEdge(m,j);
+        else if(visible[e->second]) ConnectEdge(m,j,visible[e->second]);
+        numTests++;
+        if(k > 0 && numTests == k) break;
+      }
+    }
+  }
+}
+
 void RoadmapPlanner::CreatePath(int i,int j,MilestonePath& path)
 {
   Assert(ccs.SameComponent(i,j));
@@ -267,6 +450,7 @@ void TreeRoadmapPlanner::Cleanup()
     SafeDelete(connectedComponents[i]);
   connectedComponents.clear();
   milestones.clear();
+  pointLocation.Clear();
 }
 
 TreeRoadmapPlanner::Node* TreeRoadmapPlanner::TestAndAddMilestone(const Config& x)
@@ -285,6 +469,7 @@ TreeRoadmapPlanner::Node* TreeRoadmapPlanner::AddMilestone(const Config& x)
   m.connectedComponent=n;
   connectedComponents.push_back(new Node(m));
   milestones.push_back(connectedComponents[n]);
+  pointLocation.Add(connectedComponents[n],x);
   return connectedComponents[n];
 }
 
@@ -309,10 +494,24 @@ void TreeRoadmapPlanner::ConnectToNeighbors(Node* n)
     //for each other component, attempt a connection to the closest node
     for(size_t i=0;i<connectedComponents.size();i++) {
       if((int)i == n->connectedComponent) continue;
+      if(connectedComponents[i] == NULL) continue;
       
-      ClosestMilestoneCallback callback(space,n->x);
-      connectedComponents[i]->DFS(callback);
-      TryConnect(n,callback.closestMilestone);
+      TryConnect(n,ClosestMilestoneInComponent((int)i,n->x));
+    }
+  }
+  else if(pointLocation.pointLocator) {
+    //attempt connections to the nodes within the connection threshold, 
+    //closest first
+    vector<Node*> nodes;
+    vector<Real> distances;
+    pointLocation.Close(n->x,connectionThreshold,nodes,distances);
+    vector<pair<Real,Node*> > order(nodes.size());
+    for(size_t i=0;i<nodes.size();i++)
+      order[i] = pair<Real,Node*>(distances[i],nodes[i]);
+    sort(order.begin(),order.end());
+    for(size_t i=0;i<order.size();i++) {
+      if(n->connectedComponent != order[i].second->connectedComponent)
+	TryConnect(n,order[i].second);
     }
   }
   else {
@@ -373,6 +572,7 @@ void TreeRoadmapPlanner::DeleteSubtree(Node* n)
   Graph::TopologicalSortCallback<Node*> callback;
   n->DFS(callback);
   for(list<Node*>::iterator i=callback.list.begin();i!=callback.list.end();i++) {
+    pointLocation.Remove(*i);
     for(size_t j=0;j<milestones.size();j++) {
       if(milestones[j]==*i) {
 	milestones[j]=milestones.back();
@@ -435,6 +635,9 @@ void TreeRoadmapPlanner::CreatePath(Node* a, Node* b, MilestonePath& path)
 TreeRoadmapPlanner::Node* TreeRoadmapPlanner::ClosestMilestone(const Config& x)
 {
   if(milestones.empty()) return NULL;
+  Node* closest;
+  Real d;
+  if(pointLocation.NN(x,closest,d)) return closest;
   Real dmin=space->Distance(milestones[0]->x,x);
   Node* n=milestones[0];
   for(size_t i=1;i<milestones.size();i++) {
@@ -449,6 +652,19 @@ TreeRoadmapPlanner::Node* TreeRoadmapPlanner::ClosestMilestone(const Config& x)
 
 TreeRoadmapPlanner::Node* TreeRoadmapPlanner::ClosestMilestoneInComponent(int component,const Config& x)
 {
+  if(pointLocation.pointLocator && pointLocation.pointLocator->Exact()) {
+    //look through the k nearest nodes for increasing k, until the
+    //query would cost about as much as the search over the component.
+    //Approximate locators could return a farther node of the component
+    int n = pointLocation.Size();
+    vector<Node*> nodes;
+    vector<Real> distances;
+    for(int k=1;k*8<=n;k*=2) {
+      if(!pointLocation.KNN(x,k,nodes,distances)) break;
+      for(size_t i=0;i<nodes.size();i++)
+	if(nodes[i]->connectedComponent == component) return nodes[i];
+    }
+  }
   ClosestMilestoneCallback callback(space,x);
   connectedComponents[component]->DFS(callback);
   return callback.closestMilestone;
@@ -642,20 +858,18 @@ bool BidirectionalRRTPlanner::Plan()
 
   if(n->connectedComponent == milestones[0]->connectedComponent) {
     //attempt to connect to goal, if the distance is < connectionThreshold
-    ClosestMilestoneCallback callback(space,n->x);
-    milestones[1]->DFS(callback);
-    if(callback.closestDistance < connectionThreshold) {
-      if(TryConnect(n,callback.closestMilestone)) //connection successful!
+    Node* closest = ClosestMilestoneInComponent(milestones[1]->connectedComponent,n->x);
+    if(space->Distance(closest->x,n->x) < connectionThreshold) {
+      if(TryConnect(n,closest)) //connection successful!
 	return true;
     }
   }
   else {
     Assert(n->connectedComponent == milestones[1]->connectedComponent);
     //attempt to connect to start, if the distance is < connectionThreshold
-    ClosestMilestoneCallback callback(space,n->x);
-    milestones[0]->DFS(callback);
-    if(callback.closestDistance < connectionThreshold) {
-      if(TryConnect(callback.closestMilestone,n)) //connection successful!
+    Node* closest = ClosestMilestoneInComponent(milestones[0]->connectedComponent,n->x);
+    if(space->Distance(closest->x,n->x) < connectionThreshold) {
+      if(TryConnect(closest,n)) //connection successful!
 	return true;
     }
   }
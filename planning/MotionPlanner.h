@@ -10,8 +10,7 @@
 #include "CSpace.h"
 #include "EdgePlanner.h"
 #include "Path.h"
-
-class PointLocationBase;
+#include "PointLocation.h"
 
 /** @defgroup MotionPlanning
  * @brief Classes to assist in motion planning.
@@ -19,6 +18,13 @@ class PointLocationBase;
 
 /** @ingroup MotionPlanning
  * @brief A base roadmap planner class.
+ *
+ * If numThreads is not 1, GenerateBatch, CheckFeasibility and CheckEdges
+ * run the feasibility and edge checks on several threads.  This requires
+ * the CSpace's IsFeasible and LocalPlanner methods, and the resulting edge
+ * planners' IsVisible methods, to be thread-safe.  Sampling, point location
+ * and roadmap updates are always done on the calling thread, in order, so
+ * the results do not depend on the thread timing.
  */
 class RoadmapPlanner
 {
@@ -40,13 +46,45 @@ public:
   virtual bool AreConnected(int i,int j) const { return ccs.SameComponent(i,j); }
   virtual void ConnectToNeighbors(int i,Real connectionThreshold,bool ccReject=true);
   virtual void ConnectToNearestNeighbors(int i,int k,bool ccReject=true);
+  ///Lists the milestones that ConnectToNeighbors(i,...) tries, in order,
+  ///before skipping those already connected to i
+  void NeighborCandidates(int i,Real connectionThreshold,std::vector<int>& nn);
+  ///Lists the milestones that ConnectToNearestNeighbors(i,k,ccReject)
+  ///tries, nearest first, before skipping those already connected to i.
+  ///Returns false if the point locator failed and the naive search was
+  ///used instead, which with ccReject already skips i's component
+  bool NearestNeighborCandidates(int i,int k,bool ccReject,std::vector<int>& nn);
   virtual void Generate(int numSamples,Real connectionThreshold); 
   virtual void CreatePath(int i,int j,MilestonePath& path);
 
+  ///Samples numSamples configurations, adds the feasible ones, and connects
+  ///each to its k nearest neighbors (if k > 0) or to its neighbors within
+  ///connectionThreshold.  With numThreads != 1, this is done in batches
+  ///whose feasibility checks and likely edge checks run in parallel.  The
+  ///connections are then made in the same order as with numThreads = 1,
+  ///testing any edge that was not guessed on the calling thread, so the
+  ///roadmap does not depend on the number of threads, unless the space's
+  ///checks or the point locator (e.g., "random") draw random numbers.  The
+  ///indices of the new milestones are appended to newMilestones.
+  virtual void GenerateBatch(int numSamples,int k,Real connectionThreshold,bool ccReject,std::vector<int>& newMilestones);
+  ///Tests the feasibility of each of the configurations, over numThreads
+  ///threads.  With numThreads = 1, they are passed to the CSpace as one
+  ///batch.
+  void CheckFeasibility(const std::vector<Config>& xs,std::vector<bool>& feasible);
+  ///Tests the edges between each pair of milestones, over numThreads
+  ///threads.  The edge planner is returned for visible edges and NULL
+  ///otherwise.  Does not modify the roadmap.
+  void CheckEdges(const std::vector<std::pair<int,int> >& edges,std::vector<SmartPointer<EdgePlanner> >& visible);
+  ///Returns the number of samples per batch in GenerateBatch
+  int BatchSize() const;
+
   CSpace* space;
   Roadmap roadmap;
   Graph::ConnectedComponents ccs;
   SmartPointer<PointLocationBase> pointLocator;
+  ///Number of threads for feasibility and edge checking (default 1).  0
+  ///uses all hardware threads.
+  int numThreads;
 };
 
 
@@ -57,6 +95,11 @@ public:
  * a connection may be made between them.  This is infinity by default.
  * If it is infinity, connections are attempted to the closest node in
  * a different component.
+ *
+ * Closest-node queries scan all nodes unless pointLocation.pointLocator is
+ * set, e.g., to a FlatKDTreePointLocation or GNATPointLocation built on
+ * pointLocation.points.  It is kept up to date as nodes are added and
+ * deleted.
  */
 class TreeRoadmapPlanner
 {
@@ -82,7 +125,7 @@ public:
   virtual EdgePlanner* TryConnect(Node*,Node*);
   virtual void DeleteSubtree(Node* n);
   //helpers
-  //default implementation is O(n) search
+  //default implementation is O(n) search, or uses pointLocation if set
   virtual Node* ClosestMilestone(const Config& x);
   virtual Node* ClosestMilestoneInComponent(int component,const Config& x);
   virtual Node* ClosestMilestoneInSubtree(Node* node,const Config& x);
@@ -95,6 +138,8 @@ public:
   CSpace* space;
   std::vector<Node*> connectedComponents;
   Real connectionThreshold;
+  ///Optional point location over the nodes (default none)
+  DynamicPointLocation<Node*> pointLocation;
   
   //temporary
   std::vector<Node*> milestones;
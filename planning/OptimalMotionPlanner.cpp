@@ -308,6 +308,22 @@ void PRMStarPlanner::PlanMore()
       neighbors[i] = queue[i].second;
   }
 
+  if(numThreads != 1 && !rrg && !lazy && suboptimalityFactor <= 0) {
+    //plain PRM*: every neighbor edge is checked regardless of the others,
+    //so check them in parallel and connect them in the same order
+    Assert(m >= 0);
+    vector<pair<int,int> > edges(neighbors.size());
+    for(size_t i=0;i<neighbors.size();i++)
+      edges[i] = pair<int,int>(m,neighbors[i]);
+    vector<SmartPointer<EdgePlanner> > visible;
+    CheckEdges(edges,visible);
+    numEdgeChecks += (int)edges.size();
+    for(size_t i=0;i<edges.size();i++)
+      if(visible[i]) ConnectEdge(m,neighbors[i],visible[i]);
+    tConnect += timer.ElapsedTime();
+    return;
+  }
+
   //start connecting to neighbors and doing necessary rewiring
   for(size_t i=0;i<neighbors.size();i++) {
     //check for shorter connections into m and neighbors[i]
@@ -1,6 +1,11 @@
 #include "PointLocation.h"
 #include <math/random.h>
+#include <math/metric.h>
+#include <utils/PropertyMap.h>
+#include <Timer.h>
 #include <set>
+#include <queue>
+#include <sstream>
 #include <algorithm>
 using namespace std;
 
@@ -301,3 +306,672 @@ bool KDTreePointLocation::Close(const Vector& p,Real r,std::vector<int>& nn,std:
   tree.ClosePoints(p,r,norm,weights,distances,nn);
   return true;
 }
+
+
+FlatKDTreePointLocation::FlatKDTreePointLocation(vector<Vector>& points) 
+  :PointLocationBase(points),norm(2.0),bufferSize(32),dirty(false)
+{}
+
+FlatKDTreePointLocation::FlatKDTreePointLocation(vector<Vector>& points,Real _norm,const Vector& _weights) 
+  :PointLocationBase(points),norm(_norm),weights(_weights),bufferSize(32),dirty(false)
+{}
+
+void FlatKDTreePointLocation::OnAppend()
+{
+  if(dirty) return;
+  buffer.push_back((int)points.size()-1);
+  if((int)buffer.size() < bufferSize) return;
+  //merge the buffer with the filled lower levels into the first empty one
+  vector<int> ids;
+  ids.swap(buffer);
+  size_t i=0;
+  for(;i<levels.size() && !levels[i].Empty();i++) {
+    ids.insert(ids.end(),levels[i].ids.begin(),levels[i].ids.end());
+    levels[i].Clear();
+  }
+  if(i == levels.size()) levels.resize(i+1);
+  levels[i].SetMetric(norm,weights);
+  levels[i].Build(points,ids);
+}
+
+bool FlatKDTreePointLocation::OnDelete(int id)
+{
+  //the ids of the following points have shifted, rebuild lazily
+  dirty = true;
+  return true;
+}
+
+bool FlatKDTreePointLocation::OnClear()
+{
+  buffer.clear();
+  levels.clear();
+  dirty = false;
+  return true;
+}
+
+void FlatKDTreePointLocation::Rebuild()
+{
+  buffer.clear();
+  levels.clear();
+  dirty = false;
+  if(points.empty()) return;
+  //pick the level that this many points would have reached by appending
+  size_t level=0;
+  while(((size_t)bufferSize << (level+1)) <= points.size()) level++;
+  levels.resize(level+1);
+  levels[level].SetMetric(norm,weights);
+  levels[level].Build(points);
+}
+
+inline Real FlatDistance(const Vector& a,const Vector& b,Real norm,const Vector& weights)
+{
+  if(weights.empty()) 
+    return Distance(a,b,norm);
+  else 
+    return Distance_Weighted(a,b,norm,weights);
+}
+
+bool FlatKDTreePointLocation::NN(const Vector& p,int& nn,Real& distance)
+{ 
+  if(dirty) Rebuild();
+  nn = -1;
+  distance = Inf;
+  for(size_t i=0;i<buffer.size();i++) {
+    Real d = FlatDistance(p,points[buffer[i]],norm,weights);
+    if(d < distance) {
+      nn = buffer[i];
+      distance = d;
+    }
+  }
+  for(size_t i=0;i<levels.size();i++) {
+    int res = levels[i].PointWithin(p,distance);
+    if(res >= 0) nn = res;
+  }
+  return true;
+}
+
+bool FlatKDTreePointLocation::KNN(const Vector& p,int k,std::vector<int>& nn,std::vector<Real>& distances) 
+{ 
+  if(dirty) Rebuild();
+  nn.resize(k);
+  distances.resize(k);
+  if(k == 0) return true;
+  fill(nn.begin(),nn.end(),-1);
+  fill(distances.begin(),distances.end(),Inf);
+  //insertion into the sorted candidate list
+  for(size_t i=0;i<buffer.size();i++) {
+    Real d = FlatDistance(p,points[buffer[i]],norm,weights);
+    if(d < distances[k-1]) {
+      int j=k-1;
+      while(j > 0 && distances[j-1] > d) {
+        distances[j] = distances[j-1];
+        nn[j] = nn[j-1];
+        j--;
+      }
+      distances[j] = d;
+      nn[j] = buffer[i];
+    }
+  }
+  for(size_t i=0;i<levels.size();i++)
+    levels[i].MergeKClosestPoints(p,k,&distances[0],&nn[0]);
+  //may have fewer than k points
+  for(size_t i=0;i<nn.size();i++)
+    if(nn[i] < 0) {
+      nn.resize(i);
+      distances.resize(i);
+      break;
+    }
+  return true;
+}
+
+bool FlatKDTreePointLocation::Close(const Vector& p,Real r,std::vector<int>& nn,std::vector<Real>& distances) 
+{ 
+  if(dirty) Rebuild();
+  nn.resize(0);
+  distances.resize(0);
+  for(size_t i=0;i<buffer.size();i++) {
+    Real d = FlatDistance(p,points[buffer[i]],norm,weights);
+    if(d < r) {
+      nn.push_back(buffer[i]);
+      distances.push_back(d);
+    }
+  }
+  for(size_t i=0;i<levels.size();i++)
+    levels[i].ClosePoints(p,r,distances,nn);
+  return true;
+}
+
+
+GNATPointLocation::GNATPointLocation(vector<Vector>& points,CSpace* _space,int _degree,int _maxLeafSize)
+  :PointLocationBase(points),space(_space),degree(_degree),maxLeafSize(_maxLeafSize),dirty(false)
+{}
+
+void GNATPointLocation::OnAppend()
+{
+  if(dirty) return;
+  if(nodes.empty()) nodes.resize(1);
+  Insert((int)points.size()-1);
+}
+
+bool GNATPointLocation::OnDelete(int id)
+{
+  //the ids of the following points have shifted, rebuild lazily
+  dirty = true;
+  return true;
+}
+
+bool GNATPointLocation::OnClear()
+{
+  nodes.clear();
+  dirty = false;
+  return true;
+}
+
+void GNATPointLocation::Rebuild()
+{
+  nodes.clear();
+  dirty = false;
+  if(points.empty()) return;
+  nodes.resize(1);
+  for(size_t i=0;i<points.size();i++)
+    Insert((int)i);
+}
+
+void GNATPointLocation::Insert(int id)
+{
+  int n=0;
+  while(!nodes[n].pivots.empty()) {
+    Node& node=nodes[n];
+    int k=(int)node.pivots.size();
+    vector<Real> d(k);
+    int closest=0;
+    for(int i=0;i<k;i++) {
+      d[i] = space->Distance(points[node.pivots[i]],points[id]);
+      if(d[i] < d[closest]) closest=i;
+    }
+    for(int i=0;i<k;i++) {
+      int r=i*k+closest;
+      node.rangeMin[r] = Min(node.rangeMin[r],d[i]);
+      node.rangeMax[r] = Max(node.rangeMax[r],d[i]);
+    }
+    n = node.children[closest];
+  }
+  nodes[n].bucket.push_back(id);
+  if((int)nodes[n].bucket.size() > maxLeafSize)
+    Split(n);
+}
+
+void GNATPointLocation::Split(int n)
+{
+  vector<int> bucket;
+  bucket.swap(nodes[n].bucket);
+  int m=(int)bucket.size();
+  int k=Min(degree,m);
+  //pick split points by farthest point sampling, keeping the distance
+  //from every point to every split point
+  vector<int> pivots(k);
+  vector<bool> isPivot(m,false);
+  vector<Real> d(m*k),dmin(m,Inf);
+  int next=0;
+  for(int i=0;i<k;i++) {
+    pivots[i]=next;
+    isPivot[next]=true;
+    int farthest=-1;
+    for(int j=0;j<m;j++) {
+      d[j*k+i] = space->Distance(points[bucket[next]],points[bucket[j]]);
+      if(d[j*k+i] < dmin[j]) dmin[j]=d[j*k+i];
+      if(!isPivot[j] && (farthest<0 || dmin[j] > dmin[farthest])) farthest=j;
+    }
+    next=farthest;
+  }
+  int first=(int)nodes.size();
+  nodes.resize(first+k);
+  Node& node=nodes[n];
+  node.pivots.resize(k);
+  node.children.resize(k);
+  node.rangeMin.resize(k*k,Inf);
+  node.rangeMax.resize(k*k,-Inf);
+  vector<int> pivotChild(m,-1);
+  for(int i=0;i<k;i++) {
+    node.pivots[i]=bucket[pivots[i]];
+    node.children[i]=first+i;
+    pivotChild[pivots[i]]=i;
+  }
+  for(int j=0;j<m;j++) {
+    //split points go in the range of their own child, but not its bucket
+    int closest=pivotChild[j];
+    if(closest < 0) {
+      closest=0;
+      for(int i=1;i<k;i++)
+	if(d[j*k+i] < d[j*k+closest]) closest=i;
+      nodes[first+closest].bucket.push_back(bucket[j]);
+    }
+    for(int i=0;i<k;i++) {
+      int r=i*k+closest;
+      node.rangeMin[r] = Min(node.rangeMin[r],d[j*k+i]);
+      node.rangeMax[r] = Max(node.rangeMax[r],d[j*k+i]);
+    }
+  }
+  for(int i=0;i<k;i++)
+    if((int)nodes[first+i].bucket.size() > maxLeafSize)
+      Split(first+i);
+}
+
+//inserts (d,id) into the sorted candidate list of size at most k, and
+//updates the search radius once there are k candidates
+inline void InsertCandidate(int id,Real d,int k,Real& radius,vector<int>& nn,vector<Real>& distances)
+{
+  if(k > 0 ? d > radius : d >= radius) return;
+  if(k > 0 && (int)nn.size() == k) {
+    if(d >= distances.back()) return;
+    nn.pop_back();
+    distances.pop_back();
+  }
+  vector<Real>::iterator pos=upper_bound(distances.begin(),distances.end(),d);
+  nn.insert(nn.begin()+(pos-distances.begin()),id);
+  distances.insert(pos,d);
+  if(k > 0 && (int)nn.size() == k) radius = Min(radius,distances.back());
+}
+
+void GNATPointLocation::Search(int n,const Vector& p,int k,Real& radius,vector<int>& nn,vector<Real>& distances)
+{
+  const Node& node=nodes[n];
+  if(node.pivots.empty()) {
+    for(size_t i=0;i<node.bucket.size();i++)
+      InsertCandidate(node.bucket[i],space->Distance(points[node.bucket[i]],p),k,radius,nn,distances);
+    return;
+  }
+  int m=(int)node.pivots.size();
+  vector<Real> d(m);
+  for(int i=0;i<m;i++) {
+    d[i] = space->Distance(points[node.pivots[i]],p);
+    InsertCandidate(node.pivots[i],d[i],k,radius,nn,distances);
+  }
+  //visit the children in order of distance to their split points
+  vector<pair<Real,int> > order(m);
+  for(int j=0;j<m;j++) order[j] = pair<Real,int>(d[j],j);
+  sort(order.begin(),order.end());
+  for(int c=0;c<m;c++) {
+    int j=order[c].second;
+    bool prune=false;
+    for(int i=0;i<m && !prune;i++) {
+      int r=i*m+j;
+      if(d[i]-radius > node.rangeMax[r] || d[i]+radius < node.rangeMin[r]) prune=true;
+    }
+    if(!prune) Search(node.children[j],p,k,radius,nn,distances);
+  }
+}
+
+bool GNATPointLocation::NN(const Vector& p,int& nn,Real& distance)
+{
+  vector<int> knn;
+  vector<Real> kdist;
+  KNN(p,1,knn,kdist);
+  if(knn.empty()) {
+    nn = -1;
+    distance = Inf;
+  }
+  else {
+    nn = knn[0];
+    distance = kdist[0];
+  }
+  return true;
+}
+
+bool GNATPointLocation::KNN(const Vector& p,int k,std::vector<int>& nn,std::vector<Real>& distances)
+{
+  if(dirty) Rebuild();
+  nn.resize(0);
+  distances.resize(0);
+  if(nodes.empty() || k <= 0) return true;
+  Real radius = Inf;
+  Search(0,p,k,radius,nn,distances);
+  return true;
+}
+
+bool GNATPointLocation::Close(const Vector& p,Real r,std::vector<int>& nn,std::vector<Real>& distances)
+{
+  if(dirty) Rebuild();
+  nn.resize(0);
+  distances.resize(0);
+  if(nodes.empty()) return true;
+  Search(0,p,0,r,nn,distances);
+  return true;
+}
+
+
+
+HNSWPointLocation::HNSWPointLocation(vector<Vector>& points,CSpace* _space,int _M,int _efConstruction,int _efSearch)
+  :PointLocationBase(points),space(_space),M(_M),efConstruction(_efConstruction),efSearch(_efSearch),entryPoint(-1),maxLevel(-1),dirty(false),visitTag(0)
+{}
+
+void HNSWPointLocation::OnAppend()
+{
+  if(dirty) return;
+  Insert((int)points.size()-1);
+}
+
+bool HNSWPointLocation::OnDelete(int id)
+{
+  //the ids of the following points have shifted, rebuild lazily
+  dirty = true;
+  return true;
+}
+
+bool HNSWPointLocation::OnClear()
+{
+  links.clear();
+  visited.clear();
+  entryPoint = maxLevel = -1;
+  dirty = false;
+  return true;
+}
+
+void HNSWPointLocation::Rebuild()
+{
+  OnClear();
+  for(size_t i=0;i<points.size();i++)
+    Insert((int)i);
+}
+
+int HNSWPointLocation::RandomLevel(int id) const
+{
+  //the level is drawn from a hash of the id rather than from the global
+  //random number generator, so that the planner's random sequence does not
+  //depend on the point location structure
+  unsigned int h = (unsigned int)id*2654435761u + 0x9e3779b9u;
+  h ^= h >> 16; h *= 0x85ebca6bu;
+  h ^= h >> 13; h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  Real u = (Real(h)+1.0)/4294967297.0;
+  return (int)Floor(-Log(u)/Log(Real(Max(M,2))));
+}
+
+void HNSWPointLocation::Descend(const Vector& p,int toLevel,int& cur,Real& dcur)
+{
+  cur = entryPoint;
+  dcur = space->Distance(points[cur],p);
+  for(int l=maxLevel;l>toLevel;l--) {
+    bool changed = true;
+    while(changed) {
+      changed = false;
+      const vector<int>& nb = links[cur][l];
+      for(size_t i=0;i<nb.size();i++) {
+	Real d = space->Distance(points[nb[i]],p);
+	if(d < dcur) {
+	  cur = nb[i];
+	  dcur = d;
+	  changed = true;
+	}
+      }
+    }
+  }
+}
+
+void HNSWPointLocation::SearchLayer(const Vector& p,int entry,Real dentry,int ef,int level,bool (*filter)(int),vector<pair<Real,int> >& results)
+{
+  visited.resize(points.size(),0);
+  visitTag++;
+  if(visitTag == 0) {
+    fill(visited.begin(),visited.end(),0);
+    visitTag = 1;
+  }
+  //candidates is a min-heap (by negated distance), best is a max-heap of
+  //at most ef points that pass the filter
+  priority_queue<pair<Real,int> > candidates,best;
+  candidates.push(pair<Real,int>(-dentry,entry));
+  if(!filter || filter(entry)) best.push(pair<Real,int>(dentry,entry));
+  visited[entry] = visitTag;
+  while(!candidates.empty()) {
+    pair<Real,int> c = candidates.top();
+    if((int)best.size() >= ef && -c.first > best.top().first) break;
+    candidates.pop();
+    const vector<int>& nb = links[c.second][level];
+    for(size_t i=0;i<nb.size();i++) {
+      int j = nb[i];
+      if(visited[j] == visitTag) continue;
+      visited[j] = visitTag;
+      Real d = space->Distance(points[j],p);
+      if((int)best.size() < ef || d < best.top().first) {
+	candidates.push(pair<Real,int>(-d,j));
+	if(!filter || filter(j)) {
+	  best.push(pair<Real,int>(d,j));
+	  if((int)best.size() > ef) best.pop();
+	}
+      }
+    }
+  }
+  results.resize(best.size());
+  for(int i=(int)best.size()-1;i>=0;i--) {
+    results[i] = best.top();
+    best.pop();
+  }
+}
+
+void HNSWPointLocation::SelectNeighbors(vector<pair<Real,int> >& candidates,int m,vector<int>& selected)
+{
+  //keep a candidate only if it is closer to the query than to every
+  //neighbor kept so far, which spreads the links out in different
+  //directions
+  sort(candidates.begin(),candidates.end());
+  selected.resize(0);
+  for(size_t i=0;i<candidates.size() && (int)selected.size()<m;i++) {
+    const Vector& c = points[candidates[i].second];
+    bool keep = true;
+    for(size_t j=0;j<selected.size();j++)
+      if(space->Distance(points[selected[j]],c) < candidates[i].first) {
+	keep = false;
+	break;
+      }
+    if(keep) selected.push_back(candidates[i].second);
+  }
+}
+
+void HNSWPointLocation::Insert(int id)
+{
+  int level = RandomLevel(id);
+  if((int)links.size() <= id) links.resize(id+1);
+  links[id].resize(level+1);
+  if(entryPoint < 0) {
+    entryPoint = id;
+    maxLevel = level;
+    return;
+  }
+  const Vector& p = points[id];
+  int cur;
+  Real dcur;
+  Descend(p,level,cur,dcur);
+  vector<pair<Real,int> > found,nbcand;
+  vector<int> pruned;
+  for(int l=Min(level,maxLevel);l>=0;l--) {
+    SearchLayer(p,cur,dcur,efConstruction,l,NULL,found);
+    cur = found[0].second;
+    dcur = found[0].first;
+    SelectNeighbors(found,M,links[id][l]);
+    int maxLinks = (l == 0 ? 2*M : M);
+    for(size_t i=0;i<links[id][l].size();i++) {
+      int j = links[id][l][i];
+      vector<int>& nb = links[j][l];
+      nb.push_back(id);
+      if((int)nb.size() > maxLinks) {
+	nbcand.resize(nb.size());
+	for(size_t k=0;k<nb.size();k++)
+	  nbcand[k] = pair<Real,int>(space->Distance(points[nb[k]],points[j]),nb[k]);
+	SelectNeighbors(nbcand,maxLinks,pruned);
+	nb = pruned;
+      }
+    }
+  }
+  if(level > maxLevel) {
+    entryPoint = id;
+    maxLevel = level;
+  }
+}
+
+void HNSWPointLocation::Query(const Vector& p,int ef,bool (*filter)(int),vector<pair<Real,int> >& results)
+{
+  if(dirty) Rebuild();
+  results.resize(0);
+  if(entryPoint < 0) return;
+  int cur;
+  Real dcur;
+  Descend(p,0,cur,dcur);
+  SearchLayer(p,cur,dcur,ef,0,filter,results);
+}
+
+bool HNSWPointLocation::DoKNN(const Vector& p,int k,bool (*filter)(int),vector<int>& nn,vector<Real>& distances)
+{
+  vector<pair<Real,int> > results;
+  Query(p,Max(k,efSearch),filter,results);
+  if((int)results.size() > k) results.resize(Max(k,0));
+  nn.resize(results.size());
+  distances.resize(results.size());
+  for(size_t i=0;i<results.size();i++) {
+    nn[i] = results[i].second;
+    distances[i] = results[i].first;
+  }
+  return true;
+}
+
+bool HNSWPointLocation::DoClose(const Vector& p,Real r,bool (*filter)(int),vector<int>& nn,vector<Real>& distances)
+{
+  //enlarge the search until it finds some point outside of the radius
+  vector<pair<Real,int> > results;
+  int ef = efSearch;
+  while(true) {
+    Query(p,ef,filter,results);
+    if((int)results.size() < ef || results.back().first >= r || ef >= (int)points.size()) break;
+    ef *= 2;
+  }
+  nn.resize(0);
+  distances.resize(0);
+  for(size_t i=0;i<results.size() && results[i].first < r;i++) {
+    nn.push_back(results[i].second);
+    distances.push_back(results[i].first);
+  }
+  return true;
+}
+
+bool HNSWPointLocation::NN(const Vector& p,int& nn,Real& distance)
+{
+  return FilteredNN(p,NULL,nn,distance);
+}
+
+bool HNSWPointLocation::KNN(const Vector& p,int k,std::vector<int>& nn,std::vector<Real>& distances)
+{
+  return DoKNN(p,k,NULL,nn,distances);
+}
+
+bool HNSWPointLocation::Close(const Vector& p,Real r,std::vector<int>& nn,std::vector<Real>& distances)
+{
+  return DoClose(p,r,NULL,nn,distances);
+}
+
+bool HNSWPointLocation::FilteredNN(const Vector& p,bool (*filter)(int),int& nn,Real& distance)
+{
+  vector<int> knn;
+  vector<Real> kdist;
+  DoKNN(p,1,filter,knn,kdist);
+  if(knn.empty()) {
+    nn = -1;
+    distance = Inf;
+  }
+  else {
+    nn = knn[0];
+    distance = kdist[0];
+  }
+  return true;
+}
+
+bool HNSWPointLocation::FilteredKNN(const Vector& p,int k,bool (*filter)(int),std::vector<int>& nn,std::vector<Real>& distances)
+{
+  return DoKNN(p,k,filter,nn,distances);
+}
+
+bool HNSWPointLocation::FilteredClose(const Vector& p,Real r,bool (*filter)(int),std::vector<int>& nn,std::vector<Real>& distances)
+{
+  return DoClose(p,r,filter,nn,distances);
+}
+
+PointLocationBase* MakePointLocation(const string& str,vector<Vector>& points,CSpace* space)
+{
+  stringstream ss(str);
+  string type;
+  ss>>type;
+  if(type=="random") {
+    return new RandomPointLocation(points);
+  }
+  else if(type=="randombest") {
+    int k;
+    ss >> k;
+    if(!ss) {
+      fprintf(stderr,"Error reading point location string \"randombest [k]\"\n");
+      return NULL;
+    }
+    return new RandomBestPointLocation(points,space,k);
+  }
+  else if(type=="kdtree" || type=="flatkdtree") {
+    PropertyMap props;
+    space->Properties(props);
+    int euclidean;
+    if(props.get("euclidean",euclidean) && euclidean == 0)
+      fprintf(stderr,"MotionPlannerFactory: Warning, requesting K-D tree point location for non-euclidean space\n");
+
+    vector<Real> weights;
+    bool weighted = props.getArray("metricWeights",weights);
+    if(type=="kdtree") {
+      if(weighted) return new KDTreePointLocation(points,2,weights);
+      return new KDTreePointLocation(points);
+    }
+    if(weighted) return new FlatKDTreePointLocation(points,2,weights);
+    return new FlatKDTreePointLocation(points);
+  }
+  else if(type=="gnat") {
+    int degree;
+    ss >> degree;
+    if(!ss) degree = 8;
+    return new GNATPointLocation(points,space,degree);
+  }
+  else if(type=="hnsw") {
+    int M,ef;
+    ss >> M;
+    if(!ss) M = 16;
+    ss >> ef;
+    if(!ss) ef = 50;
+    return new HNSWPointLocation(points,space,M,100,ef);
+  }
+  else {
+    fprintf(stderr,"Unsupported point location type %s\n",type.c_str());
+    return NULL;
+  }
+}
+
+
+
+void EvaluatePointLocation(PointLocationBase& pointLocation,PointLocationBase& reference,const vector<Vector>& queries,int k,PropertyMap& stats)
+{
+  vector<vector<int> > nn(queries.size()),refnn(queries.size());
+  vector<vector<Real> > dist(queries.size()),refdist(queries.size());
+  Timer timer;
+  for(size_t i=0;i<queries.size();i++)
+    pointLocation.KNN(queries[i],k,nn[i],dist[i]);
+  double t = timer.ElapsedTime();
+  timer.Reset();
+  for(size_t i=0;i<queries.size();i++)
+    reference.KNN(queries[i],k,refnn[i],refdist[i]);
+  double tref = timer.ElapsedTime();
+
+  int numFound = 0, numTotal = 0;
+  for(size_t i=0;i<queries.size();i++) {
+    numTotal += (int)refdist[i].size();
+    if(refdist[i].empty()) continue;
+    Real dk = refdist[i].back();
+    for(size_t j=0;j<dist[i].size() && j<refdist[i].size();j++)
+      if(dist[i][j] <= dk) numFound++;
+  }
+  stats.set("numQueries",(int)queries.size());
+  stats.set("k",k);
+  stats.set("recall",(numTotal == 0 ? 1.0 : double(numFound)/double(numTotal)));
+  stats.set("queriesPerSecond",(t > 0 ? double(queries.size())/t : Inf));
+  stats.set("referenceQueriesPerSecond",(tref > 0 ? double(queries.size())/tref : Inf));
+}
@@ -3,7 +3,11 @@
 
 #include "CSpace.h"
 #include <KrisLibrary/geometry/KDTree.h>
+#include <KrisLibrary/geometry/FlatKDTree.h>
 #include <KrisLibrary/geometry/Grid.h>
+#include <KrisLibrary/utils/SmartPointer.h>
+#include <KrisLibrary/utils/stl_tr1.h>
+#include <string>
 
 /** @brief A uniform abstract interface to point location data structures.
  */
@@ -122,5 +126,322 @@ class KDTreePointLocation : public PointLocationBase
   Geometry::KDTree tree;
 };
 
+/** @brief A K-D tree point location algorithm that uses the flat,
+ * contiguous-storage Geometry::FlatKDTree.
+ *
+ * New points go into a small buffer that is searched linearly.  When the
+ * buffer is full, it is merged with the trees of the lower levels into one
+ * new tree (the logarithmic method), so appends cost amortized O(log^2 n)
+ * and queries search O(log n) trees.  Call Rebuild() after a bulk append to
+ * put all points into a single tree.
+ *
+ * Uses an L-n norm, optionally with weights.
+ *
+ * Deletion is supported by rebuilding the tree on the next query.
+ */
+class FlatKDTreePointLocation : public PointLocationBase
+{
+ public:
+  FlatKDTreePointLocation(std::vector<Vector>& points);
+  FlatKDTreePointLocation(std::vector<Vector>& points,Real norm,const Vector& weights);
+  virtual void OnAppend();
+  virtual bool OnDelete(int id);
+  virtual bool OnClear();
+  virtual bool NN(const Vector& p,int& nn,Real& distance);
+  virtual bool KNN(const Vector& p,int k,std::vector<int>& nn,std::vector<Real>& distances);
+  virtual bool Close(const Vector& p,Real r,std::vector<int>& nn,std::vector<Real>& distances);
+  ///Puts all points into a single tree
+  void Rebuild();
+
+  Real norm;
+  Vector weights;
+  ///Number of points that are kept in the linear buffer (default 32)
+  int bufferSize;
+  std::vector<int> buffer;
+  ///levels[i] is either empty or holds about bufferSize*2^i points
+  std::vector<Geometry::FlatKDTree> levels;
+  ///set when a point is deleted, the tree is rebuilt on the next query
+  bool dirty;
+};
+
+/** @brief A point location algorithm for general metric spaces that uses a
+ * Geometric Near-neighbor Access Tree (GNAT).
+ *
+ * Only calls CSpace::Distance and relies on the triangle inequality, so it
+ * can be used with non-Euclidean metrics.  Each internal node has up to
+ * degree split points, each with a child holding the points closest to it,
+ * and stores the range of distances from every split point to every child.
+ * Points are inserted incrementally; a leaf is split when it holds more
+ * than maxLeafSize points.
+ *
+ * Deletion is supported by rebuilding the tree on the next query.
+ */
+class GNATPointLocation : public PointLocationBase
+{
+ public:
+  struct Node
+  {
+    ///point indices of the split points, empty for leaves
+    std::vector<int> pivots;
+    ///node indices of the children, one per split point
+    std::vector<int> children;
+    ///[i*pivots.size()+j] is the range of distances between split point i
+    ///and the points in child j
+    std::vector<Real> rangeMin,rangeMax;
+    ///points in a leaf
+    std::vector<int> bucket;
+  };
+
+  GNATPointLocation(std::vector<Vector>& points,CSpace* space,int degree=8,int maxLeafSize=32);
+  virtual void OnAppend();
+  virtual bool OnDelete(int id);
+  virtual bool OnClear();
+  virtual bool NN(const Vector& p,int& nn,Real& distance);
+  virtual bool KNN(const Vector& p,int k,std::vector<int>& nn,std::vector<Real>& distances);
+  virtual bool Close(const Vector& p,Real r,std::vector<int>& nn,std::vector<Real>& distances);
+  ///Reinserts all points
+  void Rebuild();
+
+  CSpace* space;
+  int degree,maxLeafSize;
+  std::vector<Node> nodes;
+  bool dirty;
+
+ private:
+  void Insert(int id);
+  void Split(int node);
+  void Search(int node,const Vector& p,int k,Real& radius,std::vector<int>& nn,std::vector<Real>& distances);
+};
+
+/** @brief An approximate point location algorithm for high-dimensional
+ * spaces that uses a Hierarchical Navigable Small World (HNSW) graph.
+ *
+ * Each point is linked to about M nearby points on layer 0, and a
+ * geometrically decreasing subset of the points is also linked on the
+ * higher layers.  A query descends greedily from the top layer, then runs a
+ * best-first search on layer 0 that keeps the efSearch closest points seen.
+ * Raising efSearch raises both the recall and the query time;
+ * efConstruction does the same for the quality of the graph and the time
+ * to insert.  Like GNAT, it only calls CSpace::Distance.
+ *
+ * Filtered queries walk through all points but only return those that
+ * pass the filter, so they get slower as the filter gets more selective.
+ *
+ * Deletion is supported by rebuilding the graph on the next query.
+ */
+class HNSWPointLocation : public PointLocationBase
+{
+ public:
+  HNSWPointLocation(std::vector<Vector>& points,CSpace* space,int M=16,int efConstruction=100,int efSearch=50);
+  virtual void OnAppend();
+  virtual bool OnDelete(int id);
+  virtual bool OnClear();
+  virtual bool Exact() { return false; }
+  virtual bool NN(const Vector& p,int& nn,Real& distance);
+  virtual bool KNN(const Vector& p,int k,std::vector<int>& nn,std::vector<Real>& distances);
+  virtual bool Close(const Vector& p,Real r,std::vector<int>& nn,std::vector<Real>& distances);
+  virtual bool FilteredNN(const Vector& p,bool (*filter)(int),int& nn,Real& distance);
+  virtual bool FilteredKNN(const Vector& p,int k,bool (*filter)(int),std::vector<int>& nn,std::vector<Real>& distances);
+  virtual bool FilteredClose(const Vector& p,Real r,bool (*filter)(int),std::vector<int>& neighbors,std::vector<Real>& distances);
+  ///Reinserts all points
+  void Rebuild();
+
+  CSpace* space;
+  int M,efConstruction,efSearch;
+  ///links[i][l] are the neighbors of point i on layer l
+  std::vector<std::vector<std::vector<int> > > links;
+  int entryPoint,maxLevel;
+  bool dirty;
+
+ private:
+  void Insert(int id);
+  int RandomLevel(int id) const;
+  void Descend(const Vector& p,int toLevel,int& cur,Real& dcur);
+  void SearchLayer(const Vector& p,int entry,Real dentry,int ef,int level,bool (*filter)(int),std::vector<std::pair<Real,int> >& results);
+  void SelectNeighbors(std::vector<std::pair<Real,int> >& candidates,int m,std::vector<int>& selected);
+  void Query(const Vector& p,int ef,bool (*filter)(int),std::vector<std::pair<Real,int> >& results);
+  bool DoKNN(const Vector& p,int k,bool (*filter)(int),std::vector<int>& nn,std::vector<Real>& distances);
+  bool DoClose(const Vector& p,Real r,bool (*filter)(int),std::vector<int>& nn,std::vector<Real>& distances);
+
+  //visited marks for the graph search, valid if equal to visitTag
+  std::vector<int> visited;
+  int visitTag;
+};
+
+/** @brief Creates a point location data structure on the given point list
+ * from a string.
+ *
+ * Supported types are "random", "randombest [k]", "kdtree", "flatkdtree",
+ * "gnat [degree]", and "hnsw [M] [efSearch]".  The kd-tree types require a Euclidean space, and a
+ * warning is printed if the space's properties say otherwise.  Returns NULL
+ * and prints an error if the string is not understood.
+ */
+PointLocationBase* MakePointLocation(const std::string& type,std::vector<Vector>& points,CSpace* space);
+
+/** @brief Compares the k-nearest neighbor results of a point location
+ * structure against a reference (usually NaivePointLocation) on the given
+ * queries.
+ *
+ * Sets the following stats:
+ * - recall: the fraction of the reference's k nearest neighbors that were
+ *   returned (by distance, so ties count as found).
+ * - queriesPerSecond, referenceQueriesPerSecond: the query rates.
+ * - numQueries, k.
+ *
+ * NaivePointLocation::KNN skips points at distance 0, so the queries
+ * should not be points in the set.
+ */
+void EvaluatePointLocation(PointLocationBase& pointLocation,PointLocationBase& reference,const std::vector<Vector>& queries,int k,PropertyMap& stats);
+
+/** @brief Maintains point location over a set of objects (e.g., the nodes
+ * of a tree planner) that can be added and removed in any order.
+ *
+ * Set pointLocator to a point location structure built on the points
+ * member, e.g., with MakePointLocation(type,index.points,space).  If
+ * pointLocator is NULL, nothing is stored and the queries return false.
+ *
+ * Removed objects are kept in the point list but skipped by the queries.
+ * When half of the entries have been removed, the list is compacted and
+ * the point location structure is rebuilt, so removal works with any
+ * PointLocationBase, including ones that do not support deletion.
+ *
+ * This object must not be copied after pointLocator is set, since
+ * pointLocator refers to its point list.
+ */
+template <class T>
+class DynamicPointLocation
+{
+ public:
+  DynamicPointLocation() :numRemoved(0) {}
+  void Clear();
+  void Add(const T& obj,const Vector& x);
+  void Remove(const T& obj);
+  ///Returns the number of objects that have not been removed
+  int Size() const { return (int)objects.size()-numRemoved; }
+  bool NN(const Vector& x,T& obj,Real& distance);
+  ///Returns up to k closest objects, sorted by increasing distance
+  bool KNN(const Vector& x,int k,std::vector<T>& objs,std::vector<Real>& distances);
+  bool Close(const Vector& x,Real r,std::vector<T>& objs,std::vector<Real>& distances);
+  ///Drops the removed entries and rebuilds the point location structure
+  void Compact();
+
+  SmartPointer<PointLocationBase> pointLocator;
+  std::vector<Vector> points;
+  std::vector<T> objects;
+  std::vector<bool> removed;
+  UNORDERED_MAP_TEMPLATE<T,int> indices;
+  int numRemoved;
+};
+
+template <class T>
+void DynamicPointLocation<T>::Clear()
+{
+  points.clear();
+  objects.clear();
+  removed.clear();
+  indices.clear();
+  numRemoved = 0;
+  if(pointLocator) pointLocator->OnClear();
+}
+
+template <class T>
+void DynamicPointLocation<T>::Add(const T& obj,const Vector& x)
+{
+  if(!pointLocator) return;
+  indices[obj] = (int)objects.size();
+  objects.push_back(obj);
+  removed.push_back(false);
+  points.push_back(x);
+  pointLocator->OnAppend();
+}
+
+template <class T>
+void DynamicPointLocation<T>::Remove(const T& obj)
+{
+  if(!pointLocator) return;
+  typename UNORDERED_MAP_TEMPLATE<T,int>::iterator i=indices.find(obj);
+  if(i == indices.end()) return;
+  removed[i->second] = true;
+  indices.erase(i);
+  numRemoved++;
+  if(numRemoved*2 > (int)objects.size())
+    Compact();
+}
+
+template <class T>
+void DynamicPointLocation<T>::Compact()
+{
+  std::vector<Vector> oldPoints;
+  std::vector<T> oldObjects;
+  oldPoints.swap(points);
+  oldObjects.swap(objects);
+  std::vector<bool> oldRemoved;
+  oldRemoved.swap(removed);
+  indices.clear();
+  numRemoved = 0;
+  if(!pointLocator) return;
+  pointLocator->OnClear();
+  for(size_t i=0;i<oldObjects.size();i++)
+    if(!oldRemoved[i]) Add(oldObjects[i],oldPoints[i]);
+}
+
+template <class T>
+bool DynamicPointLocation<T>::NN(const Vector& x,T& obj,Real& distance)
+{
+  if(!pointLocator || Size()==0) return false;
+  int nn;
+  if(!pointLocator->NN(x,nn,distance)) return false;
+  if(nn >= 0 && !removed[nn]) {
+    obj = objects[nn];
+    return true;
+  }
+  std::vector<T> objs;
+  std::vector<Real> dists;
+  if(!KNN(x,1,objs,dists) || objs.empty()) return false;
+  obj = objs[0];
+  distance = dists[0];
+  return true;
+}
+
+template <class T>
+bool DynamicPointLocation<T>::KNN(const Vector& x,int k,std::vector<T>& objs,std::vector<Real>& distances)
+{
+  objs.resize(0);
+  distances.resize(0);
+  if(!pointLocator) return false;
+  std::vector<int> nn;
+  std::vector<Real> d;
+  //ask for more neighbors until k of them have not been removed
+  int kq = k;
+  while(true) {
+    if(!pointLocator->KNN(x,kq,nn,d)) return false;
+    objs.resize(0);
+    distances.resize(0);
+    for(size_t i=0;i<nn.size() && (int)objs.size()<k;i++) {
+      if(removed[nn[i]]) continue;
+      objs.push_back(objects[nn[i]]);
+      distances.push_back(d[i]);
+    }
+    if((int)objs.size() == k || (int)nn.size() < kq || kq >= (int)objects.size()) return true;
+    kq *= 2;
+  }
+}
+
+template <class T>
+bool DynamicPointLocation<T>::Close(const Vector& x,Real r,std::vector<T>& objs,std::vector<Real>& distances)
+{
+  objs.resize(0);
+  distances.resize(0);
+  if(!pointLocator) return false;
+  std::vector<int> nn;
+  std::vector<Real> d;
+  if(!pointLocator->Close(x,r,nn,d)) return false;
+  for(size_t i=0;i<nn.size();i++) {
+    if(removed[nn[i]]) continue;
+    objs.push_back(objects[nn[i]]);
+    distances.push_back(d[i]);
+  }
+  return true;
+}
 
 #endif
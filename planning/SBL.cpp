@@ -25,6 +25,10 @@ void SBLPlanner::Init(const Config& qStart,const Config& qGoal)
   Assert(!tStart && !tGoal);
   tStart = new SBLTreeWithIndex(space);
   tGoal = new SBLTreeWithIndex(space);
+  if(!pointLocation.empty()) {
+    tStart->pointLocation.pointLocator = MakePointLocation(pointLocation,tStart->pointLocation.points,space);
+    tGoal->pointLocation.pointLocator = MakePointLocation(pointLocation,tGoal->pointLocation.points,space);
+  }
   tStart->Init(qStart);
   tGoal->Init(qGoal);
   //cout<<"SBL: Distance "<<space->Distance(qStart,qGoal)<<endl;
@@ -160,6 +164,8 @@ int SBLPRT::AddSeed(const Config& q)
   SBLTreeWithGrid* t = new SBLTreeWithGrid(space);
   t->A.h.resize(q.n,0.1);
   t->RandomizeSubset();
+  if(!pointLocation.empty())
+    t->pointLocation.pointLocator = MakePointLocation(pointLocation,t->pointLocation.points,space);
   ccs.AddNode();
   t->Init(q);
   Assert(space->IsFeasible(q));
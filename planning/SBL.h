@@ -18,7 +18,8 @@
  * neighborhood sampling.  maxExtendIters is the number of iters of 
  * shrinking the neighborhood sampling radius until we quit. 
  * edgeConnectionThreshold is the minimum distance required for a connection
- * between the two trees.
+ * between the two trees.  If pointLocation is not empty, the trees use
+ * that point location type (see MakePointLocation) to pick connections.
  */
 class SBLPlanner
 {
@@ -43,6 +44,7 @@ public:
   Real maxExtendDistance;
   int maxExtendIters;
   Real edgeConnectionThreshold;
+  std::string pointLocation;
 
   int numIters;
   SBLTree *tStart, *tGoal;
@@ -108,6 +110,9 @@ class SBLPRT
   Real maxExtendDistance;
   int maxExtendIters;
   Real defaultPPickClosestTree,defaultPPickClosestNode;
+  ///If not empty, the point location type used by the trees in
+  ///GetClosestNode (see MakePointLocation)
+  std::string pointLocation;
 
   int numIters;
   Roadmap roadmap;          //the roadmap nodes
@@ -101,6 +101,7 @@ SBLTree::~SBLTree()
 void SBLTree::Cleanup()
 {
   SafeDelete(root);
+  pointLocation.Clear();
 }
 
 void SBLTree::Init(const Config& qRoot)
@@ -419,6 +420,9 @@ Node* SBLTree::PickExpand()
 
 Node* SBLTree::FindClosest(const Config& x)
 {
+  Node* closest;
+  Real d;
+  if(pointLocation.NN(x,closest,d)) return closest;
   //walk through start tree
   ClosestMilestoneCallback callback(space,x);
   root->DFS(callback);
@@ -434,15 +438,18 @@ SBLTreeWithIndex::SBLTreeWithIndex(CSpace* space)
 void SBLTreeWithIndex::Cleanup()
 {
   index.resize(0);
+  pointLocation.Clear();
 }
 
 void SBLTreeWithIndex::AddMilestone(Node* n)
 {
+  SBLTree::AddMilestone(n);
   index.push_back(n);
 }
 
 void SBLTreeWithIndex::RemoveMilestone(Node* n)
 {
+  SBLTree::RemoveMilestone(n);
   vector<Node*>::iterator i=find(index.begin(),index.end(),n);
   if(i == index.end()) return;
   *i = index.back();
@@ -596,11 +603,13 @@ void SBLTreeWithGrid::RandomizeSubset()
 
 void SBLTreeWithGrid::AddMilestone(Node* n)
 {
+  SBLTree::AddMilestone(n);
   A.AddPoint(n);
 }
 
 void SBLTreeWithGrid::RemoveMilestone(Node* n)
 {
+  SBLTree::RemoveMilestone(n);
   A.RemovePoint(n);
 }
 
@@ -9,9 +9,14 @@
 #include "CSpace.h"
 #include "EdgePlanner.h"
 #include "Path.h"
+#include "PointLocation.h"
 
 /** @ingroup MotionPlanning
  * @brief A tree of configurations to be used in the SBL motion planner.
+ *
+ * FindClosest searches the whole tree unless pointLocation.pointLocator is
+ * set.  Subclasses that override AddMilestone / RemoveMilestone must call
+ * the SBLTree versions to keep it up to date.
  */
 class SBLTree
 {
@@ -30,8 +35,8 @@ public:
   virtual void Init(const Config& qStart);
   virtual Node* Extend(Real maxDistance,int maxIters);
 
-  virtual void AddMilestone(Node* n) {}
-  virtual void RemoveMilestone(Node* n) {}
+  virtual void AddMilestone(Node* n) { pointLocation.Add(n,*n); }
+  virtual void RemoveMilestone(Node* n) { pointLocation.Remove(n); }
   virtual Node* PickExpand();
 
   //helpers
@@ -49,6 +54,8 @@ public:
 
   CSpace* space;
   Node *root;
+  ///Optional point location over the nodes (default none)
+  DynamicPointLocation<Node*> pointLocation;
 };
 
 /** @ingroup MotionPlanning
@@ -0,0 +1,172 @@
+#include "IKBatch.h"
+#include <utils/threadutils.h>
+#include <math/misc.h>
+#include <limits.h>
+using namespace std;
+
+BatchIKResult::BatchIKResult()
+  :solved(false),restart(-1),numAttempts(0),numIters(0)
+{}
+
+BatchIKSolver::BatchIKSolver(const RobotKinematics3D& _robot)
+  :robot(_robot),tolerance(1e-5),maxIters(100),numRestarts(10),
+   revJointThreshold(TwoPi),useDLS(true),numThreads(0),randomSeed(0)
+{}
+
+//uniform in [0,1), hashed from a stream state and an index
+static Real HashUniform(unsigned int state,int index)
+{
+  unsigned int h = state ^ ((unsigned int)index*2654435761u + 0x9e3779b9u);
+  h ^= h >> 16; h *= 0x85ebca6bu;
+  h ^= h >> 13; h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return Real(h)/4294967296.0;
+}
+
+static unsigned int AttemptStream(unsigned int seed,int query,int attempt)
+{
+  unsigned int h = seed;
+  h = (h ^ (unsigned int)query)*0x85ebca6bu;
+  h ^= h >> 15;
+  h = (h ^ (unsigned int)attempt)*0xc2b2ae35u;
+  h ^= h >> 13;
+  return h;
+}
+
+struct BatchIKQueryState
+{
+  int nextAttempt;
+  ///lowest successful attempt, or INT_MAX
+  int best;
+};
+
+struct BatchIKJob
+{
+  BatchIKSolver* solver;
+  const vector<vector<IKGoal> >* problems;
+  const vector<Config>* seeds;
+  vector<BatchIKResult>* results;
+
+  Mutex mutex;
+  vector<BatchIKQueryState> queries;
+  int nextQuery;
+  vector<int> open;   //queries that have been started and may need restarts
+
+  bool CanDispatch(int q) const {
+    return queries[q].best == INT_MAX && queries[q].nextAttempt <= solver->numRestarts;
+  }
+  //picks the next attempt, preferring the worker's current query, then a
+  //new query, then a query that another worker is running
+  bool Dispatch(int current,int& q,int& attempt) {
+    ScopedLock lock(mutex);
+    if(current >= 0 && CanDispatch(current)) q = current;
+    else if(nextQuery < (int)queries.size()) {
+      q = nextQuery++;
+      open.push_back(q);
+    }
+    else {
+      q = -1;
+      size_t k=0;
+      for(size_t i=0;i<open.size();i++) {
+	if(!CanDispatch(open[i])) continue;
+	if(q < 0) q = open[i];
+	open[k++] = open[i];
+      }
+      open.resize(k);
+      if(q < 0) return false;
+    }
+    attempt = queries[q].nextAttempt++;
+    return true;
+  }
+  bool Cancelled(int q,int attempt) {
+    ScopedLock lock(mutex);
+    return queries[q].best < attempt;
+  }
+};
+
+static void BatchIKWorker(void* data,int index)
+{
+  BatchIKJob* job = reinterpret_cast<BatchIKJob*>(data);
+  const BatchIKSolver* params = job->solver;
+  RobotKinematics3D robot(params->robot);
+  RobotIKFunction function(robot);
+  RobotIKSolver solver(function);
+  solver.useDLS = params->useDLS;
+  Config start;
+  int current = -1;
+  int q=-1,attempt=0;
+  while(job->Dispatch(current,q,attempt)) {
+    const vector<IKGoal>& goals = (*job->problems)[q];
+    if(q != current) {
+      function.Clear();
+      function.UseIK(goals);
+      GetDefaultIKDofs(robot,goals,function.activeDofs);
+      solver.UseJointLimits(params->revJointThreshold);
+      current = q;
+    }
+    if(attempt > 0 && job->Cancelled(q,attempt)) continue;
+
+    if(job->seeds->empty()) start = params->robot.q;
+    else start = (*job->seeds)[q];
+    if(attempt > 0) {
+      unsigned int stream = AttemptStream(params->randomSeed,q,attempt);
+      for(int i=0;i<function.activeDofs.Size();i++) {
+	int d = function.activeDofs.Map(i);
+	Real a = robot.qMin(d), b = robot.qMax(d);
+	if(IsInf(a) || IsInf(b)) { a = start(d)-Pi; b = start(d)+Pi; }
+	start(d) = a + HashUniform(stream,i)*(b-a);
+      }
+    }
+    robot.q = start;
+    int iters = params->maxIters;
+    bool res = solver.Solve(params->tolerance,iters);
+
+    ScopedLock lock(job->mutex);
+    BatchIKResult& r = (*job->results)[q];
+    r.numAttempts++;
+    r.numIters += iters;
+    if(res && attempt < job->queries[q].best) {
+      job->queries[q].best = attempt;
+      r.solved = true;
+      r.q = robot.q;
+      r.restart = attempt;
+    }
+    else if(attempt == 0 && !r.solved) {
+      r.q = robot.q;
+      r.restart = 0;
+    }
+  }
+}
+
+int BatchIKSolver::Solve(const vector<vector<IKGoal> >& problems,
+			 const vector<Config>& seeds,
+			 vector<BatchIKResult>& results)
+{
+  if(!seeds.empty() && seeds.size() != problems.size())
+    FatalError("BatchIKSolver::Solve: %d seeds given for %d problems",(int)seeds.size(),(int)problems.size());
+  results.resize(0);
+  results.resize(problems.size());
+  if(problems.empty()) return 0;
+
+  BatchIKJob job;
+  job.solver = this;
+  job.problems = &problems;
+  job.seeds = &seeds;
+  job.results = &results;
+  job.queries.resize(problems.size());
+  for(size_t i=0;i<problems.size();i++) {
+    job.queries[i].nextAttempt = 0;
+    job.queries[i].best = INT_MAX;
+  }
+  job.nextQuery = 0;
+
+  int n = (numThreads <= 0 ? ThreadHardwareConcurrency() : numThreads);
+  int maxWork = (int)problems.size()*(Max(numRestarts,0)+1);
+  if(n > maxWork) n = maxWork;
+  ParallelFor(n,BatchIKWorker,&job,n);
+
+  int numSolved = 0;
+  for(size_t i=0;i<results.size();i++)
+    if(results[i].solved) numSolved++;
+  return numSolved;
+}
@@ -0,0 +1,82 @@
+#ifndef ROBOTICS_IK_BATCH_H
+#define ROBOTICS_IK_BATCH_H
+
+#include "IKFunctions.h"
+
+/** @file IKBatch.h
+ * @ingroup Kinematics
+ * @brief Solves many IK problems with random restarts on several threads.
+ */
+
+/** @addtogroup Kinematics */
+/*@{*/
+
+/** @brief The result of one query of a BatchIKSolver.
+ */
+struct BatchIKResult
+{
+  BatchIKResult();
+
+  bool solved;
+  ///The solution if solved, otherwise the end of the first attempt
+  Config q;
+  ///The index of the attempt that produced q (0 is the seed)
+  int restart;
+  ///The number of attempts that were run, and the total number of
+  ///iterations over those attempts
+  int numAttempts,numIters;
+};
+
+/** @brief Solves a batch of IK problems using random restarts, spread over
+ * several threads.
+ *
+ * Each query is a set of IKGoals and an optional seed configuration.
+ * Attempt 0 starts at the seed.  Attempts 1,...,numRestarts start at random
+ * configurations drawn uniformly within the joint limits of the active
+ * dofs.  A revolute joint with infinite limits is sampled within pi of the
+ * seed.  Each worker thread solves on its own copy of the kinematic model,
+ * so the robot passed to the constructor is never modified.
+ *
+ * Workers first take new queries.  A worker whose attempt fails continues
+ * with the next restart of the same query.  When no new queries are left,
+ * idle workers join the queries that are still running, so a small batch
+ * still runs its restarts in parallel.  Once an attempt succeeds, the later
+ * attempts of that query are not started.  Attempts that are already
+ * running are not interrupted, but their results are discarded.
+ *
+ * The random starts are a hash of (randomSeed, query, attempt), not draws
+ * from the global random number generator.  The reported solution is the
+ * one from the lowest-numbered successful attempt, so the results do not
+ * depend on the number of threads or on their timing.  Only numAttempts
+ * and numIters do.
+ */
+class BatchIKSolver
+{
+public:
+  BatchIKSolver(const RobotKinematics3D& robot);
+  ///Solves the given problems.  seeds is either empty, in which case
+  ///robot.q is used as the seed of every query, or has one configuration
+  ///per problem.  Returns the number of solved queries.
+  int Solve(const std::vector<std::vector<IKGoal> >& problems,
+	    const std::vector<Config>& seeds,
+	    std::vector<BatchIKResult>& results);
+
+  const RobotKinematics3D& robot;
+  Real tolerance;
+  ///Maximum iterations per attempt
+  int maxIters;
+  ///Number of random restarts after the seeded attempt
+  int numRestarts;
+  ///Revolute joints with a range at least this wide are unbounded in
+  ///the solve (see RobotIKSolver::UseJointLimits).  Default 2pi
+  Real revJointThreshold;
+  ///Sets RobotIKSolver::useDLS.  Default true
+  bool useDLS;
+  ///Number of worker threads; <= 0 uses all hardware threads
+  int numThreads;
+  unsigned int randomSeed;
+};
+
+/*@}*/
+
+#endif
@@ -5,6 +5,7 @@
 #include "Kinematics.h"
 #include <Timer.h>
 #include <math/misc.h>
+#include <math/AABB.h>
 #include <math3d/misc.h>
 #include <math3d/basis.h>
 #include <iostream>
@@ -311,10 +312,29 @@ Real IKGoalFunction::Eval_i(const Vector& x, int i)
 void IKGoalFunction::Jacobian(const Vector& x, Matrix& J)
 {
   UpdateEERot();
+  //the world points and the moment derivative are the same for all columns
+  Vector3 peff,pdest;
+  robot.GetWorldPosition(goal.localPosition,goal.link,peff);
+  if(goal.destLink >= 0)
+    robot.GetWorldPosition(goal.endPosition,goal.destLink,pdest);
+  Matrix3 dmoment;
+  if(goal.rotConstraint==IKGoal::RotFixed) {
+    //MomentDerivative is linear in the angular velocity
+    Vector3 ei,dmi;
+    for(int i=0;i<3;i++) {
+      ei.setZero();
+      ei[i] = One;
+      MomentDerivative(eerot,ei,dmi);
+      dmoment.setCol(i,dmi);
+    }
+  }
   for(int k=0;k<x.n;k++) {
     int baseLink = GetDOF(k);
     Vector3 dp;
-    robot.GetPositionJacobian(goal.localPosition,goal.link,baseLink,dp);
+    if(robot.IsAncestor(goal.link,baseLink))
+      robot.links[baseLink].GetPositionJacobian(robot.q[baseLink],peff,dp);
+    else
+      dp.setZero();
     if(goal.posConstraint==IKGoal::PosFixed) {
       for(int j=0;j<3;j++)
 	J(j,k) = positionScale*dp[j];
@@ -337,7 +357,10 @@ void IKGoalFunction::Jacobian(const Vector& x, Matrix& J)
 
     if(goal.destLink >= 0) {
       Vector3 dpdest;
-      robot.GetPositionJacobian(goal.endPosition,goal.destLink,baseLink,dpdest);
+      if(robot.IsAncestor(goal.destLink,baseLink))
+	robot.links[baseLink].GetPositionJacobian(robot.q[baseLink],pdest,dpdest);
+      else
+	dpdest.setZero();
       if(goal.posConstraint==IKGoal::PosFixed) {
 	for(int j=0;j<3;j++)
 	  J(j,k) -= positionScale*dpdest[j];
@@ -376,7 +399,7 @@ void IKGoalFunction::Jacobian(const Vector& x, Matrix& J)
 	robot.GetOrientationJacobian(goal.destLink,baseLink,dwdest);
 	dw -= eerot*dwdest;
       }
-      MomentDerivative(eerot,dw,dr);
+      dmoment.mul(dw,dr);
       //robot.GetWorldRotationDeriv_Moment(goal.link,baseLink,dr);
       J(m,k) = rotationScale*dr.x;
       J(m+1,k) = rotationScale*dr.y;
@@ -772,7 +795,7 @@ void RobotIKFunction::PreEval(const Vector& x)
 
 
 RobotIKSolver::RobotIKSolver(RobotIKFunction& f)
-  :solver(&f),function(f),robot(f.robot)
+  :solver(&f),function(f),robot(f.robot),useDLS(false)
 {
   solver.svd.preMultiply = false;
 }
@@ -839,6 +862,7 @@ void RobotIKSolver::StateToRobot()
 
 bool RobotIKSolver::Solve(Real tolerance,int& iters)
 {
+  if(useDLS) return SolveDLS(tolerance,iters);
   RobotToState();
   solver.tolf = tolerance;
   solver.tolx = tolerance*0.01;
@@ -850,6 +874,138 @@ bool RobotIKSolver::Solve(Real tolerance,int& iters)
   return res;
 }
 
+/*
+Levenberg-Marquardt iteration.  Each step solves
+  min ||J dx + e||^2 + lambda ||dx||^2
+whose solution is dx = -J^T (J J^T + lambda I)^-1 e, so only an m x m system
+is factored.  If the step reduces ||e||, it is taken and lambda is decreased;
+otherwise lambda is increased and the step recomputed with the same J.
+
+With a bias configuration, the nullspace component of the bias
+(I - J^T (J J^T + lambda I)^-1 J)(bias - x) is added, and dropped if the step
+is rejected.
+*/
+bool RobotIKSolver::SolveDLS(Real tolerance,int& iters)
+{
+  RobotToState();
+  Vector& x = solver.x;
+  const Vector& bmin = solver.bmin;
+  const Vector& bmax = solver.bmax;
+  if(bmin.n != 0) AABBClamp(x,bmin,bmax);
+  int m = function.NumDimensions();
+  int n = x.n;
+  dlsErr.resize(m);
+  dlsTrialErr.resize(m);
+  dlsJ.resize(m,n);
+  dlsJJt.resize(m,m);
+  dlsA.resize(m,m);
+  dlsStep.resize(n);
+  dlsX.resize(n);
+  dlsLDL.verbose = 0;
+
+  function.PreEval(x);
+  function.Eval(x,dlsErr);
+  Real E = dlsErr.normSquared();
+  Real lambdaMin = Sqr(solver.lambda);
+  const static Real lambdaMax = 1e10;
+  Real lambda = lambdaMin;
+  Real stpmax = solver.stepMax*Max(x.norm(),(Real)n);
+  Real tolx = tolerance*0.01;
+  bool useBias = !solver.bias.empty();
+  bool needJacobian = true;
+  int maxIters = iters;
+  for(iters=0;iters<maxIters;iters++) {
+    if(dlsErr.maxAbsElement() <= tolerance) break;
+    if(needJacobian) {
+      function.Jacobian(x,dlsJ);
+      //keep the nonzero columns, except directions blocked by the bounds,
+      //which are removed as in NewtonRoot
+      dlsCols.resize(0);
+      for(int j=0;j<n;j++) {
+	dlsJ.getColRef(j,dlsJj);
+	if(dlsJj.isZero()) continue;
+	Real gj = dlsJj.dot(dlsErr);
+	if(bmin.n != 0) {
+	  if(x(j) <= bmin(j) && gj > 0) continue;
+	  if(x(j) >= bmax(j) && gj < 0) continue;
+	}
+	dlsCols.push_back(j);
+      }
+      int nc = (int)dlsCols.size();
+      if(nc == 0) break;
+      dlsJc.resize(m,nc);
+      for(int c=0;c<nc;c++) {
+	dlsJ.getColRef(dlsCols[c],dlsJj);
+	dlsJc.copyCol(c,dlsJj);
+      }
+      dlsJJt.mulTransposeB(dlsJc,dlsJc);
+      needJacobian = false;
+    }
+    dlsA.copy(dlsJJt);
+    for(int i=0;i<m;i++) dlsA(i,i) += lambda;
+    dlsLDL.set(dlsA);
+    bool ok = true;
+    for(int i=0;i<m;i++)
+      if(!(dlsLDL.LDL(i,i) > 0)) ok = false;
+    if(!ok) {
+      lambda *= 10;
+      if(lambda > lambdaMax) break;
+      continue;
+    }
+    //rhs = e + J (x - bias), so that the step also includes the bias term
+    int nc = (int)dlsCols.size();
+    dlsTemp.copy(dlsErr);
+    if(useBias) {
+      dlsBias.resize(nc);
+      for(int c=0;c<nc;c++)
+	dlsBias(c) = solver.bias(dlsCols[c]) - x(dlsCols[c]);
+      dlsJc.mul(dlsBias,dlsY);
+      dlsTemp -= dlsY;
+    }
+    dlsLDL.LBackSub(dlsTemp,dlsY);
+    dlsLDL.DBackSub(dlsY,dlsY);
+    dlsLDL.LTBackSub(dlsY,dlsTemp);
+    dlsStepc.resize(nc);
+    dlsJc.mulTranspose(dlsTemp,dlsStepc);
+    dlsStepc.inplaceNegative();
+    if(useBias) dlsStepc += dlsBias;
+    dlsStep.setZero();
+    for(int c=0;c<nc;c++)
+      dlsStep(dlsCols[c]) = dlsStepc(c);
+    Real len = dlsStep.norm();
+    if(len > stpmax) dlsStep.inplaceMul(stpmax/len);
+    dlsX.add(x,dlsStep);
+    if(bmin.n != 0) AABBClamp(dlsX,bmin,bmax);
+    function.PreEval(dlsX);
+    function.Eval(dlsX,dlsTrialErr);
+    Real Etrial = dlsTrialErr.normSquared();
+    Real test = 0;
+    for(int j=0;j<n;j++)
+      test = Max(test,Abs(dlsX(j)-x(j))/Max(Abs(dlsX(j)),One));
+    if(Etrial < E) {
+      //a negligible decrease means we are creeping into a local minimum
+      bool stalled = (E - Etrial < 1e-4*E);
+      x.copy(dlsX);
+      dlsErr.copy(dlsTrialErr);
+      E = Etrial;
+      lambda = Max(lambda*0.1,lambdaMin);
+      useBias = !solver.bias.empty();
+      needJacobian = true;
+      if(test < tolx || stalled) break;
+    }
+    else {
+      //stuck, even though the step is tiny
+      if(test < tolx) break;
+      useBias = false;
+      lambda *= 10;
+      if(lambda > lambdaMax) break;
+    }
+  }
+  //x is the last accepted point, but the robot may be at a rejected one
+  StateToRobot();
+  return dlsErr.maxAbsElement() <= tolerance;
+}
+
 void RobotIKSolver::PrintStats()
 {
   /*
@@ -5,6 +5,7 @@
 #include "IK.h"
 #include <KrisLibrary/math/vectorfunction.h>
 #include <KrisLibrary/optimization/Newton.h>
+#include <KrisLibrary/math/LDL.h>
 #include <KrisLibrary/utils/ArrayMapping.h>
 #include <KrisLibrary/utils/DirtyData.h>
 
@@ -63,6 +64,12 @@ struct RobotIKFunction : public CompositeVectorFieldFunction
  * than t. Specifying a value less than 2pi is useful to avoid local minima
  * for joints with wide ranges, because it allows the joint angle to pass from
  * -pi to pi, and vice versa.
+ *
+ * If useDLS is true, Solve() uses SolveDLS(), a damped least-squares
+ * (Levenberg-Marquardt) iteration that factors the small m x m matrix
+ * J*J^T + lambda*I instead of computing an SVD of J, and adapts lambda
+ * in place of a line search.  This is much faster for typical problems with
+ * few constraints.  solver.lambda^2 is used as the minimum damping.
  */
 struct RobotIKSolver
 {
@@ -74,11 +81,19 @@ struct RobotIKSolver
   void RobotToState();
   void StateToRobot();
   bool Solve(Real tolerance,int& iters);
+  bool SolveDLS(Real tolerance,int& iters);
   void PrintStats();
 
   Optimization::NewtonRoot solver;
   RobotIKFunction& function;
   RobotKinematics3D& robot;
+  bool useDLS;
+
+  //temporary storage for SolveDLS, reused between solves
+  Vector dlsErr,dlsTrialErr,dlsX,dlsStep,dlsStepc,dlsTemp,dlsY,dlsBias,dlsJj;
+  Matrix dlsJ,dlsJc,dlsJJt,dlsA;
+  std::vector<int> dlsCols;
+  LDLDecomposition<Real> dlsLDL;
 };
 
 /// Computes the ArrayMapping that only includes ancestor links of the 
@@ -265,183 +265,175 @@ void NewtonEulerSolver::CalcTorques(const Vector& ddq,Vector& t)
 }
 
 
-void NewtonEulerSolver::CalcAccel(const Vector& t,Vector& ddq)
-{
-  ddq.resize(robot.links.size());
-  inertiaMatrices.resize(robot.links.size());
-  biasingForces.resize(robot.links.size());
-  CalcVelocities();
+//In the articulated-body algorithm, spatial quantities are given in world
+//coordinates about the world origin, so they don't need to be shifted
+//between links.  Like setMassMatrix, motion vectors are ordered
+//(linear,angular) and force vectors are ordered (force,moment).
+
+//sets I to the spatial inertia of a body with the given mass, world center
+//of mass c, and world inertia Ic about c
+static void SetSpatialInertia(Real mass,const Vector3& c,const Matrix3& Ic,SpatialMatrix& I)
+{
+  Matrix3 cp,cpcp;
+  cp.setCrossProduct(c);
+  cpcp.mul(cp,cp);
+  for(int i=0;i<3;i++)
+    for(int j=0;j<3;j++) {
+      I(i,j) = (i==j?mass:0.0);
+      I(i,j+3) = -mass*cp(i,j);
+      I(i+3,j) = mass*cp(i,j);
+      I(i+3,j+3) = Ic(i,j)-mass*cpcp(i,j);
+    }
+}
 
-  //initialize the matrices
+void NewtonEulerSolver::CalcArticulatedInertias()
+{
+  size_t numLinks = robot.links.size();
+  inertiaMatrices.resize(numLinks);
+  jointAxes.resize(numLinks);
+  jointAxisInertias.resize(numLinks);
+  jointAxisMasses.resize(numLinks);
   Matrix3 Iworld;
-  //velocity dependent accelerations (centrifugal and coriolis terms)
-  //calculated at center of mass!
-  vector<SpatialVector> velDepAccels(robot.links.size());
-  for(size_t n=0;n<robot.links.size();n++) {
-    //cout<<"Velocity n: "<<velocities[n].v<<", "<<velocities[n].w<<endl;
-    //cout<<" Vel at com: "<<velocities[n].v + cross(velocities[n].w,robot.links[n].T_World.R*robot.links[n].com)<<endl;
-    robot.links[n].GetWorldInertia(Iworld);
-    inertiaMatrices[n].setMassMatrix(robot.links[n].mass,Iworld);
-    Vector3 gyroscopicForce = cross(velocities[n].w,Iworld*velocities[n].w);
-    int p = robot.parents[n];
-    if(p < 0) {
-      const Vector3 &w2=velocities[n].w;
-      Vector3 com_n_local = robot.links[n].T_World.R*robot.links[n].com;
-      Vector3 v = cross(w2,cross(w2,com_n_local));
-      velDepAccels[n].set(v,Vector3(Zero));
-    }
-    else {
-      //calculate these quantities about the center of mass of each link
-      Vector3 com_n_local = robot.links[n].T_World.R*robot.links[n].com;
-      Vector3 com_p_local = robot.links[p].T_World.R*robot.links[p].com;
-      Vector3 v1=velocities[p].v+cross(velocities[p].w,com_p_local);
-      Vector3 v2=velocities[n].v+cross(velocities[n].w,com_n_local);
-      const Vector3 &w1=velocities[p].w, &w2=velocities[n].w;
-      Vector3 cdiff = robot.links[n].T_World*robot.links[n].com-robot.links[p].T_World*robot.links[p].com;
-      Vector3 v = cross(w1,v2-v1);
-      if(robot.links[n].type == RobotLink3D::Prismatic) {
-	v += robot.dq(n)*cross(w1,robot.links[p].T_World.R*robot.links[n].w); 
-      }
+  for(size_t n=0;n<numLinks;n++) {
+    const RobotLink3D& link = robot.links[n];
+    link.GetWorldInertia(Iworld);
+    SetSpatialInertia(link.mass,link.T_World*link.com,Iworld,inertiaMatrices[n]);
+    Vector3 axis_w = link.T_World.R*link.w;
+    if(link.type == RobotLink3D::Revolute)
+      jointAxes[n].set(cross(link.T_World.t,axis_w),axis_w);
+    else
+      jointAxes[n].set(axis_w,Vector3(Zero));
+  }
+  //go backward down the list, adding each link's articulated inertia to
+  //its parent's
+  for(int n=(int)numLinks-1;n>=0;--n) {
+    SpatialMatrix& I = inertiaMatrices[n];
+    SpatialVector& U = jointAxisInertias[n];
+    I.mul(jointAxes[n],U);
+    Real D = U.dot(jointAxes[n]);
+    if(!(D > 0.0)) {
+      //check if this is a frozen link.  If so, it moves rigidly with its
+      //parent
+      if(robot.qMin[n] == robot.qMax[n]) D = 0;
       else {
-	v += cross(w2,cross(w2-w1,com_n_local));
+	fprintf(stderr,"NewtonEulerSolver: Warning, axis-wise inertia on link %d is invalid; %g\n",n,D);
+	D = Epsilon;
       }
-      Vector3 w = cross(w1,w2);
-      velDepAccels[n].set(v,w);
     }
-    biasingForces[n].set(-externalWrenches[n].f,gyroscopicForce-externalWrenches[n].m);
-    //cout<<"Velocity dependent accel: "<<velDepAccels[n]<<endl;
-  }
-  //go backward down the list
-  SpatialMatrix cToP,pToC,IaaI,temp,temp2;
-  SpatialVector A,Ia,bf_Ivda,vtemp;
-  for(int n=(int)robot.links.size()-1;n>=0;--n) {
-    if(children[n].empty()) continue;
-    Vector3 com_n = robot.links[n].T_World*robot.links[n].com;
-    for(size_t i=0;i<children[n].size();i++) {
-      int c = children[n][i];
-      //compute the transformations
-      Vector3 com_c_local =robot.links[c].T_World.R*robot.links[c].com;
-      Vector3 com_c = com_c_local + robot.links[c].T_World.t;
-      cToP.setForceShift(com_c,com_n);
-      pToC.setVelocityShift(com_n,com_c);
-      //compute quantities with A
-      Vector3 axis_w=robot.links[c].T_World.R*robot.links[c].w;
-      if(robot.links[c].type == RobotLink3D::Revolute)
-	A.set(cross(axis_w,com_c_local),axis_w);
-      else
-	A.set(axis_w,Vector3(Zero));
-      inertiaMatrices[c].mul(A,Ia);
-      Real aIa = Ia.dot(A);
-      //IaaI.setOuterProduct(Ia);
-      for(int i=0;i<6;i++)
+    jointAxisMasses(n) = D;
+    int p = robot.parents[n];
+    if(p < 0) continue;
+    //I[p] += I-U*U^t/D
+    SpatialMatrix& Ip = inertiaMatrices[p];
+    if(D == 0)
+      Ip += I;
+    else {
+      Real scale = 1.0/D;
+      for(int i=0;i<6;i++) {
+	Real Uis = U(i)*scale;
 	for(int j=0;j<6;j++)
-	  IaaI(i,j) = Ia(i)*Ia(j);
-
-      if(!(aIa > 0.0)) {
-	//check if the child is a frozen link.  If so, add the inertias directly
-	if(robot.qMin[c] == robot.qMax[c]) {
-	  temp2.mul(cToP,temp);
-	  temp.mul(temp2,pToC);
-	  inertiaMatrices[n] += temp;
-
-	  bf_Ivda = biasingForces[c];
-	  inertiaMatrices[c].madd(velDepAccels[c],bf_Ivda);
-	  cToP.madd(bf_Ivda,biasingForces[n]);
-	  continue;
-	}
-	fprintf(stderr,"NewtonEulerSolver: Warning, axis-wise inertia on link %d is invalid; %g\n",n,aIa);
-	aIa = Epsilon;
+	  Ip(i,j) += I(i,j) - Uis*U(j);
       }
-      //add this child's contribution to the revised inertia matrix
-      //I[n] += cToP*(I-Ia*Iat/aIa)*pToC
-      temp = inertiaMatrices[c];
-      temp.madd(IaaI,-1.0/aIa);
-      temp2.mul(cToP,temp);
-      temp.mul(temp2,pToC);
-      inertiaMatrices[n] += temp;
-      
-      //add this child's contribution to the revised biasing force
-      //bf[n] += cToP*(bf+I*vda + I*A*(t[c]-At*(bf+I*vda))/aIa)
-      bf_Ivda = biasingForces[c];
-      inertiaMatrices[c].madd(velDepAccels[c],bf_Ivda);
-      Real At_bf_Ivda = A.dot(bf_Ivda);
-      vtemp.mul(Ia,(t[c]-At_bf_Ivda)/aIa);
-      vtemp += bf_Ivda;
-      cToP.madd(vtemp,biasingForces[n]);
     }
-    //cout<<"Revised inertia matrix "<<n<<": "<<endl<<MatrixPrinter(inertiaMatrices[n])<<endl;
-    //cout<<"Revised biasing force "<<n<<": "<<endl<<VectorPrinter(biasingForces[n])<<endl;
-    //getchar();
   }
-  //go down the heirarchy, computing accelerations along the way
-  //joint force is X[cm->origin]*(I*a+bf)
-  //NOTE: acceleration variables are in com frame, transform them later
-  SpatialVector nAccel,pAccel;
-  for(size_t n=0;n<robot.links.size();n++) {
-    Vector3 com_n_local =robot.links[n].T_World.R*robot.links[n].com;
-    //compute quantities with A
-    Vector3 axis_w=robot.links[n].T_World.R*robot.links[n].w;
-    if(robot.links[n].type == RobotLink3D::Revolute)
-      A.set(cross(axis_w,com_n_local),axis_w);
-    else
-      A.set(axis_w,Vector3(Zero));
-    inertiaMatrices[n].mul(A,Ia);
+}
 
-    int p=robot.parents[n];
-    if(p>=0) {
-      vtemp.set(accelerations[p].v,accelerations[p].w);
-      Vector3 com_n = robot.links[n].T_World*robot.links[n].com;
-      Vector3 com_p = robot.links[p].T_World*robot.links[p].com;
-      //which way, + or -?
-      pToC.setVelocityShift(com_p,com_n);
-      pToC.mul(vtemp,pAccel);
+void NewtonEulerSolver::SolveArticulated(const Vector& t,Vector& ddq,bool velocityTerms)
+{
+  size_t numLinks = robot.links.size();
+  ddq.resize(numLinks);
+  biasingForces.resize(numLinks);
+  accelerations.resize(numLinks);
+  if(!velocityTerms) {
+    for(size_t n=0;n<numLinks;n++)
+      biasingForces[n].setZero();
+  }
+  //go backward down the list, accumulating the articulated biasing forces
+  //bf[p] += bf + I*vda + U*(t-A^t*bf-U^t*vda)/D
+  //ddq temporarily holds t-A^t*bf
+  SpatialVector vtemp;
+  for(int n=(int)numLinks-1;n>=0;--n) {
+    SpatialVector& bf = biasingForces[n];
+    ddq(n) = t(n) - jointAxes[n].dot(bf);
+    int p = robot.parents[n];
+    if(p < 0) continue;
+    SpatialVector& bfp = biasingForces[p];
+    bfp += bf;
+    Real u = ddq(n);
+    if(velocityTerms) {
+      inertiaMatrices[n].mul(velDepAccels[n],vtemp);
+      bfp += vtemp;
+      u -= jointAxisInertias[n].dot(velDepAccels[n]);
     }
-    else 
-      pAccel.setZero();
-
-    Real aIa = Ia.dot(A);
-    if(!(aIa > 0.0)) {
-      if(robot.qMin[n] == robot.qMax[n]) {
-	ddq(n) = 0;
-	accelerations[n].v.setZero();
-	accelerations[n].w.setZero();
-	continue;
-      }
-      fprintf(stderr,"NewtonEulerSolver: Warning, axis-wise inertia on link %d is invalid; %g\n",n,aIa);
-      aIa = Epsilon;
+    if(jointAxisMasses(n) != 0)
+      bfp.madd(jointAxisInertias[n],u/jointAxisMasses(n));
+  }
+  //go down the list, computing accelerations along the way
+  //a = a[p] + vda + q''*A, with q'' = (t-A^t*bf-U^t*(a[p]+vda))/D
+  for(size_t n=0;n<numLinks;n++) {
+    int p = robot.parents[n];
+    if(p < 0) vtemp.setZero();
+    else vtemp.set(accelerations[p].v,accelerations[p].w);
+    if(velocityTerms) vtemp += velDepAccels[n];
+    if(jointAxisMasses(n) == 0)
+      ddq(n) = 0;
+    else {
+      ddq(n) = (ddq(n) - jointAxisInertias[n].dot(vtemp))/jointAxisMasses(n);
+      vtemp.madd(jointAxes[n],ddq(n));
     }
-    Assert(aIa > 0.0);
-
-    //ddq = (t-A^t*I*X[p->n]*a[p] - A^t(bf+I*vda))/(A^tIA)
-    bf_Ivda = biasingForces[n];
-    inertiaMatrices[n].madd(velDepAccels[n],bf_Ivda);
-    ddq(n) = t(n)-Ia.dot(pAccel);
-    ddq(n) -= A.dot(bf_Ivda);
-    ddq(n) /= aIa;
-
-    //a = X[p->n]*a[p] + vda + q''*A
-    vtemp = velDepAccels[n];
-    vtemp.madd(A,ddq(n));
-    vtemp += pAccel;
-    //vtemp is now the acceleration about the center of mass
     vtemp.get(accelerations[n].v,accelerations[n].w);
-    //cout<<"CM acceleration: "<<vn.v<<", "<<vn.w<<endl;
   }
+}
 
-  for(size_t n=0;n<robot.links.size();n++) {
-    Vector3 com_n_local =robot.links[n].T_World.R*robot.links[n].com;
+void NewtonEulerSolver::CalcAccel(const Vector& t,Vector& ddq)
+{
+  size_t numLinks = robot.links.size();
+  CalcVelocities();
+  CalcArticulatedInertias();
+  biasingForces.resize(numLinks);
+  velDepAccels.resize(numLinks);
 
-    //transform to origin
-    RigidBodyVelocity vn=accelerations[n];
-    accelerations[n].setShifted(vn,-com_n_local);
+  //The rigid-body biasing force is v x* I*v - fext, and the velocity
+  //dependent acceleration is v x A*dq.  The rigid-body inertias are
+  //recomputed since inertiaMatrices now holds the articulated ones.
+  Matrix3 Iworld;
+  SpatialMatrix I;
+  SpatialVector vtemp;
+  for(size_t n=0;n<numLinks;n++) {
+    const RobotLink3D& link = robot.links[n];
+    Vector3 com = link.T_World*link.com;
+    link.GetWorldInertia(Iworld);
+    SetSpatialInertia(link.mass,com,Iworld,I);
+    //spatial velocity about the world origin
+    const Vector3& w = velocities[n].w;
+    Vector3 v0 = velocities[n].v - cross(w,link.T_World.t);
+    vtemp.set(v0,w);
+    SpatialVector h;
+    I.mul(vtemp,h);
+    Vector3 hf,hm;
+    h.get(hf,hm);
+    const Wrench& fext = externalWrenches[n];
+    biasingForces[n].set(cross(w,hf)-fext.f,cross(w,hm)+cross(v0,hf)-fext.m-cross(com,fext.f));
+
+    Vector3 sv,sw;
+    jointAxes[n].get(sv,sw);
+    Real dq = robot.dq(n);
+    velDepAccels[n].set(dq*(cross(w,sv)+cross(v0,sw)),dq*cross(w,sw));
+  }
 
-    SpatialVector jointForce = biasingForces[n];
+  SolveArticulated(t,ddq,true);
+
+  //convert to the accelerations of the link origins, and the joint forces
+  //f = I*a+bf about the link origins
+  SpatialVector jointForce;
+  for(size_t n=0;n<numLinks;n++) {
+    const Vector3& p = robot.links[n].T_World.t;
+    vtemp.set(accelerations[n].v,accelerations[n].w);
+    jointForce = biasingForces[n];
     inertiaMatrices[n].madd(vtemp,jointForce);
-    //now jointForce is in the com frame
-    Wrench fn;
-    jointForce.get(fn.f,fn.m);
-    //transform to joint frame
-    jointWrenches[n].setShifted(fn,-com_n_local);
+    jointForce.get(jointWrenches[n].f,jointWrenches[n].m);
+    jointWrenches[n].m -= cross(p,jointWrenches[n].f);
+    accelerations[n].v += cross(accelerations[n].w,p) + cross(velocities[n].w,velocities[n].v);
   }
 }
 
@@ -726,19 +718,16 @@ void NewtonEulerSolver::CalcKineticEnergyMatrixInverse(Matrix& Binv)
   //by virtue of the relationship
   //Bq'' + C + G = t
   //q'' = B^-1(t-C-G)
-  //if we let t = ei, we can get column i of B^-1 (denoted Bi)
-  //such that Bi = t-B^-1(C+G)
-  //-B^-1(C+G) can be obtained by setting t=0, then q'' = -B^-1(C+G)
+  //if we let t = ei and drop C and G, we get column i of B^-1.
+  //The articulated inertias only depend on q, so they're computed once.
   Binv.resize(robot.links.size(),robot.links.size());
-  Vector t(robot.links.size());
-  Vector ddq0,ddq;
-  t.setZero();
-  CalcAccel(t,ddq0);
+  Vector t(robot.links.size(),Zero);
+  CalcArticulatedInertias();
   for(int i=0;i<t.n;i++) {
+    Vector Binvi;
+    Binv.getColRef(i,Binvi);
     t(i) = 1;
-    CalcAccel(t,ddq);
-    ddq -= ddq0;
-    Binv.copyCol(i,ddq);
+    SolveArticulated(t,Binvi,false);
     t(i) = 0;
   }
 }
@@ -746,28 +735,20 @@ void NewtonEulerSolver::CalcKineticEnergyMatrixInverse(Matrix& Binv)
 void NewtonEulerSolver::MulKineticEnergyMatrixInverse(const Vector& x,Vector& Binvx)
 {
   Assert(x.n == (int)robot.links.size());
-  Vector t(robot.links.size());
-  Vector ddq0;
-  t.setZero();
-  CalcAccel(t,ddq0);
-  CalcAccel(x,Binvx);
-  Binvx -= ddq0;
+  CalcArticulatedInertias();
+  SolveArticulated(x,Binvx,false);
 }
 
 void NewtonEulerSolver::MulKineticEnergyMatrixInverse(const Matrix& A,Matrix& BinvA)
 {
   Assert(A.m == (int)robot.links.size());
-  Vector t(robot.links.size());
-  Vector ddq0;
-  t.setZero();
-  CalcAccel(t,ddq0);
+  CalcArticulatedInertias();
   BinvA.resize(A.m,A.n);
   for(int i=0;i<A.n;i++) {
     Vector Ai,BAi;
     A.getColRef(i,Ai);
     BinvA.getColRef(i,BAi);
-    CalcAccel(Ai,BAi);
-    BAi -= ddq0;
+    SolveArticulated(Ai,BAi,false);
   }
 }
 
@@ -13,7 +13,12 @@
  * necessary joint torques to achieve the specified ddq.
  *
  * After setting all external wrenches, CalcAccel computes the ddq
- * given the specified joint torques.
+ * given the specified joint torques.  It uses the articulated-body
+ * algorithm with all spatial quantities expressed in the world frame about
+ * the world origin, so it never forms or factors the kinetic energy
+ * matrix B.  MulKineticEnergyMatrixInverse does the same with velocity and
+ * external force terms dropped, and the Matrix versions and
+ * CalcKineticEnergyMatrixInverse compute the articulated inertias only once.
  *
  * All methods operate on the assumption that the robot dynamic state
  * (q,dq) has been set, and the robot's frames are updated.
@@ -46,6 +51,16 @@ struct NewtonEulerSolver
   void CalcLinkAccel(const Vector& ddq);
   void SelfTest();
 
+  //articulated-body algorithm internals.  These set up inertiaMatrices and
+  //jointAxes about the world origin, and then compute the articulated
+  //inertias.
+  void CalcArticulatedInertias();
+  //Given t and the articulated inertias, computes ddq.  If velocityTerms is
+  //true, biasingForces and velDepAccels must be initialized, otherwise they
+  //are taken to be zero.  Leaves the world-origin spatial accelerations in
+  //accelerations.
+  void SolveArticulated(const Vector& t,Vector& ddq,bool velocityTerms);
+
   RobotDynamics3D& robot;
   std::vector<Wrench> externalWrenches;  ///<set these to the external wrenches on the links (moments about the CM)
 
@@ -54,8 +69,12 @@ struct NewtonEulerSolver
   std::vector<RigidBodyVelocity> velocities;
   std::vector<RigidBodyVelocity> accelerations;
   std::vector<Wrench> jointWrenches;  ///<element i is the force on link i from the joint to its parent
-  std::vector<SpatialMatrix> inertiaMatrices;  ///<element i is the i'th inertia matrix computed in the featherstone algorithm
+  std::vector<SpatialMatrix> inertiaMatrices;  ///<element i is the i'th articulated inertia matrix computed in the featherstone algorithm, about the world origin
   std::vector<SpatialVector> biasingForces;     ///<element i is the i'th biasing force computed in the featherstone algorithm
+  std::vector<SpatialVector> velDepAccels;      ///<element i is the velocity-dependent acceleration of link i in the featherstone algorithm
+  std::vector<SpatialVector> jointAxes;         ///<element i is the spatial motion of joint i, about the world origin
+  std::vector<SpatialVector> jointAxisInertias; ///<element i is inertiaMatrices[i]*jointAxes[i]
+  Vector jointAxisMasses;                       ///<element i is jointAxes[i]^T*inertiaMatrices[i]*jointAxes[i], or 0 for a frozen link that is rigidly attached to its parent
 };
 
 #endif
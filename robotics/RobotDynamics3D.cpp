@@ -1,5 +1,5 @@
 #include "RobotDynamics3D.h"
-#include <math/CholeskyDecomposition.h>
+#include "NewtonEuler.h"
 #include <Timer.h>
 using namespace std;
 
@@ -443,32 +443,21 @@ void RobotDynamics3D::GetCoriolisForces(Vector& Cdq)
 //B*ddq + C*dq = fext
 void RobotDynamics3D::CalcAcceleration(Vector& ddq, const Vector& fext)
 {
-	Matrix B;
-	GetKineticEnergyMatrix(B);
-	CholeskyDecomposition<Real> cholesky;
-	if(!cholesky.set(B)) {
-		cerr<<"Kinetic energy matrix is not positive definite!"<<endl;
-		cerr<<B<<endl;
-		Abort();
+	//articulated-body algorithm, O(n)
+	NewtonEulerSolver ne(*this);
+	if(fext.n==0) {
+		Vector zero(links.size(),Zero);
+		ne.CalcAccel(zero,ddq);
 	}
-
-	Vector Cdq;
-	GetCoriolisForces(Cdq);
-	Vector f_Cdq;
-	if(fext.n==0) f_Cdq.setNegative(Cdq);
-	else f_Cdq.sub(fext,Cdq);
-	cholesky.backSub(f_Cdq,ddq);
+	else
+		ne.CalcAccel(fext,ddq);
 }
 
 
 void RobotDynamics3D::CalcTorques(const Vector& ddq,Vector& fext)
 {
-	Matrix B;
-	GetKineticEnergyMatrix(B);
-	B.mul(ddq,fext);
-
-	Vector Cdq;
-	GetCoriolisForces(Cdq);
-	fext += Cdq;
+	//recursive Newton-Euler, O(n)
+	NewtonEulerSolver ne(*this);
+	ne.CalcTorques(ddq,fext);
 }
 
@@ -17,15 +17,17 @@
  * where B is the kinetic energy matrix, C is the coriolis forces, G is the 
  * generalized gravity vector, and f is the generalized torque vector.
  *
- * Forward and inverse dynamics methods use the slow O(n^3) full matrix
- * method. For faster solutions, use the NewtonEulerSolver class.
+ * The forward and inverse dynamics methods CalcAcceleration() and
+ * CalcTorques() run the O(n) algorithms of NewtonEulerSolver.  To reuse
+ * buffers across calls or to add external wrenches, use NewtonEulerSolver
+ * directly.
  *
  * All methods defined here use the current setting of #dq as the state
  * of the robot.
  *
- * The GetKineticEnergyMatrix*(),GetKineticEnergyDeriv(), GetCoriolis*()
- * CalcAcceleration(), and CalcTorques() methods additionally require
- * UpdateDynamics() to have been called beforehand.
+ * The GetKineticEnergyMatrix*(),GetKineticEnergyDeriv(), and GetCoriolis*()
+ * methods additionally require UpdateDynamics() to have been called
+ * beforehand.  CalcAcceleration() and CalcTorques() only need UpdateFrames().
  *
  * @see NewtonEulerSolver
  */
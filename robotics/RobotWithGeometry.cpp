@@ -6,20 +6,25 @@
 #include <GLdraw/drawextra.h>
 //#include <GLdraw/drawMesh.h>
 #include <GLdraw/GeometryAppearance.h>
+#include <utils/threadutils.h>
+#include <math/random.h>
 #include <fstream>
 #include <algorithm>
 using namespace GLDraw;
 using namespace std;
 
 RobotWithGeometry::RobotWithGeometry()
+  :numSelfCollisionThreads(1)
 {}
 
 RobotWithGeometry::RobotWithGeometry(const RobotDynamics3D& rhs)
+  :numSelfCollisionThreads(1)
 {
   operator = (rhs);
 }
 
 RobotWithGeometry::RobotWithGeometry(const RobotWithGeometry& rhs)
+  :numSelfCollisionThreads(1)
 {
   operator = (rhs);
 }
@@ -61,7 +66,6 @@ void RobotWithGeometry::Merge(const std::vector<RobotWithGeometry*>& robots)
     offset[i] = nl;
     nl += robots[i]->links.size();
   }
-  InitAllSelfCollisions();
   for(size_t i=0;i<robots.size();i++) {
     for(size_t j=0;j<robots[i]->geometry.size();j++)
       geometry[j+offset[i]] = robots[i]->geometry[j];
@@ -69,11 +73,15 @@ void RobotWithGeometry::Merge(const std::vector<RobotWithGeometry*>& robots)
       if(robots[i]->envCollisions[j])
 	envCollisions[j+offset[i]] = new CollisionQuery(*geometry[j+offset[i]],*robots[i]->envCollisions[j]->b);
     }
+  }
+  //the geometries must be set before the self collision queries are made
+  InitAllSelfCollisions();
+  for(size_t i=0;i<robots.size();i++) {
     //delete self collisions that are not allowed
     for(int j=0;j<robots[i]->selfCollisions.m;j++)
-      for(int k=0;k<robots[i]->selfCollisions.n;k++)
+      for(int k=j+1;k<robots[i]->selfCollisions.n;k++)
 	if(!robots[i]->selfCollisions(j,k))
-	  selfCollisions(j+offset[i],k+offset[i]) = NULL;
+	  SafeDelete(selfCollisions(j+offset[i],k+offset[i]));
   }
 }
 
@@ -87,6 +95,7 @@ const RobotWithGeometry& RobotWithGeometry::operator = (const RobotWithGeometry&
   selfCollisions.resize(n,n,NULL);
   envCollisions.resize(n,NULL);
   geometry = rhs.geometry;
+  numSelfCollisionThreads = rhs.numSelfCollisionThreads;
   for(int j=0;j<n;j++) {
     if(rhs.envCollisions[j])
       envCollisions[j] = new CollisionQuery(*geometry[j],*rhs.envCollisions[j]->b);
@@ -205,6 +214,7 @@ void RobotWithGeometry::UpdateGeometry()
 void RobotWithGeometry::UpdateGeometry(int i)
 {
   if(geometry[i]) geometry[i]->SetTransform(links[i].T_World);
+  if(i < (int)bbGeometries.size()) bbGeometries[i] = NULL;
 }
 
 void RobotWithGeometry::InitMeshCollision(CollisionGeometry& mesh)
@@ -244,166 +254,218 @@ bool RobotWithGeometry::SelfCollision(int i, int j, Real d)
   return UnderCollisionMargin(query,d);
 }
 
-bool RobotWithGeometry::SelfCollision(const vector<int>& bodies,Real distance)
+const AABB3D& RobotWithGeometry::GetBoundingBox(int i)
 {
-  //get world space bounding boxes for quick reject test
-  vector<int> validbodies;
-  validbodies.reserve(bodies.size());
-  for(size_t i=0;i<bodies.size();i++) 
-    if(!IsGeometryEmpty(i)) validbodies.push_back(bodies[i]);
-  vector<AABB3D> bbs(validbodies.size());
-  for(size_t i=0;i<validbodies.size();i++) 
-    bbs[i] = geometry[validbodies[i]]->GetAABB();
-  if(distance != 0) {
-    //adjust bounding  boxes
-    Vector3 d(distance*0.5);
-    for(size_t i=0;i<bbs.size();i++) {
-      bbs[i].bmin -= d;
-      bbs[i].bmax += d;
-    }
+  if(bbs.size() != geometry.size()) {
+    bbs.resize(geometry.size());
+    bbGeometries.resize(0);
+    bbGeometries.resize(geometry.size(),NULL);
+    bbTransforms.resize(geometry.size());
+    bbMargins.resize(geometry.size());
   }
-  //if |validbodies| > 300, you may want to use the functions in geometry/RangeQuery.h
-  //now check collisions, ensuring BBs overlap
-  for(size_t i=0;i<validbodies.size();i++) {
-    for(size_t j=i+1;j<validbodies.size();j++) {
-      CollisionQuery* query=selfCollisions(validbodies[i],validbodies[j]);
-      if(query == NULL) continue;
-      if(!bbs[i].intersects(bbs[j])) continue;
-      if(UnderCollisionMargin(query,distance)) return true;
-    }
+  const CollisionGeometry* g = geometry[i];
+  if(bbGeometries[i] != g || bbMargins[i] != g->margin || !(bbTransforms[i] == g->GetTransform())) {
+    bbs[i] = g->GetAABB();
+    bbGeometries[i] = g;
+    bbTransforms[i] = g->GetTransform();
+    bbMargins[i] = g->margin;
   }
-  return false;
+  return bbs[i];
 }
 
-bool RobotWithGeometry::SelfCollision(const vector<int>& set1,const vector<int>& set2,Real distance)
+struct BoxEndpoint
 {
-  //get world space bounding boxes for quick reject test
-  vector<int> valid1,valid2;
-  valid1.reserve(set1.size());
-  valid2.reserve(set2.size());
-  for(size_t i=0;i<set1.size();i++) 
-    if(!IsGeometryEmpty(set1[i])) valid1.push_back(set1[i]);
-  for(size_t i=0;i<set2.size();i++) 
-    if(!IsGeometryEmpty(set2[i])) valid2.push_back(set2[i]);
-  if(valid1.empty() || valid2.empty()) return false;
-  vector<AABB3D> bbs1(valid1.size()),bbs2(valid2.size());
-  for(size_t i=0;i<valid1.size();i++) 
-    bbs1[i] = geometry[valid1[i]]->GetAABB();
-  for(size_t i=0;i<valid2.size();i++) 
-    bbs2[i] = geometry[valid2[i]]->GetAABB();
+  Real x;
+  int index;
+  inline bool operator < (const BoxEndpoint& e) const { return x < e.x; }
+};
+
+void RobotWithGeometry::SelfCollisionCandidates(const vector<int>& bodies,Real distance,vector<pair<int,int> >& pairs)
+{
+  pairs.resize(0);
+  vector<int> valid;
+  vector<AABB3D> boxes;
+  valid.reserve(bodies.size());
+  boxes.reserve(bodies.size());
+  for(size_t i=0;i<bodies.size();i++) {
+    if(IsGeometryEmpty(bodies[i])) continue;
+    valid.push_back(bodies[i]);
+    boxes.push_back(GetBoundingBox(bodies[i]));
+  }
+  if(valid.size() < 2) return;
   if(distance != 0) {
-    //adjust bounding  boxes
+    //adjust bounding boxes
     Vector3 d(distance*0.5);
-    for(size_t i=0;i<bbs1.size();i++) {
-      bbs1[i].bmin -= d;
-      bbs1[i].bmax += d;
-    }
-    for(size_t i=0;i<bbs2.size();i++) {
-      bbs2[i].bmin -= d;
-      bbs2[i].bmax += d;
+    for(size_t i=0;i<boxes.size();i++) {
+      boxes[i].bmin -= d;
+      boxes[i].bmax += d;
     }
   }
-  if(valid1.size() >= 3 && valid2.size() >= 3) {
-    //O(m+n) additional fast reject tests: set 1 vs bb of set 2, and vice versa
-    AABB3D bb1,bb2;
-    bb1 = bbs1[0];
-    for(size_t i=1;i<bbs1.size();i++)
-      bb1.setUnion(bbs1[i]);
-    for(size_t i=0;i<valid2.size();i++)
-      if(!bb1.intersects(bbs2[i])) { //quick reject
-	bbs2[i] = bbs2.back();
-	valid2[i] = valid2.back();
-	bbs2.resize(bbs2.size()-1);
-	valid2.resize(valid2.size()-1);
-	i--;
-      }
-    bb2 = bbs1[0];
-    for(size_t i=1;i<bbs2.size();i++)
-      bb2.setUnion(bbs2[i]);
-    for(size_t i=0;i<valid1.size();i++)
-      if(!bb2.intersects(bbs1[i])) { //quick reject
-	bbs1[i] = bbs1.back();
-	valid1[i] = valid1.back();
-	bbs1.resize(bbs1.size()-1);
-	valid1.resize(valid1.size()-1);
-	i--;
-      }
+  //sweep and prune along the axis along which the boxes are most spread out
+  Vector3 mean(Zero),var(Zero);
+  for(size_t i=0;i<boxes.size();i++)
+    mean += 0.5*(boxes[i].bmin+boxes[i].bmax);
+  mean /= Real(boxes.size());
+  for(size_t i=0;i<boxes.size();i++) {
+    Vector3 c = 0.5*(boxes[i].bmin+boxes[i].bmax) - mean;
+    var.x += Sqr(c.x);
+    var.y += Sqr(c.y);
+    var.z += Sqr(c.z);
+  }
+  int axis = 0;
+  if(var.y > var[axis]) axis = 1;
+  if(var.z > var[axis]) axis = 2;
+  vector<BoxEndpoint> order(boxes.size());
+  for(size_t i=0;i<boxes.size();i++) {
+    order[i].x = boxes[i].bmin[axis];
+    order[i].index = (int)i;
   }
-  //quick reject of all 
-  //if |valid1| or |valid2| > 300, you may want to use the functions in geometry/RangeQuery.h
-  //now check collisions, ensuring BBs overlap
-  for(size_t i=0;i<valid1.size();i++) {
-    for(size_t j=0;j<valid2.size();j++) {
-      CollisionQuery* query=selfCollisions(valid2[i],valid2[j]);
-      if(query == NULL) continue;
-      if(!bbs1[i].intersects(bbs2[j])) continue;
-      if(UnderCollisionMargin(query,distance)) return true;
+  sort(order.begin(),order.end());
+  for(size_t i=0;i<order.size();i++) {
+    int a = order[i].index;
+    Real amax = boxes[a].bmax[axis];
+    for(size_t j=i+1;j<order.size() && order[j].x <= amax;j++) {
+      int b = order[j].index;
+      if(!boxes[a].intersects(boxes[b])) continue;
+      int bi = valid[a], bj = valid[b];
+      if(bi > bj) std::swap(bi,bj);
+      if(selfCollisions(bi,bj) != NULL) pairs.push_back(pair<int,int>(bi,bj));
     }
   }
-  return false;
 }
 
-bool RobotWithGeometry::SelfCollision(Real distance)
+struct SelfCollisionJob
 {
-  //get world space bounding boxes for quick reject test
-  vector<int> validbodies;
-  validbodies.reserve(links.size());
-  for(size_t i=0;i<links.size();i++) 
-    if(!IsGeometryEmpty(i)) validbodies.push_back(i);
-  vector<AABB3D> bbs(validbodies.size());
-  for(size_t i=0;i<validbodies.size();i++) {
-    bbs[i] = geometry[validbodies[i]]->GetAABB();
+  RobotWithGeometry* robot;
+  const vector<pair<int,int> >* pairs;
+  Real distance;
+  bool stopOnCollision;
+  vector<char> colliding;
+  Mutex mutex;
+  bool stop;
+
+  bool Stopped() { ScopedLock lock(mutex); return stop; }
+  void Stop() { ScopedLock lock(mutex); stop = true; }
+};
+
+static void SelfCollisionJobFunc(void* data,int i)
+{
+  SelfCollisionJob* job = reinterpret_cast<SelfCollisionJob*>(data);
+  if(job->stopOnCollision && job->Stopped()) return;
+  const pair<int,int>& p = (*job->pairs)[i];
+  if(UnderCollisionMargin(job->robot->selfCollisions(p.first,p.second),job->distance)) {
+    job->colliding[i] = 1;
+    if(job->stopOnCollision) job->Stop();
   }
-  if(distance != 0) {
-    //adjust bounding  boxes
-    Vector3 d(distance*0.5);
-    for(size_t i=0;i<bbs.size();i++) {
-      bbs[i].bmin -= d;
-      bbs[i].bmax += d;
+}
+
+//runs the narrow phase on the given pairs, and returns the colliding ones
+//in order.  If stopOnCollision is true, returns after the first collision
+//is found
+static void SelfCollisionNarrowPhase(RobotWithGeometry* robot,const vector<pair<int,int> >& candidates,Real distance,bool stopOnCollision,vector<pair<int,int> >& colliding)
+{
+  colliding.resize(0);
+  if(candidates.empty()) return;
+  if(robot->numSelfCollisionThreads == 1) {
+    for(size_t i=0;i<candidates.size();i++) {
+      if(UnderCollisionMargin(robot->selfCollisions(candidates[i].first,candidates[i].second),distance)) {
+	colliding.push_back(candidates[i]);
+	if(stopOnCollision) return;
+      }
     }
+    return;
   }
-  //if |validbodies| > 300, you may want to use the functions in geometry/RangeQuery.h
-  //now check collisions, ensuring BBs overlap
-  for(size_t i=0;i<validbodies.size();i++) {
-    for(size_t j=i+1;j<validbodies.size();j++) {
-      CollisionQuery* query=selfCollisions(validbodies[i],validbodies[j]);
-      if(query == NULL) continue;
-      if(!bbs[i].intersects(bbs[j])) continue;
-      if(UnderCollisionMargin(query,distance)) return true;
-    }
+  SelfCollisionJob job;
+  job.robot = robot;
+  job.pairs = &candidates;
+  job.distance = distance;
+  job.stopOnCollision = stopOnCollision;
+  job.colliding.resize(candidates.size(),0);
+  job.stop = false;
+  ParallelFor((int)candidates.size(),SelfCollisionJobFunc,&job,robot->numSelfCollisionThreads);
+  for(size_t i=0;i<candidates.size();i++)
+    if(job.colliding[i]) colliding.push_back(candidates[i]);
+}
+
+bool RobotWithGeometry::SelfCollision(const vector<int>& bodies,Real distance)
+{
+  vector<pair<int,int> > candidates,colliding;
+  SelfCollisionCandidates(bodies,distance,candidates);
+  SelfCollisionNarrowPhase(this,candidates,distance,true,colliding);
+  return !colliding.empty();
+}
+
+bool RobotWithGeometry::SelfCollision(const vector<int>& set1,const vector<int>& set2,Real distance)
+{
+  if(set1.empty() || set2.empty()) return false;
+  //find candidates among the union, then keep those between the two sets.
+  //Bit 1 marks set1 and bit 2 marks set2, so a body may be in both
+  vector<char> which(links.size(),0);
+  for(size_t i=0;i<set1.size();i++) which[set1[i]] |= 1;
+  for(size_t i=0;i<set2.size();i++) which[set2[i]] |= 2;
+  vector<int> bodies;
+  for(size_t i=0;i<links.size();i++)
+    if(which[i]) bodies.push_back((int)i);
+  vector<pair<int,int> > candidates,colliding;
+  SelfCollisionCandidates(bodies,distance,candidates);
+  size_t k=0;
+  for(size_t i=0;i<candidates.size();i++) {
+    int a = which[candidates[i].first], b = which[candidates[i].second];
+    if(((a & 1) && (b & 2)) || ((a & 2) && (b & 1)))
+      candidates[k++] = candidates[i];
   }
-  return false;
+  candidates.resize(k);
+  SelfCollisionNarrowPhase(this,candidates,distance,true,colliding);
+  return !colliding.empty();
+}
+
+bool RobotWithGeometry::SelfCollision(Real distance)
+{
+  vector<int> bodies(links.size());
+  for(size_t i=0;i<links.size();i++) bodies[i] = (int)i;
+  return SelfCollision(bodies,distance);
 }
 
 void RobotWithGeometry::SelfCollisions(vector<pair<int,int> >& pairs,Real distance)
 {
-  //get world space bounding boxes for quick reject test
-  vector<int> validbodies;
-  validbodies.reserve(links.size());
-  for(size_t i=0;i<links.size();i++) 
-    if(!IsGeometryEmpty(i)) validbodies.push_back(i);
-  vector<AABB3D> bbs(validbodies.size());
-  for(size_t i=0;i<validbodies.size();i++) 
-    bbs[i] = geometry[validbodies[i]]->GetAABB();
-  if(distance != 0) {
-    //adjust bounding  boxes
-    Vector3 d(distance*0.5);
-    for(size_t i=0;i<bbs.size();i++) {
-      bbs[i].bmin -= d;
-      bbs[i].bmax += d;
-    }
-  }
-  //if |validbodies| > 300, you may want to use the functions in geometry/RangeQuery.h
-  //now check collisions, ensuring BBs overlap
-  for(size_t i=0;i<validbodies.size();i++) {
-    for(size_t j=i+1;j<validbodies.size();j++) {
-      CollisionQuery* query=selfCollisions(validbodies[i],validbodies[j]);
-      if(query == NULL) continue;
-      if(!bbs[i].intersects(bbs[j])) continue;
-      if(UnderCollisionMargin(query,distance)) pairs.push_back(pair<int,int>(validbodies[i],validbodies[j]));
+  vector<int> bodies(links.size());
+  for(size_t i=0;i<links.size();i++) bodies[i] = (int)i;
+  vector<pair<int,int> > candidates,colliding;
+  SelfCollisionCandidates(bodies,distance,candidates);
+  SelfCollisionNarrowPhase(this,candidates,distance,false,colliding);
+  pairs.insert(pairs.end(),colliding.begin(),colliding.end());
+}
+
+int RobotWithGeometry::CullNeverCollidingPairs(int numSamples,Real margin)
+{
+  int n = (int)links.size();
+  Array2D<bool> collided(n,n,false);
+  Config qorig = q;
+  Config qsample(n);
+  vector<pair<int,int> > pairs;
+  for(int s=0;s<numSamples;s++) {
+    for(int i=0;i<n;i++) {
+      Real a = (IsInf(qMin(i)) ? -Pi : qMin(i));
+      Real b = (IsInf(qMax(i)) ? Pi : qMax(i));
+      qsample(i) = Rand(a,b);
     }
+    UpdateConfig(qsample);
+    UpdateGeometry();
+    pairs.resize(0);
+    SelfCollisions(pairs,margin);
+    for(size_t i=0;i<pairs.size();i++)
+      collided(pairs[i].first,pairs[i].second) = true;
   }
-
+  int numCulled = 0;
+  for(int i=0;i<n;i++)
+    for(int j=i+1;j<n;j++)
+      if(selfCollisions(i,j) != NULL && !collided(i,j)) {
+	SafeDelete(selfCollisions(i,j));
+	numCulled++;
+      }
+  UpdateConfig(qorig);
+  UpdateGeometry();
+  return numCulled;
 }
 
 
@@ -15,6 +15,13 @@
  * 2) Load the geometry for each link using LoadGeometry(),
  * 3) Initialize the collision structures (and self collision pairs) using
  *    InitCollisions() and InitSelfCollisionPair().
+ * 4) Optionally, remove pairs that cannot collide with
+ *    CullNeverCollidingPairs().
+ *
+ * Self collision queries first find the pairs whose world-space bounding
+ * boxes overlap by sweep and prune, and only run the narrow phase on those.
+ * The bounding boxes are cached, and recomputed only for geometries whose
+ * transforms have changed.
  */
 class RobotWithGeometry : public RobotDynamics3D
 {
@@ -39,6 +46,17 @@ public:
   void InitSelfCollisionPairs(const Array2D<bool>& collision);
   void GetSelfCollisionPairs(Array2D<bool>& collision) const;
   void CleanupSelfCollisions();
+  /** @brief Removes the self collision pairs that never collide (within
+   * the given margin) at numSamples configurations sampled uniformly within
+   * the joint limits.  Returns the number of pairs removed.
+   *
+   * Infinite limits are replaced by [-pi,pi].  The configuration is restored
+   * afterwards.  Pairs that only collide in a small region of joint space
+   * may be missed, so use a number of samples suited to the robot.  The
+   * result persists in selfCollisions, so it can be saved with
+   * GetSelfCollisionPairs() and restored with InitSelfCollisionPairs().
+   */
+  int CullNeverCollidingPairs(int numSamples,Real margin=0);
 
   ///Creates this into a mega-robot from several other robots
   void Merge(const std::vector<RobotWithGeometry*>& robots);
@@ -57,12 +75,18 @@ public:
   virtual bool SelfCollision(Real distance=0);
   /// Query self-collision between links indexed by bodies. Faster than direct enumeration.
   virtual bool SelfCollision(const std::vector<int>& bodies, Real distance=0);
-  /// Query self-collision between links in set1 and set 2.  set1 and set2 are required to be disjoint.  Faster than direct enumeration.
+  /// Query self-collision between links in set1 and set 2, i.e., pairs with one link in set1 and the other in set2.  The sets may overlap.  Faster than direct enumeration.
   virtual bool SelfCollision(const std::vector<int>& set1,const std::vector<int>& set2,Real distance=0);
   /// Query self-collision between geometries i,j.  Faster than direct enumeration.
   virtual bool SelfCollision(int i, int j, Real distance=0); 
   /// Compute all self collisions (faster than 
   virtual void SelfCollisions(std::vector<std::pair<int,int> >& pairs,Real distance=0);
+  /// Returns the pairs (i,j), i < j, of bodies with a self collision query
+  /// whose bounding boxes, expanded by distance, overlap
+  void SelfCollisionCandidates(const std::vector<int>& bodies,Real distance,std::vector<std::pair<int,int> >& pairs);
+  /// Returns the world-space bounding box of geometry i, recomputing it
+  /// only if its transform has changed
+  const Math3D::AABB3D& GetBoundingBox(int i);
 
   virtual bool MeshCollision(CollisionGeometry& mesh);
   virtual bool MeshCollision(int i,Real distance=0);
@@ -74,6 +98,17 @@ public:
   ///matrix(i,j) of collisions between bodies, i < j (upper triangular)
   Array2D<CollisionQuery*> selfCollisions;
   std::vector<CollisionQuery*> envCollisions;
+  ///Number of threads used for the narrow phase of self collision queries.
+  ///If <= 0, all hardware threads are used.  (default 1)
+  int numSelfCollisionThreads;
+
+  ///Cached world-space bounding boxes, and the geometries, transforms, and
+  ///margins at which they were computed.  UpdateGeometry(i) invalidates
+  ///entry i (bbGeometries[i] = NULL).
+  std::vector<Math3D::AABB3D> bbs;
+  std::vector<const CollisionGeometry*> bbGeometries;
+  std::vector<Math3D::RigidTransform> bbTransforms;
+  std::vector<Real> bbMargins;
 };
 
 #endif
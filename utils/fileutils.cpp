@@ -12,6 +12,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #endif //_WIN32
 #ifdef __APPLE__
 #include <unistd.h>
@@ -234,4 +236,91 @@ bool ListDirectory(const char* path,std::vector<std::string>& files)
 #endif
 }
 
+MappedFile::MappedFile()
+  :data(NULL),size(0),fileHandle(NULL),mapHandle(NULL)
+{}
+
+MappedFile::~MappedFile()
+{
+  Close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const char* fn)
+{
+  Close();
+  HANDLE f = CreateFileA(fn,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+  if(f == INVALID_HANDLE_VALUE) return false;
+  LARGE_INTEGER len;
+  if(!GetFileSizeEx(f,&len)) {
+    CloseHandle(f);
+    return false;
+  }
+  if(len.QuadPart == 0) {
+    //can't map empty files
+    CloseHandle(f);
+    return false;
+  }
+  HANDLE m = CreateFileMapping(f,NULL,PAGE_READONLY,0,0,NULL);
+  if(m == NULL) {
+    CloseHandle(f);
+    return false;
+  }
+  void* p = MapViewOfFile(m,FILE_MAP_READ,0,0,0);
+  if(p == NULL) {
+    CloseHandle(m);
+    CloseHandle(f);
+    return false;
+  }
+  fileHandle = f;
+  mapHandle = m;
+  data = (const char*)p;
+  size = (size_t)len.QuadPart;
+  return true;
+}
+
+void MappedFile::Close()
+{
+  if(data) UnmapViewOfFile(data);
+  if(mapHandle) CloseHandle((HANDLE)mapHandle);
+  if(fileHandle) CloseHandle((HANDLE)fileHandle);
+  data = NULL;
+  size = 0;
+  fileHandle = mapHandle = NULL;
+}
+
+#else
+
+bool MappedFile::Open(const char* fn)
+{
+  Close();
+  int fd = open(fn,O_RDONLY);
+  if(fd < 0) return false;
+  struct stat st;
+  if(fstat(fd,&st) != 0 || st.st_size == 0) {
+    //can't map empty files
+    close(fd);
+    return false;
+  }
+  void* p = mmap(NULL,(size_t)st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+  //the mapping stays valid after the descriptor is closed
+  close(fd);
+  if(p == MAP_FAILED) return false;
+  data = (const char*)p;
+  size = (size_t)st.st_size;
+  mapHandle = p;
+  return true;
+}
+
+void MappedFile::Close()
+{
+  if(mapHandle) munmap(mapHandle,size);
+  data = NULL;
+  size = 0;
+  mapHandle = NULL;
+}
+
+#endif //_WIN32
+
 } // namespace FileUtils
@@ -50,6 +50,31 @@ bool MakeDirectoryRecursive(const char* path);
 /// Returns a list of filenames in the given directory
 bool ListDirectory(const char* path,std::vector<std::string>& items);
 
+/** @brief A read-only memory mapping of a whole file.
+ *
+ * The contents are available in [data,data+size) until Close() is called
+ * or the object is destroyed.
+ */
+class MappedFile
+{
+ public:
+  MappedFile();
+  ~MappedFile();
+  /// Maps the file fn.  Returns true if successful.
+  bool Open(const char* fn);
+  void Close();
+  inline bool IsOpen() const { return data != NULL; }
+
+  const char* data;
+  size_t size;
+
+ private:
+  MappedFile(const MappedFile&);
+  void operator = (const MappedFile&);
+  void* fileHandle;
+  void* mapHandle;
+};
+
 } //namespace FileUtils
 
 /*@}*/
@@ -0,0 +1,120 @@
+#include "lzf.h"
+#include <string.h>
+
+typedef unsigned char uchar;
+
+//the format: a control byte c < 32 is followed by c+1 literal bytes.
+//Otherwise, the top 3 bits of c are the match length minus 2 (7 means an
+//extra length byte follows), the low 5 bits are the high bits of the
+//match offset minus 1, and the low bits of the offset follow.
+static const size_t kMaxLiteral = 32;
+static const size_t kMaxOffset = 1<<13;
+static const size_t kMaxMatch = (1<<8) + (1<<3);
+static const int kHashLog = 14;
+
+inline unsigned LZFHash(const uchar* p)
+{
+  unsigned v = (unsigned(p[0])<<16) | (unsigned(p[1])<<8) | unsigned(p[2]);
+  return (v*2654435761u) >> (32-kHashLog);
+}
+
+//writes the literals [start,end) to op, returns false if out of space
+static bool LZFFlushLiterals(const uchar* start,const uchar* end,uchar*& op,const uchar* oend)
+{
+  while(start < end) {
+    size_t n = size_t(end-start);
+    if(n > kMaxLiteral) n = kMaxLiteral;
+    if(op+1+n > oend) return false;
+    *op++ = uchar(n-1);
+    memcpy(op,start,n);
+    op += n;
+    start += n;
+  }
+  return true;
+}
+
+size_t LZFCompress(const void* in,size_t inLen,void* out,size_t outLen)
+{
+  const uchar* ip = (const uchar*)in;
+  const uchar* iend = ip+inLen;
+  uchar* op = (uchar*)out;
+  const uchar* oend = op+outLen;
+  const uchar* lit = ip;
+  //positions+1 of the last occurrence of each hashed 3-byte sequence
+  static const size_t hashSize = size_t(1)<<kHashLog;
+  size_t* table = new size_t[hashSize];
+  memset(table,0,sizeof(size_t)*hashSize);
+  bool ok = true;
+  while(ip+2 < iend) {
+    unsigned h = LZFHash(ip);
+    size_t pos = size_t(ip-(const uchar*)in);
+    size_t refpos = table[h];
+    table[h] = pos+1;
+    if(refpos != 0 && pos-refpos < kMaxOffset) {
+      const uchar* ref = (const uchar*)in+refpos-1;
+      if(ref[0]==ip[0] && ref[1]==ip[1] && ref[2]==ip[2]) {
+        size_t maxlen = size_t(iend-ip);
+        if(maxlen > kMaxMatch) maxlen = kMaxMatch;
+        size_t len = 3;
+        while(len < maxlen && ref[len]==ip[len]) len++;
+        if(!LZFFlushLiterals(lit,ip,op,oend)) { ok=false; break; }
+        size_t off = pos-refpos;
+        size_t code = len-2;
+        if(op+3 > oend) { ok=false; break; }
+        if(code < 7)
+          *op++ = uchar((code<<5) | (off>>8));
+        else {
+          *op++ = uchar((7<<5) | (off>>8));
+          *op++ = uchar(code-7);
+        }
+        *op++ = uchar(off & 0xff);
+        //index the start of the match's tail so long runs compress well
+        const uchar* mend = ip+len;
+        for(ip++;ip<mend && ip+2<iend;ip++)
+          table[LZFHash(ip)] = size_t(ip-(const uchar*)in)+1;
+        ip = mend;
+        lit = ip;
+        continue;
+      }
+    }
+    ip++;
+  }
+  if(ok) ok = LZFFlushLiterals(lit,iend,op,oend);
+  delete [] table;
+  if(!ok) return 0;
+  return size_t(op-(uchar*)out);
+}
+
+size_t LZFDecompress(const void* in,size_t inLen,void* out,size_t outLen)
+{
+  const uchar* ip = (const uchar*)in;
+  const uchar* iend = ip+inLen;
+  uchar* op = (uchar*)out;
+  uchar* oend = op+outLen;
+  while(ip < iend) {
+    size_t ctrl = *ip++;
+    if(ctrl < kMaxLiteral) {
+      ctrl++;
+      if(ip+ctrl > iend || op+ctrl > oend) return 0;
+      memcpy(op,ip,ctrl);
+      op += ctrl;
+      ip += ctrl;
+    }
+    else {
+      size_t len = ctrl>>5;
+      if(len == 7) {
+        if(ip >= iend) return 0;
+        len += *ip++;
+      }
+      len += 2;
+      if(ip >= iend) return 0;
+      size_t off = ((ctrl&0x1f)<<8) + *ip++ + 1;
+      if(off > size_t(op-(uchar*)out) || op+len > oend) return 0;
+      //the source may overlap the destination, so copy bytewise
+      const uchar* ref = op-off;
+      for(size_t i=0;i<len;i++) op[i] = ref[i];
+      op += len;
+    }
+  }
+  return size_t(op-(uchar*)out);
+}
@@ -0,0 +1,33 @@
+#ifndef UTILS_LZF_H
+#define UTILS_LZF_H
+
+#include <stddef.h>
+
+/** @file utils/lzf.h
+ * @ingroup Utils
+ * @brief A compressor / decompressor for the LZF format.
+ *
+ * LZF is a very fast LZ77 variant with a modest compression ratio.  The
+ * stream format is compatible with liblzf, which is used e.g. by the
+ * binary_compressed PCD format.
+ */
+
+/** @addtogroup Utils */
+/*@{*/
+
+///Returns an output buffer size that is always large enough to hold the
+///compressed version of n bytes.
+inline size_t LZFMaxCompressedSize(size_t n) { return n + n/32 + 1; }
+
+///Compresses inLen bytes from in to out, which has room for outLen bytes.
+///Returns the number of bytes written, or 0 if out is too small.
+size_t LZFCompress(const void* in,size_t inLen,void* out,size_t outLen);
+
+///Decompresses inLen bytes from in to out, which has room for outLen
+///bytes.  Returns the number of bytes written, or 0 if the input is
+///corrupt or out is too small.
+size_t LZFDecompress(const void* in,size_t inLen,void* out,size_t outLen);
+
+/*@}*/
+
+#endif
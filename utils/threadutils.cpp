@@ -1,7 +1,161 @@
 #include "threadutils.h"
+#include <vector>
 
 #ifdef WIN32 
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 void ThreadSleep(double duration) { Sleep(int(duration*1000)); }
-#endif
\ No newline at end of file
+#endif
+
+int ThreadHardwareConcurrency()
+{
+  int n = 0;
+#if USE_BOOST_THREADS
+  n = (int)boost::thread::hardware_concurrency();
+#elif defined(_SC_NPROCESSORS_ONLN)
+  n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  if(n < 1) n = 1;
+  return n;
+}
+
+#if USE_BOOST_THREADS
+//boost::mutex::scoped_lock does not work with Condition
+typedef boost::condition_variable PoolCondition;
+#else
+typedef Condition PoolCondition;
+#endif
+
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+//true on pool workers, and on a thread that is running a ParallelFor
+static THREAD_LOCAL bool inParallelFor = false;
+
+struct ParallelForData
+{
+  void (*func)(void*,int);
+  void* data;
+  int n;
+  int chunk;
+  int next;
+  //number of pool workers that may still join
+  int helpers;
+  Mutex mutex;
+};
+
+static void RunParallelForChunks(ParallelForData* pf)
+{
+  while(true) {
+    int start,end;
+    {
+      ScopedLock lock(pf->mutex);
+      if(pf->next >= pf->n) break;
+      start = pf->next;
+      end = start + pf->chunk;
+      if(end > pf->n) end = pf->n;
+      pf->next = end;
+    }
+    for(int i=start;i<end;i++)
+      pf->func(pf->data,i);
+  }
+}
+
+/* Workers are started on demand and live until the process exits.  One
+ * ParallelFor runs on the pool at a time; a concurrent call from another
+ * thread runs on its calling thread.
+ */
+struct ParallelForPool
+{
+  ParallelForPool() :job(NULL),busy(false),numActive(0) {}
+
+  Mutex mutex;
+  PoolCondition jobReady,jobDone;
+  std::vector<Thread> threads;
+  ParallelForData* job;
+  bool busy;
+  int numActive;
+};
+
+static ParallelForPool* GetParallelForPool()
+{
+  //never deleted, since the workers are blocked on its members at exit
+  static ParallelForPool* pool = new ParallelForPool;
+  return pool;
+}
+
+static void* parallel_for_pool_worker(void* ptr)
+{
+  ParallelForPool* pool = reinterpret_cast<ParallelForPool*>(ptr);
+  inParallelFor = true;
+  while(true) {
+    ParallelForData* pf;
+    {
+      ScopedLock lock(pool->mutex);
+      while(pool->job == NULL || pool->job->helpers == 0)
+        pool->jobReady.wait(lock);
+      pf = pool->job;
+      pf->helpers--;
+      pool->numActive++;
+    }
+    RunParallelForChunks(pf);
+    {
+      ScopedLock lock(pool->mutex);
+      pool->numActive--;
+      if(pool->numActive == 0) pool->jobDone.notify_all();
+    }
+  }
+  return NULL;
+}
+
+void ParallelFor(int n,void (*func)(void* data,int index),void* data,int numThreads,int grain)
+{
+  if(n <= 0) return;
+  if(numThreads <= 0) numThreads = ThreadHardwareConcurrency();
+  if(grain < 1) grain = 1;
+  if(numThreads > n/grain) numThreads = n/grain;
+  if(numThreads <= 1 || inParallelFor) {
+    for(int i=0;i<n;i++) func(data,i);
+    return;
+  }
+  ParallelForPool* pool = GetParallelForPool();
+  ParallelForData pf;
+  pf.func = func;
+  pf.data = data;
+  pf.n = n;
+  pf.next = 0;
+  pf.helpers = numThreads-1;
+  //several chunks per thread, so that late finishers can be balanced
+  pf.chunk = n / (numThreads*8);
+  if(pf.chunk < 1) pf.chunk = 1;
+  bool busy;
+  {
+    ScopedLock lock(pool->mutex);
+    busy = pool->busy;
+    if(!busy) {
+      pool->busy = true;
+      while((int)pool->threads.size() < numThreads-1)
+        pool->threads.push_back(ThreadStart(parallel_for_pool_worker,pool));
+      pool->job = &pf;
+      pool->jobReady.notify_all();
+    }
+  }
+  if(busy) {
+    for(int i=0;i<n;i++) func(data,i);
+    return;
+  }
+  inParallelFor = true;
+  RunParallelForChunks(&pf);
+  inParallelFor = false;
+  {
+    //workers that have not woken up yet must not join
+    ScopedLock lock(pool->mutex);
+    pool->job = NULL;
+    while(pool->numActive > 0)
+      pool->jobDone.wait(lock);
+    pool->busy = false;
+  }
+}
@@ -66,6 +66,27 @@ struct Condition
 
 #endif //USE_PTHREADS
 
+///Returns the number of hardware threads on this machine (at least 1)
+int ThreadHardwareConcurrency();
+
+/** @brief Calls func(data,i) for each i in [0,n), spreading the calls over
+ * up to numThreads threads.
+ *
+ * The calling thread participates in the work, and indices are handed out
+ * in small chunks so that uneven workloads are balanced.  Calls to func may
+ * happen in any order and concurrently, so func must be safe to call from
+ * multiple threads.  If numThreads <= 0, ThreadHardwareConcurrency() threads
+ * are used.  If numThreads == 1, everything is run on the calling thread.
+ *
+ * The helper threads are kept in a pool that persists between calls, so a
+ * call costs a wakeup rather than a thread creation.  At most n/grain
+ * threads are used, so callers with cheap items should pass a grain large
+ * enough to amortize that wakeup.  A ParallelFor called from inside a
+ * ParallelFor, or while another thread's ParallelFor is using the pool, runs
+ * on the calling thread.
+ */
+void ParallelFor(int n,void (*func)(void* data,int index),void* data,int numThreads=0,int grain=1);
+
 #ifdef WIN32
 void ThreadSleep(double duration);
 #else